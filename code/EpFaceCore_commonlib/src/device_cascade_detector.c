@@ -25,6 +25,7 @@
 #include <e_ctimers.h>
 #include <e_dma.h>
 */
+#include <stddef.h>
 #include "e_lib.h"
 #include "../../EpFaceHost/c/ep_data_types.h"
 
@@ -32,8 +33,9 @@
 #define BANK1 0x2000
 
 
-//Almost two memory banks are used to store image data:
-//EpCoreBank2 BANK2 SECTION(".text_bank2"); //Second part of image data
+//Second tile slot and mutex:
+//EpCoreBank2 BANK2 SECTION(".text_bank2");
+#define BANK2 0x4000
 
 //Part of last memory bank is for classifier:
 //EpCoreBank3 BANK3 SECTION(".text_bank3"); //It is supposed that stack is less than 512 bytes!
@@ -47,12 +49,25 @@
  * @return global pointer to mutex in first core
  */
 
+/// Slot of shared memory buffer the core works with (@see take_start_token)
+static int sram_slot;
+
+/// Task range owned by the core in current frame (@see take_start_token)
+static int core_range;
+
 /**
  * Get pointer on begin of Shared memory structure.
  * @return pointer on origin of SRAM
  */
 static EpDRAMBuf volatile *get_sram_origin() {
-	return (EpDRAMBuf*)0x8f000000;
+	return ((EpSharedMemory *)0x8f000000)->slots + sram_slot;
+}
+
+/**
+ * @return pointer to images buffer of shared memory (@see EpSharedMemory)
+ */
+static unsigned char volatile *get_imgs_origin() {
+    return ((EpSharedMemory *)0x8f000000)->imgs_buf;
 }
 
 /**
@@ -81,6 +96,23 @@ static unsigned int stop_timer() {
     //return 0;
 }
 
+/**
+ * Start free-running trace clock (@see EpTaskTrace). Uses second core timer,
+ *   so that it is not disturbed by start_timer() / stop_timer().
+ */
+static void trace_clock_start() {
+    e_ctimer_stop(E_CTIMER_1);
+    e_ctimer_set(E_CTIMER_1, E_CTIMER_MAX);
+    e_ctimer_start(E_CTIMER_1, E_CTIMER_CLK);
+}
+
+/**
+ * @return ticks since trace_clock_start()
+ */
+static unsigned int trace_clock() {
+    return E_CTIMER_MAX - e_ctimer_get(E_CTIMER_1);
+}
+
 /**
  * Copy memory buffer using DMA.
  * @param dst : pointer to destination memory location.
@@ -122,6 +154,60 @@ static void dma_transfer (
     return;
 }
 
+/// DMA channel for tile prefetch; e_dma_copy() used by dma_transfer() occupies E_DMA_1
+#define TILE_DMA E_DMA_0
+
+static e_dma_desc_t tile_dma_desc;
+/// Last byte of tile being loaded and its expected value (@see dma_transfer)
+static char volatile *tile_last_dst_byte;
+static char tile_last_source_byte;
+
+/**
+ * Start two-dimensional DMA transfer of image tile without waiting for its end.
+ * Only one tile transfer may be in progress.
+ * @param dst       destination buffer in core memory (lines are stored without gaps)
+ * @param src       first pixel of tile in shared memory
+ * @param line_size bytes in each line
+ * @param lines     number of lines
+ * @param src_step  step between lines of source image
+ */
+static void dma_start_tile (
+    void       volatile *const dst,
+    void const volatile *const src,
+    unsigned int         const line_size,
+    unsigned int         const lines,
+    unsigned int         const src_step
+) {
+    unsigned int const aligned = !( ( (unsigned int)dst | (unsigned int)src | line_size | src_step ) & 7 );
+    unsigned int const item_size = aligned ? 8 : 1;
+    unsigned int const items = line_size / item_size;
+
+    tile_last_dst_byte = (char volatile *)dst + line_size * lines - 1;
+    tile_last_source_byte = *( (char const volatile *)src + src_step * (lines - 1) + line_size - 1 );
+    *tile_last_dst_byte = ~tile_last_source_byte;
+
+    //Outer stride replaces the last inner stride of each line
+    e_dma_set_desc (
+        TILE_DMA,
+        E_DMA_ENABLE | E_DMA_MASTER | (aligned ? E_DMA_DWORD : E_DMA_BYTE),
+        0x0000,
+        item_size, item_size,
+        items, lines,
+        src_step - line_size + item_size, item_size,
+        (void *)src, (void *)dst,
+        &tile_dma_desc
+    );
+    e_dma_start(&tile_dma_desc, TILE_DMA);
+}
+
+/**
+ * Wait for the end of transfer started by dma_start_tile()
+ */
+static void dma_wait_tile() {
+    e_dma_wait(TILE_DMA);
+    while(*tile_last_dst_byte != tile_last_source_byte);
+}
+
 /**
  * Increment shared variable
  * @param val pointer on variable for increment
@@ -129,7 +215,7 @@ static void dma_transfer (
  * @return unmodified (*val) value
  */
 static int atomic_increment(int volatile *const val, int const max_val) {
-    e_mutex_t *mutex_p = (void *)0x00004000;
+    e_mutex_t *mutex_p = (e_mutex_t *)&((EpCoreBank2 *)BANK2)->mutex;
 
     e_mutex_lock(0, 0, mutex_p);
     int const cur_val = *val;
@@ -147,7 +233,7 @@ static int atomic_increment(int volatile *const val, int const max_val) {
  * @return unmodified (*val) value
  */
 static int atomic_decrement(int volatile * const val, int const min_val) {
-    e_mutex_t *mutex_p = (void *)0x00004000;
+    e_mutex_t *mutex_p = (e_mutex_t *)&((EpCoreBank2 *)BANK2)->mutex;
 
     e_mutex_lock(0, 0, mutex_p);
     int const cur_val = *val;
@@ -158,6 +244,27 @@ static int atomic_decrement(int volatile * const val, int const min_val) {
     return cur_val;
 }
 
+/**
+ * Lock task range. Mutex of range N is held by core N of workgroup (row-major order),
+ *   so locks of different ranges do not compete for one core memory.
+ * @param range_index index of range in EpDRAMBuf::task_ranges
+ */
+static void lock_task_range(int const range_index) {
+    e_mutex_t *mutex_p = (e_mutex_t *)&((EpCoreBank2 *)BANK2)->range_mutex;
+
+    e_mutex_lock(range_index / e_group_config.group_cols, range_index % e_group_config.group_cols, mutex_p);
+}
+
+/**
+ * Unlock task range locked by lock_task_range()
+ * @param range_index index of range in EpDRAMBuf::task_ranges
+ */
+static void unlock_task_range(int const range_index) {
+    e_mutex_t *mutex_p = (e_mutex_t *)&((EpCoreBank2 *)BANK2)->range_mutex;
+
+    e_mutex_unlock(range_index / e_group_config.group_cols, range_index % e_group_config.group_cols, mutex_p);
+}
+
 #include "device_routines.h"
 
 int mc_core_common_go()
@@ -168,18 +275,20 @@ int mc_core_common_go()
     e_coreid_t coreid = 0;
     e_mutex_t *mutex = NULL;
     // Must be initialized ONLY on one core
-    mutex = (int *)0x00004000;
+    mutex = (e_mutex_t *)&((EpCoreBank2 *)BANK2)->mutex;
     coreid = e_get_coreid();
     e_coords_from_coreid(coreid, &row, &col);
     if ( (0==row) && (0==col) )
     {
         e_mutex_init(0, 0, mutex, NULL);
     }
+    //Every core holds mutex of one task range
+    e_mutex_init(row, col, (e_mutex_t *)&((EpCoreBank2 *)BANK2)->range_mutex, NULL);
 #endif
     ((EpCoreBank1 *)BANK1)->timer.core_id = e_get_coreid();
 
     while (1) {
-        while(atomic_decrement(&get_sram_origin()->control_info.start_cores, 0) == 0);
+        while( !take_start_token() );
         device_process_tasks();
     }
 
@@ -29,16 +29,16 @@ void lineTest(int n)
  *
  * @param scan_lines: Pointer to pointers to scan lines of current detection window.
  * @param x: Horizontal coordinate of current detection window.
- * @param node Classifier node used to make decision.
+ * @param feature: LBP feature rectangle (@see EpNodeDecision::feature).
+ * @param subsets: One bit for each possible value of LBP feature.
  * @return Decision value: 0 or 1.
  */
 static int device_calc_lbp_decision (
     unsigned char const *const *scan_lines,
     int x,
-    EpNodeDecision const *const node
+    int const feature,
+    int const *const subsets
 ) {
-    int const feature = node->feature;
-
     //Shifting position according to LBP feature position
     scan_lines += feature >> 24;
     x += (feature >> 16) & 255;
@@ -157,7 +157,19 @@ static int device_calc_lbp_decision (
         ( ( ( (unsigned int)~(sum20 - sum11) ) & sign ) >> 30 ) |
         (   ( (unsigned int)~(sum10 - sum11) )          >> 31 ) ;
 
-    return (node->subsets[subset_index] >> bit_index) & 1;
+    return (subsets[subset_index] >> bit_index) & 1;
+}
+
+/**
+ * Calculate decision of NODE_DECISION node (@see device_calc_lbp_decision)
+ */
+static int device_calc_node_decision (
+    unsigned char const *const *const scan_lines,
+    int const x,
+    char const *const node
+) {
+    return device_calc_lbp_decision(scan_lines, x, ((EpNodeDecision const *)node)->feature,
+        (int const *)( node + offsetof(EpNodeDecision, subsets) ));
 }
 
 /**
@@ -168,32 +180,39 @@ static int device_calc_lbp_decision (
  *   by specified value if feature value is in specified subset.
  * NODE_STAGE: compare object_score accumulated so far with specified threshold.
  *   if value is less than threshold then return 0 otherwise continue.
+ * NODE_BOUND: the same as NODE_STAGE, but object_score is kept for the rest of the stage.
  * NODE_FINAL: return 1.
  * For performance reasons it is supposed that first node is always
  * NODE_DECISION, and two NODE_STAGE nodes are never go in succession.
- * @param image_data Position in memory where to sample data from.
+ * @param scan_lines Pointers to scan lines of current detection window.
+ * @param x Horizontal coordinate of current detection window.
+ * @param node First node of stages to run (resident stages or page, @see EpCascadePaging).
  * @return 1 for positive classification. Zero otherwise.
  */
 static int classify (
     unsigned char const *const *const scan_lines,
-    int const x
+    int const x,
+    char const *node
 ) {
-    //Skipping initial META node
-	char const *node = (char *)((EpCoreBank3 *)BANK3)->buf_classifier + sizeof(EpNodeMeta);
 
     //Node after META is always NODE_DECISION
     int object_score = ((EpNodeDecision const *)node)->score &
-        -device_calc_lbp_decision(scan_lines, x, (EpNodeDecision const *)node);
+        -device_calc_node_decision(scan_lines, x, node);
     node += sizeof(EpNodeDecision);
 
     while(1) {
         if(!*node) { //NODE_DECISION
             object_score += ((EpNodeDecision const *)node)->score &
-                -device_calc_lbp_decision(scan_lines, x, (EpNodeDecision const *)node);
+                -device_calc_node_decision(scan_lines, x, node);
             node += sizeof(EpNodeDecision);
-        } else { //NODE_STAGE
+        } else { //NODE_STAGE or NODE_BOUND
             if(object_score < ((EpNodeStage *)node)->threshold)
                 return 0;
+
+            if(*(int const *)node == NODE_BOUND) { //Stage goes on with the same sum
+                node += sizeof(EpNodeBound);
+                continue;
+            }
             node += sizeof(EpNodeStage);
 
             if(*node)
@@ -201,7 +220,7 @@ static int classify (
 
             //NODE_DECISION is after NODE_STAGE if no NODE_FINAL found
             object_score = ((EpNodeDecision const *)node)->score &
-                -device_calc_lbp_decision(scan_lines, x, (EpNodeDecision const *)node);
+                -device_calc_node_decision(scan_lines, x, node);
             node += sizeof(EpNodeDecision);
         }
     }
@@ -209,23 +228,133 @@ static int classify (
     return 0; //This point is unreachable
 }
 
-void device_detect_single_scale(void) {
+/**
+ * Classify single image position using classifier in compact encoding (@see EpCompactMeta).
+ *   Stages are run one by one until stage with zero decisions_count.
+ * @param scan_lines Pointers to scan lines of current detection window.
+ * @param x Horizontal coordinate of current detection window.
+ * @param part Part of compact classifier (resident stages or page, @see EpCascadePaging).
+ * @return 1 for positive classification. Zero otherwise.
+ */
+static int classify_compact (
+    unsigned char const *const *const scan_lines,
+    int const x,
+    EpCompactPart const *const part
+) {
+    int const (*const subsets)[8] = (int const (*)[8])(part + 1);
+    EpCompactStage const *stage = (EpCompactStage const *)(subsets + part->subsets_count);
+
+    for(int decisions_count; (decisions_count = stage->decisions_count); ) {
+        EpCompactDecision const *decision = (EpCompactDecision const *)(stage + 1);
+
+        int object_score = 0;
+        for(; decisions_count; --decisions_count, ++decision)
+            object_score += decision->score &
+                -device_calc_lbp_decision(scan_lines, x, decision->feature, subsets[decision->subset]);
+
+        if(object_score < stage->threshold)
+            return 0;
+
+        stage = (EpCompactStage const *)decision;
+    }
+
+    return 1;
+}
+
+/**
+ * Run resident stages or page of classifier in any encoding
+ */
+static int classify_part (
+    unsigned char const *const *const scan_lines,
+    int const x,
+    char const *const part,
+    int const compact
+) {
+    return compact ? classify_compact(scan_lines, x, (EpCompactPart const *)part) : classify(scan_lines, x, part);
+}
+
+/**
+ * Run paged stages for windows which survived resident ones. Pages are fetched
+ *   one by one and every page is applied to all survivors before the next is fetched,
+ *   so each page crosses DMA once per batch instead of once per window.
+ * @param task_item       task of the tile; receives detections
+ * @param buf_tile        tile data
+ * @param survivors       positions (x | y << 16) of windows in scan order; compacted in place
+ * @param survivors_count number of survivors
+ * @param num_objects     number of detections already stored in task_item
+ * @param pages_count     number of pages (@see EpCascadePaging)
+ * @return number of detections stored in task_item
+ */
+static int device_classify_paged (
+    EpTaskItem          *const task_item,
+    unsigned char const *const buf_tile,
+    unsigned int        *const survivors,
+    int                        survivors_count,
+    int                        num_objects,
+    int                  const pages_count
+) {
+    EpDRAMBuf volatile *const sram = get_sram_origin();
+    char *const page = ((EpCoreBank3 *)BANK3)->buf_classifier + MAX_RESIDENT_BYTES;
+    int const window_height = ((EpNodeMeta const *)((EpCoreBank3 *)BANK3)->buf_classifier)->window_height;
+    int const compact = *(int const *)((EpCoreBank3 *)BANK3)->buf_classifier == NODE_META_COMPACT;
+    int const image_step = task_item->step;
+    unsigned char const *scan_lines[window_height];
+
+    for(int page_index = 0; page_index < pages_count && survivors_count; ++page_index) {
+        int const page_offset = sram->cascade_paging.page_offsets[page_index];
+        dma_transfer(page, sram->buf_classifier + page_offset,
+            sram->cascade_paging.page_offsets[page_index + 1] - page_offset, 1);
+
+        int kept = 0;
+        for(int i = 0; i < survivors_count; ++i) {
+            unsigned int const position = survivors[i];
+
+            scan_lines[0] = buf_tile + (position >> 16) * image_step;
+            for(int y = 1; y < window_height; ++y)
+                scan_lines[y] = scan_lines[y - 1] + image_step;
+
+            if( classify_part(scan_lines, position & 0xffff, page, compact) )
+                survivors[kept++] = position;
+        }
+        survivors_count = kept;
+    }
+
+    for(int i = 0; i < survivors_count && num_objects < MAX_DETECTIONS_PER_TILE; ++i)
+        task_item->objects[num_objects++] = survivors[i];
+
+    return num_objects;
+}
+
+/**
+ * Detect objects in tile
+ * @param task_item task of the tile; receives detections
+ * @param buf_tile  tile data
+ */
+void device_detect_single_scale(EpTaskItem *const task_item, unsigned char const *const buf_tile) {
 	char const *const classifier_data = (char const *)((EpCoreBank3 *)BANK3)->buf_classifier;
+    //Skipping initial META node
+    int const compact = *(int const *)classifier_data == NODE_META_COMPACT;
+    char const *const resident_nodes = classifier_data + (compact ? sizeof(EpCompactMeta) : sizeof(EpNodeMeta));
+
+    //Windows which pass resident stages of paged cascade wait for next pages here
+    int const pages_count = get_sram_origin()->cascade_paging.pages_count;
+    unsigned int *const survivors = (unsigned int *)(((EpCoreBank3 *)BANK3)->buf_classifier + MAX_RESIDENT_BYTES + CASCADE_PAGE_BYTES);
+    int survivors_count = 0;
 
     //assert (((EpNodeMeta const *)classifier_data)->id == NODE_META);
 
     int const window_width  = ((EpNodeMeta const *)classifier_data)->window_width;
     int const window_height = ((EpNodeMeta const *)classifier_data)->window_height;
 
-	int const process_width = ((EpCoreBank1 *)BANK1)->task_item.width + 1 - window_width;
-	int const process_height = ((EpCoreBank1 *)BANK1)->task_item.height + 1 - window_height;
+	int const process_width = task_item->width + 1 - window_width;
+	int const process_height = task_item->height + 1 - window_height;
 
-	int const image_step = ((EpCoreBank1 *)BANK1)->task_item.step;
-	int const scan_mode = ((EpCoreBank1 *)BANK1)->task_item.scan_mode;
+	int const image_step = task_item->step;
+	int const scan_mode = task_item->scan_mode;
 
     //To do without multiplications we use this small array of pointers
     unsigned char const *scan_lines[window_height];
-	scan_lines[0] = (unsigned char const *)((EpCoreBank1 *)BANK1)->buf_tile;
+	scan_lines[0] = buf_tile;
     for(int y = 1; y < window_height; ++y)
         scan_lines[y] = scan_lines[y - 1] + image_step;
 
@@ -238,9 +367,21 @@ void device_detect_single_scale(void) {
 
         for(int x = x_start; x < process_width; x += x_step) {
 	//e_wait(E_CTIMER_1, 5000);
-            if( !classify(scan_lines, x) ) continue;
+            if( !classify_part(scan_lines, x, resident_nodes, compact) ) continue;
 
-			((EpCoreBank1 *)BANK1)->task_item.objects[num_objects] = x | (y << 16);
+            if(pages_count) {
+                survivors[survivors_count++] = x | (y << 16);
+                if(survivors_count < MAX_PAGE_SURVIVORS)
+                    continue;
+
+                num_objects = device_classify_paged(task_item, buf_tile, survivors, survivors_count, num_objects, pages_count);
+                survivors_count = 0;
+                if(num_objects == MAX_DETECTIONS_PER_TILE)
+                    break;
+                continue;
+            }
+
+			task_item->objects[num_objects] = x | (y << 16);
             ++num_objects;
             if(num_objects == MAX_DETECTIONS_PER_TILE)
                 break;
@@ -256,119 +397,206 @@ void device_detect_single_scale(void) {
 	}
     }
 #endif
-	((EpCoreBank1 *)BANK1)->task_item.items_count = num_objects;
+    if(survivors_count)
+        num_objects = device_classify_paged(task_item, buf_tile, survivors, survivors_count, num_objects, pages_count);
+
+    task_item->items_count = num_objects;
 }
 
 /**
- * Clone image tile to core memory
- * @param src_buf pointer to the source image in shared memory
- * @param src_step step of source image
+ * @param slot index of tile slot (0 or 1)
+ * @return task of tile slot
  */
-static void subimage_clone_to_core (
-    unsigned char volatile const *const src_buf,
-    int const src_step
-) {
-	//lineTest(17);
-	EpTaskItem const *const task_item = &((EpCoreBank1 *)BANK1)->task_item;
+static EpTaskItem *slot_task_item(int const slot) {
+    return slot ? &((EpCoreBank2 *)BANK2)->task_item : &((EpCoreBank1 *)BANK1)->task_item;
+}
 
-	//lineTest(2);
-    int const result_step   = task_item->step,
-              result_height = task_item->height,
-              result_area   = task_item->area;
+/**
+ * @param slot index of tile slot (0 or 1)
+ * @return tile buffer of tile slot
+ */
+static unsigned char *slot_buf_tile(int const slot) {
+    return slot ? ((EpCoreBank2 *)BANK2)->buf_tile : ((EpCoreBank1 *)BANK1)->buf_tile;
+}
 
-	//lineTest(3);
-    unsigned char volatile const *source_pixels = src_buf + task_item->offset;
-	unsigned char *result_pixels = ((EpCoreBank1 *)BANK1)->buf_tile;
+/**
+ * Copy task to tile slot and start loading of its tile.
+ * Tile is not ready until dma_wait_tile() returns.
+ * @param task task in shared memory
+ * @param slot index of tile slot (0 or 1)
+ */
+static void start_tile_load(EpTaskItem volatile *const task, int const slot) {
+    EpTaskItem *const task_item = slot_task_item(slot);
 
-	//lineTest(4);
+    dma_transfer(task_item, task, sizeof(EpTaskItem), 1);
 
-    if(src_step == result_step) {
-        dma_transfer(result_pixels, source_pixels, result_area, 1);
-	lineTest(5);
-    }
-#if 1
-    else {
-        for(int line = 0; line < result_height; ++line) {
-            lineTest(line+2000);
-            dma_transfer(result_pixels, source_pixels, result_step, 1/*line == result_height - 1*/);
-            result_pixels += result_step;
-            source_pixels += src_step;
-	    //e_wait(E_CTIMER_1, 5000);
-	    lineTest(line+1000);
+    EpImageProp volatile const *const img_prop = get_sram_origin()->imgs_prop + task_item->image_index;
+    unsigned char volatile const *const source_pixels = get_imgs_origin() + img_prop->data_offset + task_item->offset;
+
+    if(img_prop->step == task_item->step)
+        dma_start_tile(slot_buf_tile(slot), source_pixels, task_item->area, 1, task_item->area);
+    else
+        dma_start_tile(slot_buf_tile(slot), source_pixels, task_item->step, task_item->height, img_prop->step);
+}
+
+/**
+ * Take start token from any slot of shared memory buffer.
+ * Host fills slots in turn, so slot next to the current one is tested first.
+ * Every token comes with its own task range (@see EpTaskRange).
+ * @return non-zero if token is taken; get_sram_origin() points to its slot and core_range to the range then
+ */
+static int take_start_token() {
+    int const prev_slot = sram_slot;
+
+    for(int i = 1; i <= DRAM_BUF_SLOTS; ++i) {
+        sram_slot = (prev_slot + i) % DRAM_BUF_SLOTS;
+        int const token = atomic_decrement(
+            (int volatile *)( (char *)&get_sram_origin()->control_info + offsetof(EpControlInfo, start_cores) ), 0);
+        if(token > 0) {
+            core_range = token - 1;
+            return 1;
         }
     }
-#endif
+
+    sram_slot = prev_slot;
+    return 0;
+}
+
+/**
+ * @return pointer to task list of current slot (@see EpControlInfo::tasks_offset)
+ */
+static EpTaskItem volatile *get_tasks_origin() {
+    return (EpTaskItem volatile *)( get_imgs_origin() + get_sram_origin()->control_info.tasks_offset );
+}
+
+/**
+ * @return pointer to task traces of current slot (@see EpControlInfo::traces_offset)
+ */
+static EpTaskTrace volatile *get_traces_origin() {
+    return (EpTaskTrace volatile *)( get_imgs_origin() + get_sram_origin()->control_info.traces_offset );
 }
 
 /**
+ * Take task from the front of own range. When own range is empty, tasks are stolen
+ *   one by one from the back of the following ranges. Every range has its own lock,
+ *   so cores contend only while stealing at the end of the frame.
  * @return pointer to next task to take
  */
 static EpTaskItem volatile *get_next_task() {
+    EpDRAMBuf volatile *const sram = get_sram_origin();
+    int const ranges_count = sram->control_info.ranges_count;
 
-    int const task_cur = atomic_increment(&get_sram_origin()->control_info.task_to_take, get_sram_origin()->control_info.task_count);
+    for(int i = 0; i < ranges_count; ++i) {
+        int const range_index = (core_range + i) % ranges_count;
+        EpTaskRange volatile *const range = sram->task_ranges + range_index;
 
-    if(task_cur < get_sram_origin()->control_info.task_count)
-        return get_sram_origin()->tasks + task_cur;
+        if(range->next >= range->end)
+            continue; //Empty range; no need to lock it
+
+        int task_cur = -1;
+        lock_task_range(range_index);
+        if(range->next < range->end)
+            task_cur = i ? --range->end : range->next++;
+        unlock_task_range(range_index);
+
+        if(task_cur >= 0)
+            return get_tasks_origin() + task_cur;
+    }
 
     return 0;
 }
 
 /**
- * Load classifier in local cores bank from shared memory
+ * Load classifier (its resident stages if cascade is paged) in local cores bank from shared memory
  */
 static void load_classifier() {
-	dma_transfer(((EpCoreBank3 *)BANK3)->buf_classifier, get_sram_origin()->buf_classifier, MAX_CLASSIFIER_BYTES, 0);
+	dma_transfer(((EpCoreBank3 *)BANK3)->buf_classifier, get_sram_origin()->buf_classifier,
+        get_sram_origin()->cascade_paging.resident_bytes, 0);
 }
 
 /**
- * Process task list on core
+ * @return trace clock value if tracing is enabled, zero otherwise
+ */
+static unsigned int trace_mark(int const trace) {
+    return trace ? trace_clock() : 0;
+}
+
+/**
+ * Process task list on core.
+ * Tile of the next task is loaded to one slot while tile in the other slot is processed.
  */
 void device_process_tasks(void) {
+    int const trace = get_sram_origin()->control_info.trace_enabled;
+    if(trace)
+        trace_clock_start();
+
+    //Trace records of tasks in both tile slots (@see EpTaskTrace)
+    EpTaskTrace traces[2];
+
 	lineTest(1);
     load_classifier();
 	lineTest(11);
 	((EpCoreBank1 *)BANK1)->timer.value = 0;
 
-    while(1) {
-//e_wait(E_CTIMER_1, 5000);
+    int slot = 0;
+    traces[slot].claim_start = trace_mark(trace);
+    EpTaskItem volatile *cur_task = get_next_task();
+    traces[slot].claim_end = trace_mark(trace);
+    if(cur_task)
+        start_tile_load(cur_task, slot);
+
+    while(cur_task) {
 	lineTest(12);
-        EpTaskItem volatile *const cur_task = get_next_task();
-        if(cur_task == 0)
-            break;
+        traces[slot].wait_start = trace_mark(trace);
+        dma_wait_tile();
+        traces[slot].wait_end = trace_mark(trace);
 	lineTest(13);
-		dma_transfer(&((EpCoreBank1 *)BANK1)->task_item, cur_task, sizeof(EpTaskItem), 1);
-	lineTest(14);
-		EpImageProp  volatile const *const cur_img_prop = get_sram_origin()->imgs_prop + ((EpCoreBank1 *)BANK1)->task_item.image_index;
-	lineTest(15);
-        unsigned char volatile const *const cur_img_buf = get_sram_origin()->imgs_buf + cur_img_prop->data_offset;
-	lineTest(16);
-        subimage_clone_to_core(cur_img_buf, cur_img_prop->step);
-
+        traces[slot ^ 1].claim_start = trace_mark(trace);
+        EpTaskItem volatile *const next_task = get_next_task();
+        traces[slot ^ 1].claim_end = trace_mark(trace);
+        if(next_task)
+            start_tile_load(next_task, slot ^ 1);
 	lineTest(7);
 
+        traces[slot].classify_start = trace_mark(trace);
         unsigned int const start_ticks = start_timer();
-	
+
 	lineTest(8);
 
-        device_detect_single_scale();
-	
+        device_detect_single_scale(slot_task_item(slot), slot_buf_tile(slot));
+
 	lineTest(9);
+        unsigned int const task_ticks = start_ticks - stop_timer();
+        traces[slot].classify_end = trace_mark(trace);
 #if 1
         if(TIMER_VALUE_SHIFT)
-			((EpCoreBank1 *)BANK1)->timer.value += (start_ticks - stop_timer() + (1 << (TIMER_VALUE_SHIFT - 1))) >> TIMER_VALUE_SHIFT;
+			((EpCoreBank1 *)BANK1)->timer.value += (task_ticks + (1 << (TIMER_VALUE_SHIFT - 1))) >> TIMER_VALUE_SHIFT;
         else
-			((EpCoreBank1 *)BANK1)->timer.value += start_ticks - stop_timer();
+			((EpCoreBank1 *)BANK1)->timer.value += task_ticks;
 #endif
-		if (((EpCoreBank1 *)BANK1)->task_item.items_count > 0) //Sending results back
-			dma_transfer(cur_task, &((EpCoreBank1 *)BANK1)->task_item, sizeof(EpTaskItem), 0);
+        //Sending results back; always done because host cost model needs cycles of every task.
+        //Transfer is waited for, so host never reads stale items or cycles of finished task.
+        slot_task_item(slot)->cycles = task_ticks;
+        dma_transfer(cur_task, slot_task_item(slot), sizeof(EpTaskItem), 1);
+
+        //Trace record must be in shared memory before task is reported as finished
+        if(trace) {
+            traces[slot].write_end = trace_clock();
+            traces[slot].core_id = ((EpCoreBank1 *)BANK1)->timer.core_id;
+            dma_transfer(get_traces_origin() + (cur_task - get_tasks_origin()), traces + slot, sizeof(EpTaskTrace), 1);
+        }
+
+        ++get_sram_origin()->task_ranges[core_range].finished;
 
-        atomic_increment(&get_sram_origin()->control_info.task_finished, get_sram_origin()->control_info.task_count);
+        cur_task = next_task;
+        slot ^= 1;
     }
 	lineTest(20);
     //Sending timer to shared memory
     //ToDo: it can happen that host will read these timers before they will be written completely
 
-    int const timer_cur = atomic_increment(&get_sram_origin()->control_info.timer_index, 4096);
+    int const timer_cur = atomic_increment(
+        (int volatile *)( (char *)&get_sram_origin()->control_info + offsetof(EpControlInfo, timer_index) ), MAX_CORES_NUM);
 	dma_transfer(get_sram_origin()->timers + timer_cur, &((EpCoreBank1 *)BANK1)->timer, sizeof(EpTimerBuf), 1);
 	lineTest(21);
 }
@@ -19,12 +19,18 @@
  * Adapteva implementation of LBP face detection algorithm
  * Exported function names start with "ep_"
  */
+#define _GNU_SOURCE //usleep() is not part of C99
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
 #include <math.h>
+#include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <opencv/cv.h>
 
 #include <omp.h>
@@ -38,13 +44,26 @@
     //#define BUF_OFFSET 0x0
 #else//DEVICE_EMULATION
     #include "ep_emulator.h"
-    #define DRAM_ADR ((unsigned char*)&(dram_memory.common_memory))
+    #define DRAM_ADR ((unsigned char*)&dram_memory)
+    #define BUF_OFFSET 0
 #endif//DEVICE_EMULATION
 
-#define ROWS 4
-#define COLS 4
+/// Workgroup geometry; may be redefined for emulation of larger chips (up to MAX_CORES_NUM cores)
+#ifndef ROWS
+    #define ROWS 4
+#endif
+#ifndef COLS
+    #define COLS 4
+#endif
+
+/// Per-window counters of EpDetectStats (decisions, stage exits); 0 compiles them out of host scanning
+#ifndef EP_DETECT_STATS
+    #define EP_DETECT_STATS 1
+#endif
 
 #include "ep_cascade_detector.h"
+#include "ep_task_planner.h"
+#include "ep_trace.h"
 
 typedef struct
 {
@@ -554,6 +573,8 @@ EpErrorCode ep_task_list_add (
     new_task->scan_mode   = scan_mode;
     new_task->items_count = items_count;
     new_task->image_index = image_index;
+    new_task->cycles      = 0;
+    new_task->reserved    = 0;
 
     ++task_list->count;
     return ERR_SUCCESS;
@@ -615,6 +636,66 @@ int ep_classifier_is_empty(EpCascadeClassifier const *const classifier) {
     return !classifier->data;
 }
 
+/**
+ * Check classifier data in compact encoding (@see EpCompactMeta).
+ * @param classifier: pointer to tested classifier with NODE_META_COMPACT first node.
+ * @return zero value for good classifier data; non-zero value for bad data.
+ */
+static int classifier_check_compact(EpCascadeClassifier const *const classifier) {
+    int const size = classifier->size;
+    char const *const data = classifier->data;
+    char const *const data_end = data + size;
+
+    if( size < (int)( sizeof(EpCompactMeta) + sizeof(EpCompactPart) + sizeof(EpCompactStage) ) )
+        return 10; //Classifier is too small
+
+    EpCompactMeta const *const meta = (EpCompactMeta const *)data;
+
+    if(meta->version != COMPACT_CLASSIFIER_VERSION)
+        return 11; //Unknown version of encoding
+
+    if(meta->window_height < 3 || meta->window_width < 3)
+        return 12; //Window size is too small
+
+    EpCompactPart const *const part = (EpCompactPart const *)(data + sizeof(EpCompactMeta));
+    int const subsets_count = part->subsets_count;
+
+    if( subsets_count < 0 || subsets_count > MAX_COMPACT_SUBSETS ||
+        (data_end - (char const *)(part + 1)) / (int)sizeof(int[8]) < subsets_count )
+        return 13; //Bad number of subset tables
+
+    char const *node = (char const *)(part + 1) + subsets_count * sizeof(int[8]);
+    int stages_count = 0;
+
+    while(1) {
+        if( data_end - node < (int)sizeof(EpCompactStage) )
+            return 14; //No terminating stage
+
+        int const decisions_count = ((EpCompactStage const *)node)->decisions_count;
+        node += sizeof(EpCompactStage);
+        if(!decisions_count)
+            break; //Terminating stage
+
+        if( decisions_count < 0 || (data_end - node) / (int)sizeof(EpCompactDecision) < decisions_count )
+            return 14; //Stage is cut off
+
+        for(int i = 0; i < decisions_count; ++i)
+            if( ((EpCompactDecision const *)node)[i].subset >= subsets_count )
+                return 15; //Decision refers to absent subset table
+
+        node += decisions_count * sizeof(EpCompactDecision);
+        ++stages_count;
+    }
+
+    if(!stages_count)
+        return 16; //No stages
+
+    if(node != data_end)
+        return 17; //Unknown data after terminating stage
+
+    return 0;
+}
+
 /**
  * Check classifier data for validity. Empty classifier is considered invalid!
  * Use ep_classifier_is_empty() function to check whether classifier is empty.
@@ -629,6 +710,9 @@ int ep_classifier_check(EpCascadeClassifier const *const classifier) {
 
     int const size = classifier->size;
 
+    if( ep_classifier_is_compact(classifier) )
+        return classifier_check_compact(classifier);
+
     if( size < (int)( sizeof(EpNodeMeta) + sizeof(EpNodeDecision) +
         sizeof(EpNodeStage) + sizeof(EpNodeFinal) ) )
         return 2; //Classifier is too small
@@ -679,6 +763,208 @@ EpCascadeClassifier ep_classifier_clone(EpCascadeClassifier const *const classif
     return result;
 }
 
+/**
+ * Check whether classifier is in compact encoding (@see EpCompactMeta).
+ * @param classifier: pointer to non-empty classifier.
+ * @return non-zero value for compact classifier; zero otherwise.
+ */
+int ep_classifier_is_compact(EpCascadeClassifier const *const classifier) {
+    return classifier->size >= (int)sizeof(EpCompactMeta) &&
+        ((EpCompactMeta const *)classifier->data)->id == NODE_META_COMPACT;
+}
+
+/**
+ * Divide score or threshold by 2^shift with rounding
+ */
+static int quantize_score(int const value, int const shift) {
+    return shift ? (value + (1 << (shift - 1))) >> shift : value;
+}
+
+/**
+ * Convert classifier to compact encoding (@see EpCompactMeta). Scores and thresholds are
+ *   quantized, so windows very close to stage thresholds may be classified differently.
+ *   Bounds of optimized classifier (@see EpNodeBound) are dropped; order of decisions is kept.
+ * @param classifier: pointer to valid classifier; compact classifier is just cloned.
+ * @return compact classifier; empty classifier is returned in case of any error.
+ */
+EpCascadeClassifier ep_classifier_compact(EpCascadeClassifier const *const classifier) {
+    if( ep_classifier_check(classifier) )
+        return ep_classifier_create_empty();
+
+    if( ep_classifier_is_compact(classifier) )
+        return ep_classifier_clone(classifier);
+
+    char const *const nodes = classifier->data + sizeof(EpNodeMeta);
+    char const *const nodes_end = classifier->data + classifier->size - sizeof(EpNodeFinal);
+
+    //Number of nodes and largest score
+    int decisions_count = 0, stages_count = 0, max_score = 0, stage_decisions = 0;
+    for(char const *node = nodes; node < nodes_end; ) {
+        if(*(int const *)node == NODE_DECISION) {
+            int const score = ((EpNodeDecision const *)node)->score;
+            if(score > max_score) max_score = score;
+            if(-score > max_score) max_score = -score;
+            ++decisions_count;
+            ++stage_decisions;
+            node += sizeof(EpNodeDecision);
+        } else if(*(int const *)node == NODE_BOUND) {
+            node += sizeof(EpNodeBound);
+        } else {
+            if(stage_decisions > SHRT_MAX)
+                return ep_classifier_create_empty(); //Stage is too large for compact encoding
+            stage_decisions = 0;
+            ++stages_count;
+            node += sizeof(EpNodeStage);
+        }
+    }
+
+    int score_shift = 0;
+    while(quantize_score(max_score, score_shift) > SHRT_MAX)
+        ++score_shift;
+
+    //Equal subset tables are stored once
+    int (*const subsets)[8] = (int (*)[8])malloc( decisions_count * sizeof(int[8]) );
+    unsigned short *const decision_subsets = (unsigned short *)malloc( decisions_count * sizeof(unsigned short) );
+    if(!subsets || !decision_subsets) {
+        free(subsets);
+        free(decision_subsets);
+        return ep_classifier_create_empty();
+    }
+
+    int subsets_count = 0, decision_index = 0;
+    for(char const *node = nodes; node < nodes_end; ) {
+        if(*(int const *)node != NODE_DECISION) {
+            node += sizeof(EpNodeStage); //EpNodeBound has the same size
+            continue;
+        }
+
+        int const *const subset = (int const *)( node + offsetof(EpNodeDecision, subsets) );
+        int subset_index = 0;
+        while( subset_index < subsets_count && memcmp(subsets[subset_index], subset, sizeof(int[8])) )
+            ++subset_index;
+        if(subset_index == subsets_count) {
+            if(subsets_count > USHRT_MAX) {
+                free(subsets);
+                free(decision_subsets);
+                return ep_classifier_create_empty(); //Subset index does not fit in EpCompactDecision::subset
+            }
+            memcpy(subsets[subsets_count++], subset, sizeof(int[8]));
+        }
+
+        decision_subsets[decision_index++] = subset_index;
+        node += sizeof(EpNodeDecision);
+    }
+
+    int const size = sizeof(EpCompactMeta) + sizeof(EpCompactPart) + subsets_count * sizeof(int[8]) +
+        (stages_count + 1) * sizeof(EpCompactStage) + decisions_count * sizeof(EpCompactDecision);
+
+    EpCascadeClassifier result = { (char *)calloc(1, size), size };
+    if(!result.data) {
+        free(subsets);
+        free(decision_subsets);
+        return ep_classifier_create_empty();
+    }
+
+    EpCompactMeta *const meta = (EpCompactMeta *)result.data;
+    meta->id            = NODE_META_COMPACT;
+    meta->window_width  = ((EpNodeMeta const *)classifier->data)->window_width;
+    meta->window_height = ((EpNodeMeta const *)classifier->data)->window_height;
+    meta->version       = COMPACT_CLASSIFIER_VERSION;
+    meta->score_shift   = score_shift;
+
+    EpCompactPart *const part = (EpCompactPart *)(meta + 1);
+    part->subsets_count = subsets_count;
+    memcpy(part + 1, subsets, subsets_count * sizeof(int[8]));
+
+    EpCompactStage *stage = (EpCompactStage *)( (char *)(part + 1) + subsets_count * sizeof(int[8]) );
+    EpCompactDecision *decision = (EpCompactDecision *)(stage + 1);
+    decision_index = 0;
+
+    for(char const *node = nodes; node < nodes_end; ) {
+        if(*(int const *)node == NODE_DECISION) {
+            decision->feature = ((EpNodeDecision const *)node)->feature;
+            decision->score   = quantize_score(((EpNodeDecision const *)node)->score, score_shift);
+            decision->subset  = decision_subsets[decision_index++];
+            ++decision;
+            node += sizeof(EpNodeDecision);
+        } else if(*(int const *)node == NODE_BOUND) {
+            node += sizeof(EpNodeBound);
+        } else {
+            stage->decisions_count = decision - (EpCompactDecision *)(stage + 1);
+            stage->threshold = quantize_score(((EpNodeStage const *)node)->threshold, score_shift);
+            stage = (EpCompactStage *)decision;
+            decision = (EpCompactDecision *)(stage + 1);
+            node += sizeof(EpNodeStage);
+        }
+    }
+    //Terminating stage with zero decisions is already zeroed by calloc
+
+    free(subsets);
+    free(decision_subsets);
+    return result;
+}
+
+/**
+ * Mirror LBP code horizontally: columns 0 and 2 of the 3x3 block grid are swapped.
+ *   Code bits: 7 - block 00, 6 - 01, 5 - 02, 4 - 12, 3 - 22, 2 - 21, 1 - 20, 0 - 10 (@see calc_lbp_decision).
+ */
+static int mirror_lbp_code(int const code) {
+    return ( code & 0x44 ) |                                  //Blocks 01 and 21 stay
+           ( (code & 0x80) >> 2 ) | ( (code & 0x20) << 2 ) |  //00 <-> 02
+           ( (code & 0x10) >> 4 ) | ( (code & 0x01) << 4 ) |  //12 <-> 10
+           ( (code & 0x08) >> 2 ) | ( (code & 0x02) << 2 ) ;  //22 <-> 20
+}
+
+/**
+ * Mirror classifier horizontally. Mirrored classifier run over image finds the same objects as
+ *   source classifier run over horizontally flipped image: features are moved to mirrored positions
+ *   and subset tables are permuted, so no flipped copy of image is needed.
+ * @param classifier: pointer to valid classifier in standard encoding.
+ * @return mirrored classifier; empty classifier is returned for compact classifier or in case of any error.
+ */
+EpCascadeClassifier ep_classifier_mirror(EpCascadeClassifier const *const classifier) {
+    if( ep_classifier_check(classifier) || ep_classifier_is_compact(classifier) )
+        return ep_classifier_create_empty();
+
+    EpCascadeClassifier result = ep_classifier_clone(classifier);
+    if( ep_classifier_is_empty(&result) )
+        return result;
+
+    int const window_width = ((EpNodeMeta const *)result.data)->window_width;
+
+    char *const nodes_end = result.data + result.size - sizeof(EpNodeFinal);
+    for(char *node = result.data + sizeof(EpNodeMeta); node < nodes_end; ) {
+        if(*(int const *)node != NODE_DECISION) {
+            node += sizeof(EpNodeStage); //EpNodeBound has the same size
+            continue;
+        }
+
+        EpNodeDecision *const decision = (EpNodeDecision *)node;
+        EpNodeDecision const source = *decision;
+
+        int const feature_width = source.feature & 255,
+                  feature_x     = (source.feature >> 16) & 255;
+
+        int const mirrored_x = window_width - feature_x - 3 * feature_width;
+        if(mirrored_x < 0) { //Feature does not fit the window
+            ep_classifier_release(&result);
+            return result;
+        }
+        decision->feature = (source.feature & ~(255 << 16)) | (mirrored_x << 16);
+
+        memset(decision->subsets, 0, sizeof(decision->subsets));
+        for(int code = 0; code < 256; ++code) {
+            unsigned int const bit = ( (unsigned int)source.subsets[code >> 5] >> (code & 31) ) & 1;
+            int const mirrored = mirror_lbp_code(code);
+            decision->subsets[mirrored >> 5] |= (int)( bit << (mirrored & 31) );
+        }
+
+        node += sizeof(EpNodeDecision);
+    }
+
+    return result;
+}
+
 /**
  * Calculate classifier checksum for debug purpose.
  *   Classifiers with the same data will get the same checksums,
@@ -815,6 +1101,266 @@ void ep_classifier_release(EpCascadeClassifier *const classifier) {
     classifier->size = 0;
 }
 
+/**
+ * Classifier file mapped read-only; shared by store and everyone who acquired the classifier
+ */
+typedef struct {
+    /// Classifiers given out point here, so this field must be the first one
+    EpCascadeClassifier classifier;
+    /// Mapped file
+    void *map;
+    size_t map_size;
+    /// One reference of store while mapping is current, and one per acquire / retain
+    int references;
+} EpClassifierMapping;
+
+/**
+ * Identity of classifier file; reload maps file only if identity changes
+ */
+typedef struct {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+} EpFileIdentity;
+
+struct EpClassifierStore {
+    char *file_name;
+    /// Identity of the last file seen at file_name; guarded by critical section ep_classifier_store as current is
+    EpFileIdentity identity;
+    EpClassifierMapping *current;
+};
+
+/**
+ * @return identity of file with given status
+ */
+static EpFileIdentity file_identity(struct stat const *const file_stat) {
+    EpFileIdentity const identity = { file_stat->st_dev, file_stat->st_ino, file_stat->st_size, file_stat->st_mtime };
+    return identity;
+}
+
+/**
+ * @return non-zero if identities are of the same file
+ */
+static int file_identity_equal(EpFileIdentity const *const a, EpFileIdentity const *const b) {
+    return a->device == b->device && a->inode == b->inode && a->size == b->size && a->mtime == b->mtime;
+}
+
+/**
+ * Map classifier file (written by ep_classifier_save()) and check its contents.
+ * @param file_name : name of file;
+ * @param identity  : receives identity of the file even if its contents are wrong;
+ *                    it is not set if error code is ERR_FILE (file may be retried);
+ * @param error_code: receives error code (@see ep_classifier_load).
+ * @return mapping with one reference; NULL in case of any error.
+ */
+static EpClassifierMapping *classifier_mapping_open (
+    char           const *const file_name,
+    EpFileIdentity       *const identity,
+    EpErrorCode          *const error_code
+) {
+    int const file = open(file_name, O_RDONLY);
+    if(file < 0) {
+        *error_code = ERR_FILE;
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if( fstat(file, &file_stat) ) {
+        close(file);
+        *error_code = ERR_FILE;
+        return NULL;
+    }
+
+    if( file_stat.st_size < (off_t)( 2 * sizeof(int) ) ) {
+        *identity = file_identity(&file_stat);
+        close(file);
+        *error_code = ERR_FILE_CONTENTS;
+        return NULL;
+    }
+
+    size_t const map_size = file_stat.st_size;
+    void *const map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file); //Mapping keeps file alive
+    if(map == MAP_FAILED) {
+        *error_code = ERR_FILE;
+        return NULL;
+    }
+
+    *identity = file_identity(&file_stat);
+
+    //Same layout as written by ep_classifier_save(): id, size, data (8-byte aligned in page-aligned mapping)
+    int const *const header = (int const *)map;
+    EpCascadeClassifier const classifier = { (char *)map + 2 * sizeof(int), header[1] };
+
+    if( header[0] != FILE_ID_CLASSIFIER || classifier.size <= 0 ||
+        (size_t)classifier.size > map_size - 2 * sizeof(int) || ep_classifier_check(&classifier) ) {
+        munmap(map, map_size);
+        *error_code = ERR_FILE_CONTENTS;
+        return NULL;
+    }
+
+    EpClassifierMapping *const mapping = (EpClassifierMapping *)malloc( sizeof(EpClassifierMapping) );
+    if(!mapping) {
+        munmap(map, map_size);
+        *error_code = ERR_MEMORY;
+        return NULL;
+    }
+
+    mapping->classifier = classifier;
+    mapping->map        = map;
+    mapping->map_size   = map_size;
+    mapping->references = 1;
+
+    *error_code = ERR_SUCCESS;
+    return mapping;
+}
+
+/**
+ * Drop one reference of mapping; the last one unmaps file
+ */
+static void classifier_mapping_unref(EpClassifierMapping *const mapping) {
+    int references;
+
+    #pragma omp critical(ep_classifier_store)
+    references = --mapping->references;
+
+    if(!references) {
+        munmap(mapping->map, mapping->map_size);
+        free(mapping);
+    }
+}
+
+/**
+ * Open store of classifier mapped from binary file ( previously written by ep_classifier_save() ).
+ * @param file_name : pointer to file name (null-terminated string);
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ *                  If this pointer is NULL then no error code is stored.
+ * @return opened store; NULL in case of any error.
+ */
+EpClassifierStore *ep_classifier_store_open(char const *const file_name, EpErrorCode *const error_code) {
+    EpErrorCode dummy_error_code;
+    EpErrorCode *const result = error_code ? error_code : &dummy_error_code;
+
+    EpClassifierStore *const store = (EpClassifierStore *)calloc( 1, sizeof(EpClassifierStore) );
+    if(store)
+        store->file_name = strdup(file_name);
+
+    if(!store || !store->file_name) {
+        free(store);
+        *result = ERR_MEMORY;
+        return NULL;
+    }
+
+    store->current = classifier_mapping_open(store->file_name, &store->identity, result);
+    if(!store->current) {
+        free(store->file_name);
+        free(store);
+        return NULL;
+    }
+
+    return store;
+}
+
+/**
+ * Map file again if it was replaced since the last check. New classifier is used by
+ *   next acquires, while classifiers acquired before stay valid until released.
+ *   Replace file atomically (write new file, then rename() it over the old one);
+ *   file with wrong contents is rejected and current classifier is kept.
+ * @param store     : opened store;
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ *                  If this pointer is NULL then no error code is stored.
+ * @return non-zero if new classifier was swapped in; zero otherwise.
+ */
+int ep_classifier_store_reload(EpClassifierStore *const store, EpErrorCode *const error_code) {
+    EpErrorCode dummy_error_code;
+    EpErrorCode *const result = error_code ? error_code : &dummy_error_code;
+
+    struct stat file_stat;
+    if( stat(store->file_name, &file_stat) ) {
+        *result = ERR_FILE;
+        return 0;
+    }
+
+    EpFileIdentity identity = file_identity(&file_stat);
+    int same_file;
+
+    #pragma omp critical(ep_classifier_store)
+    same_file = file_identity_equal(&identity, &store->identity);
+
+    *result = ERR_SUCCESS;
+    if(same_file)
+        return 0;
+
+    EpClassifierMapping *const mapping = classifier_mapping_open(store->file_name, &identity, result);
+    EpClassifierMapping *old_mapping = NULL;
+
+    //Identity of rejected file is kept too, so it is not mapped again until it is replaced
+    #pragma omp critical(ep_classifier_store)
+    {
+        if(*result != ERR_FILE)
+            store->identity = identity;
+        if(mapping) {
+            old_mapping = store->current;
+            store->current = mapping;
+        }
+    }
+
+    if(!mapping)
+        return 0;
+
+    classifier_mapping_unref(old_mapping);
+    return 1;
+}
+
+/**
+ * Take current classifier of the store. It stays valid (even after reload or close of the store)
+ *   until it is released with ep_classifier_store_release(). Data is read-only!
+ * @param store: opened store.
+ * @return current classifier.
+ */
+EpCascadeClassifier const *ep_classifier_store_acquire(EpClassifierStore *const store) {
+    EpClassifierMapping *mapping;
+
+    #pragma omp critical(ep_classifier_store)
+    {
+        mapping = store->current;
+        ++mapping->references;
+    }
+
+    return &mapping->classifier;
+}
+
+/**
+ * Take one more reference of classifier acquired from store.
+ * @param classifier: classifier returned by ep_classifier_store_acquire() and not released yet.
+ * @return the same classifier.
+ */
+EpCascadeClassifier const *ep_classifier_store_retain(EpCascadeClassifier const *const classifier) {
+    #pragma omp critical(ep_classifier_store)
+    ++((EpClassifierMapping *)classifier)->references;
+
+    return classifier;
+}
+
+/**
+ * Release classifier acquired from store; the last release of replaced classifier unmaps its file.
+ * @param classifier: classifier returned by ep_classifier_store_acquire() or ep_classifier_store_retain().
+ */
+void ep_classifier_store_release(EpCascadeClassifier const *const classifier) {
+    classifier_mapping_unref( (EpClassifierMapping *)classifier );
+}
+
+/**
+ * Close store. Classifiers acquired from it stay valid until released.
+ * @param store: opened store.
+ */
+void ep_classifier_store_close(EpClassifierStore *const store) {
+    classifier_mapping_unref(store->current);
+    free(store->file_name);
+    free(store);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //                            DETECTION FUNCTIONS                             //
 ////////////////////////////////////////////////////////////////////////////////
@@ -1051,14 +1597,24 @@ static void scale21(EpImage const *const src, EpImage *const out) {
 }
 
 /**
- * Scale image inplace with realloc in memory;
- * @param src: pointer to source image;
+ * Scale image by 7/8, 6/8 and 5/8 (@see ep_image_scale8765)
+ */
+void ep_image_scale8765 (
+    EpImage const *const src8,
+    EpImage       *const out7,
+    EpImage       *const out6,
+    EpImage       *const out5,
+    int           *const offset_x,
+    int           *const offset_y
+) {
+    scale8765(src8, out7, out6, out5, offset_x, offset_y);
+}
+
+/**
+ * Reduce image twice (@see ep_image_scale21)
  */
-static void scale21_realloc(EpImage *const src){
-    EpImage temp = ep_image_create(src->width / 2, src->height / 2);
-    scale21(src, &temp);
-    ep_image_release(src);
-    *src = temp;
+void ep_image_scale21(EpImage const *const src, EpImage *const out) {
+    scale21(src, out);
 }
 
 /**
@@ -1066,16 +1622,16 @@ static void scale21_realloc(EpImage *const src){
  *
  * @param image_data: Position in memory where to sample feature from.
  * @param image_step: Step in bytes from one image line to the next image line.
- * @param node: Classifier node used to make decision.
+ * @param feature: LBP feature rectangle (@see EpNodeDecision::feature).
+ * @param subsets: One bit for each possible value of LBP feature.
  * @return decision value: 0 or 1.
  */
 static int calc_lbp_decision (
     unsigned char const *image_data,
     int const image_step,
-    EpNodeDecision const *const node
+    int const feature,
+    int const *const subsets
 ) {
-    int const feature = node->feature;
-
     //Shifting position according to LBP feature position
     image_data += ( (feature >> 16) & 255 ) + (feature >> 24) * image_step;
 
@@ -1196,7 +1752,30 @@ static int calc_lbp_decision (
         ( ( ( (unsigned int)~(sum20 - sum11) ) & sign ) >> 30 ) |
         (   ( (unsigned int)~(sum10 - sum11) )          >> 31 ) ;
 
-    return (node->subsets[subset_index] >> bit_index) & 1;
+    return (subsets[subset_index] >> bit_index) & 1;
+}
+
+/**
+ * Calculate decision of NODE_DECISION node (@see calc_lbp_decision)
+ */
+static int calc_node_decision (
+    unsigned char const *const image_data,
+    int const image_step,
+    char const *const node
+) {
+    return calc_lbp_decision(image_data, image_step, ((EpNodeDecision const *)node)->feature,
+        (int const *)( node + offsetof(EpNodeDecision, subsets) ));
+}
+
+/**
+ * Calculate decision of one decision node at given window position (@see ep_classifier_node_decision)
+ */
+int ep_classifier_node_decision (
+    char          const *const node,
+    unsigned char const *const image_data,
+    int                  const image_step
+) {
+    return calc_node_decision(image_data, image_step, node);
 }
 
 /**
@@ -1207,6 +1786,7 @@ static int calc_lbp_decision (
  *   this value is in specified subset.
  * NODE_STAGE: compare object_score accumulated so far with specified threshold.
  *   if value is less than threshold then return 0 otherwise continue.
+ * NODE_BOUND: the same as NODE_STAGE, but object_score is kept for the rest of the stage.
  * NODE_FINAL: return 1.
  * For performance reasons it is supposed that first node is always
  * NODE_DECISION, and two NODE_STAGE nodes are never go in succession.
@@ -1222,17 +1802,22 @@ static int classify (
 ) {
     //First node is always NODE_DECISION
     int object_score = ((EpNodeDecision const *)node)->score &
-        -calc_lbp_decision(image_data, image_step, (EpNodeDecision const *)node);
+        -calc_node_decision(image_data, image_step, node);
     node += sizeof(EpNodeDecision);
 
     while(1) {
         if(!*node) { //NODE_DECISION
             object_score += ((EpNodeDecision const *)node)->score &
-                -calc_lbp_decision(image_data, image_step, (EpNodeDecision const *)node);
+                -calc_node_decision(image_data, image_step, node);
             node += sizeof(EpNodeDecision);
-        } else { //NODE_STAGE
+        } else { //NODE_STAGE or NODE_BOUND
             if(object_score < ((EpNodeStage *)node)->threshold)
                 return 0;
+
+            if(*(int const *)node == NODE_BOUND) { //Stage goes on with the same sum
+                node += sizeof(EpNodeBound);
+                continue;
+            }
             node += sizeof(EpNodeStage);
 
             if(*node)
@@ -1240,7 +1825,7 @@ static int classify (
 
             //NODE_DECISION
             object_score = ((EpNodeDecision const *)node)->score &
-                -calc_lbp_decision(image_data, image_step, (EpNodeDecision const *)node);
+                -calc_node_decision(image_data, image_step, node);
             node += sizeof(EpNodeDecision);
         }
     }
@@ -1249,83 +1834,370 @@ static int classify (
 }
 
 /**
- * Perform single-scale object detection
- * @param image: Image to scan.
- * @param classifier: Classifier to use.
+ * Classify single image position using classifier in compact encoding (@see EpCompactMeta).
+ *   Stages are run one by one until stage with zero decisions_count.
+ * @param part: first part of compact classifier;
+ * @param image_data: position in memory where to sample image data
+ * @param image_step: step from current image line to the next image line
+ * @return Non-zero for positive classification, zero otherwise.
+ */
+static int classify_compact (
+    EpCompactPart const *const part,
+    unsigned char const *const image_data,
+    int const image_step
+) {
+    int const (*const subsets)[8] = (int const (*)[8])(part + 1);
+    EpCompactStage const *stage = (EpCompactStage const *)(subsets + part->subsets_count);
+
+    for(int decisions_count; (decisions_count = stage->decisions_count); ) {
+        EpCompactDecision const *decision = (EpCompactDecision const *)(stage + 1);
+
+        int object_score = 0;
+        for(; decisions_count; --decisions_count, ++decision)
+            object_score += decision->score &
+                -calc_lbp_decision(image_data, image_step, decision->feature, subsets[decision->subset]);
+
+        if(object_score < stage->threshold)
+            return 0;
+
+        stage = (EpCompactStage const *)decision;
+    }
+
+    return 1;
+}
+
+/**
+ * Classifier scanned by host threads (@see detect_tile_host)
+ */
+typedef struct {
+    /// First node after META node
+    char const *node;
+    /// Non-zero for compact encoding (@see EpCompactMeta)
+    int compact;
+    /// Native object size of the classifier
+    int window_width, window_height;
+    /// Detections are added to this list
+    EpRectList *objects;
+} EpHostCascade;
+
+/**
+ * Prepare classifier for scanning by host threads.
+ * @param classifier_data: Classifier in any encoding (META node included).
  * @param objects: Detections will be added to this list.
- * @param scale: Size and coordinates of resulting rectangles will be multiplied by this factor.
- * @param offset_x: X coordinate of resulting rectangles will be offset by this values.
- * @param offset_y: Y coordinate of resulting rectangles will be offset by this values.
- * @param scan_mode: which pixels should be tested. @see EpScanMode
  */
-static void detect_single_scale_host (
-    EpImage             const *const image,
-    EpCascadeClassifier const *      classifier,
-    EpRectList                *const objects,
-    float                      const scale,
-    int                        const offset_x,
-    int                        const offset_y,
-    EpScanMode                 const scan_mode
+static EpHostCascade host_cascade(char const *const classifier_data, EpRectList *const objects) {
+    int const compact = *(int const *)classifier_data == NODE_META_COMPACT;
+    EpHostCascade const result = {
+        classifier_data + (compact ? sizeof(EpCompactMeta) : sizeof(EpNodeMeta)),
+        compact,
+        ( (EpNodeMeta const *)classifier_data )->window_width,
+        ( (EpNodeMeta const *)classifier_data )->window_height,
+        objects
+    };
+    return result;
+}
+
+/**
+ * Classify one window position (@see ep_classifier_classify)
+ */
+int ep_classifier_classify (
+    EpCascadeClassifier const *const classifier,
+    unsigned char       const *const image_data,
+    int                        const image_step
+) {
+    EpHostCascade const cascade = host_cascade(classifier->data, NULL);
+    return cascade.compact ? classify_compact((EpCompactPart const *)cascade.node, image_data, image_step) :
+                             classify(cascade.node, image_data, image_step);
+}
+
+/**
+ * Classify one window position and report where cascade exited.
+ * @param cascade        : classifier prepared by host_cascade();
+ * @param decisions_count: receives number of decisions evaluated;
+ * @param passed         : receives non-zero if window is classified as object.
+ * @return index of stage which rejected the window; number of stages if window passed.
+ */
+static int classify_depth (
+    EpHostCascade       const *const cascade,
+    unsigned char       const *const image_data,
+    int                        const image_step,
+    int                       *const decisions_count,
+    int                       *const passed
 ) {
-    /*{
-        cv::Mat const cv_image(image->height, image->width, CV_8UC1, image->data, image->step);
-        cv::imshow("Debug", cv_image);
-        cv::waitKey(0);
-    }*/
+    int stage_index = 0, decisions = 0;
+    *passed = 0;
+
+    if(cascade->compact) {
+        EpCompactPart const *const part = (EpCompactPart const *)cascade->node;
+        int const (*const subsets)[8] = (int const (*)[8])(part + 1);
+        EpCompactStage const *stage = (EpCompactStage const *)(subsets + part->subsets_count);
+
+        for(;; ++stage_index) {
+            if(!stage->decisions_count) {
+                *passed = 1;
+                break;
+            }
 
-    char const *node = classifier->data;
+            EpCompactDecision const *decision = (EpCompactDecision const *)(stage + 1);
 
-    int const window_width  = ((EpNodeMeta const *)node)->window_width,
-              window_height = ((EpNodeMeta const *)node)->window_height;
+            int object_score = 0;
+            for(int i = stage->decisions_count; i; --i, ++decision)
+                object_score += decision->score &
+                    -calc_lbp_decision(image_data, image_step, decision->feature, subsets[decision->subset]);
+            decisions += stage->decisions_count;
 
-    int const process_width  = image->width  + 1 - window_width,
-              process_height = image->height + 1 - window_height;
+            if(object_score < stage->threshold)
+                break;
 
-    float const detection_width  = window_width  * scale,
-                detection_height = window_height * scale;
+            stage = (EpCompactStage const *)decision;
+        }
+    } else {
+        char const *node = cascade->node;
+        int object_score = 0;
 
-    node += sizeof(EpNodeMeta); //Skipping initial META node
+        for(;;) {
+            if(*(int const *)node == NODE_FINAL) {
+                *passed = 1;
+                break;
+            }
 
-    int const image_step = image->step;
+            if(*(int const *)node == NODE_DECISION) {
+                object_score += ((EpNodeDecision const *)node)->score &
+                    -calc_node_decision(image_data, image_step, node);
+                ++decisions;
+                node += sizeof(EpNodeDecision);
+                continue;
+            }
 
-    //OpenCV has this hack:
-    //int step = scale > 2.0f ? 1 : 2;
-    //We do not like it. Instead we use checkerboard scanning pattern.
-    //Required calculations are almost doubled, but detection of small objects is better, and all pyramid levels are equal
+            if(object_score < ((EpNodeStage const *)node)->threshold)
+                break; //Rejected by stage or by its bound
 
-    #pragma omp parallel for schedule(dynamic)
-    for(int y = 0; y < process_height; ++y) {
-        unsigned char const *const scan_line = image->data + y * image_step;
-
-        int const x_start = scan_mode == SCAN_FULL ? 0 : (y + scan_mode) & 1;
-        int const x_step = scan_mode == SCAN_FULL ? 1 : 2;
-
-        for(int x = x_start; x < process_width; x += x_step) {
-			if (classify(node, scan_line + x, image_step)) {
-                #pragma omp critical(add_face)
-                ep_rect_list_add (
-                    objects,
-                    x * scale + offset_x,
-                    y * scale + offset_y,
-                    detection_width,
-                    detection_height
-                );
+            if(*(int const *)node == NODE_STAGE) {
+                object_score = 0;
+                ++stage_index;
             }
+            node += sizeof(EpNodeStage); //EpNodeBound has the same size
         }
     }
+
+    *decisions_count = decisions;
+    return stage_index;
 }
 
 /**
- * Returns sequence
- * 8.0/8, 8.0/7, 8.0/6, 8.0/5, 16.0/8, 16.0/7, 16.0/6, 16.0/5, 32.0/8, 32.0/7, 32.0/6, 32.0/5, ...
- * needed to convert coordinates and object sizes detected at pyramid level image_index into
- * source image coordinates.
+ * Classify one window position and report where cascade exited (@see ep_classifier_classify_depth)
  */
-static float convert_image_index_to_scale(int const image_index)
+int ep_classifier_classify_depth (
+    EpCascadeClassifier const *const classifier,
+    unsigned char       const *const image_data,
+    int                        const image_step,
+    int                       *const decisions_count
+) {
+    EpHostCascade const cascade = host_cascade(classifier->data, NULL);
+    int decisions, passed;
+    int const result = classify_depth(&cascade, image_data, image_step, &decisions, &passed);
+
+    if(decisions_count)
+        *decisions_count = decisions;
+    return result;
+}
+
+/**
+ * Number of window positions scanned in tile.
+ * @param process_width : Number of positions in a tile row;
+ * @param process_height: Number of tile rows;
+ * @param scan_mode     : Scan mode of the tile (@see EpTaskItem).
+ */
+static double tile_windows(int const process_width, int const process_height, int const scan_mode) {
+    if(process_width <= 0 || process_height <= 0)
+        return 0;
+    if(scan_mode == SCAN_FULL)
+        return (double)process_width * process_height;
+
+    //Rows starting at the first position have one more window when row length is odd
+    int const even_rows = scan_mode == SCAN_EVEN ? (process_height + 1) / 2 : process_height / 2;
+    return (double)even_rows * ( (process_width + 1) / 2 ) + (double)(process_height - even_rows) * (process_width / 2);
+}
+
+/**
+ * Detect objects in one tile of pyramid level on host. Cycles spent are stored in the task.
+ *   Every position is tested by all cascades while tile is in cache.
+ *   Tiles are planned for the largest window among cascades (planning window), so neighbour tiles
+ *   overlap by planning window size - 1. Cascades with smaller windows test the same positions
+ *   as the largest one, and also the extra positions near right and bottom borders of the level.
+ *
+ * @param image: Pyramid level the task refers to.
+ * @param tile: Copy of the tile in host memory (task->width x task->height); NULL to scan the tile right in image.
+ * @param cascades: Classifiers to run; the ones with window larger than the level are skipped.
+ * @param cascades_count: Number of classifiers.
+ * @param task: Tile to scan; same tiles and scan pattern as used by cores.
+ * @param plan_width: Planning window width.
+ * @param plan_height: Planning window height.
+ * @param scale: Size and coordinates of resulting rectangles will be multiplied by this factor.
+ * @param offset_x: X coordinate of resulting rectangles will be offset by this values.
+ * @param offset_y: Y coordinate of resulting rectangles will be offset by this values.
+ * @param stats: Counters of the level; NULL if not needed (the fast scanning loop is used).
+ */
+static void detect_tile_host (
+    EpImage             const *const image,
+    EpImage             const *const tile,
+    EpHostCascade       const *const cascades,
+    int                        const cascades_count,
+    EpTaskItem                *const task,
+    int                        const plan_width,
+    int                        const plan_height,
+    float                      const scale,
+    int                        const offset_x,
+    int                        const offset_y,
+    EpLevelStats              *const stats
+) {
+    int64 const time_start = cvGetTickCount();
+
+    //Counters of the tile are added to level ones at the end; the branch on counters is hoisted out of loops
+#if EP_DETECT_STATS
+    EpLevelStats tile_stats;
+    EpLevelStats *const counters = stats ? &tile_stats : NULL;
+    if(counters)
+        memset(counters, 0, sizeof(EpLevelStats));
+#else
+    EpLevelStats *const counters = NULL;
+#endif
+    int hits = 0;
+
+    int const image_step = image->step;
+
+    int const tile_x = task->offset % image_step,
+              tile_y = task->offset / image_step;
+
+    unsigned char const *const tile_pixels = tile ? tile->data : image->data + task->offset;
+    int const tile_step = tile ? tile->step : image_step;
+
+    //Tiles at right and bottom borders of the level get all positions where window fits
+    int const last_column = tile_x + task->width  == image->width,
+              last_row    = tile_y + task->height == image->height;
+
+    //OpenCV has this hack:
+    //int step = scale > 2.0f ? 1 : 2;
+    //We do not like it. Instead we use checkerboard scanning pattern.
+    //Required calculations are almost doubled, but detection of small objects is better, and all pyramid levels are equal
+
+    int process_widths[cascades_count], process_heights[cascades_count];
+    int max_process_width = 0, max_process_height = 0;
+    for(int c = 0; c < cascades_count; ++c) {
+        EpHostCascade const *const cascade = cascades + c;
+        int const fits = image->width >= cascade->window_width && image->height >= cascade->window_height;
+        process_widths [c] = !fits ? 0 : task->width  + 1 - (last_column ? cascade->window_width  : plan_width );
+        process_heights[c] = !fits ? 0 : task->height + 1 - (last_row    ? cascade->window_height : plan_height);
+        if(process_widths [c] > max_process_width ) max_process_width  = process_widths [c];
+        if(process_heights[c] > max_process_height) max_process_height = process_heights[c];
+    }
+
+    for(int y = 0; y < max_process_height; ++y) {
+        unsigned char const *const scan_line = tile_pixels + y * tile_step;
+
+        int const x_start = task->scan_mode == SCAN_FULL ? 0 : (y + task->scan_mode) & 1;
+        int const x_step = task->scan_mode == SCAN_FULL ? 1 : 2;
+
+        for(int x = x_start; x < max_process_width; x += x_step) {
+            for(int c = 0; c < cascades_count; ++c) {
+                EpHostCascade const *const cascade = cascades + c;
+                if(x >= process_widths[c] || y >= process_heights[c])
+                    continue;
+
+                int passed;
+                if(counters) {
+                    int decisions;
+                    int const stage = classify_depth(cascade, scan_line + x, tile_step, &decisions, &passed);
+                    counters->windows   += 1;
+                    counters->decisions += decisions;
+                    if(!passed)
+                        counters->stage_exits[stage < MAX_STATS_STAGES ? stage : MAX_STATS_STAGES - 1] += 1;
+                } else {
+                    passed = cascade->compact ? classify_compact((EpCompactPart const *)cascade->node, scan_line + x, tile_step) :
+                                                classify(cascade->node, scan_line + x, tile_step);
+                }
+
+                if(passed) {
+                    ++hits;
+                    #pragma omp critical(add_face)
+                    ep_rect_list_add (
+                        cascade->objects,
+                        (tile_x + x) * scale + offset_x,
+                        (tile_y + y) * scale + offset_y,
+                        cascade->window_width  * scale,
+                        cascade->window_height * scale
+                    );
+                }
+            }
+        }
+    }
+
+    int64 const time_end = cvGetTickCount();
+    task->cycles = (unsigned int)(time_end - time_start);
+
+    if(stats) {
+        #pragma omp critical(detect_stats)
+        {
+            ++stats->host_tiles;
+            stats->hits += hits;
+            if(counters) {
+                stats->windows      += counters->windows;
+                stats->host_windows += counters->windows;
+                stats->decisions    += counters->decisions;
+                for(int i = 0; i < MAX_STATS_STAGES; ++i)
+                    stats->stage_exits[i] += counters->stage_exits[i];
+            } else {
+                for(int c = 0; c < cascades_count; ++c) {
+                    double const windows = tile_windows(process_widths[c], process_heights[c], task->scan_mode);
+                    stats->windows      += windows;
+                    stats->host_windows += windows;
+                }
+            }
+        }
+    }
+
+    ep_trace_span("tile", "host", TRACE_PID_HOST, omp_get_thread_num(), ep_trace_time(time_start), ep_trace_time(time_end), "level", task->image_index);
+}
+
+/**
+ * Returns sequence
+ * 8.0/8, 8.0/7, 8.0/6, 8.0/5, 16.0/8, 16.0/7, 16.0/6, 16.0/5, 32.0/8, 32.0/7, 32.0/6, 32.0/5, ...
+ * needed to convert coordinates and object sizes detected at pyramid level image_index into
+ * source image coordinates.
+ */
+static float convert_image_index_to_scale(int const image_index)
 {
 	return (float)( 8 << (image_index / 4) ) / ( 8 - (image_index % 4) );
 }
 
+/**
+ * Counters of pyramid level; deep levels share the last counters (@see MAX_STATS_LEVELS)
+ * @return NULL if stats is NULL
+ */
+static EpLevelStats *level_stats(EpDetectStats *const stats, int const image_index) {
+    if(!stats)
+        return NULL;
+    return stats->levels + (image_index < MAX_STATS_LEVELS ? image_index : MAX_STATS_LEVELS - 1);
+}
+
+/**
+ * Count tiles of planned tasks in their levels
+ */
+static void stats_add_tiles(EpDetectStats *const stats, EpTaskList const *const tasks) {
+    if(!stats)
+        return;
+
+    for(int i = 0; i < tasks->count; ++i) {
+        int const image_index = tasks->data[i].image_index;
+        EpLevelStats *const level = level_stats(stats, image_index);
+        ++level->tiles;
+        if(image_index < MAX_STATS_LEVELS)
+            level->scale = convert_image_index_to_scale(image_index);
+        if(level - stats->levels >= stats->levels_count)
+            stats->levels_count = level - stats->levels + 1;
+    }
+}
+
 /**
  * Process detection results.
  * @param objects          : Processed detections will be added here;
@@ -1382,41 +2254,117 @@ static int process_results (
 }
 
 
+void ep_detect_stats_reset(EpDetectStats *const stats) {
+    memset(stats, 0, sizeof(EpDetectStats));
+}
+
+/**
+ * Write statistics as text (@see ep_detect_stats_save)
+ */
+EpErrorCode ep_detect_stats_save(EpDetectStats const *const stats, char const *const file_name) {
+    FILE *const f = fopen(file_name, "wt");
+    if(!f)
+        return ERR_FILE;
+
+    double windows = 0, decisions = 0, host_windows = 0;
+    int tiles = 0, hits = 0;
+    for(int i = 0; i < stats->levels_count; ++i) {
+        EpLevelStats const *const level = stats->levels + i;
+        windows += level->windows;
+        host_windows += level->host_windows;
+        decisions += level->decisions;
+        tiles += level->tiles;
+        hits += level->hits;
+    }
+
+    fprintf(f, "------- Detection statistics ------\n\n");
+    fprintf(f, "Scale time:          %.6f s\n", stats->time_scale / 1000000);
+    fprintf(f, "Scan time:           %.6f s\n", stats->time_scan / 1000000);
+    fprintf(f, "Group time:          %.6f s\n", stats->time_group / 1000000);
+    fprintf(f, "Tiles:               %d\n", tiles);
+    fprintf(f, "Windows:             %.0f\n", windows);
+    fprintf(f, "Raw hits:            %d\n", hits);
+    if(decisions > 0)
+        fprintf(f, "Decisions per window: %.2f (%.0f windows of host tiles)\n", decisions / host_windows, host_windows);
+    else
+        fprintf(f, "Decisions per window: not measured\n");
+    if(stats->cores_count) {
+        fprintf(f, "Bytes to device:     %.0f\n", stats->bytes_to_device);
+        fprintf(f, "Bytes from device:   %.0f\n", stats->bytes_from_device);
+        fprintf(f, "Bytes of tiles:      %.0f\n", stats->bytes_tiles);
+    }
+
+    //Cores do not count decisions and stage exits; they are measured in host tiles only
+    fprintf(f, "\nLevel   Scale  Tiles  Host tiles       Windows  Host windows   Decisions   Hits  Stage exits (host windows)\n");
+    for(int i = 0; i < stats->levels_count; ++i) {
+        EpLevelStats const *const level = stats->levels + i;
+        fprintf(f, "%5d  %6.3f  %5d  %10d  %12.0f  %12.0f  ", i, level->scale, level->tiles, level->host_tiles,
+                level->windows, level->host_windows);
+        if(level->decisions <= 0) {
+            fprintf(f, "%10s  %5d  not measured\n", "-", level->hits);
+            continue;
+        }
+        fprintf(f, "%10.0f  %5d ", level->decisions, level->hits);
+
+        int last_stage = MAX_STATS_STAGES;
+        while(last_stage > 0 && level->stage_exits[last_stage - 1] <= 0)
+            --last_stage;
+        for(int k = 0; k < last_stage; ++k)
+            fprintf(f, " %.0f", level->stage_exits[k]);
+        fprintf(f, "\n");
+    }
+
+    if(stats->cores_count) {
+        fprintf(f, "\nCore    Busy time, s   DMA stall, s\n");
+        double total_cores_time = 0;
+        for(int i = 0; i < stats->cores_count; ++i) {
+            fprintf(f, "%4d  %14.6f  %13.6f\n", i, stats->core_times[i] / 1000000, stats->core_stall_times[i] / 1000000);
+            total_cores_time += stats->core_times[i];
+        }
+        fprintf(f, "Average cores time: %.6f s\n", total_cores_time / stats->cores_count / 1000000);
+        fprintf(f, "Total cores time:   %.6f s\n", total_cores_time / 1000000);
+    }
+
+    return fclose(f) ? ERR_FILE : ERR_SUCCESS;
+}
+
 /**
- * Parse task on core times and output times in log_file
- * @param log_file  : name of result file
- * @param scale_time: time of images scaling
- * @param wait_time : time of host wait of detection
- * @param num_cores : count of working cores
- * @param timers    : array of cores timers
+ * Geometry of tile of image split into tiles_hor x tiles_ver tiles (@see add_tasks_for_image).
+ *
+ * @param image_width  : image width without horizontal overlap;
+ * @param image_height : image height without vertical overlap;
+ * @param tile_index   : index of tile, row by row;
+ * @param tile_x1      : receives left edge of tile (multiple of 8 pixels);
+ * @param tile_y1      : receives top edge of tile;
+ * @param tile_width   : receives tile width;
+ * @param tile_height  : receives tile height.
+ * @return tile step (width rounded up to 8 pixels)
  */
-static void time_log(
-        char       const * const log_file,
-        double     const         scale_time,
-        double     const         wait_time,
-        int        const         num_cores,
-        EpTimerBuf const * const timers
+static int tile_geometry(
+        int   const image_width,
+        int   const image_height,
+        int   const overlap_width,
+        int   const overlap_height,
+        int   const tiles_hor,
+        int   const tiles_ver,
+        int   const tile_index,
+        int * const tile_x1,
+        int * const tile_y1,
+        int * const tile_width,
+        int * const tile_height
 ) {
-    FILE *f = fopen(log_file, "wt");
-    fprintf(f, "------- Timers result in seconds ------\r\n\r\n");
-    fprintf(f, "Scale time:               %lf\r\n", scale_time / 1000000);
-    fprintf(f, "Host detection wait time: %lf\r\n", wait_time / 1000000);
-    fprintf(f, "\r\nWork times per cores\r\n");
-    fprintf(f, "=============================================\r\n");
+    int const tile_y = tile_index / tiles_hor,
+              tile_x = tile_index % tiles_hor;
 
-    const double core_timer_freq = 1000000.0 * CORE_FREQUENCY;
-    double total_cores_time = 0;
-    for (int i = 0; i < num_cores; ++i) {
-        double cur_time = timers[i].value / core_timer_freq * (1 << TIMER_VALUE_SHIFT);
-        fprintf(f, "\t Core #%d:\t%lf\r\n", timers[i].core_id, cur_time);
-        total_cores_time += cur_time;
-    }
+    *tile_y1 = divide_round(image_height * tile_y, tiles_ver);
+    *tile_height = divide_round(image_height * (tile_y + 1), tiles_ver) + overlap_height - *tile_y1;
 
-    fprintf(f, "=============================================\r\n");
-    fprintf(f, "Average cores time: %lf\r\n", total_cores_time / num_cores);
-    fprintf(f, "Total cores time: %lf\r\n", total_cores_time);
+    *tile_x1 = round_to_8n( divide_round(image_width * tile_x, tiles_hor) );
+    *tile_width = (tile_x + 1 == tiles_hor ?
+                   image_width + overlap_width :
+                   round_to_8n( divide_round(image_width * (tile_x + 1), tiles_hor) ) + overlap_width) - *tile_x1;
 
-    fclose(f);
+    return round_up_to_8n(*tile_width);
 }
 
 /**
@@ -1428,9 +2376,11 @@ static void time_log(
  * @param window_width : detection window width;
  * @param window_height: detection window height;
  * @param task_buf     : task list;
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY if image cannot be split into tiles fitting in MAX_TILE_BYTES or memory allocation fails.
  */
 
-static void add_tasks_for_image(
+static EpErrorCode add_tasks_for_image(
         EpScanMode   const scan_mode,
         EpImgList  * const img_list,
         int          const img_index,
@@ -1466,7 +2416,7 @@ static void add_tasks_for_image(
         //Maximal allowed tile step to not exceed max_tile_area
         int const max_tile_step = round_down_to_8n( round_down_to_8n(MAX_TILE_BYTES / max_tile_height) - overlap_width) + overlap_width;
 
-        tiles_hor = divide_up(image_width, max_tile_step - overlap_width);
+        tiles_hor = max_tile_step > overlap_width ? divide_up(image_width, max_tile_step - overlap_width) : image_width;
     } else {
         tiles_hor = divide_round(image_width, RECOMMENDED_TILE_SIZE - overlap_width);
         if(!tiles_hor) tiles_hor = 1;
@@ -1477,29 +2427,42 @@ static void add_tasks_for_image(
         //Maximal allowed tile height to not exceed max_tile_area
         int const tile_height = MAX_TILE_BYTES / max_tile_step;
 
-        tiles_ver = divide_up(image_height, tile_height - overlap_height);
+        tiles_ver = tile_height > overlap_height ? divide_up(image_height, tile_height - overlap_height) : image_height;
     }
-    const int num_tiles = tiles_hor * tiles_ver;
-
-    for(int tile_index = 0; tile_index < num_tiles; ++tile_index) {
-            int const tile_y = tile_index / tiles_hor,
-                      tile_y1 = divide_round(image_height *  tile_y     , tiles_ver),
-                      tile_y2 = divide_round(image_height * (tile_y + 1), tiles_ver) + overlap_height;
 
-            int const tile_height = tile_y2 - tile_y1;
-
-            int const tile_x = tile_index % tiles_hor,
-                      tile_x1 = round_to_8n( divide_round(image_width *  tile_x     , tiles_hor) ),
-                      tile_x2 = tile_x + 1 == tiles_hor ?
-                                image_width + overlap_width :
-                                round_to_8n( divide_round(image_width * (tile_x + 1), tiles_hor) ) + overlap_width;
+    //Rounding of tile edges to 8 pixels may make some tiles larger than planned; then more tiles are used
+    for(;;) {
+        int max_step = 0, max_height = 0, fits = 1;
+        for(int tile_index = 0; tile_index < tiles_hor * tiles_ver; ++tile_index) {
+            int tile_x1, tile_y1, tile_width, tile_height;
+            int const tile_step = tile_geometry(image_width, image_height, overlap_width, overlap_height, tiles_hor, tiles_ver,
+                                                tile_index, &tile_x1, &tile_y1, &tile_width, &tile_height);
+            if(tile_step * tile_height > MAX_TILE_BYTES) fits = 0;
+            if(tile_step   > max_step  ) max_step   = tile_step;
+            if(tile_height > max_height) max_height = tile_height;
+        }
+        if(fits) break;
+
+        //The larger side of tiles is split further; tiles narrower than 8 pixels or lower than 1 pixel are not possible
+        int const more_hor = max_step - overlap_width >= max_height - overlap_height;
+        if(more_hor && 8 * (tiles_hor + 1) <= image_width)
+            ++tiles_hor;
+        else if(tiles_ver + 1 <= image_height)
+            ++tiles_ver;
+        else if(8 * (tiles_hor + 1) <= image_width)
+            ++tiles_hor;
+        else
+            return ERR_MEMORY; //Window is too large for tile slot
+    }
 
-            int const tile_width = tile_x2 - tile_x1,
-                      tile_step  = round_up_to_8n(tile_width);
+    const int num_tiles = tiles_hor * tiles_ver;
 
-            assert(tile_step * tile_height <= MAX_TILE_BYTES);
+    for(int tile_index = 0; tile_index < num_tiles; ++tile_index) {
+            int tile_x1, tile_y1, tile_width, tile_height;
+            int const tile_step = tile_geometry(image_width, image_height, overlap_width, overlap_height, tiles_hor, tiles_ver,
+                                                tile_index, &tile_x1, &tile_y1, &tile_width, &tile_height);
 
-            ep_task_list_add (
+            EpErrorCode const result = ep_task_list_add (
                 task_buf,
                 tile_x1 + tile_y1 * img_prop->step,
                 tile_width,
@@ -1509,326 +2472,1477 @@ static void add_tasks_for_image(
                 0,
                 img_index
             );
+            if(result != ERR_SUCCESS)
+                return result;
     }
+
+    return ERR_SUCCESS;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//                          DEVICE SESSION FUNCTIONS                          //
+////////////////////////////////////////////////////////////////////////////////
+
 /**
- * Multiscale object detection
- *
- * Image is iteratively scaled down until it became less than native object size.
- * On each scale detection is performed.
- *
- * @param image     : Image to process (pointer to valid image structure).
- * @param classifier: Classifier to use (pointer to valid classifier structure).
- * @param objects   : Detections will be added to this list (pointer to valid rectangles list structure).
- * @param scan_mode : Which image pixels to test; @see EpScanMode.
- * @param num_cores : Number of cores in cores list.
- * @param log_file  : Name of log file. Pass NULL to disable log file and debug output.
- *
- * @return ERR_SUCCESS: successful detection;
- *         ERR_ARGUMENT: empty image, or invalid classifier, or unknown detection_mode, or unknown scan_mode.
- *         ERR_MEMORY: cannot allocate required memory (memory checks are not implemented yet).
- *         ERR_OTHER: classifier is too large and cannot be uploaded to core.
+ * Frame held in one of shared buffer slots
  */
-EpErrorCode ep_detect_multi_scale_device (
-    EpImage                   *const image,
+typedef struct {
+    /// Non-zero if frame is submitted and its results are not collected yet
+    int busy;
+    /// Properties of images in shared buffer
+    EpImgList imgs;
+    /// Non-zero if pyramid and tasks of the frame take the whole images buffer; such frame is not pipelined
+    int whole_imgs_buf;
+    /// Tasks of the frame; receive detections when frame is collected
+    EpTaskList tasks;
+    /// Offsets of device tasks and their traces in images buffer (@see EpControlInfo::tasks_offset)
+    int tasks_offset, traces_offset;
+    /// Offset of levels 7/8, 6/8, 5/8 (@see scale8765)
+    int offset_x, offset_y;
+    /// Time of pyramid building in microseconds
+    double time_scale;
+    /// Bytes written to shared memory for the frame (@see EpDetectStats)
+    double bytes_to_device;
+    /// Time when cores got start tokens
+    int64 time_start;
+    /// Number of tasks processed by cores; the rest of tasks is processed by host (DET_HYBRID)
+    int device_count;
+    /// Predicted cost of host and device parts of tasks (@see EpCostModel)
+    double host_cost, device_cost;
+} EpDeviceFrame;
+
+/**
+ * Opened workgroup with classifier uploaded to shared memory
+ */
+struct EpDeviceSession {
+    /// eSDK handles
+    ep_context_t e;
+    /// Number of cores started for every frame
+    int cores_count;
+    /// Native size of detected objects (taken from classifier)
+    int window_width, window_height;
+    /// Frames held in shared buffer slots
+    EpDeviceFrame frames[DRAM_BUF_SLOTS];
+    /// Slot for the next submitted frame
+    int submit_slot;
+    /// Slot of the oldest frame which is not collected yet
+    int collect_slot;
+    /// Cycles measured for previous frames; used to plan tasks of the next ones
+    EpCostModel cost_model;
+    /// DET_DEVICE or DET_HYBRID
+    EpDetectionMode mode;
+    /// Part of predicted cost given to host threads in DET_HYBRID mode
+    float host_share;
+    /// Host copy of classifier for host part of tasks
+    EpCascadeClassifier classifier;
+};
+
+/// Offset of field of EpDRAMBuf in given slot of shared buffer
+#define SLOT_OFFSET(slot, field) ( offsetof(EpSharedMemory, slots) + (slot) * sizeof(EpDRAMBuf) + offsetof(EpDRAMBuf, field) )
+
+/// Offset of images buffer in shared buffer
+#define IMGS_OFFSET offsetof(EpSharedMemory, imgs_buf)
+
+/// Workgroup and shared buffer are process-wide, so only one session may be opened at a time
+static int device_session_opened = 0;
+
+/**
+ * Close resident part or page of paged cascade: append NODE_FINAL and align next part for DMA.
+ * @param buf : cascade layout;
+ * @param size: size of layout so far.
+ * @return new size of layout.
+ */
+static int device_cascade_close_part(char *const buf, int const size) {
+    EpNodeFinal const final_node = {NODE_FINAL};
+    memcpy(buf + size, &final_node, sizeof(EpNodeFinal));
+    return round_up_to_8n( size + sizeof(EpNodeFinal) );
+}
+
+/**
+ * Lay out compact classifier larger than core memory for shared memory (@see EpCascadePaging).
+ *   Every part gets its own header and copies of subset tables its stages refer to.
+ * @param classifier: valid compact classifier;
+ * @param buf       : receives layout (MAX_CASCADE_BYTES zeroed bytes);
+ * @param paging    : receives description of layout (zeroed).
+ * @return size of layout in bytes; zero if cascade is too large or one of its stages does not fit in a page.
+ */
+static int device_cascade_layout_compact (
     EpCascadeClassifier const *const classifier,
-    EpRectList                *const objects,
-    EpScanMode                 const scan_mode,
-    int                        const num_cores,
-    char                const *const log_file
+    char                      *const buf,
+    EpCascadePaging           *const paging
 ) {
-    if( ep_classifier_check(classifier) )
-        return ERR_ARGUMENT; //Wrong classifier
+    EpCompactPart const *const source_part = (EpCompactPart const *)(classifier->data + sizeof(EpCompactMeta));
+    int const subsets_count = source_part->subsets_count;
+    int const (*const subsets)[8] = (int const (*)[8])(source_part + 1);
+    EpCompactStage const *stage = (EpCompactStage const *)(subsets + subsets_count);
+
+    //Index of subset table in current part, and number of part (plus one) it was marked for
+    int *const part_subsets = (int *)malloc( subsets_count * sizeof(int) );
+    int *const subset_marks = (int *)calloc( subsets_count, sizeof(int) );
+    //Subset tables of current part in order of their indices in it
+    int *const part_order = (int *)malloc( subsets_count * sizeof(int) );
+    if(!part_subsets || !subset_marks || !part_order) {
+        free(part_subsets);
+        free(subset_marks);
+        free(part_order);
+        return 0;
+    }
 
-    if( ep_image_is_empty(image) )
-        return ERR_ARGUMENT; //Wrong image
+    memcpy(buf, classifier->data, sizeof(EpCompactMeta));
+    int size = sizeof(EpCompactMeta);
+
+    for(int part_index = 0; stage->decisions_count && size; ++part_index) {
+        int const part_limit = part_index ? CASCADE_PAGE_BYTES : MAX_RESIDENT_BYTES - (int)sizeof(EpCompactMeta);
+        int const mark = part_index + 1;
+        int part_subsets_count = 0, part_bytes = sizeof(EpCompactPart) + sizeof(EpCompactStage);
+        EpCompactStage const *const part_begin = stage;
+
+        //Whole stages are added while part fits; subset tables new for the part are counted first
+        while(stage->decisions_count) {
+            EpCompactDecision const *const decisions = (EpCompactDecision const *)(stage + 1);
+            int const decisions_count = stage->decisions_count;
+
+            int new_subsets = 0;
+            for(int i = 0; i < decisions_count; ++i) {
+                int const subset = decisions[i].subset;
+                if(subset_marks[subset] != mark && subset_marks[subset] != -mark) {
+                    subset_marks[subset] = -mark;
+                    ++new_subsets;
+                }
+            }
 
-    int const window_width = ((EpNodeMeta const *)classifier->data)->window_width ,
-             window_height = ((EpNodeMeta const *)classifier->data)->window_height;
+            int const stage_bytes = new_subsets * sizeof(int[8]) +
+                sizeof(EpCompactStage) + decisions_count * sizeof(EpCompactDecision);
+            if(part_bytes + stage_bytes > part_limit)
+                break;
+
+            for(int i = 0; i < decisions_count; ++i) {
+                int const subset = decisions[i].subset;
+                if(subset_marks[subset] == -mark) {
+                    subset_marks[subset] = mark;
+                    part_subsets[subset] = part_subsets_count;
+                    part_order[part_subsets_count++] = subset;
+                }
+            }
 
-    if(image->width < window_width || image->height < window_height)
-        return ERR_SUCCESS; //Image is too small; no detections
+            part_bytes += stage_bytes;
+            stage = (EpCompactStage const *)(decisions + decisions_count);
+        }
 
-    int const blocks_x = image->width  / 8,
-              blocks_y = image->height / 8;
+        if( stage == part_begin || part_index > MAX_CASCADE_PAGES || size + part_bytes > MAX_CASCADE_BYTES ) {
+            size = 0; //Stage does not fit even in empty part, or too many pages, or cascade is too large
+            break;
+        }
 
-    EpImage img8 = *image;
-    EpImage img7 = ep_image_create(blocks_x * 7, blocks_y * 7);
-    EpImage img6 = ep_image_create(blocks_x * 6, blocks_y * 6);
-    EpImage img5 = ep_image_create(blocks_x * 5, blocks_y * 5);
+        if(part_index)
+            paging->page_offsets[part_index - 1] = size;
+
+        EpCompactPart *const part = (EpCompactPart *)(buf + size);
+        part->subsets_count = part_subsets_count;
+        int (*const out_subsets)[8] = (int (*)[8])(part + 1);
+        for(int i = 0; i < part_subsets_count; ++i)
+            memcpy(out_subsets[i], subsets[part_order[i]], sizeof(int[8]));
+
+        EpCompactDecision *out = (EpCompactDecision *)(out_subsets + part_subsets_count);
+        for(EpCompactStage const *cur = part_begin; cur != stage; ) {
+            EpCompactDecision const *const decisions = (EpCompactDecision const *)(cur + 1);
+            int const decisions_count = cur->decisions_count;
+
+            memcpy(out, cur, sizeof(EpCompactStage));
+            EpCompactDecision *const out_decisions = (EpCompactDecision *)((EpCompactStage *)out + 1);
+            for(int i = 0; i < decisions_count; ++i) {
+                out_decisions[i] = decisions[i];
+                out_decisions[i].subset = part_subsets[decisions[i].subset];
+            }
 
-    *image = ep_image_create_empty();
+            out = out_decisions + decisions_count;
+            cur = (EpCompactStage const *)(decisions + decisions_count);
+        }
+        //Terminating stage is left zeroed
 
-    double time_scale = 0.0;
-    int64 time_start_scale = cvGetTickCount();
-    int offset_x, offset_y;
-    scale8765(&img8, &img7, &img6, &img5, &offset_x, &offset_y);
-    time_scale += (cvGetTickCount() - time_start_scale) / cvGetTickFrequency();
+        size += part_bytes;
+        if(part_index)
+            paging->page_offsets[paging->pages_count = part_index] = size;
+        else
+            paging->resident_bytes = size;
+    }
 
+    free(part_subsets);
+    free(subset_marks);
+    free(part_order);
+    return size;
+}
 
+/**
+ * Lay out classifier for shared memory (@see EpCascadePaging). Cascade which fits
+ *   in core memory is copied as is. Otherwise whole stages go to the resident part
+ *   while it fits in MAX_RESIDENT_BYTES, and the rest are packed in pages of CASCADE_PAGE_BYTES.
+ * @param classifier: valid classifier;
+ * @param buf       : receives layout (MAX_CASCADE_BYTES zeroed bytes);
+ * @param paging    : receives description of layout.
+ * @return size of layout in bytes; zero if cascade is too large or one of its stages does not fit in a page.
+ */
+static int device_cascade_layout (
+    EpCascadeClassifier const *const classifier,
+    char                      *const buf,
+    EpCascadePaging           *const paging
+) {
+    memset(paging, 0, sizeof(EpCascadePaging));
 
+    if(classifier->size <= MAX_CLASSIFIER_BYTES) {
+        memcpy(buf, classifier->data, classifier->size);
+        paging->resident_bytes = round_up_to_8n(classifier->size);
+        return paging->resident_bytes;
+    }
 
+    if( ep_classifier_is_compact(classifier) )
+        return device_cascade_layout_compact(classifier, buf, paging);
 
-	/*
-	\D4\F6\BC\D3\C6\F4\B6\AF\B6\E0\BA\CB
-	*/
-	static ep_context_t ee;
-	ep_context_t *e = NULL;
-	e = &ee;
-	e_init(NULL);
-	e_reset_system();
-	e_get_platform_info(&e->eplat);
-	e_alloc(&e->emem, BUF_OFFSET, sizeof(EpDRAMBuf));
-	
-	e_open(&e->edev, 0, 0, ROWS, COLS);
+    memcpy(buf, classifier->data, sizeof(EpNodeMeta));
+    int size = sizeof(EpNodeMeta);
+    int part_start = 0, part_limit = MAX_RESIDENT_BYTES;
 
-	printf("load srec! ROWS=%d, COLS=%d\n", ROWS, COLS);
+    char const *node = classifier->data + sizeof(EpNodeMeta);
+    char const *const nodes_end = classifier->data + classifier->size - sizeof(EpNodeFinal);
 
-	if (e_load_group("epiphany.elf", &e->edev, 0, 0, ROWS, COLS, E_FALSE) == E_ERR)
-	//if (e_load("epiphany.srec", &e->edev, 0, 0, E_TRUE) == E_ERR)
-	{
-		perror("e_load failed");
-		return -1;
-	}
+    while(node < nodes_end) {
+        char const *stage_end = node;
+        while(*(int const *)stage_end != NODE_STAGE)
+            stage_end += *(int const *)stage_end == NODE_DECISION ? sizeof(EpNodeDecision) : sizeof(EpNodeBound);
+        stage_end += sizeof(EpNodeStage);
+        int const stage_bytes = stage_end - node;
 
+        if( round_up_to_8n(size - part_start + stage_bytes + sizeof(EpNodeFinal)) > part_limit ) {
+            if(size == part_start || paging->pages_count == MAX_CASCADE_PAGES)
+                return 0; //Stage does not fit even in empty part, or too many pages
 
-    	// wake-up eCore
-/*
-	int row, col;
-	for (row = 0; row < ROWS; row++)
-	{
-		for (col = 0; col < COLS; col++)
-		{
-			e_resume(&e->edev, row, col);
-		}
-	}
-*/
+            size = device_cascade_close_part(buf, size);
+            if(part_start)
+                ++paging->pages_count;
+            else
+                paging->resident_bytes = size;
+
+            part_start = size;
+            part_limit = CASCADE_PAGE_BYTES;
+            paging->page_offsets[paging->pages_count] = size;
+        }
 
+        if( round_up_to_8n(size + stage_bytes + sizeof(EpNodeFinal)) > MAX_CASCADE_BYTES )
+            return 0;
 
+        memcpy(buf + size, node, stage_bytes);
+        size += stage_bytes;
+        node = stage_end;
+    }
 
+    size = device_cascade_close_part(buf, size);
+    if(part_start)
+        paging->page_offsets[++paging->pages_count] = size;
+    else
+        paging->resident_bytes = size;
 
-    // 1 - build shared memory buffer
-    //    1.1 - copy images, build images properties
-    EpImgList imgs = ep_img_list_create_empty(0);
+    return size;
+}
 
-    if(log_file) printf("WRITING DATA TO SHARED MEMORY\n");
+/**
+ * Wait until all cores are idle with given slot: all tasks are finished (@see EpTaskRange),
+ *   all start tokens are taken and all started cores have reported their timers.
+ * After that slot may be safely rewritten by host.
+ * Control info is polled with exponentially growing sleeps in between, so that
+ *   waiting host thread does not steal ARM time from the rest of pipeline.
+ *
+ * @param session   : opened session;
+ * @param slot      : slot of shared buffer;
+ * @param task_count: number of tasks of the frame in slot.
+ */
+static void device_session_wait(EpDeviceSession *const session, int const slot, int const task_count) {
+    unsigned int const min_delay = 16, max_delay = 1024; //microseconds
+    unsigned int delay = min_delay;
+    int const cores_count = session->cores_count;
+    EpControlInfo control_info;
+    EpTaskRange ranges[MAX_CORES_NUM];
 
-    int data_amount;
     while(1) {
-        if(img8.width < window_width || img8.height < window_height) break;
-        ep_img_list_add(&imgs, img8.step, img8.width, img8.height);
-        if(log_file) { printf("Sending image %dx%d...", img8.width, img8.height); fflush(stdout); }
-printf("write!\n");
-		data_amount = e_write(&e->emem, 0, 0, offsetof(EpDRAMBuf, imgs_buf) + imgs.prev_offset, img8.data, img8.step * img8.height);
-printf("write1\n");
-        if(log_file) printf(" Image sent: %d bytes.\n", data_amount);
+        e_read(&session->e.emem, 0, 0, SLOT_OFFSET(slot, control_info), &control_info, sizeof(EpControlInfo));
+        e_read(&session->e.emem, 0, 0, SLOT_OFFSET(slot, task_ranges), ranges, sizeof(EpTaskRange) * cores_count);
 
-        if(img7.width < window_width || img7.height < window_height) break;
-        ep_img_list_add(&imgs, img7.step, img7.width, img7.height);
-        if(log_file) { printf("Sending image %dx%d...", img7.width, img7.height); fflush(stdout); }
-printf("write!\n");
-		data_amount = e_write(&e->emem, 0, 0,  offsetof(EpDRAMBuf, imgs_buf) + imgs.prev_offset, img7.data, img7.step * img7.height);
-printf("write2\n");
-        if(log_file) printf(" Image sent: %d bytes.\n", data_amount);
+        //Every core counts tasks it has finished
+        int task_finished = 0;
+        for(int i = 0; i < cores_count; ++i)
+            task_finished += ranges[i].finished;
 
-        if(img6.width < window_width || img6.height < window_height) break;
-        ep_img_list_add(&imgs, img6.step, img6.width, img6.height);
-        if(log_file) { printf("Sending image %dx%d...", img6.width, img6.height); fflush(stdout); }
-printf("write!\n");
-		data_amount = e_write(&e->emem, 0, 0, offsetof(EpDRAMBuf, imgs_buf) + imgs.prev_offset, img6.data, img6.step * img6.height);
-printf("write3\n");
-        if(log_file) printf(" Image sent: %d bytes.\n", data_amount);
-
-        if(img5.width < window_width || img5.height < window_height) break;
-        ep_img_list_add(&imgs, img5.step, img5.width, img5.height);
-        if(log_file) { printf("Sending image %dx%d...", img5.width, img5.height); fflush(stdout); }
-printf("write!\n");
-		data_amount = e_write(&e->emem, 0, 0,offsetof(EpDRAMBuf, imgs_buf) + imgs.prev_offset, img5.data, img5.step * img5.height);
-printf("write4\n");
-        if(log_file) printf(" Image sent: %d bytes.\n", data_amount);
+        if( task_finished             == task_count &&
+            control_info.start_cores  == 0          &&
+            control_info.timer_index  == cores_count )
+            break;
 
-        time_start_scale = cvGetTickCount();
-        scale21_realloc(&img8);
-        scale21_realloc(&img7);
-        scale21_realloc(&img6);
-        scale21_realloc(&img5);
-        time_scale += (cvGetTickCount() - time_start_scale) / cvGetTickFrequency();
+        usleep(delay);
+        if(delay < max_delay)
+            delay *= 2;
     }
+}
+
+/**
+ * Free slot of collected or failed frame. Lists keep their memory for the next frames of the slot.
+ */
+static void device_frame_release(EpDeviceFrame *const frame) {
+    frame->tasks.count = 0;
+    frame->imgs.count = frame->imgs.cur_offset = frame->imgs.prev_offset = 0;
+    frame->whole_imgs_buf = 0;
+    frame->busy = 0;
+}
 
-    if(log_file) { printf("Sending image properties..."); fflush(stdout); }
-printf("write!\n");
-	data_amount = e_write(&e->emem, 0, 0,offsetof(EpDRAMBuf, imgs_prop), imgs.data, imgs.count * sizeof(EpImageProp));
-printf("write5\n");
-    if(log_file) printf(" Data sent: %d bytes.\n", data_amount);
+/**
+ * Place device tasks of the frame and their traces in images buffer right after its pyramid.
+ * @param imgs_end: offset task traces must end at or before;
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY if tasks do not fit before imgs_end.
+ */
+static EpErrorCode device_frame_place_tasks(EpDeviceFrame *const frame, int const imgs_end) {
+    frame->tasks_offset  = round_up_to_8n(frame->imgs.cur_offset);
+    frame->traces_offset = frame->tasks_offset + frame->device_count * sizeof(EpTaskItem);
+    return frame->traces_offset + frame->device_count * (int)sizeof(EpTaskTrace) <= imgs_end ? ERR_SUCCESS : ERR_MEMORY;
+}
 
-    //    1.2 - copy classifier
-    if(log_file) { printf("Sending classifier..."); fflush(stdout); }
-printf("write!\n");
-	data_amount = e_write(&e->emem, 0, 0, offsetof(EpDRAMBuf, buf_classifier), classifier->data, round_up_to_8n(classifier->size));
-printf("write6\n");
-    if(log_file) printf(" Classifier sent: %d bytes.\n", data_amount);
+/**
+ * Add phases of device tasks of collected frame to trace (@see EpTaskTrace).
+ *   Core clocks are started when cores take start tokens, so they are aligned with frame->time_start.
+ */
+static void device_frame_trace (
+    EpDeviceSession     *const session,
+    EpDeviceFrame const *const frame
+) {
+    EpTaskTrace *const traces = (EpTaskTrace *)malloc( sizeof(EpTaskTrace) * frame->device_count );
+    if(!traces)
+        return;
+
+    e_read(&session->e.emem, 0, 0, IMGS_OFFSET + frame->traces_offset, traces, sizeof(EpTaskTrace) * frame->device_count);
+
+    double const origin = ep_trace_time(frame->time_start);
+    double const ticks_per_us = CORE_FREQUENCY;
+
+    for(int i = 0; i < frame->device_count; ++i) {
+        EpTaskTrace const *const t = traces + i;
+        int const core = t->core_id;
+        int const level = frame->tasks.data[i].image_index;
+
+        ep_trace_span("claim", "device", TRACE_PID_DEVICE, core,
+                      origin + t->claim_start / ticks_per_us, origin + t->claim_end / ticks_per_us, "task", i);
+        ep_trace_span("dma-in", "dma", TRACE_PID_DEVICE, core + TRACE_TID_DMA,
+                      origin + t->claim_end / ticks_per_us, origin + t->wait_end / ticks_per_us, "level", level);
+        if(t->wait_end > t->wait_start)
+            ep_trace_span("dma stall", "dma", TRACE_PID_DEVICE, core,
+                          origin + t->wait_start / ticks_per_us, origin + t->wait_end / ticks_per_us, "level", level);
+        ep_trace_span("classify", "device", TRACE_PID_DEVICE, core,
+                      origin + t->classify_start / ticks_per_us, origin + t->classify_end / ticks_per_us, "level", level);
+        ep_trace_span("write-back", "device", TRACE_PID_DEVICE, core,
+                      origin + t->classify_end / ticks_per_us, origin + t->write_end / ticks_per_us, "task", i);
+    }
 
-    //    1.3 - build task list
-    EpTaskList tasks = ep_task_list_create_empty();
+    free(traces);
+}
 
-    for(int i = 0; i < imgs.count; ++i)
-        add_tasks_for_image(scan_mode, &imgs, i, window_width, window_height, &tasks);
+/**
+ * Process host part of tasks of the frame (tasks after frame->device_count) by host threads.
+ *   Shared memory is not cached on host, so every tile is copied from shared images buffer
+ *   to host memory (it fits in MAX_TILE_BYTES as tiles of cores do) before it is scanned.
+ *   Host and cores do not share task ranges: cores lock ranges with mutexes in core memory,
+ *   which host cannot take, so host part is fixed when frame is submitted
+ *   (@see ep_task_list_route_hybrid) and balanced between frames by host_share.
+ * @return time spent in microseconds
+ */
+static double device_frame_detect_host (
+    EpDeviceSession const *const session,
+    EpDeviceFrame         *const frame,
+    EpRectList            *const objects,
+    EpDetectStats         *const stats
+) {
+    int64 const time_start = cvGetTickCount();
 
-    EpControlInfo control_info = {tasks.count, 0, 0, num_cores, 0};
+    unsigned char *const imgs_buf = (unsigned char *)session->e.emem.base + IMGS_OFFSET;
 
-    if(log_file) { printf("Sending task list..."); fflush(stdout); }
-	data_amount = e_write(&e->emem, 0, 0, offsetof(EpDRAMBuf, tasks), tasks.data, tasks.count * sizeof(EpTaskItem));
-    if(log_file) printf(" Task list sent: %u bytes.\n", data_amount);
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = frame->device_count; i < frame->tasks.count; ++i) {
+        EpTaskItem *const task = frame->tasks.data + i;
+        EpImageProp const *const img_prop = frame->imgs.data + task->image_index;
+        EpImage const level = { imgs_buf + img_prop->data_offset, img_prop->width, img_prop->height, img_prop->step };
+
+        unsigned char tile_buf[MAX_TILE_BYTES];
+        EpImage const tile = { tile_buf, task->width, task->height, task->step };
+        for(int y = 0; y < task->height; ++y)
+            memcpy(tile_buf + y * task->step, level.data + task->offset + y * level.step, task->width);
+
+        EpHostCascade const cascade = host_cascade(session->classifier.data, objects);
+
+        detect_tile_host (
+            &level,
+            &tile,
+            &cascade,
+            1,
+            task,
+            session->window_width,
+            session->window_height,
+            convert_image_index_to_scale(task->image_index),
+            frame->offset_x,
+            frame->offset_y,
+            level_stats(stats, task->image_index)
+        );
+    }
 
-    if(log_file) { printf("Sending control flags..."); fflush(stdout); }
-	data_amount = e_write(&e->emem, 0, 0, offsetof(EpDRAMBuf, control_info), &control_info, sizeof(EpControlInfo));
-    if(log_file) printf(" Data sent: %u bytes.\n", data_amount);
+    return (cvGetTickCount() - time_start) / cvGetTickFrequency();
+}
 
-    
+/**
+ * Move host share of hybrid session towards equal finish time of host and cores.
+ * @param host_time  : time host threads spent on the frame in microseconds;
+ * @param device_time: time of the busiest core in microseconds.
+ */
+static void device_session_update_share (
+    EpDeviceSession     *const session,
+    EpDeviceFrame const *const frame,
+    double               const host_time,
+    double               const device_time
+) {
+    if(frame->host_cost <= 0.0 || frame->device_cost <= 0.0 || host_time <= 0.0 || device_time <= 0.0)
+        return; //One of the parts was not measured
 
+    double const host_rate   = frame->host_cost   / host_time,
+                 device_rate = frame->device_cost / device_time;
 
+    session->host_share = 0.5f * ( session->host_share + (float)( host_rate / (host_rate + device_rate) ) );
+}
 
+/**
+ * Plan image scale pyramid in shared images buffer (@see build_pyramid_shared).
+ *   Levels go in order 8/8, 7/8, 6/8, 5/8 of the image, then the same levels
+ *   halved and so on until level becomes smaller than detection window.
+ *
+ * @param image        : source image;
+ * @param window_width : detection window width;
+ * @param window_height: detection window height;
+ * @param imgs_offset  : offset of the first level in EpSharedMemory::imgs_buf;
+ * @param imgs_end     : offset pyramid must end at or before;
+ * @param imgs         : receives properties of levels (must be empty).
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY if pyramid does not fit in given part of buffer or memory allocation fails.
+ */
+static EpErrorCode plan_pyramid_shared (
+    EpImage const *const image,
+    int            const window_width,
+    int            const window_height,
+    int            const imgs_offset,
+    int            const imgs_end,
+    EpImgList     *const imgs
+) {
+    int const blocks_x = image->width  / 8,
+              blocks_y = image->height / 8;
 
+    int width [4] = {image->width , blocks_x * 7, blocks_x * 6, blocks_x * 5},
+        height[4] = {image->height, blocks_y * 7, blocks_y * 6, blocks_y * 5};
 
+    imgs->count = 0;
+    imgs->cur_offset = imgs->prev_offset = imgs_offset;
 
+    for(int i = 0; ; ++i) {
+        int const k = i & 3;
+        if(i > 3) {
+            width [k] /= 2;
+            height[k] /= 2;
+        }
+        if(width[k] < window_width || height[k] < window_height)
+            break;
 
+        int const step = round_up_to_8n(width[k]);
+        if(imgs->count == MAX_IMGS_COUNT || imgs->cur_offset + step * height[k] > imgs_end)
+            return ERR_MEMORY; //Pyramid does not fit in shared buffer
+        if( ep_img_list_add(imgs, step, width[k], height[k]) )
+            return ERR_MEMORY;
+    }
 
+    return ERR_SUCCESS;
+}
 
+/**
+ * Build image scale pyramid planned by plan_pyramid_shared() directly in shared images buffer.
+ *
+ * @param image   : source image (not modified);
+ * @param imgs_buf: host address of EpSharedMemory::imgs_buf;
+ * @param imgs    : properties of planned levels;
+ * @param offs_x  : receives horizontal offset of levels 7/8, 6/8, 5/8 (@see scale8765);
+ * @param offs_y  : receives vertical offset of levels 7/8, 6/8, 5/8.
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY if memory allocation fails.
+ */
+static EpErrorCode build_pyramid_shared (
+    EpImage   const *const image,
+    unsigned char   *const imgs_buf,
+    EpImgList const *const imgs,
+    int             *const offs_x,
+    int             *const offs_y
+) {
+    int const blocks_x = image->width  / 8,
+              blocks_y = image->height / 8;
 
+    EpImage levels[MAX_IMGS_COUNT];
 
+    //    1 - levels at their planned offsets in shared buffer
+    for(int i = 0; i < imgs->count; ++i) {
+        EpImageProp const *const prop = imgs->data + i;
+        EpImage const level = {imgs_buf + prop->data_offset, prop->width, prop->height, prop->step};
+        levels[i] = level;
+    }
 
+    //    2 - first octave; levels too small for detection are built in temporary buffers
+    double trace_start = ep_trace_now();
+    unsigned char const *source_pixels = image->data;
+    unsigned char *result_pixels = levels[0].data;
+    for(int line = 0; line < image->height; ++line) {
+        memcpy(result_pixels, source_pixels, image->width);
+        result_pixels += levels[0].step;
+        source_pixels += image->step;
+    }
+    ep_trace_span("copy", "pyramid", TRACE_PID_HOST, 0, trace_start, ep_trace_now(), "level", 0);
+
+    for(int k = 1; k < 4; ++k) {
+        if(k < imgs->count) continue;
+        levels[k] = ep_image_create(blocks_x * (8 - k), blocks_y * (8 - k));
+        if( ep_image_is_empty(&levels[k]) ) {
+            for(int j = imgs->count; j < k; ++j)
+                ep_image_release(&levels[j]);
+            return ERR_MEMORY;
+        }
+    }
 
-if(log_file) { printf("WAITING FOR CORES TO FINISH..."); fflush(stdout); }
+    trace_start = ep_trace_now();
+    scale8765(levels, levels + 1, levels + 2, levels + 3, offs_x, offs_y);
+    ep_trace_span("scale8765", "pyramid", TRACE_PID_HOST, 0, trace_start, ep_trace_now(), NULL, 0);
 
+    for(int k = imgs->count; k < 4; ++k)
+        ep_image_release(&levels[k]);
 
-    // 2 - wait end of detection
-    
-        e_read(&e->emem, 0, 0, offsetof(EpDRAMBuf, control_info), &control_info, sizeof(EpControlInfo));
-        printf("unused: %d, start_cores: %d, task_finished: %d, tasks.count: %d\n",control_info.unused, control_info.start_cores, control_info.task_finished,tasks.count); 
-	//e_start(&e->edev, 0, 0);
-	e_start_group(&e->edev);
-	int64 const time_start_waiting = cvGetTickCount();
-#ifndef DEVICE_EMULATION
-    while(1) {
-        e_read(&e->emem, 0, 0, offsetof(EpDRAMBuf, control_info), &control_info, sizeof(EpControlInfo));
-        if(control_info.task_finished == tasks.count)
-            break;
-        //printf("unused: %d, start_cores: %d, task_finished: %d, tasks.count: %d\n",control_info.unused, control_info.start_cores, control_info.task_finished,tasks.count); 
-        //sleep(1);
+    //    3 - next octaves are halved levels of previous ones
+    for(int i = 4; i < imgs->count; ++i) {
+        trace_start = ep_trace_now();
+        scale21(levels + i - 4, levels + i);
+        ep_trace_span("scale21", "pyramid", TRACE_PID_HOST, 0, trace_start, ep_trace_now(), "level", i);
     }
-#else //DEVICE_EMULATION
-    device_process_tasks();
-#endif//DEVICE_EMULATION
 
-    double const wait_time = (cvGetTickCount() - time_start_waiting) / cvGetTickFrequency();
-
-    if(log_file) printf(" CORES FINISHED IN %lf SECONDS.\n", wait_time / 1000000);
+    return ERR_SUCCESS;
+}
 
-    if(log_file) { printf("Downloading results..."); fflush(stdout); }
-    // 3 - download result and analyze detections
-	data_amount = e_read(&e->emem, 0, 0, offsetof(EpDRAMBuf, tasks), tasks.data, sizeof(EpTaskItem)* tasks.count);
-    if(log_file) printf(" Results downloaded: %d bytes.\n", data_amount);
-    process_results(objects, &tasks, &imgs, window_width, window_height, offset_x, offset_y);
+EpDeviceSession *ep_device_session_create (
+    EpCascadeClassifier const *const classifier,
+    int                        const num_cores,
+    EpErrorCode               *const error_code
+) {
+    EpErrorCode dummy_error_code;
+    EpErrorCode *const result = error_code ? error_code : &dummy_error_code;
 
-    // 4 - download timers values
-    if(log_file) {
-        printf("Downloading timers..."); fflush(stdout);
-        EpTimerBuf timers[num_cores];
-		data_amount = e_read(&e->emem, 0, 0, offsetof(EpDRAMBuf, timers), timers, sizeof(EpTimerBuf)* num_cores);
-        printf(" Timers downloaded: %d bytes.\n", data_amount);
-        time_log(log_file, time_scale, wait_time, num_cores, timers);
+    if( ep_classifier_check(classifier) || num_cores < 1 ) {
+        *result = ERR_ARGUMENT;
+        return NULL;
     }
 
+    if(device_session_opened) {
+        *result = ERR_OTHER;
+        return NULL;
+    }
 
+    //Cascades larger than core memory are paged (@see EpCascadePaging)
+    char *const cascade_buf = (char *)calloc(1, MAX_CASCADE_BYTES);
+    if(!cascade_buf) {
+        *result = ERR_MEMORY;
+        return NULL;
+    }
 
+    EpCascadePaging cascade_paging;
+    int const cascade_size = device_cascade_layout(classifier, cascade_buf, &cascade_paging);
+    if(!cascade_size) {
+        free(cascade_buf);
+        *result = ERR_OTHER;
+        return NULL;
+    }
 
+    EpDeviceSession *const session = (EpDeviceSession *)calloc( 1, sizeof(EpDeviceSession) );
+    if(!session) {
+        free(cascade_buf);
+        *result = ERR_MEMORY;
+        return NULL;
+    }
 
+    ep_context_t *const e = &session->e;
+    session->cores_count   = num_cores < ROWS * COLS ? num_cores : ROWS * COLS;
+    session->window_width  = ((EpNodeMeta const *)classifier->data)->window_width;
+    session->window_height = ((EpNodeMeta const *)classifier->data)->window_height;
+    session->cost_model    = ep_cost_model_create_empty();
+    session->mode          = DET_DEVICE;
+    session->classifier    = ep_classifier_clone(classifier);
+
+    if( ep_classifier_is_empty(&session->classifier) ) {
+        free(cascade_buf);
+        free(session);
+        *result = ERR_MEMORY;
+        return NULL;
+    }
 
+	e_init(NULL);
+	e_reset_system();
+	e_get_platform_info(&e->eplat);
+	if (e_alloc(&e->emem, BUF_OFFSET, sizeof(EpSharedMemory)) == E_ERR)
+	{
+		e_finalize();
+		ep_classifier_release(&session->classifier);
+		free(cascade_buf);
+		free(session);
+		*result = ERR_MEMORY;
+		return NULL;
+	}
 
+	e_open(&e->edev, 0, 0, ROWS, COLS);
 
-	/*
-	\CAͷ\C5\C4ڴ\E6
-	*/
+	if (e_load_group("epiphany.elf", &e->edev, 0, 0, ROWS, COLS, E_FALSE) == E_ERR)
+	{
+		perror("e_load failed");
+		e_close(&e->edev);
+		e_free(&e->emem);
+		e_finalize();
+		ep_classifier_release(&session->classifier);
+		free(cascade_buf);
+		free(session);
+		*result = ERR_OTHER;
+		return NULL;
+	}
 
+    for(int slot = 0; slot < DRAM_BUF_SLOTS; ++slot) {
+        //Cores are waiting for start tokens from the very beginning, so control info is cleared before start
+        EpControlInfo const control_info = {0, 0, 0, 0, 0, 0, 0, 0};
+		e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, control_info), &control_info, sizeof(EpControlInfo));
 
+        //Classifier is uploaded once per session; cores copy it (or its resident stages) to local memory every time they are started
+		e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, cascade_paging), &cascade_paging, sizeof(EpCascadePaging));
+		e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, buf_classifier), cascade_buf, cascade_size);
+    }
 
+	if (e_start_group(&e->edev) == E_ERR)
+	{
+		e_close(&e->edev);
+		e_free(&e->emem);
+		e_finalize();
+		ep_classifier_release(&session->classifier);
+		free(cascade_buf);
+		free(session);
+		*result = ERR_OTHER;
+		return NULL;
+	}
 
+    free(cascade_buf);
+    device_session_opened = 1;
+    *result = ERR_SUCCESS;
+    return session;
+}
 
-	e_close(&e->edev);
-	e_free(&e->emem);
-	e_finalize();
+EpErrorCode ep_device_session_set_mode (
+    EpDeviceSession           *const session,
+    EpDetectionMode            const mode
+) {
+    if(!session || (mode != DET_DEVICE && mode != DET_HYBRID))
+        return ERR_ARGUMENT;
 
+    //Initial guess: host thread is as fast as core; corrected after every collected frame
+    if(mode == DET_HYBRID && session->mode != DET_HYBRID)
+        session->host_share = (float)omp_get_max_threads() / (omp_get_max_threads() + session->cores_count);
 
+    session->mode = mode;
+    return ERR_SUCCESS;
+}
 
-    ep_task_list_release(&tasks);
-    ep_img_list_release(&imgs);
+EpErrorCode ep_device_session_submit (
+    EpDeviceSession           *const session,
+    EpImage             const *const image,
+    EpScanMode                 const scan_mode
+) {
+    if(!session)
+        return ERR_ARGUMENT; //Session is not opened
 
-    ep_image_release(&img5);
-    ep_image_release(&img6);
-    ep_image_release(&img7);
-    ep_image_release(&img8);
+    if( ep_image_is_empty(image) )
+        return ERR_ARGUMENT; //Wrong image
+
+    int const slot = session->submit_slot;
+    EpDeviceFrame *const frame = session->frames + slot;
+
+    if(frame->busy)
+        return ERR_OTHER; //All slots are in use; the oldest frame must be collected first
+
+    int frames_in_flight = 0;
+    for(int i = 0; i < DRAM_BUF_SLOTS; ++i) {
+        if(session->frames[i].busy && session->frames[i].whole_imgs_buf)
+            return ERR_OTHER; //Frame in flight takes the whole images buffer; it must be collected first
+        frames_in_flight += session->frames[i].busy;
+    }
+
+    int const window_width  = session->window_width ,
+              window_height = session->window_height;
+
+    frame->time_scale = 0.0;
+    frame->bytes_to_device = 0.0;
+    frame->device_count = 0;
+    frame->host_cost = frame->device_cost = 0.0;
+    frame->busy = 1;
+    session->submit_slot = (slot + 1) % DRAM_BUF_SLOTS;
+
+    if(image->width < window_width || image->height < window_height)
+        return ERR_SUCCESS; //Image is too small; no detections; frame without tasks is collected immediately
+
+    ep_context_t *const e = &session->e;
+
+    // 1 - build shared memory buffer
+    //    1.1 - plan images pyramid in part of images buffer given to the slot; larger one takes the whole buffer.
+    EpErrorCode pyramid_result = plan_pyramid_shared (
+        image, window_width, window_height, slot * MAX_SLOT_IMGS_BUF, (slot + 1) * MAX_SLOT_IMGS_BUF, &frame->imgs
+    );
+    if(pyramid_result == ERR_MEMORY) {
+        pyramid_result = plan_pyramid_shared(image, window_width, window_height, 0, MAX_IMGS_BUF, &frame->imgs);
+        frame->whole_imgs_buf = 1;
+    }
+
+    if(pyramid_result != ERR_SUCCESS) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return pyramid_result;
+    }
+
+    //    1.2 - build task list (classifier is already uploaded by ep_device_session_create())
+    double const trace_plan = ep_trace_now();
+    EpErrorCode tasks_result = ERR_SUCCESS;
+    for(int i = 0; i < frame->imgs.count && tasks_result == ERR_SUCCESS; ++i)
+        tasks_result = add_tasks_for_image(scan_mode, &frame->imgs, i, window_width, window_height, &frame->tasks);
+
+    if(tasks_result != ERR_SUCCESS) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return tasks_result;
+    }
+
+    //    1.3 - split hot tiles and order tasks longest-first, so cores finish together
+    EpErrorCode const plan_result = ep_task_list_plan (
+        &frame->tasks, &frame->imgs, &session->cost_model, window_width, window_height, session->cores_count, MAX_TASK_BUF
+    );
+
+    if(plan_result != ERR_SUCCESS) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return plan_result;
+    }
+
+    if(frame->tasks.count > MAX_TASK_BUF) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return ERR_MEMORY; //Task list is too long
+    }
+
+    //    1.4 - in hybrid mode host threads take small levels and the cheapest tasks; they go to the end of list
+    frame->device_count = frame->tasks.count;
+    if( session->mode == DET_HYBRID &&
+        ep_task_list_route_hybrid(&frame->tasks, &frame->imgs, session->host_share, &frame->device_count) != ERR_SUCCESS ) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return ERR_MEMORY;
+    }
+
+    for(int i = 0; i < frame->tasks.count; ++i) {
+        if(i < frame->device_count)
+            frame->device_cost += frame->tasks.data[i].cycles;
+        else
+            frame->host_cost   += frame->tasks.data[i].cycles;
+    }
+
+    //    1.5 - device tasks follow the pyramid; if they do not fit in the slot part, pyramid is moved to the whole buffer.
+    //          Tasks refer to levels by index and offset within level, so they stay valid.
+    pyramid_result = device_frame_place_tasks(frame, frame->whole_imgs_buf ? MAX_IMGS_BUF : (slot + 1) * MAX_SLOT_IMGS_BUF);
+    if(pyramid_result == ERR_MEMORY && !frame->whole_imgs_buf) {
+        pyramid_result = plan_pyramid_shared(image, window_width, window_height, 0, MAX_IMGS_BUF, &frame->imgs);
+        frame->whole_imgs_buf = 1;
+        if(pyramid_result == ERR_SUCCESS)
+            pyramid_result = device_frame_place_tasks(frame, MAX_IMGS_BUF);
+    }
+    if(pyramid_result == ERR_SUCCESS && frame->whole_imgs_buf && frames_in_flight)
+        pyramid_result = ERR_OTHER; //Frames in flight must be collected first
+
+    //    1.6 - build images pyramid right in shared memory
+    int64 const time_start_scale = cvGetTickCount();
+    if(pyramid_result == ERR_SUCCESS) {
+        pyramid_result = build_pyramid_shared (
+            image,
+            (unsigned char *)e->emem.base + IMGS_OFFSET,
+            &frame->imgs,
+            &frame->offset_x,
+            &frame->offset_y
+        );
+    }
+    frame->time_scale += (cvGetTickCount() - time_start_scale) / cvGetTickFrequency();
+
+    if(pyramid_result != ERR_SUCCESS) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return pyramid_result;
+    }
+
+    //Pyramid is written through host mapping; make it visible before control data is sent
+    __sync_synchronize();
+
+    frame->bytes_to_device = frame->imgs.cur_offset - frame->imgs.data[0].data_offset;
+	frame->bytes_to_device += e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, imgs_prop), frame->imgs.data, frame->imgs.count * sizeof(EpImageProp));
+
+    if(!frame->device_count)
+        return ERR_SUCCESS; //Everything is done by host in ep_device_session_collect(); cores are not started
+
+    int const cores_count = session->cores_count;
+    //    1.7 - give every core its own range of tasks; cores steal from each other at the end
+    EpTaskList device_tasks = {frame->tasks.data, frame->device_count, frame->device_count};
+    EpTaskRange ranges[MAX_CORES_NUM];
+    if(ep_task_list_partition(&device_tasks, ranges, cores_count) != ERR_SUCCESS) {
+        device_frame_release(frame);
+        session->submit_slot = slot;
+        return ERR_MEMORY;
+    }
+
+    double const trace_upload = ep_trace_now();
+    ep_trace_span("plan", "host", TRACE_PID_HOST, 0, trace_plan, trace_upload, "tasks", frame->tasks.count);
+
+    //Start tokens are written separately after the rest of control info, since cores are already running
+    EpControlInfo const control_info = {
+        frame->device_count, cores_count, 0, 0, 0, ep_trace_is_active(), frame->tasks_offset, frame->traces_offset
+    };
+
+	frame->bytes_to_device += e_write(&e->emem, 0, 0, IMGS_OFFSET + frame->tasks_offset, frame->tasks.data, frame->device_count * sizeof(EpTaskItem));
+	frame->bytes_to_device += e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, task_ranges), ranges, cores_count * sizeof(EpTaskRange));
+	frame->bytes_to_device += e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, control_info), &control_info, sizeof(EpControlInfo));
+
+    // 2 - start cores
+    frame->time_start = cvGetTickCount();
+    ep_trace_span("upload", "host", TRACE_PID_HOST, 0, trace_upload, ep_trace_time(frame->time_start), NULL, 0);
+	frame->bytes_to_device += e_write(&e->emem, 0, 0, SLOT_OFFSET(slot, control_info) + offsetof(EpControlInfo, start_cores), &cores_count, sizeof(int));
 
     return ERR_SUCCESS;
 }
 
-EpErrorCode ep_detect_multi_scale_host (
-    EpImage                   *const image,
+EpErrorCode ep_device_session_collect (
+    EpDeviceSession           *const session,
+    EpRectList                *const objects,
+    EpDetectStats             *const stats
+) {
+    if(stats)
+        ep_detect_stats_reset(stats);
+
+    if(!session)
+        return ERR_ARGUMENT; //Session is not opened
+
+    int const slot = session->collect_slot;
+    EpDeviceFrame *const frame = session->frames + slot;
+
+    if(!frame->busy)
+        return ERR_OTHER; //Nothing was submitted
+
+    ep_context_t *const e = &session->e;
+    int const cores_count = session->cores_count;
+
+    double host_time = 0.0, device_time = 0.0;
+
+    stats_add_tiles(stats, &frame->tasks);
+
+    // 3 - host part of tasks (DET_HYBRID) is processed while cores are busy
+    if(frame->device_count < frame->tasks.count)
+        host_time = device_frame_detect_host(session, frame, objects, stats);
+
+    if(stats) {
+        stats->time_scale = frame->time_scale;
+        stats->time_scan = host_time;
+        stats->bytes_to_device = frame->bytes_to_device;
+    }
+
+    if(frame->device_count) {
+        //Device results and cycles are kept apart from host ones, which are measured in other units
+        EpTaskList device_tasks = {frame->tasks.data, frame->device_count, frame->device_count};
+
+        // 4 - wait end of detection
+        double const trace_wait = ep_trace_now();
+        device_session_wait(session, slot, frame->device_count);
+        ep_trace_span("wait", "host", TRACE_PID_HOST, 0, trace_wait, ep_trace_now(), NULL, 0);
+
+        double const wait_time = (cvGetTickCount() - frame->time_start) / cvGetTickFrequency();
+
+        // 5 - download result and analyze detections
+		int const results_amount = e_read(&e->emem, 0, 0, IMGS_OFFSET + frame->tasks_offset, device_tasks.data, sizeof(EpTaskItem)* device_tasks.count);
+        process_results(objects, &device_tasks, &frame->imgs, session->window_width, session->window_height, frame->offset_x, frame->offset_y);
+        ep_cost_model_update(&session->cost_model, &device_tasks, &frame->imgs, session->window_width, session->window_height);
+
+        if( ep_trace_is_active() )
+            device_frame_trace(session, frame);
+
+        // 6 - download timers values; the busiest core gives device time of hybrid frame
+        EpTimerBuf timers[cores_count];
+		int const timers_amount = e_read(&e->emem, 0, 0, SLOT_OFFSET(slot, timers), timers, sizeof(EpTimerBuf)* cores_count);
+
+        for(int i = 0; i < cores_count; ++i) {
+            double const core_time = (double)timers[i].value * (1 << TIMER_VALUE_SHIFT) / CORE_FREQUENCY;
+            if(core_time > device_time)
+                device_time = core_time;
+        }
+
+        if(stats) {
+            stats->time_scan = wait_time; //Host part is processed while cores are busy
+            stats->bytes_from_device = results_amount + timers_amount;
+            stats->cores_count = cores_count;
+
+            for(int i = 0; i < device_tasks.count; ++i) {
+                EpTaskItem const *const task = device_tasks.data + i;
+                EpLevelStats *const level = level_stats(stats, task->image_index);
+                level->windows += tile_windows(task->width + 1 - session->window_width, task->height + 1 - session->window_height, task->scan_mode);
+                level->hits += task->items_count;
+                stats->bytes_tiles += (double)task->step * task->height;
+            }
+
+            for(int i = 0; i < cores_count; ++i) {
+                stats->core_times[i] = (double)timers[i].value * (1 << TIMER_VALUE_SHIFT) / CORE_FREQUENCY;
+#ifdef DEVICE_EMULATION
+                EpEmulatedDmaStats dma_stats;
+                if( device_get_dma_stats(timers[i].core_id, &dma_stats) )
+                    stats->core_stall_times[i] = dma_stats.stall_time * 1000000;
+#endif
+            }
+        }
+    }
+
+    if(session->mode == DET_HYBRID)
+        device_session_update_share(session, frame, host_time, device_time);
+
+    device_frame_release(frame);
+    session->collect_slot = (slot + 1) % DRAM_BUF_SLOTS;
+
+    return ERR_SUCCESS;
+}
+
+EpErrorCode ep_device_session_detect (
+    EpDeviceSession           *const session,
+    EpImage             const *const image,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+) {
+    if(!session)
+        return ERR_ARGUMENT; //Session is not opened
+
+    if(session->frames[session->collect_slot].busy)
+        return ERR_OTHER; //Results of submitted frames would be mixed up
+
+    EpErrorCode const result = ep_device_session_submit(session, image, scan_mode);
+    if(result != ERR_SUCCESS)
+        return result;
+
+    return ep_device_session_collect(session, objects, stats);
+}
+
+void ep_device_session_release(EpDeviceSession *const session) {
+    if(!session)
+        return;
+
+    //Cores must not be stopped while they are working with frames
+    for(int slot = 0; slot < DRAM_BUF_SLOTS; ++slot) {
+        EpDeviceFrame *const frame = session->frames + slot;
+        if(!frame->busy) continue;
+        if(frame->device_count)
+            device_session_wait(session, slot, frame->device_count);
+        device_frame_release(frame);
+    }
+
+    for(int slot = 0; slot < DRAM_BUF_SLOTS; ++slot) {
+        ep_task_list_release(&session->frames[slot].tasks);
+        ep_img_list_release(&session->frames[slot].imgs);
+    }
+
+    e_close(&session->e.edev);
+    e_free(&session->e.emem);
+    e_finalize();
+
+    ep_classifier_release(&session->classifier);
+    free(session);
+    device_session_opened = 0;
+}
+
+/**
+ * Open session in given mode, detect objects on single image and release session
+ */
+static EpErrorCode detect_multi_scale_session (
+    EpImage             const *const image,
     EpCascadeClassifier const *const classifier,
     EpRectList                *const objects,
-    EpScanMode                 const scan_mode
+    EpScanMode                 const scan_mode,
+    int                        const num_cores,
+    EpDetectionMode            const mode,
+    EpDetectStats             *const stats
 ) {
+    if(stats)
+        ep_detect_stats_reset(stats);
+
     if( ep_classifier_check(classifier) )
         return ERR_ARGUMENT; //Wrong classifier
 
     if( ep_image_is_empty(image) )
         return ERR_ARGUMENT; //Wrong image
 
-    int const window_width = ( (EpNodeMeta const *)classifier->data )->window_width ,
-             window_height = ( (EpNodeMeta const *)classifier->data )->window_height;
+    int const window_width = ((EpNodeMeta const *)classifier->data)->window_width ,
+             window_height = ((EpNodeMeta const *)classifier->data)->window_height;
 
     if(image->width < window_width || image->height < window_height)
         return ERR_SUCCESS; //Image is too small; no detections
 
-    int const blocks_x = image->width  / 8,
-              blocks_y = image->height / 8;
+    EpErrorCode result;
+    EpDeviceSession *const session = ep_device_session_create(classifier, num_cores, &result);
+    if(!session)
+        return result;
 
-    EpImage img8 = *image;
-    EpImage img7 = ep_image_create(blocks_x * 7, blocks_y * 7);
-    EpImage img6 = ep_image_create(blocks_x * 6, blocks_y * 6);
-    EpImage img5 = ep_image_create(blocks_x * 5, blocks_y * 5);
+    result = ep_device_session_set_mode(session, mode);
+    if(result == ERR_SUCCESS)
+        result = ep_device_session_detect(session, image, objects, scan_mode, stats);
 
-    *image = ep_image_create_empty();
+    ep_device_session_release(session);
+
+    return result;
+}
+
+/**
+ * Multiscale object detection
+ *
+ * Image is iteratively scaled down until it became less than native object size.
+ * On each scale detection is performed.
+ * Workgroup is opened and closed on every call; use EpDeviceSession for processing of video.
+ *
+ * @param image     : Image to process (pointer to valid image structure).
+ * @param classifier: Classifier to use (pointer to valid classifier structure).
+ * @param objects   : Detections will be added to this list (pointer to valid rectangles list structure).
+ * @param scan_mode : Which image pixels to test; @see EpScanMode.
+ * @param num_cores : Number of cores in cores list.
+ * @param stats     : Receives statistics of the call; NULL if not needed.
+ *
+ * @return ERR_SUCCESS: successful detection;
+ *         ERR_ARGUMENT: empty image, or invalid classifier, or unknown detection_mode, or unknown scan_mode.
+ *         ERR_MEMORY: cannot allocate required memory (memory checks are not implemented yet).
+ *         ERR_OTHER: classifier is too large and cannot be uploaded to core.
+ */
+EpErrorCode ep_detect_multi_scale_device (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const classifier,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    int                        const num_cores,
+    EpDetectStats             *const stats
+) {
+    return detect_multi_scale_session(image, classifier, objects, scan_mode, num_cores, DET_DEVICE, stats);
+}
+
+EpErrorCode ep_detect_multi_scale_hybrid (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const classifier,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    int                        const num_cores,
+    EpDetectStats             *const stats
+) {
+    return detect_multi_scale_session(image, classifier, objects, scan_mode, num_cores, DET_HYBRID, stats);
+}
+
+/**
+ * Plan tiles of pyramid levels added since the last call and scan them by host threads.
+ *   Costs of measured tiles update cost model; task list is emptied.
+ *
+ * @param levels     : Pyramid levels of current octave.
+ * @param first_level: Index of levels[0] in image list.
+ * @param cascades   : Classifiers to run.
+ * @param cascades_count: Number of classifiers.
+ * @param plan_width : Planning window width (the largest window fitting all planned levels).
+ * @param plan_height: Planning window height.
+ * @param offset_x   : X offset of octave pyramid levels.
+ * @param offset_y   : Y offset of octave pyramid levels.
+ * @param threads_count: Number of host threads scanning tiles.
+ * @param stats      : Statistics of the call; NULL if not needed.
+ */
+static EpErrorCode detect_levels_host (
+    EpImage             const *const *const levels,
+    int                        const first_level,
+    EpHostCascade       const *const cascades,
+    int                        const cascades_count,
+    int                        const plan_width,
+    int                        const plan_height,
+    int                        const offset_x,
+    int                        const offset_y,
+    EpImgList           const *const imgs,
+    EpTaskList                *const tasks,
+    EpCostModel               *const cost_model,
+    int                        const threads_count,
+    EpDetectStats             *const stats
+) {
+    if(tasks->count == 0)
+        return ERR_SUCCESS;
+
+    int64 const time_start = cvGetTickCount();
+
+    EpErrorCode const result = ep_task_list_plan(tasks, imgs, cost_model, plan_width, plan_height, threads_count, INT_MAX);
+    if(result != ERR_SUCCESS)
+        return result;
+
+    stats_add_tiles(stats, tasks);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(threads_count)
+    for(int i = 0; i < tasks->count; ++i) {
+        EpTaskItem *const task = tasks->data + i;
+        detect_tile_host (
+            levels[task->image_index - first_level],
+            NULL,
+            cascades,
+            cascades_count,
+            task,
+            plan_width,
+            plan_height,
+            convert_image_index_to_scale(task->image_index),
+            offset_x,
+            offset_y,
+            level_stats(stats, task->image_index)
+        );
+    }
+
+    ep_cost_model_update(cost_model, tasks, imgs, plan_width, plan_height);
+    tasks->count = 0;
+
+    if(stats)
+        stats->time_scan += (cvGetTickCount() - time_start) / cvGetTickFrequency();
+
+    return ERR_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//                          HOST SESSION FUNCTIONS                            //
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Scratch data of host detection kept between frames
+ */
+struct EpHostSession {
+    /// Number of host threads scanning tiles; zero means omp_get_max_threads()
+    int threads_count;
+    /// Size of source image the pyramid levels are allocated for
+    int width, height;
+    /// Pyramid levels 8/8 (copy of source image), 7/8, 6/8 and 5/8; next octaves are scaled in place
+    EpImage levels[4];
+    /// Prepared classifiers of the current call
+    EpHostCascade *cascades;
+    int cascades_capacity;
+    /// Properties of levels of the current octave and their tasks
+    EpImgList imgs;
+    EpTaskList tasks;
+    /// Cycles measured for previous octaves and frames; used to plan tasks of the next ones
+    EpCostModel cost_model;
+};
+
+/**
+ * Session without buffers
+ */
+static EpHostSession host_session_create_empty(int const threads_count) {
+    EpHostSession result;
+    result.threads_count = threads_count;
+    result.width = result.height = 0;
+    for(int i = 0; i < 4; ++i)
+        result.levels[i] = ep_image_create_empty();
+    result.cascades = NULL;
+    result.cascades_capacity = 0;
+    result.imgs = ep_img_list_create_empty(0);
+    result.tasks = ep_task_list_create_empty();
+    result.cost_model = ep_cost_model_create_empty();
+    return result;
+}
+
+/**
+ * Release buffers of session; session becomes empty
+ */
+static void host_session_release_buffers(EpHostSession *const session) {
+    for(int i = 0; i < 4; ++i)
+        ep_image_release(session->levels + i);
+    free(session->cascades);
+    session->cascades = NULL;
+    session->cascades_capacity = 0;
+    ep_img_list_release(&session->imgs);
+    ep_task_list_release(&session->tasks);
+    session->width = session->height = 0;
+}
+
+/**
+ * (Re)allocate image level if its size differs from the required one; contents is undefined
+ */
+static EpErrorCode host_session_level_reserve(EpImage *const level, int const width, int const height) {
+    if(!ep_image_is_empty(level) && level->width == width && level->height == height)
+        return ERR_SUCCESS;
+
+    ep_image_release(level);
+    *level = ep_image_create(width, height);
+    return ep_image_is_empty(level) ? ERR_MEMORY : ERR_SUCCESS;
+}
+
+/**
+ * Multiscale detection of source image held in session->levels[0] (@see ep_host_session_detect)
+ */
+static EpErrorCode host_session_run (
+    EpHostSession             *const session,
+    EpCascadeClassifier const *const *const classifiers,
+    int                        const classifiers_count,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+) {
+    if(stats)
+        ep_detect_stats_reset(stats);
+
+    if(classifiers_count < 1 || !classifiers || !objects)
+        return ERR_ARGUMENT;
+
+    for(int c = 0; c < classifiers_count; ++c) {
+        if( ep_classifier_check(classifiers[c]) )
+            return ERR_ARGUMENT; //Wrong classifier
+    }
+
+    if( ep_image_is_empty(session->levels) )
+        return ERR_ARGUMENT; //Wrong image
+
+    if(session->cascades_capacity < classifiers_count) {
+        EpHostCascade *const cascades = (EpHostCascade *)realloc( session->cascades, classifiers_count * sizeof(EpHostCascade) );
+        if(!cascades)
+            return ERR_MEMORY;
+        session->cascades = cascades;
+        session->cascades_capacity = classifiers_count;
+    }
+    EpHostCascade *const cascades = session->cascades;
+
+    //Pyramid is built while the smallest window fits
+    int min_width = INT_MAX, min_height = INT_MAX;
+    for(int c = 0; c < classifiers_count; ++c) {
+        cascades[c] = host_cascade(classifiers[c]->data, objects + c);
+        if(cascades[c].window_width  < min_width ) min_width  = cascades[c].window_width;
+        if(cascades[c].window_height < min_height) min_height = cascades[c].window_height;
+    }
+
+    if(session->width < min_width || session->height < min_height)
+        return ERR_SUCCESS; //Image is too small; no detections
+
+    int const blocks_x = session->width  / 8,
+              blocks_y = session->height / 8;
+
+    if( host_session_level_reserve(session->levels + 1, blocks_x * 7, blocks_y * 7) != ERR_SUCCESS ||
+        host_session_level_reserve(session->levels + 2, blocks_x * 6, blocks_y * 6) != ERR_SUCCESS ||
+        host_session_level_reserve(session->levels + 3, blocks_x * 5, blocks_y * 5) != ERR_SUCCESS )
+        return ERR_MEMORY;
+
+    //Octaves are scaled in place, so levels are shrunk in local copies and session keeps full sizes
+    EpImage img8 = session->levels[0],
+            img7 = session->levels[1],
+            img6 = session->levels[2],
+            img5 = session->levels[3];
+
+    int const threads_count = session->threads_count > 0 ? session->threads_count : omp_get_max_threads();
 
     int offset_x, offset_y;
+    double trace_start = ep_trace_now();
     scale8765(&img8, &img7, &img6, &img5, &offset_x, &offset_y);
+    double trace_end = ep_trace_now();
+    ep_trace_span("scale8765", "pyramid", TRACE_PID_HOST, 0, trace_start, trace_end, NULL, 0);
+    if(stats)
+        stats->time_scale += trace_end - trace_start;
+
+    //Tiles and their order are planned the same way as for cores; octaves measured first predict costs of the next ones.
+    //Tiles are planned for the largest window fitting the level; consecutive levels with the same one are planned together.
+    EpImage const *const levels[4] = {&img8, &img7, &img6, &img5};
+    EpImgList *const imgs = &session->imgs;
+    EpTaskList *const tasks = &session->tasks;
+    imgs->count = imgs->cur_offset = imgs->prev_offset = 0;
+    tasks->count = 0;
+    EpErrorCode result = ERR_SUCCESS;
+
+    while(result == ERR_SUCCESS) {
+        int const first_level = imgs->count;
+        int plan_width = 0, plan_height = 0;
+
+        for(int i = 0; i < 4; ++i) {
+            EpImage const *const level = levels[i];
+            if(level->width < min_width || level->height < min_height) break;
+
+            int level_width = 0, level_height = 0;
+            for(int c = 0; c < classifiers_count; ++c) {
+                if(level->width < cascades[c].window_width || level->height < cascades[c].window_height) continue;
+                if(cascades[c].window_width  > level_width ) level_width  = cascades[c].window_width;
+                if(cascades[c].window_height > level_height) level_height = cascades[c].window_height;
+            }
 
-    int image_index = 0;
-    float scale;
-
-    while(1) {
-        if(img8.width < window_width || img8.height < window_height) break;
-        scale = convert_image_index_to_scale(image_index    );
-        detect_single_scale_host(&img8, classifier, objects, scale, offset_x, offset_y, scan_mode);
+            if(level_width != plan_width || level_height != plan_height) {
+                result = detect_levels_host(levels, first_level, cascades, classifiers_count, plan_width, plan_height, offset_x, offset_y, imgs, tasks, &session->cost_model, threads_count, stats);
+                if(result != ERR_SUCCESS) break;
+                plan_width  = level_width;
+                plan_height = level_height;
+            }
 
-        if(img7.width < window_width || img7.height < window_height) break;
-        scale = convert_image_index_to_scale(image_index + 1);
-        detect_single_scale_host(&img7, classifier, objects, scale, offset_x, offset_y, scan_mode);
+            result = ep_img_list_add(imgs, level->step, level->width, level->height);
+            if(result != ERR_SUCCESS) break;
+            result = add_tasks_for_image(scan_mode, imgs, imgs->count - 1, plan_width, plan_height, tasks);
+            if(result != ERR_SUCCESS) break;
+        }
 
-        if(img6.width < window_width || img6.height < window_height) break;
-        scale = convert_image_index_to_scale(image_index + 2);
-        detect_single_scale_host(&img6, classifier, objects, scale, offset_x, offset_y, scan_mode);
+        if(result == ERR_SUCCESS)
+            result = detect_levels_host(levels, first_level, cascades, classifiers_count, plan_width, plan_height, offset_x, offset_y, imgs, tasks, &session->cost_model, threads_count, stats);
+        if(result != ERR_SUCCESS) break;
 
-        if(img5.width < window_width || img5.height < window_height) break;
-        scale = convert_image_index_to_scale(image_index + 3);
-        detect_single_scale_host(&img5, classifier, objects, scale, offset_x, offset_y, scan_mode);
+        if(imgs->count - first_level < 4) break; //The smallest level is reached
 
+        trace_start = ep_trace_now();
         scale21(&img8, &img8);
         scale21(&img7, &img7);
         scale21(&img6, &img6);
         scale21(&img5, &img5);
+        trace_end = ep_trace_now();
+        ep_trace_span("scale21", "pyramid", TRACE_PID_HOST, 0, trace_start, trace_end, "level", imgs->count);
+        if(stats)
+            stats->time_scale += trace_end - trace_start;
+    }
+
+    tasks->count = 0;
+
+    return result;
+}
+
+EpHostSession *ep_host_session_create(int const threads_count, EpErrorCode *const error_code) {
+    EpHostSession *const session = (EpHostSession *)malloc( sizeof(EpHostSession) );
+    if(error_code)
+        *error_code = session ? ERR_SUCCESS : ERR_MEMORY;
+    if(session)
+        *session = host_session_create_empty(threads_count);
+    return session;
+}
+
+EpErrorCode ep_host_session_detect (
+    EpHostSession             *const session,
+    EpImage             const *const image,
+    EpCascadeClassifier const *const *const classifiers,
+    int                        const classifiers_count,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+) {
+    if(!session || ep_image_is_empty(image))
+        return ERR_ARGUMENT; //Session is not created or wrong image
+
+    //Level 8/8 is scaled in place, so source image is copied; buffer is reused while frame size is the same
+    double const trace_start = ep_trace_now();
+    if( host_session_level_reserve(session->levels, image->width, image->height) != ERR_SUCCESS ) {
+        host_session_release_buffers(session);
+        return ERR_MEMORY;
+    }
+    session->width  = image->width;
+    session->height = image->height;
+
+    for(int y = 0; y < image->height; ++y)
+        memcpy(session->levels[0].data + y * session->levels[0].step, image->data + y * image->step, image->width);
+    ep_trace_span("clone", "host", TRACE_PID_HOST, 0, trace_start, ep_trace_now(), NULL, 0);
+
+    return host_session_run(session, classifiers, classifiers_count, objects, scan_mode, stats);
+}
+
+void ep_host_session_release(EpHostSession *const session) {
+    if(!session)
+        return;
+
+    host_session_release_buffers(session);
+    free(session);
+}
+
+EpErrorCode ep_detect_multi_scale_host (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const classifier,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+) {
+    return ep_detect_multi_scale_host_multi(image, &classifier, 1, objects, scan_mode, stats);
+}
+
+EpErrorCode ep_detect_multi_scale_host_multi (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const *const classifiers,
+    int                        const classifiers_count,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+) {
+    //Single call session takes image as level 8/8 and releases it with the other buffers
+    EpHostSession session = host_session_create_empty(0);
+    session.levels[0] = *image;
+    session.width  = image->width;
+    session.height = image->height;
+    *image = ep_image_create_empty();
+
+    EpErrorCode const result = host_session_run(&session, classifiers, classifiers_count, objects, scan_mode, stats);
+
+    host_session_release_buffers(&session);
+
+    return result;
+}
+
+/**
+ * Build scale pyramid of image and call visitor for each level (@see ep_image_pyramid_visit)
+ */
+EpErrorCode ep_image_pyramid_visit (
+    EpImage          const *const image,
+    int                     const window_width,
+    int                     const window_height,
+    EpPyramidVisitor        const visitor,
+    void                   *const context
+) {
+    if( ep_image_is_empty(image) )
+        return ERR_ARGUMENT; //Wrong image
 
-        image_index += 4;
+    if(image->width < window_width || image->height < window_height)
+        return ERR_SUCCESS; //Image is too small; nothing to visit
+
+    int const blocks_x = image->width  / 8,
+              blocks_y = image->height / 8;
+
+    //Levels 8/8 are scaled in place, so source image is cloned
+    EpImage img8 = ep_image_clone(image);
+    EpImage img7 = ep_image_create(blocks_x * 7, blocks_y * 7);
+    EpImage img6 = ep_image_create(blocks_x * 6, blocks_y * 6);
+    EpImage img5 = ep_image_create(blocks_x * 5, blocks_y * 5);
+
+    EpErrorCode result = ERR_SUCCESS;
+
+    if( ep_image_is_empty(&img8) || ep_image_is_empty(&img7) ||
+        ep_image_is_empty(&img6) || ep_image_is_empty(&img5) ) {
+        result = ERR_MEMORY;
+    } else {
+        int offset_x, offset_y;
+        scale8765(&img8, &img7, &img6, &img5, &offset_x, &offset_y);
+
+        EpImage *const levels[4] = {&img8, &img7, &img6, &img5};
+        int level_index = 0;
+
+        for(;;) {
+            int i = 0;
+            for(; i < 4; ++i, ++level_index) {
+                EpImage const *const level = levels[i];
+                if(level->width < window_width || level->height < window_height) break;
+                visitor(level, level_index, convert_image_index_to_scale(level_index), offset_x, offset_y, context);
+            }
+
+            if(i < 4) break; //The smallest level is reached
+
+            scale21(&img8, &img8);
+            scale21(&img7, &img7);
+            scale21(&img6, &img6);
+            scale21(&img5, &img5);
+        }
     }
 
     ep_image_release(&img5);
@@ -1836,5 +3950,5 @@ EpErrorCode ep_detect_multi_scale_host (
     ep_image_release(&img7);
     ep_image_release(&img8);
 
-    return ERR_SUCCESS;
+    return result;
 }
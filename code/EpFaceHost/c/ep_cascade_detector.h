@@ -133,6 +133,32 @@ EpImage ep_image_load(char const *const file_name, EpErrorCode *const error_code
  */
 void ep_image_release(EpImage *const image);
 
+/**
+ * Scale image by 7/8, 6/8 and 5/8 at once, as the first octave of detection pyramid is built.
+ *   Source size is cut down to multiple of 8 (centered); resulting images must be preallocated
+ *   with blocks_x * 7 by blocks_y * 7 pixels etc. Used by benchmarks; detection calls it internally.
+ * @param src8    : source image;
+ * @param out7    : resulting images;
+ * @param out6    ;
+ * @param out5    ;
+ * @param offset_x: receives number of pixels thrown away from the left side;
+ * @param offset_y: receives number of pixels thrown away from the top side.
+ */
+void ep_image_scale8765 (
+    EpImage const *const src8,
+    EpImage       *const out7,
+    EpImage       *const out6,
+    EpImage       *const out5,
+    int           *const offset_x,
+    int           *const offset_y
+);
+
+/**
+ * Reduce image twice, as the next octave of detection pyramid is built.
+ *   Result may occupy the same memory as source (with the same step). Used by benchmarks.
+ */
+void ep_image_scale21(EpImage const *const src, EpImage *const out);
+
 ////////////////////////////////////////////////////////////////////////////////
 // IMAGE LIST FUNCTIONS (Control list of images held in shared memory buffer) //
 ////////////////////////////////////////////////////////////////////////////////
@@ -284,6 +310,32 @@ int ep_classifier_check(EpCascadeClassifier const *const classifier);
  */
 EpCascadeClassifier ep_classifier_clone(EpCascadeClassifier const *const classifier);
 
+/**
+ * Check whether classifier is in compact encoding (@see EpCompactMeta).
+ * @param classifier: pointer to non-empty classifier.
+ * @return non-zero value for compact classifier; zero otherwise.
+ */
+int ep_classifier_is_compact(EpCascadeClassifier const *const classifier);
+
+/**
+ * Convert classifier to compact encoding (@see EpCompactMeta). Scores and thresholds are
+ *   quantized, so windows very close to stage thresholds may be classified differently.
+ *   Bounds of optimized classifier (@see EpNodeBound) are dropped; order of decisions is kept.
+ *   Compact classifier is saved and loaded by ep_classifier_save() / ep_classifier_load() as is.
+ * @param classifier: pointer to valid classifier; compact classifier is just cloned.
+ * @return compact classifier; empty classifier is returned in case of any error.
+ */
+EpCascadeClassifier ep_classifier_compact(EpCascadeClassifier const *const classifier);
+
+/**
+ * Mirror classifier horizontally, e.g. to get right profile detector from left profile one.
+ *   Mirrored classifier samples the same image data horizontally flipped, so it finds the objects
+ *   source classifier would find in flipped image.
+ * @param classifier: pointer to valid classifier in standard encoding (bounds are kept).
+ * @return mirrored classifier; empty classifier is returned for compact classifier or in case of any error.
+ */
+EpCascadeClassifier ep_classifier_mirror(EpCascadeClassifier const *const classifier);
+
 /**
  * Calculate classifier checksum for debug purpose.
  *   Classifiers with the same data will get the same checksums,
@@ -320,6 +372,17 @@ EpErrorCode ep_classifier_save (
  */
 EpCascadeClassifier ep_classifier_load(char const *const file_name, EpErrorCode *const EpErrorCode);
 
+/**
+ * Load classifier from OpenCV LBP cascade .xml file ( written by opencv_traincascade ).
+ *   Result is the same as conversion of cv::CascadeClassifier loaded from this file,
+ *   but OpenCV ObjDetect is not used. Only stump based cascades are supported.
+ * @param file_name: pointer to file name (null-terminated string)
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ *                  ERR_FILE_CONTENTS is also returned for bad XML and unsupported cascades.
+ * @return classifier loaded. Empty classifier is returned in case of any error.
+ */
+EpCascadeClassifier ep_classifier_load_xml(char const *const file_name, EpErrorCode *const error_code);
+
 /**
  * Release memory hold by classifier.
  * After calling this function classifier is empty.
@@ -327,10 +390,169 @@ EpCascadeClassifier ep_classifier_load(char const *const file_name, EpErrorCode
  */
 void ep_classifier_release(EpCascadeClassifier *const classifier);
 
+/**
+ * Classifier file mapped read-only and shared by all processes which open the same file.
+ *   File may be replaced while store is used (@see ep_classifier_store_reload).
+ */
+typedef struct EpClassifierStore EpClassifierStore;
+
+/**
+ * Open store of classifier mapped from binary file ( previously written by ep_classifier_save() ).
+ * @param file_name : pointer to file name (null-terminated string);
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ *                  If this pointer is NULL then no error code is stored.
+ * @return opened store; NULL in case of any error.
+ */
+EpClassifierStore *ep_classifier_store_open(char const *const file_name, EpErrorCode *const error_code);
+
+/**
+ * Map file again if it was replaced since the last check. New classifier is used by
+ *   next acquires, while classifiers acquired before stay valid until released.
+ *   Replace file atomically (write new file, then rename() it over the old one);
+ *   file with wrong contents is rejected and current classifier is kept.
+ * @param store     : opened store;
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ *                  If this pointer is NULL then no error code is stored.
+ * @return non-zero if new classifier was swapped in; zero otherwise.
+ */
+int ep_classifier_store_reload(EpClassifierStore *const store, EpErrorCode *const error_code);
+
+/**
+ * Take current classifier of the store. It stays valid (even after reload or close of the store)
+ *   until it is released with ep_classifier_store_release(). Data is read-only!
+ * @param store: opened store.
+ * @return current classifier.
+ */
+EpCascadeClassifier const *ep_classifier_store_acquire(EpClassifierStore *const store);
+
+/**
+ * Take one more reference of classifier acquired from store.
+ * @param classifier: classifier returned by ep_classifier_store_acquire() and not released yet.
+ * @return the same classifier.
+ */
+EpCascadeClassifier const *ep_classifier_store_retain(EpCascadeClassifier const *const classifier);
+
+/**
+ * Release classifier acquired from store; the last release of replaced classifier unmaps its file.
+ * @param classifier: classifier returned by ep_classifier_store_acquire() or ep_classifier_store_retain().
+ */
+void ep_classifier_store_release(EpCascadeClassifier const *const classifier);
+
+/**
+ * Close store. Classifiers acquired from it stay valid until released.
+ * @param store: opened store.
+ */
+void ep_classifier_store_close(EpClassifierStore *const store);
+
+/**
+ * Calculate decision of one decision node at given window position, the same way detection does.
+ *   Used by tools which profile classifiers node by node.
+ * @param node      : pointer to EpNodeDecision node of valid classifier;
+ * @param image_data: upper-left corner of detection window;
+ * @param image_step: step in bytes from one image line to the next one.
+ * @return 1 if feature value is in the node subset (node score is added to the stage sum), otherwise 0.
+ */
+int ep_classifier_node_decision (
+    char          const *const node,
+    unsigned char const *const image_data,
+    int                  const image_step
+);
+
+/**
+ * Classify one window position, the same way detection does. Used by benchmarks and profiling tools.
+ * @param classifier: pointer to valid classifier (any encoding);
+ * @param image_data: upper-left corner of detection window; window must fit the image;
+ * @param image_step: step in bytes from one image line to the next one.
+ * @return non-zero if window is classified as object, otherwise zero.
+ */
+int ep_classifier_classify (
+    EpCascadeClassifier const *const classifier,
+    unsigned char       const *const image_data,
+    int                        const image_step
+);
+
+/**
+ * Classify one window position like ep_classifier_classify(), and report how deep into the cascade
+ *   evaluation went. Used by profiling tools (@see ep_cascade_heatmap.h).
+ * @param classifier     : pointer to valid classifier (any encoding);
+ * @param image_data     : upper-left corner of detection window; window must fit the image;
+ * @param image_step     : step in bytes from one image line to the next one;
+ * @param decisions_count: receives number of decisions evaluated (may be NULL).
+ * @return index of stage which rejected the window; number of stages if window is classified as object.
+ */
+int ep_classifier_classify_depth (
+    EpCascadeClassifier const *const classifier,
+    unsigned char       const *const image_data,
+    int                        const image_step,
+    int                       *const decisions_count
+);
+
 ////////////////////////////////////////////////////////////////////////////////
 //                          MAIN DETECTION FUNCTION                           //
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef enum {
+    /// Pyramid levels with their own counters; deeper levels are added to the last one
+    MAX_STATS_LEVELS = 48,
+    /// Stages with their own exit counters; exits at deeper stages are added to the last one
+    MAX_STATS_STAGES = 32
+} EpDetectStatsConstants;
+
+/**
+ * Counters of one pyramid level
+ */
+typedef struct {
+    /// Size and coordinates of windows found at the level are multiplied by this factor
+    float scale;
+    /// Tiles (tasks) of the level, and tiles of them scanned by host threads
+    int tiles, host_tiles;
+    /// Windows scanned (every classifier counts its windows)
+    double windows;
+    /// Windows of them scanned by host threads; decisions and stage exits are counted for these windows
+    double host_windows;
+    /// Decision nodes evaluated; counted in tiles scanned by host threads only
+    double decisions;
+    /// Windows rejected by stage k; counted in tiles scanned by host threads only
+    double stage_exits[MAX_STATS_STAGES];
+    /// Raw hits (detections before grouping)
+    int hits;
+} EpLevelStats;
+
+/**
+ * Statistics of one detection call, filled if caller passes pointer to it.
+ *   Per-tile counters cost nothing; per-window counters (decisions, stage exits) make host
+ *   scanning slower and are compiled out if library is built with EP_DETECT_STATS=0.
+ */
+typedef struct {
+    int levels_count;
+    EpLevelStats levels[MAX_STATS_LEVELS];
+    /// Microseconds spent building scale pyramid, scanning tiles and grouping hits (by C++ wrappers)
+    double time_scale, time_scan, time_group;
+    /// Bytes written by host to shared memory (pyramid, tasks, control info) and read back (results, timers)
+    double bytes_to_device, bytes_from_device;
+    /// Bytes of tiles copied by cores from shared memory to their local memory
+    double bytes_tiles;
+    /// Number of started cores; zero for host detection
+    int cores_count;
+    /// Busy time of every core in microseconds
+    double core_times[MAX_CORES_NUM];
+    /// Time every core waited for tile DMA in microseconds; measured by emulator only
+    double core_stall_times[MAX_CORES_NUM];
+} EpDetectStats;
+
+/**
+ * Zero all counters
+ */
+void ep_detect_stats_reset(EpDetectStats *const stats);
+
+/**
+ * Write statistics as text: totals, per-level counters and per-core times.
+ * @param stats    : statistics of detection call;
+ * @param file_name: pointer to file name (null-terminated string); the file is overwritten.
+ * @return ERR_SUCCESS; ERR_FILE if file cannot be written.
+ */
+EpErrorCode ep_detect_stats_save(EpDetectStats const *const stats, char const *const file_name);
+
 /**
  * Multiscale object detection
  *
@@ -342,12 +564,12 @@ void ep_classifier_release(EpCascadeClassifier *const classifier);
  * @param objects   : Detections will be added to this list (pointer to valid rectangles list structure).
  * @param scan_mode : Which image pixels to test; @see EpScanMode.
  * @param num_cores : Number of cores to use.
- * @param log_file  : Name of time-log file (if 0  then time logging is off).
+ * @param stats     : Receives statistics of the call (@see EpDetectStats); NULL if not needed.
  *
  * @return ERR_SUCCESS : successful detection;
  *         ERR_ARGUMENT: empty image, or invalid classifier, or unknown detection_mode, or unknown scan_mode.
  *         ERR_MEMORY  : cannot allocate required memory (memory checks are not implemented yet).
- *         ERR_OTHER  : classifier is too large and cannot be uploaded to core.
+ *         ERR_OTHER  : classifier is too large even for paging (@see EpCascadePaging).
  */
 EpErrorCode ep_detect_multi_scale_device (
     EpImage                   *const image,
@@ -355,16 +577,264 @@ EpErrorCode ep_detect_multi_scale_device (
     EpRectList                *const objects,
     EpScanMode                 const scan_mode,
     int                        const num_cores,
-    char                const *const log_file
+    EpDetectStats             *const stats
 );
 
 EpErrorCode ep_detect_multi_scale_host (
     EpImage                   *const image,
     EpCascadeClassifier const *const classifier,
     EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Multiscale detection of several classifiers by host threads. Scale pyramid is built once and
+ *   each tile is scanned by all classifiers while it is in cache. Results are the same as of
+ *   separate ep_detect_multi_scale_host() calls for each classifier.
+ *   Classifiers may have different window sizes; the pyramid goes on while the smallest window fits.
+ *
+ * @param image            : Image to process (pointer to valid image structure). Image contents is modified during detection!
+ * @param classifiers      : Array of pointers to valid classifiers (any encoding).
+ * @param classifiers_count: Number of classifiers (at least one).
+ * @param objects          : Array of classifiers_count rectangle lists; detections of classifiers[i] are added to objects[i].
+ * @param scan_mode        : Which image pixels to test; @see EpScanMode.
+ * @param stats            : Receives statistics of the call (counters of all classifiers are summed); NULL if not needed.
+ *
+ * @return ERR_SUCCESS : successful detection;
+ *         ERR_ARGUMENT: empty image, or no classifiers, or invalid classifier;
+ *         ERR_MEMORY  : cannot allocate required memory.
+ */
+EpErrorCode ep_detect_multi_scale_host_multi (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const *const classifiers,
+    int                        const classifiers_count,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Multiscale object detection by host threads and Epiphany cores together (@see DET_HYBRID).
+ * Parameters and return values are the same as of ep_detect_multi_scale_device().
+ */
+EpErrorCode ep_detect_multi_scale_hybrid (
+    EpImage                   *const image,
+    EpCascadeClassifier const *const classifier,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    int                        const num_cores,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Function called for every level of scale pyramid (@see ep_image_pyramid_visit).
+ * @param level      : pyramid level; valid only during the call;
+ * @param level_index: index of the level (0 is the source image);
+ * @param scale      : size and coordinates of window found at the level must be multiplied by this factor...
+ * @param offset_x   : ...and offset by these values to get rectangle in source image;
+ * @param offset_y   ;
+ * @param context    : pointer passed to ep_image_pyramid_visit().
+ */
+typedef void (*EpPyramidVisitor) (
+    EpImage const *const level,
+    int            const level_index,
+    float          const scale,
+    int            const offset_x,
+    int            const offset_y,
+    void          *const context
+);
+
+/**
+ * Build the same scale pyramid as ep_detect_multi_scale_host() does, and call visitor for each level
+ *   which is not smaller than detection window. Levels are visited one by one in host thread.
+ * @param image        : Source image (pointer to valid image structure); it is not modified.
+ * @param window_width : Native object width of the classifier.
+ * @param window_height: Native object height of the classifier.
+ * @param visitor      : Function to call for each level.
+ * @param context      : Pointer passed to visitor.
+ * @return ERR_SUCCESS; ERR_ARGUMENT if image is empty; ERR_MEMORY if pyramid cannot be allocated.
+ */
+EpErrorCode ep_image_pyramid_visit (
+    EpImage          const *const image,
+    int                     const window_width,
+    int                     const window_height,
+    EpPyramidVisitor        const visitor,
+    void                   *const context
+);
+
+////////////////////////////////////////////////////////////////////////////////
+//                          DEVICE SESSION FUNCTIONS                          //
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Device session keeps workgroup opened and running between detections,
+ *   so eSDK initialization, program loading and classifier upload are performed once.
+ *   Only one session may be opened at a time.
+ *
+ * Shared memory holds DRAM_BUF_SLOTS frames, so detections may be pipelined:
+ *   host submits frame N + 1 and processes results of frame N - 1 while cores work on frame N.
+ *   Results are collected in the order frames were submitted.
+ *   Pyramid and task list of pipelined frame must fit in MAX_SLOT_IMGS_BUF bytes (1920x1080 image does);
+ *   larger frame (up to MAX_IMGS_BUF bytes, 2720x1530 image) takes the whole images buffer,
+ *   so it is submitted only when no other frame is in flight and is not pipelined.
+ *   Frames with larger pyramid (2880x1620 image needs 16.9 MB) fail with ERR_MEMORY.
+ */
+typedef struct EpDeviceSession EpDeviceSession;
+
+/**
+ * Open workgroup, upload classifier to shared memory and start cores.
+ * @param classifier: Classifier to use (pointer to valid classifier structure). Data is copied to shared memory.
+ * @param num_cores : Number of cores to use for every detection.
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- success;
+ *                  ERR_ARGUMENT -- invalid classifier or number of cores;
+ *                  ERR_MEMORY -- cannot allocate session or shared buffer;
+ *                  ERR_OTHER -- classifier is too large even for paging, workgroup cannot be loaded
+ *                               or another session is already opened.
+ * @return opened session, or NULL in case of any error.
+ */
+EpDeviceSession *ep_device_session_create (
+    EpCascadeClassifier const *const classifier,
+    int                        const num_cores,
+    EpErrorCode               *const error_code
+);
+
+/**
+ * Choose who processes tasks of frames submitted after the call. Session is created in DET_DEVICE mode.
+ *   In DET_HYBRID mode small images and small pyramid levels are processed by host only;
+ *   tasks of the rest are shared by host threads (inside ep_device_session_collect(), while
+ *   cores are busy) and cores. Host share follows measured throughput of both.
+ * @param session: Session opened by ep_device_session_create().
+ * @param mode   : DET_DEVICE or DET_HYBRID.
+ * @return ERR_SUCCESS : mode is set;
+ *         ERR_ARGUMENT: session is NULL or mode is not supported by session.
+ */
+EpErrorCode ep_device_session_set_mode (
+    EpDeviceSession           *const session,
+    EpDetectionMode            const mode
+);
+
+/**
+ * Start multiscale object detection of frame on opened session without waiting for its end.
+ *   Scale pyramid is built right in free slot of shared memory; only images properties,
+ *   tasks and control info are sent with e_write().
+ * @param session   : Session opened by ep_device_session_create().
+ * @param image     : Image to process (pointer to valid image structure). Image is not modified
+ *                    and may be released right after the call.
+ * @param scan_mode : Which image pixels to test; @see EpScanMode.
+ * @return ERR_SUCCESS : frame is submitted;
+ *         ERR_ARGUMENT: session is NULL or image is empty;
+ *         ERR_MEMORY  : images pyramid or task list does not fit in shared memory
+ *                       (MAX_IMGS_COUNT, MAX_IMGS_BUF, MAX_TASK_BUF);
+ *         ERR_OTHER   : all slots are occupied by frames which are not collected yet, or frames in flight
+ *                       share images buffer with this one (pyramid and tasks larger than MAX_SLOT_IMGS_BUF bytes);
+ *                       frame may be submitted again after the oldest one is collected.
+ */
+EpErrorCode ep_device_session_submit (
+    EpDeviceSession           *const session,
+    EpImage             const *const image,
     EpScanMode                 const scan_mode
 );
 
+/**
+ * Wait for the end of detection of the oldest submitted frame and get its results.
+ *   Host thread sleeps between checks of cores progress.
+ * @param session   : Session opened by ep_device_session_create().
+ * @param objects   : Detections will be added to this list (pointer to valid rectangles list structure).
+ * @param stats     : Receives statistics of the frame (@see EpDetectStats); NULL if not needed.
+ * @return ERR_SUCCESS : successful detection;
+ *         ERR_ARGUMENT: session is NULL;
+ *         ERR_OTHER   : there are no submitted frames.
+ */
+EpErrorCode ep_device_session_collect (
+    EpDeviceSession           *const session,
+    EpRectList                *const objects,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Multiscale object detection on opened session: ep_device_session_submit() followed
+ *   by ep_device_session_collect(). Returns after all cores became idle.
+ * @param session   : Session opened by ep_device_session_create().
+ * @param image     : Image to process (pointer to valid image structure). Image is not modified.
+ * @param objects   : Detections will be added to this list (pointer to valid rectangles list structure).
+ * @param scan_mode : Which image pixels to test; @see EpScanMode.
+ * @param stats     : Receives statistics of the frame (@see EpDetectStats); NULL if not needed.
+ * @return ERR_SUCCESS : successful detection;
+ *         ERR_ARGUMENT: session is NULL or image is empty.
+ *         ERR_MEMORY  : images pyramid or task list does not fit in shared memory
+ *                       (MAX_IMGS_COUNT, MAX_IMGS_BUF, MAX_TASK_BUF).
+ *         ERR_OTHER   : there are submitted frames which are not collected yet.
+ */
+EpErrorCode ep_device_session_detect (
+    EpDeviceSession           *const session,
+    EpImage             const *const image,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Wait for submitted frames (their results are discarded), stop cores, close workgroup and release session.
+ * @param session: session opened by ep_device_session_create(); NULL is ignored.
+ */
+void ep_device_session_release(EpDeviceSession *const session);
+
+////////////////////////////////////////////////////////////////////////////////
+//                           HOST SESSION FUNCTIONS                           //
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Host session keeps scratch data of host detection between frames: copy of source image,
+ *   pyramid levels, image and task lists and cost model measured on previous frames.
+ *   Buffers are sized for the last frame, so detection of frames of the same size allocates
+ *   nothing once lists have grown. Session is not thread safe; use one session per calling thread.
+ */
+typedef struct EpHostSession EpHostSession;
+
+/**
+ * Create host session without buffers; they are allocated by the first detection.
+ * @param threads_count: Number of host threads scanning tiles of every frame; zero means omp_get_max_threads().
+ * @param error_code   : pointer to integer value which will receive the error code.
+ *                       If this pointer is NULL then no error code is stored.
+ *          Error codes: ERR_SUCCESS -- success;
+ *                       ERR_MEMORY -- cannot allocate session.
+ * @return created session, or NULL in case of any error.
+ */
+EpHostSession *ep_host_session_create(int const threads_count, EpErrorCode *const error_code);
+
+/**
+ * Multiscale detection of several classifiers by host threads (@see ep_detect_multi_scale_host_multi)
+ *   using buffers of session.
+ * @param session          : Session created by ep_host_session_create().
+ * @param image            : Image to process (pointer to valid image structure). Image is not modified.
+ * @param classifiers      : Array of pointers to valid classifiers (any encoding).
+ * @param classifiers_count: Number of classifiers (at least one).
+ * @param objects          : Array of classifiers_count rectangle lists; detections of classifiers[i] are added to objects[i].
+ * @param scan_mode        : Which image pixels to test; @see EpScanMode.
+ * @param stats            : Receives statistics of the call (counters of all classifiers are summed); NULL if not needed.
+ * @return ERR_SUCCESS : successful detection;
+ *         ERR_ARGUMENT: session is NULL, empty image, or no classifiers, or invalid classifier;
+ *         ERR_MEMORY  : cannot allocate buffers for the frame size.
+ */
+EpErrorCode ep_host_session_detect (
+    EpHostSession             *const session,
+    EpImage             const *const image,
+    EpCascadeClassifier const *const *const classifiers,
+    int                        const classifiers_count,
+    EpRectList                *const objects,
+    EpScanMode                 const scan_mode,
+    EpDetectStats             *const stats
+);
+
+/**
+ * Release session and its buffers.
+ * @param session: session created by ep_host_session_create(); NULL is ignored.
+ */
+void ep_host_session_release(EpHostSession *const session);
+
 #ifdef __cplusplus
 }
 #endif
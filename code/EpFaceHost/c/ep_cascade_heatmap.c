@@ -0,0 +1,322 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Cascade-depth profiler
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#include "ep_cascade_detector.h"
+#include "ep_cascade_heatmap.h"
+
+/**
+ * Statistics of one pyramid level accumulated over all profiled images
+ */
+typedef struct {
+    float scale;
+    double windows;
+    double decisions;
+    /// Sum of exit stages
+    double depth;
+} EpHeatmapLevelStats;
+
+struct EpCascadeHeatmap {
+    EpCascadeClassifier classifier;
+    int window_width, window_height;
+    int stages_count;
+    /// Windows rejected by stage k are exits[k]; exits[stages_count] windows are detected
+    double *exits;
+    double windows, decisions;
+    EpHeatmapLevelStats *level_stats;
+    int level_stats_count;
+    /// Heatmaps of the last image
+    EpImage *levels;
+    int levels_count, levels_capacity;
+    /// Scan mode of the image being profiled
+    EpScanMode scan_mode;
+    /// Error of the image being profiled
+    EpErrorCode error;
+};
+
+/**
+ * Count stages of classifier in any encoding
+ */
+static int count_stages(EpCascadeClassifier const *const classifier) {
+    int result = 0;
+
+    if( ep_classifier_is_compact(classifier) ) {
+        EpCompactPart const *const part = (EpCompactPart const *)(classifier->data + sizeof(EpCompactMeta));
+        EpCompactStage const *stage = (EpCompactStage const *)( (int const (*)[8])(part + 1) + part->subsets_count );
+        for(; stage->decisions_count; ++result)
+            stage = (EpCompactStage const *)( (EpCompactDecision const *)(stage + 1) + stage->decisions_count );
+        return result;
+    }
+
+    char const *const nodes_end = classifier->data + classifier->size - sizeof(EpNodeFinal);
+    for(char const *node = classifier->data + sizeof(EpNodeMeta); node < nodes_end; ) {
+        if(*(int const *)node == NODE_DECISION) {
+            node += sizeof(EpNodeDecision);
+        } else {
+            result += *(int const *)node == NODE_STAGE;
+            node += sizeof(EpNodeStage); //EpNodeBound has the same size
+        }
+    }
+    return result;
+}
+
+/**
+ * Create empty profile (@see ep_cascade_heatmap_create)
+ */
+EpCascadeHeatmap *ep_cascade_heatmap_create (
+    EpCascadeClassifier const *const classifier,
+    EpErrorCode               *const error_code
+) {
+    EpErrorCode error_code_stub;
+    EpErrorCode *const result = error_code ? error_code : &error_code_stub;
+
+    if( ep_classifier_check(classifier) ) {
+        *result = ERR_ARGUMENT;
+        return NULL;
+    }
+
+    EpCascadeHeatmap *const heatmap = (EpCascadeHeatmap *)calloc( 1, sizeof(EpCascadeHeatmap) );
+    if(!heatmap) {
+        *result = ERR_MEMORY;
+        return NULL;
+    }
+
+    heatmap->classifier = ep_classifier_clone(classifier);
+    heatmap->stages_count = count_stages(classifier);
+    heatmap->exits = (double *)calloc( heatmap->stages_count + 1, sizeof(double) );
+    if( ep_classifier_is_empty(&heatmap->classifier) || !heatmap->exits ) {
+        ep_cascade_heatmap_release(heatmap);
+        *result = ERR_MEMORY;
+        return NULL;
+    }
+
+    //Compact META node starts with the same fields
+    heatmap->window_width  = ( (EpNodeMeta const *)classifier->data )->window_width;
+    heatmap->window_height = ( (EpNodeMeta const *)classifier->data )->window_height;
+
+    *result = ERR_SUCCESS;
+    return heatmap;
+}
+
+/**
+ * Get heatmap image and statistics slot of level, allocating them if needed.
+ * @return non-zero on success.
+ */
+static int prepare_level(EpCascadeHeatmap *const heatmap, EpImage const *const level, int const level_index) {
+    if(level_index >= heatmap->levels_capacity) {
+        int const capacity = level_index * 2 + 8;
+        EpImage *const levels = (EpImage *)realloc( heatmap->levels, capacity * sizeof(EpImage) );
+        if(!levels)
+            return 0;
+        for(int i = heatmap->levels_capacity; i < capacity; ++i)
+            levels[i] = ep_image_create_empty();
+        heatmap->levels = levels;
+        heatmap->levels_capacity = capacity;
+    }
+
+    if(level_index >= heatmap->level_stats_count) {
+        EpHeatmapLevelStats *const stats = (EpHeatmapLevelStats *)realloc( heatmap->level_stats, (level_index + 1) * sizeof(EpHeatmapLevelStats) );
+        if(!stats)
+            return 0;
+        memset( stats + heatmap->level_stats_count, 0, (level_index + 1 - heatmap->level_stats_count) * sizeof(EpHeatmapLevelStats) );
+        heatmap->level_stats = stats;
+        heatmap->level_stats_count = level_index + 1;
+    }
+
+    EpImage *const image = heatmap->levels + level_index;
+    if(image->width != level->width || image->height != level->height) {
+        ep_image_release(image);
+        *image = ep_image_create(level->width, level->height);
+        if( ep_image_is_empty(image) )
+            return 0;
+    }
+    memset(image->data, 0, image->step * image->height);
+
+    return 1;
+}
+
+/**
+ * Classify all windows of one pyramid level (@see EpPyramidVisitor)
+ */
+static void profile_level (
+    EpImage const *const level,
+    int            const level_index,
+    float          const scale,
+    int            const offset_x,
+    int            const offset_y,
+    void          *const context
+) {
+    EpCascadeHeatmap *const heatmap = (EpCascadeHeatmap *)context;
+    (void)offset_x;
+    (void)offset_y;
+
+    if(heatmap->error != ERR_SUCCESS)
+        return;
+    if( !prepare_level(heatmap, level, level_index) ) {
+        heatmap->error = ERR_MEMORY;
+        return;
+    }
+
+    EpImage const *const image = heatmap->levels + level_index;
+    EpHeatmapLevelStats *const stats = heatmap->level_stats + level_index;
+    int const stages_count = heatmap->stages_count;
+    EpScanMode const scan_mode = heatmap->scan_mode;
+
+    int const process_width  = level->width  + 1 - heatmap->window_width,
+              process_height = level->height + 1 - heatmap->window_height;
+
+    stats->scale = scale;
+    heatmap->levels_count = level_index + 1;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int y = 0; y < process_height; ++y) {
+        unsigned char const *const scan_line = level->data + y * level->step;
+        //Values are placed at window centres
+        unsigned char *const heat_line = image->data + (y + heatmap->window_height / 2) * image->step + heatmap->window_width / 2;
+
+        int const x_start = scan_mode == SCAN_FULL ? 0 : (y + scan_mode) & 1;
+        int const x_step = scan_mode == SCAN_FULL ? 1 : 2;
+
+        int exits[stages_count + 1];
+        memset(exits, 0, sizeof(exits));
+        double windows = 0, decisions = 0, depth = 0;
+
+        for(int x = x_start; x < process_width; x += x_step) {
+            int window_decisions;
+            int const stage = ep_classifier_classify_depth(&heatmap->classifier, scan_line + x, level->step, &window_decisions);
+            ++exits[stage];
+            ++windows;
+            decisions += window_decisions;
+            depth += stage;
+            heat_line[x] = (unsigned char)( 255 * stage / stages_count );
+        }
+
+        //Windows skipped by checkerboard take value of their neighbour
+        if(x_step == 2) {
+            for(int x = 1 - x_start; x < process_width; x += 2)
+                heat_line[x] = x ? heat_line[x - 1] : ( process_width > 1 ? heat_line[1] : 0 );
+        }
+
+        #pragma omp critical(heatmap_stats)
+        {
+            for(int i = 0; i <= stages_count; ++i)
+                heatmap->exits[i] += exits[i];
+            heatmap->windows += windows;
+            heatmap->decisions += decisions;
+            stats->windows += windows;
+            stats->decisions += decisions;
+            stats->depth += depth;
+        }
+    }
+}
+
+/**
+ * Profile all windows of image pyramid (@see ep_cascade_heatmap_add_image)
+ */
+EpErrorCode ep_cascade_heatmap_add_image (
+    EpCascadeHeatmap       *const heatmap,
+    EpImage          const *const image,
+    EpScanMode              const scan_mode
+) {
+    heatmap->scan_mode = scan_mode;
+    heatmap->error = ERR_SUCCESS;
+    heatmap->levels_count = 0;
+
+    EpErrorCode const result = ep_image_pyramid_visit (
+        image,
+        heatmap->window_width,
+        heatmap->window_height,
+        profile_level,
+        heatmap
+    );
+
+    return result != ERR_SUCCESS ? result : heatmap->error;
+}
+
+int ep_cascade_heatmap_levels_count(EpCascadeHeatmap const *const heatmap) {
+    return heatmap->levels_count;
+}
+
+EpImage const *ep_cascade_heatmap_level (
+    EpCascadeHeatmap const *const heatmap,
+    int                     const level_index,
+    float                  *const scale
+) {
+    if(scale)
+        *scale = heatmap->level_stats[level_index].scale;
+    return heatmap->levels + level_index;
+}
+
+/**
+ * Write stage-exit histogram and per-level averages (@see ep_cascade_heatmap_save_report)
+ */
+EpErrorCode ep_cascade_heatmap_save_report(EpCascadeHeatmap const *const heatmap, char const *const file_name) {
+    FILE *const file = fopen(file_name, "wt");
+    if(!file)
+        return ERR_FILE;
+
+    double const windows = heatmap->windows > 0 ? heatmap->windows : 1;
+
+    double depth = 0;
+    for(int i = 0; i <= heatmap->stages_count; ++i)
+        depth += i * heatmap->exits[i];
+
+    fprintf(file, "Windows:                        %.0f\n", heatmap->windows);
+    fprintf(file, "Stages:                         %d\n", heatmap->stages_count);
+    fprintf(file, "Decisions per window:           %.2f\n", heatmap->decisions / windows);
+    fprintf(file, "Mean exit stage:                %.2f\n", depth / windows);
+
+    fprintf(file, "\nStage      Rejected  Rejected %%  Reached %%\n");
+    double reached = heatmap->windows;
+    for(int i = 0; i < heatmap->stages_count; ++i) {
+        fprintf(file, "%5d  %12.0f  %10.3f  %9.3f\n", i, heatmap->exits[i], 100 * heatmap->exits[i] / windows, 100 * reached / windows);
+        reached -= heatmap->exits[i];
+    }
+    fprintf(file, "passed %12.0f  %10.3f  %9.3f\n", heatmap->exits[heatmap->stages_count],
+            100 * heatmap->exits[heatmap->stages_count] / windows, 100 * reached / windows);
+
+    fprintf(file, "\nLevel   Scale       Windows  Decisions per window  Mean exit stage\n");
+    for(int i = 0; i < heatmap->level_stats_count; ++i) {
+        EpHeatmapLevelStats const *const stats = heatmap->level_stats + i;
+        double const level_windows = stats->windows > 0 ? stats->windows : 1;
+        fprintf(file, "%5d  %6.3f  %12.0f  %20.2f  %15.2f\n", i, stats->scale, stats->windows,
+                stats->decisions / level_windows, stats->depth / level_windows);
+    }
+
+    return fclose(file) ? ERR_FILE : ERR_SUCCESS;
+}
+
+void ep_cascade_heatmap_release(EpCascadeHeatmap *const heatmap) {
+    if(!heatmap)
+        return;
+
+    for(int i = 0; i < heatmap->levels_capacity; ++i)
+        ep_image_release(heatmap->levels + i);
+    free(heatmap->levels);
+    free(heatmap->level_stats);
+    free(heatmap->exits);
+    ep_classifier_release(&heatmap->classifier);
+    free(heatmap);
+}
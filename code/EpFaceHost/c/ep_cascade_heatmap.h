@@ -0,0 +1,109 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Cascade-depth profiler.
+ *
+ * Every window of the detection pyramid is classified while recording the stage at which
+ * cascade exited and the number of decisions evaluated. Results are a heatmap per pyramid
+ * level of the last profiled image (brighter means deeper) and a stage-exit histogram
+ * accumulated over all profiled images. Used to tune scan patterns, prefilters and
+ * cascade ordering on real content.
+ */
+
+#ifndef EP_CASCADE_HEATMAP_H
+#define EP_CASCADE_HEATMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+/**
+ * Statistics of cascade depth and heatmaps of the last image
+ */
+typedef struct EpCascadeHeatmap EpCascadeHeatmap;
+
+/**
+ * Create empty profile.
+ * @param classifier: valid classifier (any encoding); profile keeps its own copy.
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- success;
+ *                  ERR_ARGUMENT -- invalid classifier;
+ *                  ERR_MEMORY -- cannot allocate profile.
+ * @return profile, or NULL in case of any error.
+ */
+EpCascadeHeatmap *ep_cascade_heatmap_create (
+    EpCascadeClassifier const *const classifier,
+    EpErrorCode               *const error_code
+);
+
+/**
+ * Classify all windows of image scale pyramid (the same pyramid as detection uses), add them to
+ *   the histogram and replace heatmaps with the ones of this image.
+ * @param heatmap  : profile to update;
+ * @param image    : valid image; it is not modified;
+ * @param scan_mode: which windows to classify (@see EpScanMode); windows skipped by checkerboard
+ *                   take heatmap value of their left neighbour.
+ * @return ERR_SUCCESS; ERR_ARGUMENT if image is empty; ERR_MEMORY if pyramid or heatmaps cannot be allocated.
+ */
+EpErrorCode ep_cascade_heatmap_add_image (
+    EpCascadeHeatmap       *const heatmap,
+    EpImage          const *const image,
+    EpScanMode              const scan_mode
+);
+
+/**
+ * Get number of pyramid levels of the last profiled image.
+ */
+int ep_cascade_heatmap_levels_count(EpCascadeHeatmap const *const heatmap);
+
+/**
+ * Get heatmap of pyramid level of the last profiled image. Heatmap has the size of the level;
+ *   pixel at window centre is 255 * exit stage / stages count (255 for detected objects),
+ *   border pixels where no window is centred are zero.
+ * @param heatmap    : profile;
+ * @param level_index: index of pyramid level (0 is the source image);
+ * @param scale      : receives scale factor of the level (may be NULL).
+ * @return heatmap image owned by profile; valid until next ep_cascade_heatmap_add_image() call.
+ */
+EpImage const *ep_cascade_heatmap_level (
+    EpCascadeHeatmap const *const heatmap,
+    int                     const level_index,
+    float                  *const scale
+);
+
+/**
+ * Write text report: windows rejected by each stage (count, percentage and percentage of windows
+ *   reaching the stage), average decisions evaluated per window, and the same averages per level.
+ * @param heatmap  : profile with at least one image added;
+ * @param file_name: pointer to file name (null-terminated string).
+ * @return ERR_SUCCESS; ERR_FILE if file cannot be written.
+ */
+EpErrorCode ep_cascade_heatmap_save_report(EpCascadeHeatmap const *const heatmap, char const *const file_name);
+
+/**
+ * Release profile
+ */
+void ep_cascade_heatmap_release(EpCascadeHeatmap *const heatmap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//EP_CASCADE_HEATMAP_H
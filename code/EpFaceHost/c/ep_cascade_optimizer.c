@@ -0,0 +1,537 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Profile-guided cascade optimizer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ep_cascade_detector.h"
+#include "ep_cascade_optimizer.h"
+
+/**
+ * Profile of one stage
+ */
+typedef struct {
+    /// Decisions of the stage are profile->decisions[first .. first + count - 1]
+    int first, count;
+    int threshold;
+    /// Number of windows which reached the stage
+    double windows;
+    /// Reservoir sample of windows reached the stage: samples_count rows of count decisions (0 or 1)
+    unsigned char *hits;
+    int samples_count;
+} EpProfileStage;
+
+struct EpCascadeProfile {
+    EpNodeMeta meta;
+    /// Decisions in classifier order
+    EpNodeDecision *decisions;
+    int decisions_count;
+    EpProfileStage *stages;
+    int stages_count;
+    /// Number of windows profiled
+    double windows;
+    /// State of random generator used for reservoir sampling (fixed seed, so results are reproducible)
+    unsigned long long random;
+    /// Decisions of window being profiled
+    unsigned char *window_hits;
+};
+
+/**
+ * Create empty profile of classifier (@see ep_cascade_profile_create)
+ */
+EpCascadeProfile *ep_cascade_profile_create (
+    EpCascadeClassifier const *const classifier,
+    EpErrorCode               *const error_code
+) {
+    if( ep_classifier_check(classifier) || ep_classifier_is_compact(classifier) ) {
+        if(error_code) *error_code = ERR_ARGUMENT;
+        return NULL;
+    }
+
+    char const *const nodes = classifier->data + sizeof(EpNodeMeta);
+    char const *const nodes_end = classifier->data + classifier->size - sizeof(EpNodeFinal);
+
+    int decisions_count = 0, stages_count = 0;
+    for(char const *node = nodes; node < nodes_end; ) {
+        if(*(int const *)node == NODE_DECISION) {
+            ++decisions_count;
+            node += sizeof(EpNodeDecision);
+        } else {
+            if(*(int const *)node == NODE_STAGE)
+                ++stages_count;
+            node += sizeof(EpNodeStage); //EpNodeBound has the same size
+        }
+    }
+
+    EpCascadeProfile *const profile = (EpCascadeProfile *)calloc( 1, sizeof(EpCascadeProfile) );
+    if(!profile) {
+        if(error_code) *error_code = ERR_MEMORY;
+        return NULL;
+    }
+
+    profile->meta = *(EpNodeMeta const *)classifier->data;
+    profile->decisions = (EpNodeDecision *)malloc( decisions_count * sizeof(EpNodeDecision) );
+    profile->stages = (EpProfileStage *)calloc( stages_count + 1, sizeof(EpProfileStage) ); //One spare item for loop below
+    profile->window_hits = (unsigned char *)malloc(decisions_count);
+    profile->random = 1;
+
+    if(!profile->decisions || !profile->stages || !profile->window_hits) {
+        ep_cascade_profile_release(profile);
+        if(error_code) *error_code = ERR_MEMORY;
+        return NULL;
+    }
+
+    EpProfileStage *stage = profile->stages;
+    for(char const *node = nodes; node < nodes_end; ) {
+        if(*(int const *)node == NODE_DECISION) {
+            memcpy(profile->decisions + profile->decisions_count++, node, sizeof(EpNodeDecision));
+            ++stage->count;
+            node += sizeof(EpNodeDecision);
+        } else {
+            if(*(int const *)node == NODE_STAGE) {
+                stage->threshold = ((EpNodeStage const *)node)->threshold;
+                stage->hits = (unsigned char *)malloc(MAX_PROFILE_SAMPLES * stage->count);
+                if(!stage->hits) {
+                    ep_cascade_profile_release(profile);
+                    if(error_code) *error_code = ERR_MEMORY;
+                    return NULL;
+                }
+                ++profile->stages_count;
+                ++stage;
+                stage->first = profile->decisions_count;
+            }
+            node += sizeof(EpNodeStage);
+        }
+    }
+
+    if(error_code) *error_code = ERR_SUCCESS;
+    return profile;
+}
+
+/**
+ * Add decisions of one window to reservoir sample of stage
+ */
+static void profile_stage_sample(EpCascadeProfile *const profile, EpProfileStage *const stage) {
+    int row;
+
+    if(stage->samples_count < MAX_PROFILE_SAMPLES) {
+        row = stage->samples_count++;
+    } else {
+        profile->random = profile->random * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned long long const index = (profile->random >> 11) % (unsigned long long)stage->windows;
+        if(index >= MAX_PROFILE_SAMPLES)
+            return;
+        row = (int)index;
+    }
+
+    memcpy(stage->hits + row * stage->count, profile->window_hits, stage->count);
+}
+
+/**
+ * Profile all windows of one pyramid level (@see EpPyramidVisitor)
+ */
+static void profile_level (
+    EpImage const *const level,
+    int            const level_index,
+    float          const scale,
+    int            const offset_x,
+    int            const offset_y,
+    void          *const context
+) {
+    EpCascadeProfile *const profile = (EpCascadeProfile *)context;
+
+    int const process_width  = level->width  + 1 - profile->meta.window_width,
+              process_height = level->height + 1 - profile->meta.window_height;
+
+    //Checkerboard scanning pattern as in detection
+    for(int y = 0; y < process_height; ++y) {
+        unsigned char const *const scan_line = level->data + y * level->step;
+
+        for(int x = y & 1; x < process_width; x += 2) {
+            ++profile->windows;
+
+            for(int stage_index = 0; stage_index < profile->stages_count; ++stage_index) {
+                EpProfileStage *const stage = profile->stages + stage_index;
+                EpNodeDecision const *const decisions = profile->decisions + stage->first;
+
+                int object_score = 0;
+                for(int i = 0; i < stage->count; ++i) {
+                    int const hit = ep_classifier_node_decision((char const *)(decisions + i), scan_line + x, level->step);
+                    profile->window_hits[i] = hit;
+                    object_score += decisions[i].score & -hit;
+                }
+
+                ++stage->windows;
+                profile_stage_sample(profile, stage);
+
+                if(object_score < stage->threshold)
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Profile classifier over scale pyramid of image (@see ep_cascade_profile_add_image)
+ */
+EpErrorCode ep_cascade_profile_add_image(EpCascadeProfile *const profile, EpImage const *const image) {
+    return ep_image_pyramid_visit (
+        image,
+        profile->meta.window_width,
+        profile->meta.window_height,
+        profile_level,
+        profile
+    );
+}
+
+/**
+ * Modeled cost of decision: pixel loads depend on LBP block size (@see calc_lbp_decision)
+ */
+static int decision_cost(EpNodeDecision const *const decision) {
+    int const feature_width  =  decision->feature       & 255,
+              feature_height = (decision->feature >> 8) & 255;
+
+    int const loads = feature_width == 1 && feature_height == 1 ? 9 :
+                      feature_width == 1 || feature_height == 1 ? 18 : 36;
+
+    return DECISION_BASE_COST + loads;
+}
+
+/**
+ * Greatest amount decision can add to stage sum
+ */
+static int positive_part(int const score) {
+    return score > 0 ? score : 0;
+}
+
+/**
+ * Order decisions of stage greedily: the next decision is the one that lets the bound after it
+ *   reject most sampled windows per unit of cost; if no decision rejects anything, the one that
+ *   lowers the bound most on average per unit of cost.
+ * @param order: receives indices of stage decisions in new order.
+ */
+static void optimize_stage_order (
+    EpProfileStage const *const stage,
+    EpNodeDecision const *const decisions,
+    int                  *const order,
+    int                  *const sums,
+    unsigned char        *const alive,
+    unsigned char        *const used
+) {
+    int remaining = 0; //Greatest amount remaining decisions can add
+    for(int i = 0; i < stage->count; ++i) {
+        remaining += positive_part(decisions[i].score);
+        used[i] = 0;
+    }
+
+    memset(sums, 0, stage->samples_count * sizeof(int));
+    memset(alive, 1, stage->samples_count);
+
+    for(int position = 0; position < stage->count; ++position) {
+        int best = -1;
+        double best_rejected = 0, best_drop = 0;
+
+        for(int i = 0; i < stage->count; ++i) {
+            if(used[i])
+                continue;
+
+            int const score = decisions[i].score;
+            int const bound = stage->threshold - (remaining - positive_part(score));
+
+            int rejected = 0;
+            double drop = 0;
+            for(int sample = 0; sample < stage->samples_count; ++sample) {
+                if(!alive[sample])
+                    continue;
+                int const hit = stage->hits[sample * stage->count + i];
+                if(sums[sample] + (score & -hit) < bound)
+                    ++rejected;
+                drop += positive_part(score) - (score & -hit);
+            }
+
+            double const cost = decision_cost(decisions + i);
+            double const rejected_per_cost = rejected / cost, drop_per_cost = drop / cost;
+
+            if( best < 0 || rejected_per_cost > best_rejected ||
+                (rejected_per_cost == best_rejected && drop_per_cost > best_drop) ) {
+                best = i;
+                best_rejected = rejected_per_cost;
+                best_drop = drop_per_cost;
+            }
+        }
+
+        order[position] = best;
+        used[best] = 1;
+
+        int const score = decisions[best].score;
+        remaining -= positive_part(score);
+        for(int sample = 0; sample < stage->samples_count; ++sample) {
+            if(!alive[sample])
+                continue;
+            sums[sample] += score & -stage->hits[sample * stage->count + best];
+            if(sums[sample] < stage->threshold - remaining)
+                alive[sample] = 0;
+        }
+    }
+}
+
+/**
+ * Choose positions of bounds for given order of stage decisions.
+ *   Sum plus greatest remaining amount never grows along the stage, so every sampled window has
+ *   the first position after which it is rejectable; it leaves the stage at the first bound
+ *   at or after that position. Bound set minimizing modeled cost of the sample is found by
+ *   dynamic programming over positions of the last bound.
+ * @param bounds: receives 1 for positions followed by bound (the last position is never one).
+ * @return modeled cost of sample with chosen bounds.
+ */
+static double optimize_stage_bounds (
+    EpProfileStage const *const stage,
+    EpNodeDecision const *const decisions,
+    int            const *const order,
+    unsigned char        *const bounds,
+    double               *const decisions_evaluated
+) {
+    int const count = stage->count;
+
+    //prefix_cost[k]: cost of decisions at positions 0..k; exits[k]: samples first rejectable after position k
+    double *const prefix_cost = (double *)malloc( count * sizeof(double) );
+    int *const exits = (int *)calloc( count + 1, sizeof(int) );
+    int *const remaining_after = (int *)malloc( count * sizeof(int) );
+    double *const best_cost = (double *)malloc( count * sizeof(double) );
+    int *const best_previous = (int *)malloc( count * sizeof(int) );
+
+    memset(bounds, 0, count);
+    *decisions_evaluated = 0;
+
+    if(!prefix_cost || !exits || !remaining_after || !best_cost || !best_previous) {
+        free(prefix_cost); free(exits); free(remaining_after); free(best_cost); free(best_previous);
+        *decisions_evaluated = count;
+        return -1;
+    }
+
+    double cost = 0;
+    int remaining = 0;
+    for(int position = count - 1; position >= 0; --position) {
+        remaining_after[position] = remaining;
+        remaining += positive_part(decisions[order[position]].score);
+    }
+    for(int position = 0; position < count; ++position) {
+        cost += decision_cost(decisions + order[position]);
+        prefix_cost[position] = cost;
+    }
+
+    for(int sample = 0; sample < stage->samples_count; ++sample) {
+        int sum = 0, position = 0;
+        for(; position < count; ++position) {
+            int const index = order[position];
+            sum += decisions[index].score & -stage->hits[sample * count + index];
+            if(sum < stage->threshold - remaining_after[position])
+                break;
+        }
+        ++exits[position];
+    }
+
+    //later[k]: samples first rejectable after position k or later
+    int *const later = exits; //Reused in place as suffix sums
+    for(int position = count - 1; position >= 0; --position)
+        later[position] += later[position + 1];
+
+    //best_cost[b]: cost of samples which leave stage at or before bound b, for the best bounds up to b.
+    //Previous bound a == -1 means no bound; later[a + 1] samples are alive after bound a
+    for(int b = 0; b < count - 1; ++b) {
+        best_cost[b] = -1;
+        for(int a = -1; a < b; ++a) {
+            double const leaving = later[a + 1] - later[b + 1];
+            double const value = (a < 0 ? 0 : best_cost[a]) +
+                                 leaving * prefix_cost[b] + later[a + 1] * BOUND_COST;
+            if(best_cost[b] < 0 || value < best_cost[b]) {
+                best_cost[b] = value;
+                best_previous[b] = a;
+            }
+        }
+    }
+
+    double total = -1;
+    int last = -1;
+    for(int a = -1; a < count - 1; ++a) {
+        double const value = (a < 0 ? 0 : best_cost[a]) + later[a + 1] * (prefix_cost[count - 1] + BOUND_COST);
+        if(total < 0 || value < total) {
+            total = value;
+            last = a;
+        }
+    }
+
+    for(int b = last; b >= 0; b = best_previous[b])
+        bounds[b] = 1;
+
+    //Decisions evaluated by sampled windows with chosen bounds
+    int previous = -1;
+    for(int b = 0; b < count; ++b) {
+        if(b < count - 1 && !bounds[b])
+            continue;
+        *decisions_evaluated += (double)(later[previous + 1] - (b < count - 1 ? later[b + 1] : 0)) * (b + 1);
+        previous = b;
+    }
+
+    free(prefix_cost); free(exits); free(remaining_after); free(best_cost); free(best_previous);
+    return total;
+}
+
+/**
+ * Build optimized classifier from profile (@see ep_classifier_optimize)
+ */
+EpCascadeClassifier ep_classifier_optimize (
+    EpCascadeProfile const *const profile,
+    EpCascadeOptimizeReport *const report
+) {
+    EpCascadeClassifier result = ep_classifier_create_empty();
+
+    int max_count = 0;
+    for(int stage_index = 0; stage_index < profile->stages_count; ++stage_index)
+        if(profile->stages[stage_index].count > max_count)
+            max_count = profile->stages[stage_index].count;
+
+    int *const orders = (int *)malloc( profile->decisions_count * sizeof(int) );
+    unsigned char *const bounds = (unsigned char *)malloc(profile->decisions_count);
+    int *const sums = (int *)malloc( MAX_PROFILE_SAMPLES * sizeof(int) );
+    unsigned char *const alive = (unsigned char *)malloc(MAX_PROFILE_SAMPLES);
+    unsigned char *const used = (unsigned char *)malloc(max_count);
+
+    EpCascadeOptimizeReport summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.windows = profile->windows;
+    summary.stages_count = profile->stages_count;
+    summary.decisions_count = profile->decisions_count;
+
+    int failed = !orders || !bounds || !sums || !alive || !used;
+
+    for(int stage_index = 0; stage_index < profile->stages_count && !failed; ++stage_index) {
+        EpProfileStage const *const stage = profile->stages + stage_index;
+        EpNodeDecision const *const decisions = profile->decisions + stage->first;
+        int *const order = orders + stage->first;
+        unsigned char *const stage_bounds = bounds + stage->first;
+
+        double cost_before = BOUND_COST;
+        for(int i = 0; i < stage->count; ++i)
+            cost_before += decision_cost(decisions + i);
+        summary.cost_before += stage->windows * cost_before;
+        summary.decisions_before += stage->windows * stage->count;
+
+        if(!stage->samples_count) { //No window reached the stage; nothing to optimize
+            for(int i = 0; i < stage->count; ++i)
+                order[i] = i;
+            memset(stage_bounds, 0, stage->count);
+            continue;
+        }
+
+        optimize_stage_order(stage, decisions, order, sums, alive, used);
+
+        double decisions_evaluated;
+        double const cost = optimize_stage_bounds(stage, decisions, order, stage_bounds, &decisions_evaluated);
+        if(cost < 0) {
+            failed = 1;
+            break;
+        }
+
+        //Sample represents all windows reached the stage
+        double const weight = stage->windows / stage->samples_count;
+        summary.cost_after += weight * cost;
+        summary.decisions_after += weight * decisions_evaluated;
+
+        for(int i = 0; i < stage->count; ++i)
+            summary.bounds_count += stage_bounds[i];
+    }
+
+    if(!failed) {
+        int const size = sizeof(EpNodeMeta) + profile->decisions_count * sizeof(EpNodeDecision) +
+            (summary.bounds_count + profile->stages_count) * sizeof(EpNodeStage) + sizeof(EpNodeFinal);
+
+        result.data = (char *)malloc(size);
+        if(result.data) {
+            result.size = size;
+            memcpy(result.data, &profile->meta, sizeof(EpNodeMeta));
+            char *cur_node = result.data + sizeof(EpNodeMeta);
+
+            for(int stage_index = 0; stage_index < profile->stages_count; ++stage_index) {
+                EpProfileStage const *const stage = profile->stages + stage_index;
+                EpNodeDecision const *const decisions = profile->decisions + stage->first;
+                int const *const order = orders + stage->first;
+
+                int remaining = 0;
+                for(int i = 0; i < stage->count; ++i)
+                    remaining += positive_part(decisions[i].score);
+
+                for(int position = 0; position < stage->count; ++position) {
+                    memcpy(cur_node, decisions + order[position], sizeof(EpNodeDecision));
+                    cur_node += sizeof(EpNodeDecision);
+                    remaining -= positive_part(decisions[order[position]].score);
+
+                    if(bounds[stage->first + position]) {
+                        EpNodeBound const node_bound = {NODE_BOUND, stage->threshold - remaining};
+                        memcpy(cur_node, &node_bound, sizeof(node_bound));
+                        cur_node += sizeof(EpNodeBound);
+                    }
+                }
+
+                EpNodeStage const node_stage = {NODE_STAGE, stage->threshold};
+                memcpy(cur_node, &node_stage, sizeof(node_stage));
+                cur_node += sizeof(EpNodeStage);
+            }
+
+            EpNodeFinal const node_final = {NODE_FINAL};
+            memcpy(cur_node, &node_final, sizeof(node_final));
+        }
+    }
+
+    if(summary.windows > 0) {
+        summary.cost_before /= summary.windows;
+        summary.cost_after /= summary.windows;
+        summary.decisions_before /= summary.windows;
+        summary.decisions_after /= summary.windows;
+    }
+    if(report)
+        *report = summary;
+
+    free(orders);
+    free(bounds);
+    free(sums);
+    free(alive);
+    free(used);
+
+    return result;
+}
+
+/**
+ * Release profile
+ */
+void ep_cascade_profile_release(EpCascadeProfile *const profile) {
+    if(!profile)
+        return;
+
+    if(profile->stages)
+        for(int stage_index = 0; stage_index <= profile->stages_count; ++stage_index)
+            free(profile->stages[stage_index].hits);
+
+    free(profile->stages);
+    free(profile->decisions);
+    free(profile->window_hits);
+    free(profile);
+}
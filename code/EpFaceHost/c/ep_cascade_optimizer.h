@@ -0,0 +1,110 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Profile-guided cascade optimizer.
+ *
+ * Profile records which decisions hit for windows of representative images. Optimizer
+ * reorders decisions inside each stage (cheap and discriminative ones first) and inserts
+ * partial sum bounds (@see EpNodeBound) where the stage can no longer pass. Stage sums are
+ * not changed by reordering and bounds reject only windows the stage would reject anyway,
+ * so optimized classifier finds exactly the same objects.
+ */
+
+#ifndef EP_CASCADE_OPTIMIZER_H
+#define EP_CASCADE_OPTIMIZER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+typedef enum {
+    /// Windows kept per stage for optimization (reservoir sample of all windows reaching the stage)
+    MAX_PROFILE_SAMPLES = 4096,
+    /// Modeled cost of EpNodeBound and EpNodeStage check, in the units of EpCascadeOptimizeReport
+    BOUND_COST = 2,
+    /// Modeled cost of decision without pixel loads (LBP code, subset lookup, score)
+    DECISION_BASE_COST = 8
+} EpCascadeOptimizerConstants;
+
+/**
+ * Statistics of classifier evaluation over profiled images
+ */
+typedef struct EpCascadeProfile EpCascadeProfile;
+
+/**
+ * Result of optimization. Costs are modeled: pixel loads of decision (9, 18 or 36 depending on
+ *   LBP block size) plus DECISION_BASE_COST, and BOUND_COST per checked bound or stage.
+ */
+typedef struct {
+    /// Number of windows profiled
+    double windows;
+    int stages_count, decisions_count;
+    /// Number of bounds in optimized classifier
+    int bounds_count;
+    /// Average number of decisions evaluated per window
+    double decisions_before, decisions_after;
+    /// Average modeled cost per window
+    double cost_before, cost_after;
+} EpCascadeOptimizeReport;
+
+/**
+ * Create empty profile of classifier.
+ * @param classifier: valid classifier in standard encoding; bounds of already optimized one are ignored.
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- success;
+ *                  ERR_ARGUMENT -- invalid or compact classifier;
+ *                  ERR_MEMORY -- cannot allocate profile.
+ * @return profile, or NULL in case of any error. Profile keeps its own copy of classifier.
+ */
+EpCascadeProfile *ep_cascade_profile_create (
+    EpCascadeClassifier const *const classifier,
+    EpErrorCode               *const error_code
+);
+
+/**
+ * Run classifier over all windows of image scale pyramid (the same pyramid and checkerboard
+ *   scan pattern as detection uses) and add evaluated decisions to profile.
+ * @param profile: profile to update;
+ * @param image  : valid image; it is not modified.
+ * @return ERR_SUCCESS; ERR_ARGUMENT if image is empty; ERR_MEMORY if pyramid cannot be allocated.
+ */
+EpErrorCode ep_cascade_profile_add_image(EpCascadeProfile *const profile, EpImage const *const image);
+
+/**
+ * Build optimized classifier from profile.
+ * @param profile: profile with at least one image added;
+ * @param report : receives expected effect of optimization (may be NULL).
+ * @return optimized classifier; empty classifier in case of memory allocation failure.
+ */
+EpCascadeClassifier ep_classifier_optimize (
+    EpCascadeProfile const *const profile,
+    EpCascadeOptimizeReport *const report
+);
+
+/**
+ * Release profile
+ */
+void ep_cascade_profile_release(EpCascadeProfile *const profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//EP_CASCADE_OPTIMIZER_H
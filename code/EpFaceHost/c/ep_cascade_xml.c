@@ -0,0 +1,544 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Loader of OpenCV LBP cascades (.xml files written by opencv_traincascade).
+ *
+ * File is read in one pass by a small streaming XML reader; only elements used by
+ * the detector are kept. Conversion to EpCascadeClassifier is the same as
+ * ep::convert_cascade() does for cv::CascadeClassifier, but OpenCV ObjDetect
+ * is not needed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <opencv/cv.h>
+
+#include "ep_cascade_detector.h"
+
+typedef enum {
+    /// Maximal nesting depth of XML elements
+    XML_MAX_DEPTH = 16,
+    /// Maximal length of XML element name (including terminating zero)
+    XML_MAX_NAME = 32,
+    /// Maximal length of XML element text (including terminating zero); longer texts are only skipped
+    XML_MAX_TEXT = 1024
+} EpXmlLimits;
+
+/**
+ * Streaming XML reader. Keeps names of open elements and text of the innermost one.
+ */
+typedef struct {
+    FILE *file;
+    /// Number of open elements
+    int depth;
+    char names[XML_MAX_DEPTH][XML_MAX_NAME];
+    /// Text of current element since its last child element
+    char text[XML_MAX_TEXT];
+    int text_length;
+    /// Non-zero if text did not fit into buffer
+    int text_overflow;
+} EpXmlReader;
+
+/**
+ * Skip input up to and including given terminator.
+ * @return non-zero on success; zero on end of file.
+ */
+static int xml_skip_to(EpXmlReader *const reader, char const *const terminator) {
+    int const length = strlen(terminator);
+    int matched = 0;
+
+    while(matched < length) {
+        int const c = getc(reader->file);
+        if(c == EOF)
+            return 0;
+
+        if(c == terminator[matched])
+            ++matched;
+        else
+            matched = (c == terminator[0]) ? 1 : 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Read element name and the rest of the tag.
+ * @param name: receives element name.
+ * @param empty: receives non-zero if element is self-closing ( <name/> ).
+ * @return non-zero on success; zero on bad tag or end of file.
+ */
+static int xml_read_tag(EpXmlReader *const reader, char *const name, int *const empty) {
+    int length = 0;
+    int c = getc(reader->file);
+
+    while( c != EOF && c != '>' && c != '/' && c != ' ' && c != '\t' && c != '\r' && c != '\n' ) {
+        if(length + 1 >= XML_MAX_NAME)
+            return 0;
+        name[length++] = c;
+        c = getc(reader->file);
+    }
+    name[length] = 0;
+
+    //Attributes are skipped
+    int last = c;
+    while(c != EOF && c != '>') {
+        if(c == '"' || c == '\'') {
+            int const quote = c;
+            do { c = getc(reader->file); } while(c != EOF && c != quote);
+            if(c == EOF)
+                return 0;
+        }
+        last = c;
+        c = getc(reader->file);
+    }
+
+    *empty = (last == '/');
+    return length > 0 && c == '>';
+}
+
+/**
+ * Read XML up to the end of next element.
+ *   After successful call reader->names[0 .. reader->depth] is path of closed element,
+ *   and reader->text is its text (if it has no child elements).
+ * @return 1 if element is closed; 0 on end of file; -1 on bad XML.
+ */
+static int xml_next_element(EpXmlReader *const reader) {
+    reader->text_length = 0;
+    reader->text_overflow = 0;
+
+    for(;;) {
+        int const c = getc(reader->file);
+
+        if(c == EOF)
+            return reader->depth == 0 ? 0 : -1;
+
+        if(c != '<') {
+            if(reader->text_length + 1 < XML_MAX_TEXT)
+                reader->text[reader->text_length++] = c;
+            else
+                reader->text_overflow = 1;
+            continue;
+        }
+
+        int const next = getc(reader->file);
+
+        if(next == '?') { //Processing instruction
+            if( !xml_skip_to(reader, "?>") )
+                return -1;
+        } else if(next == '!') { //Comment, DOCTYPE or CDATA (CDATA is not used by OpenCV)
+            int const dash1 = getc(reader->file);
+            int const dash2 = (dash1 == '-') ? getc(reader->file) : EOF;
+            if( !xml_skip_to(reader, (dash1 == '-' && dash2 == '-') ? "-->" : ">") )
+                return -1;
+        } else if(next == '/') { //End of element
+            char name[XML_MAX_NAME];
+            int empty;
+            if( !xml_read_tag(reader, name, &empty) || reader->depth == 0 ||
+                strcmp(name, reader->names[reader->depth - 1]) )
+                return -1;
+            --reader->depth;
+            reader->text[reader->text_length] = 0;
+            return 1;
+        } else if(next != EOF) { //Start of element
+            if(reader->depth == XML_MAX_DEPTH)
+                return -1;
+            ungetc(next, reader->file);
+            int empty;
+            if( !xml_read_tag(reader, reader->names[reader->depth], &empty) )
+                return -1;
+            reader->text_length = 0;
+            reader->text_overflow = 0;
+            if(empty) {
+                reader->text[0] = 0;
+                return 1;
+            }
+            ++reader->depth;
+        } else {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Check path of element just closed by xml_next_element().
+ * @param path: element names separated by '/' starting from the root element.
+ */
+static int xml_path_is(EpXmlReader const *const reader, char const *path) {
+    for(int level = 0; level <= reader->depth; ++level) {
+        int const length = strlen(reader->names[level]);
+        if( strncmp(path, reader->names[level], length) )
+            return 0;
+        path += length;
+        if(level < reader->depth && *path++ != '/')
+            return 0;
+    }
+    return *path == 0;
+}
+
+/**
+ * Parse whitespace separated numbers from element text.
+ * @return number of values parsed (up to max_count + 1 to detect extra values); -1 on bad number.
+ */
+static int xml_parse_ints(EpXmlReader const *const reader, int *const values, int const max_count) {
+    char const *cur = reader->text;
+    int count = 0;
+
+    for(;;) {
+        char *end;
+        long const value = strtol(cur, &end, 10);
+        if(end == cur)
+            break;
+        if(count < max_count)
+            values[count] = (int)value;
+        if(++count > max_count)
+            break;
+        cur = end;
+    }
+
+    while(*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')
+        ++cur;
+
+    return (*cur && count <= max_count) || reader->text_overflow ? -1 : count;
+}
+
+static int xml_parse_floats(EpXmlReader const *const reader, float *const values, int const max_count) {
+    char const *cur = reader->text;
+    int count = 0;
+
+    for(;;) {
+        char *end;
+        double const value = strtod(cur, &end);
+        if(end == cur)
+            break;
+        if(count < max_count)
+            values[count] = (float)value;
+        if(++count > max_count)
+            break;
+        cur = end;
+    }
+
+    while(*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')
+        ++cur;
+
+    return (*cur && count <= max_count) || reader->text_overflow ? -1 : count;
+}
+
+/**
+ * Check that text of element is given word (surrounding whitespace is ignored)
+ */
+static int xml_text_is(EpXmlReader const *const reader, char const *const word) {
+    char const *cur = reader->text;
+    while(*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')
+        ++cur;
+
+    int const length = strlen(word);
+    if( strncmp(cur, word, length) )
+        return 0;
+    cur += length;
+
+    while(*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')
+        ++cur;
+
+    return *cur == 0;
+}
+
+/**
+ * Stump (weak classifier with single split) as it is written to .xml file
+ */
+typedef struct {
+    int feature_index;
+    int subsets[8];
+    /// Scores for feature values out of subset and in subset
+    float leaves[2];
+} EpXmlTree;
+
+typedef struct {
+    float threshold;
+    int trees_count;
+} EpXmlStage;
+
+typedef struct {
+    int x, y, width, height;
+} EpXmlFeature;
+
+/**
+ * Cascade items read so far. Features are at the end of the file,
+ *   so trees cannot be converted until whole file is read.
+ */
+typedef struct {
+    int window_width, window_height;
+    int boost_stages, lbp_features;
+
+    EpXmlTree *trees;
+    int trees_count, trees_capacity;
+    EpXmlStage *stages;
+    int stages_count, stages_capacity;
+    EpXmlFeature *features;
+    int features_count, features_capacity;
+
+    /// Item being read (flags are set when corresponding element is read)
+    EpXmlTree tree;
+    int tree_nodes_read, tree_leaves_read;
+    EpXmlStage stage;
+    int stage_threshold_read;
+} EpXmlCascade;
+
+/**
+ * Append item to growing array.
+ * @return pointer to appended item; NULL on memory allocation failure.
+ */
+static void *xml_array_append(void **const items, int *const count, int *const capacity,
+                              void const *const item, size_t const item_size) {
+    if(*count == *capacity) {
+        int const new_capacity = *capacity ? *capacity * 2 : 64;
+        void *const new_items = realloc(*items, new_capacity * item_size);
+        if(!new_items)
+            return NULL;
+        *items = new_items;
+        *capacity = new_capacity;
+    }
+    void *const result = (char *)*items + *count * item_size;
+    memcpy(result, item, item_size);
+    ++*count;
+    return result;
+}
+
+/**
+ * Handle element just closed by xml_next_element()
+ * @return ERR_SUCCESS; ERR_FILE_CONTENTS on unsupported cascade; ERR_MEMORY on memory allocation failure.
+ */
+static EpErrorCode xml_cascade_element(EpXmlCascade *const cascade, EpXmlReader const *const reader) {
+    //OpenCV subtracts it from stage thresholds to compensate float rounding
+    static float const THRESHOLD_EPS = 1e-5f;
+
+    if( xml_path_is(reader, "opencv_storage/cascade/stages/_/weakClassifiers/_/internalNodes") ) {
+        //Stumps only: left, right, feature index and 8 subset words
+        int values[11];
+        if(xml_parse_ints(reader, values, 11) != 11)
+            return ERR_FILE_CONTENTS;
+        cascade->tree.feature_index = values[2];
+        memcpy(cascade->tree.subsets, values + 3, sizeof(cascade->tree.subsets));
+        cascade->tree_nodes_read = 1;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stages/_/weakClassifiers/_/leafValues") ) {
+        if(xml_parse_floats(reader, cascade->tree.leaves, 2) != 2)
+            return ERR_FILE_CONTENTS;
+        cascade->tree_leaves_read = 1;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stages/_/weakClassifiers/_") ) {
+        if(!cascade->tree_nodes_read || !cascade->tree_leaves_read)
+            return ERR_FILE_CONTENTS;
+        if( !xml_array_append((void **)&cascade->trees, &cascade->trees_count, &cascade->trees_capacity,
+                              &cascade->tree, sizeof(cascade->tree)) )
+            return ERR_MEMORY;
+        ++cascade->stage.trees_count;
+        cascade->tree_nodes_read = cascade->tree_leaves_read = 0;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stages/_/stageThreshold") ) {
+        if(xml_parse_floats(reader, &cascade->stage.threshold, 1) != 1)
+            return ERR_FILE_CONTENTS;
+        cascade->stage.threshold -= THRESHOLD_EPS;
+        cascade->stage_threshold_read = 1;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stages/_") ) {
+        if(!cascade->stage_threshold_read || cascade->stage.trees_count == 0)
+            return ERR_FILE_CONTENTS;
+        if( !xml_array_append((void **)&cascade->stages, &cascade->stages_count, &cascade->stages_capacity,
+                              &cascade->stage, sizeof(cascade->stage)) )
+            return ERR_MEMORY;
+        cascade->stage.trees_count = 0;
+        cascade->stage_threshold_read = 0;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/features/_/rect") ) {
+        int values[4];
+        if(xml_parse_ints(reader, values, 4) != 4)
+            return ERR_FILE_CONTENTS;
+        EpXmlFeature const feature = {values[0], values[1], values[2], values[3]};
+        if( !xml_array_append((void **)&cascade->features, &cascade->features_count, &cascade->features_capacity,
+                              &feature, sizeof(feature)) )
+            return ERR_MEMORY;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stageType") ) {
+        cascade->boost_stages = xml_text_is(reader, "BOOST");
+    } else if( xml_path_is(reader, "opencv_storage/cascade/featureType") ) {
+        cascade->lbp_features = xml_text_is(reader, "LBP");
+    } else if( xml_path_is(reader, "opencv_storage/cascade/width") ) {
+        if(xml_parse_ints(reader, &cascade->window_width, 1) != 1)
+            return ERR_FILE_CONTENTS;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/height") ) {
+        if(xml_parse_ints(reader, &cascade->window_height, 1) != 1)
+            return ERR_FILE_CONTENTS;
+    } else if( xml_path_is(reader, "opencv_storage/cascade/stageParams/maxDepth") ) {
+        int max_depth = 0;
+        if(xml_parse_ints(reader, &max_depth, 1) != 1 || max_depth != 1)
+            return ERR_FILE_CONTENTS; //Only stump based cascades are supported
+    } else if( xml_path_is(reader, "opencv_storage/cascade/featureParams/maxCatCount") ) {
+        int max_cat_count = 0;
+        if(xml_parse_ints(reader, &max_cat_count, 1) != 1 || max_cat_count != 256)
+            return ERR_FILE_CONTENTS;
+    }
+
+    return ERR_SUCCESS;
+}
+
+/**
+ * Count number of unit bits in given value
+ */
+static int count_bits(unsigned int x) {
+    x = (x & 0x55555555) + ( (x >>  1) & 0x55555555 );
+    x = (x & 0x33333333) + ( (x >>  2) & 0x33333333 );
+    x = (x & 0x0F0F0F0F) + ( (x >>  4) & 0x0F0F0F0F );
+    x = (x & 0x00FF00FF) + ( (x >>  8) & 0x00FF00FF );
+    x = (x & 0x0000FFFF) + ( (x >> 16) & 0x0000FFFF );
+    return x;
+}
+
+/**
+ * Convert cascade read from file into EpCascadeClassifier (@see ep::convert_cascade)
+ * @return ERR_SUCCESS; ERR_FILE_CONTENTS on unsupported or inconsistent cascade; ERR_MEMORY on memory allocation failure.
+ */
+static EpErrorCode xml_cascade_convert(EpXmlCascade const *const cascade, EpCascadeClassifier *const classifier) {
+    if( !cascade->boost_stages || !cascade->lbp_features || !cascade->stages_count ||
+        cascade->window_width <= 0 || cascade->window_height <= 0 )
+        return ERR_FILE_CONTENTS;
+
+    for(int tree_index = 0; tree_index < cascade->trees_count; ++tree_index) {
+        int const feature_index = cascade->trees[tree_index].feature_index;
+        if(feature_index < 0 || feature_index >= cascade->features_count)
+            return ERR_FILE_CONTENTS;
+    }
+
+    //Feature rectangle is packed into bytes of EpNodeDecision::feature
+    for(int feature_index = 0; feature_index < cascade->features_count; ++feature_index) {
+        EpXmlFeature const *const feature = cascade->features + feature_index;
+        if( feature->x < 0 || feature->x > 255 || feature->y < 0 || feature->y > 255 ||
+            feature->width < 0 || feature->width > 255 || feature->height < 0 || feature->height > 255 )
+            return ERR_FILE_CONTENTS;
+    }
+
+    int const classifier_size = sizeof(EpNodeMeta) + sizeof(EpNodeDecision) * cascade->trees_count +
+                                sizeof(EpNodeStage) * cascade->stages_count + sizeof(EpNodeFinal);
+
+    classifier->data = (char *)malloc(classifier_size);
+    if(!classifier->data)
+        return ERR_MEMORY;
+    classifier->size = classifier_size;
+
+    EpNodeMeta *const node_meta = (EpNodeMeta *)classifier->data;
+    node_meta->id = NODE_META;
+    node_meta->window_width = cascade->window_width;
+    node_meta->window_height = cascade->window_height;
+
+    char *cur_node = classifier->data + sizeof(EpNodeMeta);
+    EpXmlTree const *tree = cascade->trees;
+
+    for(int stage_index = 0; stage_index < cascade->stages_count; ++stage_index) {
+        EpXmlStage const *const stage = cascade->stages + stage_index;
+
+        int node_threshold = cvRound(stage->threshold * 65535);
+
+        for(int tree_index = 0; tree_index < stage->trees_count; ++tree_index, ++tree) {
+            EpXmlFeature const *const block_rect = cascade->features + tree->feature_index;
+
+            int const score_negative = cvRound(tree->leaves[0] * 65535),
+                      score_positive = cvRound(tree->leaves[1] * 65535);
+
+            EpNodeDecision *const node_decision = (EpNodeDecision *)cur_node;
+
+            node_decision->id = NODE_DECISION;
+            node_decision->feature = block_rect->width | (block_rect->height << 8) |
+                                     (block_rect->x << 16) | (block_rect->y << 24);
+
+            int ones = 0; //Number of ones in subset
+            int subsets[8];
+            for(int subset_index = 0; subset_index < 8; ++subset_index) {
+                subsets[subset_index] = tree->subsets[subset_index];
+                ones += count_bits(subsets[subset_index]);
+            }
+
+            //Minimizing probability that value "1" will be hit in the subset
+            if(ones <= 128) {
+                node_decision->score = score_negative - score_positive;
+                node_threshold -= score_positive;
+            } else {
+                node_decision->score = score_positive - score_negative;
+                node_threshold -= score_negative;
+                for(int subset_index = 0; subset_index < 8; ++subset_index)
+                    subsets[subset_index] = ~subsets[subset_index];
+            }
+            memcpy(cur_node + offsetof(EpNodeDecision, subsets), subsets, sizeof(subsets));
+
+            cur_node += sizeof(EpNodeDecision);
+        }
+
+        EpNodeStage *const node_stage = (EpNodeStage *)cur_node;
+        node_stage->id = NODE_STAGE;
+        node_stage->threshold = node_threshold;
+
+        cur_node += sizeof(EpNodeStage);
+    }
+
+    EpNodeFinal *const node_final = (EpNodeFinal *)cur_node;
+    node_final->id = NODE_FINAL;
+
+    return ERR_SUCCESS;
+}
+
+/**
+ * Load classifier from OpenCV cascade .xml file without OpenCV ObjDetect.
+ * @param file_name: pointer to file name (null-terminated string)
+ * @param error_code: pointer to integer value which will receive the error code (@see ep_classifier_load).
+ * @return classifier loaded. Empty classifier is returned in case of any error.
+ */
+EpCascadeClassifier ep_classifier_load_xml(char const *const file_name, EpErrorCode *const error_code) {
+    EpCascadeClassifier result = ep_classifier_create_empty();
+
+    EpXmlReader reader;
+    reader.file = fopen(file_name, "rb");
+    if( !reader.file ) {
+        if(error_code) *error_code = ERR_FILE;
+        return result; //Bad file
+    }
+    reader.depth = 0;
+
+    EpXmlCascade cascade;
+    memset(&cascade, 0, sizeof(cascade));
+
+    EpErrorCode status = ERR_SUCCESS;
+    int element;
+    while( status == ERR_SUCCESS && (element = xml_next_element(&reader)) > 0 )
+        status = xml_cascade_element(&cascade, &reader);
+
+    if(status == ERR_SUCCESS && element < 0)
+        status = ERR_FILE_CONTENTS;
+    if( status == ERR_SUCCESS && ferror(reader.file) )
+        status = ERR_FILE;
+
+    fclose(reader.file);
+
+    if(status == ERR_SUCCESS)
+        status = xml_cascade_convert(&cascade, &result);
+
+    free(cascade.trees);
+    free(cascade.stages);
+    free(cascade.features);
+
+    if( status == ERR_SUCCESS && ep_classifier_check(&result) ) {
+        ep_classifier_release(&result);
+        status = ERR_FILE_CONTENTS;
+    }
+
+    if(error_code) *error_code = status;
+    return result;
+}
@@ -15,18 +15,30 @@ typedef enum {
     /// Size of Epiphany memory bank in bytes.
     BANK_SIZE = 8192,
     /// Recommended vertical and horizontal size of tile used to detect objects.
-    /// Tiles are overlapped in order to not miss detections at edges
-    RECOMMENDED_TILE_SIZE = 128,
+    /// Tiles are overlapped in order to not miss detections at edges.
+    /// Square tile of this size must fit in one tile slot (@see MAX_TILE_BYTES)
+    RECOMMENDED_TILE_SIZE = 88,
     /// Maximal allowed detections per tile. If more will be detected then some detections will be discarded
     /// Must be even value because transmitted data size is rounded up to the nearest 64 bits boundary
     MAX_DETECTIONS_PER_TILE = 16,
     /// Classifier should occupy less than one memory bank; some space is reserved for stack.
     /// This value must be dividible by 8
     MAX_CLASSIFIER_BYTES = BANK_SIZE - 512,
+    /// Larger cascades are paged (@see EpCascadePaging): part of classifier space then holds
+    /// one page of stages fetched on demand and positions of windows which survived all stages so far.
+    /// Both values must be dividible by 8
+    CASCADE_PAGE_BYTES = 2048,
+    MAX_PAGE_SURVIVORS = 128,
+    /// Space left for stages which stay resident in core when cascade is paged
+    MAX_RESIDENT_BYTES = MAX_CLASSIFIER_BYTES - CASCADE_PAGE_BYTES - MAX_PAGE_SURVIVORS * 4,
+    /// Maximal size of cascade in shared memory (paged layout included)
+    MAX_CASCADE_BYTES = 65536,
     /// Identifier (4 bytes) written to the beginning of image file (simple binary format is used)
     FILE_ID_IMAGE = 1734438217,
     /// Identifier (4 bytes) written to the beginning of classifier file (binary format is used)
     FILE_ID_CLASSIFIER = 1935764547,
+    /// Identifier (4 bytes) written to the beginning of binary detections stream (headless mode)
+    FILE_ID_DETECTIONS = 1937007940,
     /// Core frequency in MHz to convert tics to seconds
     CORE_FREQUENCY = 400,
     /// Timer divisor to prevent unsigned int overflow of total core time
@@ -40,7 +52,9 @@ typedef enum {
     /// Detection on host CPU. Fast parallel implementation
     DET_HOST = 0,
     /// Detection of Epiphany (single or multiple cores)
-    DET_DEVICE
+    DET_DEVICE,
+    /// Host threads and Epiphany cores share tasks of every frame
+    DET_HYBRID
 } EpDetectionMode;
 
 /**
@@ -128,7 +142,11 @@ typedef enum {
     /// End of classifier stage. Contains rule to reject object or go to the next stage
     NODE_STAGE = 1734440019,
     /// Last node of the classifier, meaning successful detection. May only go after the NODE_STAGE node
-    NODE_FINAL = 1819175238
+    NODE_FINAL = 1819175238,
+    /// First node of classifier in compact encoding (@see EpCompactMeta)
+    NODE_META_COMPACT = 1953525059,
+    /// Early rejection bound inside stage (@see EpNodeBound)
+    NODE_BOUND = 1853189954
 } EpNodeType;
 
 /**
@@ -176,6 +194,18 @@ typedef struct {
      int threshold;
 } __attribute__((packed)) EpNodeStage;
 
+/**
+ * Partial sum bound inserted between decisions of a stage by ep_classifier_optimize().
+ *   Remaining decisions of the stage cannot add more than stage threshold minus this threshold,
+ *   so if sum of decisions accumulated so far is less than it then stage fails right away.
+ *   Sum is not reset, and the next node is always NODE_DECISION. Same layout as EpNodeStage.
+ */
+typedef struct {
+    /// id == NODE_BOUND for EpNodeBound structure
+    int id;
+    int threshold;
+} __attribute__((packed)) EpNodeBound;
+
 /**
  * Last node of the classifier, meaning successful detection. May only go after the EpNodeStage node
  */
@@ -184,6 +214,67 @@ typedef struct {
     int id;
 } __attribute__((packed)) EpNodeFinal;
 
+/**
+ * Compact classifier encoding:
+ *   EpCompactMeta, EpCompactPart, subset tables, stages (EpCompactStage followed by its
+ *   EpCompactDecision items), terminating EpCompactStage with zero decisions_count.
+ * Decision takes 8 bytes instead of 44: equal subset tables are stored once per part,
+ *   and scores are quantized to 16 bits.
+ */
+typedef enum {
+    /// Version of compact encoding written to EpCompactMeta
+    COMPACT_CLASSIFIER_VERSION = 1,
+    /// Maximal number of subset tables in one part (limited by EpCompactDecision::subset)
+    MAX_COMPACT_SUBSETS = 65535
+} EpCompactConstants;
+
+/**
+ * First node of compact classifier. Window size is at the same place as in EpNodeMeta
+ */
+typedef struct {
+    /// id == NODE_META_COMPACT for EpCompactMeta structure
+    int id;
+    /// Native width and height of detected objects in pixels
+    int window_width, window_height;
+    /// COMPACT_CLASSIFIER_VERSION
+    short version;
+    /// Scores and thresholds are divided by 2^score_shift to fit scores in 16 bits
+    short score_shift;
+} __attribute__((packed)) EpCompactMeta;
+
+/**
+ * Header of stages which are run together: the whole compact classifier, or resident part
+ *   or page of paged one (@see EpCascadePaging). Followed by subset tables of its decisions.
+ */
+typedef struct {
+    /// Number of subset tables (8 ints each) after the header
+    int subsets_count;
+    int reserved;
+} __attribute__((packed)) EpCompactPart;
+
+/**
+ * Stage of compact classifier. Followed by decisions_count decisions
+ */
+typedef struct {
+    /// Number of decisions of the stage; zero means end of part (successful classification)
+    short decisions_count;
+    short reserved;
+    /// If sum of decision scores is less than this threshold then object is rejected
+    int threshold;
+} __attribute__((packed)) EpCompactStage;
+
+/**
+ * Decision of compact classifier
+ */
+typedef struct {
+    /// LBP feature rectangle; same as EpNodeDecision::feature
+    int feature;
+    /// Score for object if feature value is in subset
+    short score;
+    /// Index of subset table in the part
+    unsigned short subset;
+} __attribute__((packed)) EpCompactDecision;
+
 /**
  * Structure of timer
  */
@@ -214,6 +305,10 @@ typedef struct {
     int items_count;
     /// Index of processing image
     int image_index;
+    /// Cycles spent by core on the task (written back by core); before that -- cost predicted by host
+    unsigned int cycles;
+    /// Keeps structure size multiple of 8 so tile slots stay aligned for DMA
+    int reserved;
     /// Detection result
     int objects[MAX_DETECTIONS_PER_TILE];
 } __attribute__((packed)) EpTaskItem;
@@ -231,30 +326,44 @@ typedef struct {
 } EpTaskList;
 
 typedef enum {
-    /// Maximal allowed memory occupied by tile -- 2 banks of Epiphany memory in this case
-    MAX_TILE_BYTES = BANK_SIZE * 2 - sizeof(EpTaskItem) - sizeof(EpTimerBuf) - 1024,
+    /// Maximal allowed memory occupied by tile -- one tile slot.
+    /// Core has two slots (in banks 1 and 2) to load next tile while current one is processed
+    MAX_TILE_BYTES = BANK_SIZE - sizeof(EpTaskItem) - sizeof(EpTimerBuf),
     /// Maximal allowed images count in scale pyramid
     MAX_IMGS_COUNT = 30,
-    /// Maximal allowed memory occupied by pyramid
-    MAX_IMGS_BUF   = 16480000,
+    /// Maximal allowed memory occupied by pyramids and task lists of all slots (enough for one 2720x1530 image)
+    MAX_IMGS_BUF   = 16640000,
     /// Maximal cores count
-    MAX_CORES_NUM  = 16,
-    /// Maximal tasks count
-    MAX_TASK_BUF   = 2048
+    MAX_CORES_NUM  = 64,
+    /// Maximal tasks count of frame (enough for 2720x1530 image)
+    MAX_TASK_BUF   = 3584,
+    /// Maximal number of pages of cascade stages
+    MAX_CASCADE_PAGES = 64,
+    /// Number of EpDRAMBuf slots in shared memory; host prepares next frame in one slot while cores process the other
+    DRAM_BUF_SLOTS = 2,
+    /// Part of images buffer given to every slot while frames are pipelined (enough for 1920x1080 image).
+    /// Frame with larger pyramid and task list takes the whole buffer and is not pipelined with other frames.
+    MAX_SLOT_IMGS_BUF = MAX_IMGS_BUF / DRAM_BUF_SLOTS
 } EpConstants2;
 
 typedef struct {
     /// Timer service info
     EpTimerBuf timer;
-    /// Data structure for exchanging control data
+    /// Task of the first tile slot
     EpTaskItem task_item;
-    /// Begin of tile buffer
-    unsigned char buf_tile[BANK_SIZE - sizeof(EpTaskItem) - sizeof(EpTimerBuf)]; // First part of image data
+    /// First tile slot
+    unsigned char buf_tile[MAX_TILE_BYTES];
 } __attribute__((packed)) EpCoreBank1;
 
 typedef struct {
-    ///Almost two memory banks are used to store image data:
-    unsigned char buf_tile[BANK_SIZE]; //Second part of image data
+    /// Mutex for shared counters (only one of core 0,0 is used); never overwritten by tiles
+    int mutex;
+    /// Mutex of task range with the same index as this core in workgroup (@see EpTaskRange)
+    int range_mutex;
+    /// Task of the second tile slot
+    EpTaskItem task_item;
+    /// Second tile slot
+    unsigned char buf_tile[MAX_TILE_BYTES];
 } __attribute__((packed)) EpCoreBank2;
 
 typedef struct {
@@ -262,6 +371,25 @@ typedef struct {
     char buf_classifier[MAX_CLASSIFIER_BYTES]; //It is supposed that stack is less than 512 bytes!
 } __attribute__((packed)) EpCoreBank3;
 
+/**
+ * Layout of classifier in shared memory. Cascade which fits in EpCoreBank3 is copied
+ *   to cores whole and pages_count is zero. Otherwise first stages (up to MAX_RESIDENT_BYTES)
+ *   stay resident in cores, and the rest is split in pages of whole stages. Every part
+ *   (resident one and each page) ends with NODE_FINAL, so the same interpreter runs them all.
+ *   Parts of compact classifier are EpCompactPart with their own subset tables and terminating stage.
+ *   Core runs resident stages for every window of the tile, then fetches pages one by one
+ *   into buf_classifier + MAX_RESIDENT_BYTES only for windows which are still alive.
+ */
+typedef struct {
+    /// Bytes of buf_classifier copied to cores (META node included)
+    int resident_bytes;
+    /// Number of pages
+    int pages_count;
+    /// Offsets of pages in buf_classifier; page i ends where page i + 1 begins
+    int page_offsets[MAX_CASCADE_PAGES + 1];
+    int reserved;
+} __attribute__((packed)) EpCascadePaging;
+
 /**
  * Properties of image held is shared buffer
  */
@@ -295,30 +423,79 @@ typedef struct {
 typedef struct {
     /// total tasks count
     int task_count;
-    /// current task number
-    int task_to_take;
-    /// number of processed tasks
-    int task_finished;
+    /// number of task ranges (one per started core)
+    int ranges_count;
     /// number of cores to be started
     int start_cores;
     /// current index in timers queue
     int timer_index;
     int unused;
+    /// non-zero if cores should fill task traces (@see EpTaskTrace)
+    int trace_enabled;
+    /// offset of task list (task_count items) in EpSharedMemory::imgs_buf
+    int tasks_offset;
+    /// offset of task traces (same indices as tasks) in EpSharedMemory::imgs_buf
+    int traces_offset;
 } __attribute__((packed)) EpControlInfo;
 
+/**
+ * Phases of task processed by core; written only if EpControlInfo::trace_enabled is set.
+ *   Times are trace clock ticks (CORE_FREQUENCY) since the core took its start token.
+ *   Tile DMA (claim_end..wait_end) overlaps detection of the previous task.
+ */
+typedef struct {
+    /// Core which processed the task
+    unsigned int core_id;
+    /// Task was being taken from task ranges
+    unsigned int claim_start, claim_end;
+    /// Core was waiting for the end of tile DMA
+    unsigned int wait_start, wait_end;
+    /// Detection in the tile
+    unsigned int classify_start, classify_end;
+    /// Results were sent back to shared memory (from classify_end)
+    unsigned int write_end;
+} __attribute__((packed)) EpTaskTrace;
+
+/**
+ * Range of tasks owned by one core. Owner takes tasks from the front of its range;
+ *   cores which have finished their own ranges steal tasks from the back.
+ */
+typedef struct {
+    /// index of the next task to take by owner
+    int next;
+    /// index after the last task of the range
+    int end;
+    /// number of tasks finished by owner of the range (stolen ones included); written by owner only
+    int finished;
+    int reserved;
+} __attribute__((packed)) EpTaskRange;
+
 typedef struct {
     /// Control information for core task manager
     EpControlInfo control_info;
     /// Images properties
     EpImageProp   imgs_prop[MAX_IMGS_COUNT];
+    /// Layout of classifier buffer
+    EpCascadePaging cascade_paging;
     /// Classifier buffer
-    char          buf_classifier[MAX_CLASSIFIER_BYTES];
-    /// Images buffer
-    unsigned char imgs_buf[MAX_IMGS_BUF];
-    /// Tasks list
-    EpTaskItem    tasks[MAX_TASK_BUF];
+    char          buf_classifier[MAX_CASCADE_BYTES];
     /// Timers list
     EpTimerBuf    timers[MAX_CORES_NUM];
+    /// Task ranges; one per started core
+    EpTaskRange   task_ranges[MAX_CORES_NUM];
 } __attribute__((packed)) EpDRAMBuf;
 
+/**
+ * Shared memory: frame slots followed by images buffer of all slots.
+ *   Pixels of image are at imgs_buf + EpImageProp::data_offset whatever slot the image belongs to.
+ *   Task list and task traces of frame follow its pyramid (@see EpControlInfo::tasks_offset),
+ *   so small pyramid leaves room for many tasks and vice versa.
+ */
+typedef struct {
+    /// Frame slots
+    EpDRAMBuf     slots[DRAM_BUF_SLOTS];
+    /// Images buffer; slot N takes MAX_SLOT_IMGS_BUF bytes at N * MAX_SLOT_IMGS_BUF or the whole buffer for pyramid and tasks
+    unsigned char imgs_buf[MAX_IMGS_BUF];
+} __attribute__((packed)) EpSharedMemory;
+
 #endif /* EP_DATA_TYPES_H */
@@ -22,28 +22,55 @@
 
 #ifdef DEVICE_EMULATION
 
+#define _GNU_SOURCE //usleep() is not part of C99
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <opencv/cv.h>
 
 #include "ep_emulator.h"
 
-EpCoreMemory core_memory;
-#define BANK1 (core_memory.bank1)
-#define BANK2 (core_memory.bank2)
-#define BANK3 (core_memory.bank3)
+EpCoreMemory core_memory[MAX_CORES_NUM];
+
+/// Memory of the core executing current thread
+static __thread EpCoreMemory *cur_core_memory;
+/// Id of the core executing current thread (zero for host thread)
+static __thread unsigned int cur_core_id;
+
+#define BANK1 (&cur_core_memory->bank1)
+#define BANK2 (&cur_core_memory->bank2)
+#define BANK3 (&cur_core_memory->bank3)
 
-EpDRAMMemory dram_memory;
+EpSharedMemory dram_memory;
+
+/// Slot of shared memory buffer the current thread works with (@see take_start_token)
+static __thread int sram_slot;
+
+/// Task range owned by the current thread in current frame (@see take_start_token)
+static __thread int core_range;
 
 /**
- * @return pointer to shared memory buffer
+ * @return pointer to current slot of shared memory buffer
  */
 static EpDRAMBuf *get_sram_origin() {
-    return (EpDRAMBuf*)&dram_memory;
+    return dram_memory.slots + sram_slot;
+}
+
+/**
+ * @return pointer to images buffer of shared memory (@see EpSharedMemory)
+ */
+static unsigned char *get_imgs_origin() {
+    return dram_memory.imgs_buf;
 }
 
 /**
- * global time counter
+ * Per-core time counter
  */
-int64 emulated_timer;
+static __thread int64 emulated_timer;
 
 /**
  * Start timer.
@@ -63,6 +90,25 @@ static unsigned int stop_timer() {
     return ~((unsigned int)0) - cvRound(time * CORE_FREQUENCY);
 }
 
+/**
+ * Start point of per-core trace clock
+ */
+static __thread int64 trace_clock_origin;
+
+/**
+ * Start trace clock (@see EpTaskTrace)
+ */
+static void trace_clock_start() {
+    trace_clock_origin = cvGetTickCount();
+}
+
+/**
+ * @return ticks of emulated core clock since trace_clock_start()
+ */
+static unsigned int trace_clock() {
+    return cvRound( (cvGetTickCount() - trace_clock_origin) / cvGetTickFrequency() * CORE_FREQUENCY );
+}
+
 /**
  * Emulate DMA data transfer.
  * calls memcpy(dst, src, size)
@@ -76,6 +122,113 @@ static void dma_transfer (
     memcpy( (void *)dst, (void const *)src, size );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//                           EMULATED TILE DMA                                //
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * DMA engine of emulated core: separate thread copies tiles while core computes.
+ */
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    /// Current transfer (@see dma_start_tile)
+    unsigned char       *dst;
+    unsigned char const *src;
+    unsigned int line_size, lines, src_step;
+    /// Non-zero while transfer is in progress
+    int pending;
+    /// Non-zero value asks DMA thread to exit
+    int stop;
+    /// Statistics since core was started last time
+    EpEmulatedDmaStats stats;
+} EpEmulatedDma;
+
+static EpEmulatedDma cores_dma[MAX_CORES_NUM];
+
+/// DMA engine of the core executing current thread
+static __thread EpEmulatedDma *cur_core_dma;
+
+/**
+ * Main loop of DMA thread
+ * @param arg: pointer to EpEmulatedDma
+ */
+static void *dma_main(void *const arg) {
+    EpEmulatedDma *const dma = (EpEmulatedDma *)arg;
+
+    pthread_mutex_lock(&dma->lock);
+    while(1) {
+        while(!dma->pending && !dma->stop)
+            pthread_cond_wait(&dma->cond, &dma->lock);
+        if(!dma->pending)
+            break;
+        pthread_mutex_unlock(&dma->lock);
+
+        int64 const start = cvGetTickCount();
+        for(unsigned int line = 0; line < dma->lines; ++line)
+            memcpy(dma->dst + line * dma->line_size, dma->src + line * dma->src_step, dma->line_size);
+
+        //Transfer is not finished earlier than it would be at EMULATED_DMA_BANDWIDTH
+        if(EMULATED_DMA_BANDWIDTH) {
+            double const model_time = 1e6 * dma->line_size * dma->lines / (EMULATED_DMA_BANDWIDTH * 1048576.0);
+            double const spent_time = (cvGetTickCount() - start) / cvGetTickFrequency();
+            if(spent_time < model_time)
+                usleep( (useconds_t)(model_time - spent_time) );
+        }
+        double const transfer_time = (cvGetTickCount() - start) / cvGetTickFrequency() / 1e6;
+
+        pthread_mutex_lock(&dma->lock);
+        dma->stats.transfers++;
+        dma->stats.bytes += dma->line_size * dma->lines;
+        dma->stats.transfer_time += transfer_time;
+        dma->pending = 0;
+        pthread_cond_broadcast(&dma->cond);
+    }
+    pthread_mutex_unlock(&dma->lock);
+
+    return NULL;
+}
+
+/**
+ * Emulate two-dimensional DMA transfer of image tile started without waiting for its end.
+ * Data is copied by DMA thread of the core.
+ */
+static void dma_start_tile (
+    void       volatile *const dst,
+    void const volatile *const src,
+    unsigned int         const line_size,
+    unsigned int         const lines,
+    unsigned int         const src_step
+) {
+    EpEmulatedDma *const dma = cur_core_dma;
+
+    pthread_mutex_lock(&dma->lock);
+    dma->dst = (unsigned char *)dst;
+    dma->src = (unsigned char const *)src;
+    dma->line_size = line_size;
+    dma->lines = lines;
+    dma->src_step = src_step;
+    dma->pending = 1;
+    pthread_cond_broadcast(&dma->cond);
+    pthread_mutex_unlock(&dma->lock);
+}
+
+/**
+ * Wait for the end of transfer started by dma_start_tile().
+ * Time spent here is accounted as stall time.
+ */
+static void dma_wait_tile() {
+    EpEmulatedDma *const dma = cur_core_dma;
+    int64 const start = cvGetTickCount();
+
+    pthread_mutex_lock(&dma->lock);
+    while(dma->pending)
+        pthread_cond_wait(&dma->cond, &dma->lock);
+    dma->stats.stall_time += (cvGetTickCount() - start) / cvGetTickFrequency() / 1e6;
+    pthread_mutex_unlock(&dma->lock);
+}
+
 /**
  * Increment shared variable
  * @param val pointer on variable for increment
@@ -83,42 +236,252 @@ static void dma_transfer (
  * @return unmodified (*val) value
  */
 static int atomic_increment(int volatile *const val, int const max_val) {
+    int cur_val = *val;
+
+    while(cur_val < max_val) {
+        int const prev_val = __sync_val_compare_and_swap(val, cur_val, cur_val + 1);
+        if(prev_val == cur_val)
+            break;
+        cur_val = prev_val; //Another core was faster; retry with its value
+    }
+
+    return cur_val;
+}
+
+/**
+ * Decrement shared variable
+ * @param val pointer on variable for decrement
+ * @param min_val min value of variable
+ * @return unmodified (*val) value
+ */
+static int atomic_decrement(int volatile *const val, int const min_val) {
+    int cur_val = *val;
 
-    int const cur_val = *val;
-    if(cur_val < max_val)
-        *val = cur_val + 1;
+    while(cur_val > min_val) {
+        int const prev_val = __sync_val_compare_and_swap(val, cur_val, cur_val - 1);
+        if(prev_val == cur_val)
+            break;
+        cur_val = prev_val; //Another core was faster; retry with its value
+    }
 
     return cur_val;
 }
 
+/**
+ * @param range_index index of range in EpDRAMBuf::task_ranges
+ * @return lock of task range; as on device, lock of range N is held in memory of core N
+ */
+static int volatile *task_range_mutex(int const range_index) {
+    //Pointer is formed from offset, since EpCoreBank2 is packed
+    return (int volatile *)( (char *)&core_memory[range_index].bank2 + offsetof(EpCoreBank2, range_mutex) );
+}
+
+/**
+ * Lock task range
+ * @param range_index index of range in EpDRAMBuf::task_ranges
+ */
+static void lock_task_range(int const range_index) {
+    int volatile *const mutex = task_range_mutex(range_index);
+
+    while( __sync_lock_test_and_set(mutex, 1) )
+        while(*mutex); //Spin on plain reads until lock looks free
+}
+
+/**
+ * Unlock task range locked by lock_task_range()
+ * @param range_index index of range in EpDRAMBuf::task_ranges
+ */
+static void unlock_task_range(int const range_index) {
+    __sync_lock_release( task_range_mutex(range_index) );
+}
 
 //Including actual core code
 #include "../../EpFaceCore_commonlib/src/device_routines.h"
 
-int e_open(char const *const eServIP, unsigned short const eServPort) {
-    return 0;
+////////////////////////////////////////////////////////////////////////////////
+//                              EMULATED CORES                                //
+////////////////////////////////////////////////////////////////////////////////
+
+/// Threads of started emulated cores
+static pthread_t cores_threads[MAX_CORES_NUM];
+/// Number of started emulated cores
+static int cores_count;
+/// Number of columns in started workgroup (to calculate core ids)
+static int cores_cols;
+/// Non-zero value asks emulated cores to leave their main loop
+static int volatile cores_stop;
+
+/**
+ * Main loop of emulated core. Same as mc_core_common_go() on device,
+ * but can be stopped by e_close().
+ * @param arg: index of the core in workgroup (row * cols + col)
+ */
+static void *core_main(void *const arg) {
+    int const core_index = (int)(intptr_t)arg;
+
+    cur_core_memory = core_memory + core_index;
+    cur_core_dma = cores_dma + core_index;
+    cur_core_id = e_coreid_origin() + ( (core_index / cores_cols) << 6 ) + core_index % cores_cols;
+    ((EpCoreBank1 *)BANK1)->timer.core_id = cur_core_id;
+
+    while(!cores_stop) {
+        if( !take_start_token() ) {
+            usleep(50); //Nothing to do; do not steal host time
+            continue;
+        }
+
+        pthread_mutex_lock(&cur_core_dma->lock);
+        memset(&cur_core_dma->stats, 0, sizeof(EpEmulatedDmaStats));
+        pthread_mutex_unlock(&cur_core_dma->lock);
+
+        device_process_tasks();
+    }
+
+    return NULL;
+}
+
+int e_init(char *hdf) {
+    return E_OK;
 }
 
-int e_close() {
-    return 0;
+int e_reset_system(void) {
+    return E_OK;
 }
 
-size_t e_read(void volatile const *const from_addr, void volatile *const buf, size_t const count) {
-    memcpy( (void *)buf, (void *)from_addr, count );
-    return count;
+int e_get_platform_info(e_platform_t *platform) {
+    platform->objtype = E_EPI_PLATFORM;
+    platform->rows = MAX_CORES_NUM / 8;
+    platform->cols = 8;
+    return E_OK;
 }
 
-size_t e_write(void volatile *const to_addr, const void volatile *const buf, size_t const count) {
-    memcpy( (void *)to_addr, (void *)buf, count );
-    return count;
+int e_alloc(e_mem_t *mbuf, off_t base, size_t size) {
+    if(size > sizeof(EpSharedMemory))
+        return E_ERR;
+    mbuf->objtype = E_SHARED_MEM;
+    mbuf->base = &dram_memory;
+    mbuf->size = size;
+    return E_OK;
+}
+
+int e_free(e_mem_t *mbuf) {
+    mbuf->base = NULL;
+    mbuf->size = 0;
+    return E_OK;
+}
+
+int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols) {
+    if(rows * cols > MAX_CORES_NUM)
+        return E_ERR;
+    dev->objtype = E_EPI_GROUP;
+    dev->row  = row ; dev->col  = col ;
+    dev->rows = rows; dev->cols = cols;
+    return E_OK;
+}
+
+int e_close(e_epiphany_t *dev) {
+    cores_stop = 1;
+    for(int i = 0; i < cores_count; ++i) {
+        pthread_join(cores_threads[i], NULL);
+
+        EpEmulatedDma *const dma = cores_dma + i;
+        pthread_mutex_lock(&dma->lock);
+        dma->stop = 1;
+        pthread_cond_broadcast(&dma->cond);
+        pthread_mutex_unlock(&dma->lock);
+        pthread_join(dma->thread, NULL);
+        pthread_mutex_destroy(&dma->lock);
+        pthread_cond_destroy(&dma->cond);
+    }
+    cores_count = 0;
+    cores_stop = 0;
+    return E_OK;
+}
+
+int e_load_group(char *executable, e_epiphany_t *dev, unsigned row, unsigned col,
+                 unsigned rows, unsigned cols, e_bool_t start) {
+    memset(core_memory, 0, sizeof(core_memory));
+    return start ? e_start_group(dev) : E_OK;
+}
+
+int e_start_group(e_epiphany_t *dev) {
+    int const group_size = dev->rows * dev->cols;
+    cores_cols = dev->cols;
+
+    for(; cores_count < group_size; ++cores_count) {
+        EpEmulatedDma *const dma = cores_dma + cores_count;
+        memset(dma, 0, sizeof(EpEmulatedDma));
+        pthread_mutex_init(&dma->lock, NULL);
+        pthread_cond_init(&dma->cond, NULL);
+        if( pthread_create(&dma->thread, NULL, dma_main, dma) ) {
+            pthread_mutex_destroy(&dma->lock);
+            pthread_cond_destroy(&dma->cond);
+            return E_ERR;
+        }
+
+        if( pthread_create(cores_threads + cores_count, NULL, core_main, (void *)(intptr_t)cores_count) ) {
+            pthread_mutex_lock(&dma->lock);
+            dma->stop = 1;
+            pthread_cond_broadcast(&dma->cond);
+            pthread_mutex_unlock(&dma->lock);
+            pthread_join(dma->thread, NULL);
+            pthread_mutex_destroy(&dma->lock);
+            pthread_cond_destroy(&dma->cond);
+            return E_ERR;
+        }
+    }
+
+    return E_OK;
+}
+
+int e_finalize(void) {
+    return E_OK;
+}
+
+/**
+ * Translate address used by e_read() / e_write() to host address
+ */
+static char *get_host_address(void *const dev, unsigned const row, unsigned const col, off_t const addr) {
+    if( ((e_mem_t *)dev)->objtype == E_SHARED_MEM )
+        return (char *)((e_mem_t *)dev)->base + addr;
+
+    e_epiphany_t const *const group = (e_epiphany_t const *)dev;
+    return (char *)(core_memory + row * group->cols + col) + (addr - EMULATED_BANK1_ADDR);
+}
+
+ssize_t e_read(void *dev, unsigned row, unsigned col, off_t from_addr, void *buf, size_t size) {
+    __sync_synchronize();
+    memcpy( buf, get_host_address(dev, row, col, from_addr), size );
+    return size;
+}
+
+ssize_t e_write(void *dev, unsigned row, unsigned col, off_t to_addr, const void *buf, size_t size) {
+    memcpy( get_host_address(dev, row, col, to_addr), buf, size );
+    __sync_synchronize();
+    return size;
+}
+
+int device_get_dma_stats(unsigned int const core_id, EpEmulatedDmaStats *const stats) {
+    unsigned int const row = (core_id - e_coreid_origin()) >> 6,
+                       col = (core_id - e_coreid_origin()) & 63;
+    int const core_index = row * cores_cols + col;
+
+    if(col >= (unsigned int)cores_cols || core_index >= cores_count)
+        return 0;
+
+    EpEmulatedDma *const dma = cores_dma + core_index;
+    pthread_mutex_lock(&dma->lock);
+    *stats = dma->stats;
+    pthread_mutex_unlock(&dma->lock);
+    return 1;
 }
 
 unsigned int e_coreid_origin(void) {
     return 2084;
 }
 
-unsigned int e_get_coreid() {
-    return 2084;
+unsigned int e_get_coreid(void) {
+    return cur_core_memory ? cur_core_id : e_coreid_origin();
 }
 
 #endif//DEVICE_EMULATION
@@ -1,6 +1,10 @@
 /**
  * Header file for emulation routines and data structures which allow compiling
  * and running core code on host. Activated only if DEVICE_EMULATION is defined.
+ *
+ * Every emulated core is a host thread with its own private EpCoreMemory banks;
+ * all of them share one EpDRAMBuf. Functions below stand in for the subset of
+ * eSDK e-hal/e-loader API used by the host code.
  */
 
 #ifdef DEVICE_EMULATION
@@ -8,6 +12,9 @@
 #ifndef EP_EMULATOR_H
 #define EP_EMULATOR_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
 #include "ep_data_types.h"
 
 typedef struct {
@@ -16,16 +23,74 @@ typedef struct {
     EpCoreBank3 bank3;
 } __attribute__((packed)) EpCoreMemory;
 
+/// Emulated core memory; one item per emulated core
+extern EpCoreMemory core_memory[MAX_CORES_NUM];
+
+/// Emulated shared memory
+extern EpSharedMemory dram_memory;
+
+/// Local address of the first bank held in EpCoreMemory (bank 0 holds code on real device)
+#define EMULATED_BANK1_ADDR 0x2000
+
+/// Modeled bandwidth of tile DMA in MB/s per core; zero means plain memcpy speed
+#ifndef EMULATED_DMA_BANDWIDTH
+    #define EMULATED_DMA_BANDWIDTH 0
+#endif
+
+/**
+ * Tile DMA statistics of emulated core
+ */
 typedef struct {
-    EpDRAMBuf common_memory;
-} __attribute__((packed)) EpDRAMMemory;
+    /// Number of tiles transferred
+    unsigned int transfers;
+    /// Total size of tiles transferred in bytes
+    unsigned int bytes;
+    /// Time in seconds DMA was busy with tile transfers
+    double transfer_time;
+    /// Time in seconds core waited for tiles; transfer time not hidden behind detection
+    double stall_time;
+} EpEmulatedDmaStats;
+
+////////////////////////////////////////////////////////////////////////////////
+//                         e-hal stand-in data types                          //
+////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    E_FALSE = 0,
+    E_TRUE  = 1
+} e_bool_t;
+
+typedef enum {
+    E_OK  =  0,
+    E_ERR = -1
+} e_return_stat_t;
+
+/// Kind of object passed to e_read() / e_write()
+typedef enum {
+    E_EPI_PLATFORM,
+    E_EPI_GROUP,
+    E_SHARED_MEM
+} e_objtype_t;
 
-/// Emulated core memory
-extern EpCoreMemory core_memory;
+typedef struct {
+    e_objtype_t objtype;
+    /// Emulated chip geometry
+    int rows, cols;
+} e_platform_t;
 
-/// Emulated shared memory
-extern EpDRAMMemory dram_memory;
+typedef struct {
+    e_objtype_t objtype;
+    /// Workgroup origin and size
+    unsigned row, col, rows, cols;
+} e_epiphany_t;
 
+typedef struct {
+    e_objtype_t objtype;
+    /// Host address of allocated shared buffer
+    void *base;
+    /// Size of allocated shared buffer in bytes
+    size_t size;
+} e_mem_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,39 +99,102 @@ extern "C" {
 void device_dump_buffers(char const *const file_name);
 
 /**
- * @return 0
+ * @return E_OK
+ */
+int e_init(char *hdf);
+
+/**
+ * @return E_OK
+ */
+int e_reset_system(void);
+
+/**
+ * Fill platform info with geometry of emulated chip (MAX_CORES_NUM cores).
+ * @return E_OK
+ */
+int e_get_platform_info(e_platform_t *platform);
+
+/**
+ * Attach mbuf to emulated shared memory (base offset is ignored).
+ * @return E_OK; E_ERR if required size is larger than EpSharedMemory.
+ */
+int e_alloc(e_mem_t *mbuf, off_t base, size_t size);
+
+/**
+ * @return E_OK
  */
-int e_open(char const *const eServIP, unsigned short const eServPort);
+int e_free(e_mem_t *mbuf);
 
 /**
- * @return 0
+ * Define workgroup of rows x cols emulated cores.
+ * @return E_OK; E_ERR if workgroup has more than MAX_CORES_NUM cores.
  */
-int e_close();
+int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols);
 
 /**
- * Calls memcpy(buf, from_addr, count);
+ * Stop and join emulated cores threads of the workgroup.
+ * @return E_OK
  */
-size_t e_read(void volatile const *const from_addr, void volatile *const buf, size_t const count);
+int e_close(e_epiphany_t *dev);
 
 /**
- * Calls memcpy(to_addr, buf, count);
+ * Core program is linked into host executable, so nothing is actually loaded.
+ * If start is E_TRUE then cores are started as with e_start_group().
+ * @return E_OK; E_ERR if cores cannot be started.
  */
-size_t e_write(void volatile *const to_addr, const void volatile *const buf, size_t const count);
+int e_load_group(char *executable, e_epiphany_t *dev, unsigned row, unsigned col,
+                 unsigned rows, unsigned cols, e_bool_t start);
+
+/**
+ * Start one host thread per core of the workgroup. Each thread gets its own
+ * EpCoreMemory and runs the same loop as device main(): it waits for a start
+ * token in control_info.start_cores and then calls device_process_tasks().
+ * @return E_OK; E_ERR if threads cannot be created.
+ */
+int e_start_group(e_epiphany_t *dev);
+
+/**
+ * @return E_OK
+ */
+int e_finalize(void);
+
+/**
+ * Read from shared memory (dev is e_mem_t) or from local memory of core
+ * (row, col) of workgroup (dev is e_epiphany_t). Calls memcpy.
+ * @return number of bytes read.
+ */
+ssize_t e_read(void *dev, unsigned row, unsigned col, off_t from_addr, void *buf, size_t size);
+
+/**
+ * Write to shared memory (dev is e_mem_t) or to local memory of core
+ * (row, col) of workgroup (dev is e_epiphany_t). Calls memcpy.
+ * @return number of bytes written.
+ */
+ssize_t e_write(void *dev, unsigned row, unsigned col, off_t to_addr, const void *buf, size_t size);
 
 /**
  * @return 2084
  */
 unsigned int e_coreid_origin(void);
+
 /**
- * @return 2084
+ * @return core id of calling emulated core (e_coreid_origin() for host thread)
  */
-unsigned int e_get_coreid();
+unsigned int e_get_coreid(void);
 
 /**
  * Process task list on core
  */
 void device_process_tasks(void);
 
+/**
+ * Get tile DMA statistics of core since it was started last time.
+ * @param core_id: id of emulated core (@see EpTimerBuf);
+ * @param stats  : receives statistics.
+ * @return non-zero on success; zero if there is no such core in started workgroup.
+ */
+int device_get_dma_stats(unsigned int const core_id, EpEmulatedDmaStats *const stats);
+
 #ifdef __cplusplus
 }
 #endif
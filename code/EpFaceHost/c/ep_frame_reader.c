@@ -0,0 +1,308 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Reader of decoded video frames from a pipe, FIFO or file
+ */
+#define _GNU_SOURCE //posix_memalign() and sysconf() are not part of C99
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "ep_frame_reader.h"
+
+typedef enum {
+    /// Size of buffer chroma planes are read into and dropped
+    FRAME_SKIP_BUFFER = 65536
+} EpFrameReaderPrivateConstants;
+
+struct EpFrameReader {
+    /// Input file descriptor
+    int fd;
+    /// Non-zero if descriptor is opened by reader (not standard input)
+    int own_fd;
+    /// Non-zero for YUV4MPEG2 stream; frames are preceded by FRAME headers
+    int y4m;
+    int width, height;
+    /// Bytes of luma plane and of all chroma planes of a frame
+    size_t luma_size, chroma_size;
+    /// Frames per second; zero if unknown
+    double frame_rate;
+    /// FRAME_RING_SIZE page-aligned buffers, buffer_size bytes each
+    unsigned char *buffers;
+    size_t buffer_size;
+    int next_buffer;
+    /// Number of frames read
+    long frame_index;
+    unsigned char skip[FRAME_SKIP_BUFFER];
+};
+
+/**
+ * Read up to size bytes; short count is returned only at the end of file.
+ * @return number of bytes read; -1 in case of read error.
+ */
+static ssize_t read_full(int const fd, void *const buffer, size_t const size) {
+    size_t done = 0;
+    while(done < size) {
+        ssize_t const count = read(fd, (char *)buffer + done, size - done);
+        if(count < 0 && errno == EINTR)
+            continue;
+        if(count < 0)
+            return -1;
+        if(count == 0)
+            break; //End of file
+        done += count;
+    }
+    return done;
+}
+
+/**
+ * Read header line up to '\n' (not stored); line is terminated with zero.
+ * @return ERR_SUCCESS; ERR_FILE on read error; ERR_FILE_CONTENTS if line is truncated or too long.
+ */
+static EpErrorCode read_line(int const fd, char *const line, int const capacity) {
+    for(int length = 0; length < capacity; ++length) {
+        ssize_t const count = read_full(fd, line + length, 1);
+        if(count < 0)
+            return ERR_FILE;
+        if(count == 0)
+            return ERR_FILE_CONTENTS;
+        if(line[length] == '\n') {
+            line[length] = 0;
+            return ERR_SUCCESS;
+        }
+    }
+    return ERR_FILE_CONTENTS;
+}
+
+/**
+ * Parse YUV4MPEG2 stream header: frame size, rate and chroma format.
+ * @return ERR_SUCCESS; ERR_FILE on read error; ERR_FILE_CONTENTS for bad or unsupported header.
+ */
+static EpErrorCode read_y4m_header(EpFrameReader *const reader) {
+    char line[FRAME_MAX_HEADER];
+    EpErrorCode const result = read_line(reader->fd, line, FRAME_MAX_HEADER);
+    if(result != ERR_SUCCESS)
+        return result;
+
+    if( strncmp(line, "YUV4MPEG2", 9) || (line[9] && line[9] != ' ') )
+        return ERR_FILE_CONTENTS;
+
+    int chroma_x = 2, chroma_y = 2, chroma_planes = 2; //C420 is default
+
+    for(char *token = strtok(line + 9, " "); token; token = strtok(NULL, " ")) {
+        int num, den;
+        switch(*token) {
+        case 'W': reader->width  = atoi(token + 1); break;
+        case 'H': reader->height = atoi(token + 1); break;
+        case 'F':
+            if( sscanf(token + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0 )
+                reader->frame_rate = (double)num / den;
+            break;
+        case 'C':
+            if( !strcmp(token + 1, "420") || !strcmp(token + 1, "420jpeg") ||
+                !strcmp(token + 1, "420paldv") || !strcmp(token + 1, "420mpeg2") ) {
+                chroma_x = 2; chroma_y = 2; chroma_planes = 2;
+            } else if( !strcmp(token + 1, "422") ) {
+                chroma_x = 2; chroma_y = 1; chroma_planes = 2;
+            } else if( !strcmp(token + 1, "444") ) {
+                chroma_x = 1; chroma_y = 1; chroma_planes = 2;
+            } else if( !strcmp(token + 1, "mono") ) {
+                chroma_planes = 0;
+            } else {
+                return ERR_FILE_CONTENTS; //High bit depth or alpha
+            }
+            break;
+        default: //Interlacing, aspect ratio and extensions do not matter
+            break;
+        }
+    }
+
+    if(reader->width <= 0 || reader->height <= 0)
+        return ERR_FILE_CONTENTS;
+
+    reader->chroma_size = (size_t)chroma_planes *
+        ( (reader->width + chroma_x - 1) / chroma_x ) * ( (reader->height + chroma_y - 1) / chroma_y );
+
+    return ERR_SUCCESS;
+}
+
+/**
+ * Parse raw format "nv12:WxH[@fps]" or "i420:WxH[@fps]".
+ * @return ERR_SUCCESS or ERR_ARGUMENT.
+ */
+static EpErrorCode parse_raw_format(EpFrameReader *const reader, char const *const format) {
+    if( strncmp(format, "nv12:", 5) && strncmp(format, "i420:", 5) )
+        return ERR_ARGUMENT;
+
+    int length = 0;
+    if( sscanf(format + 5, "%dx%d%n", &reader->width, &reader->height, &length) != 2 )
+        return ERR_ARGUMENT;
+
+    char const *const rate = format + 5 + length;
+    if( *rate == '@' && ( sscanf(rate + 1, "%lf%n", &reader->frame_rate, &length) != 1 ||
+                          rate[1 + length] || reader->frame_rate <= 0.0 ) )
+        return ERR_ARGUMENT;
+    if(*rate && *rate != '@')
+        return ERR_ARGUMENT;
+
+    if(reader->width <= 0 || reader->height <= 0)
+        return ERR_ARGUMENT;
+
+    //NV12 has interleaved UV plane and I420 has separate U and V planes; sizes are the same
+    reader->chroma_size = (size_t)2 * ( (reader->width + 1) / 2 ) * ( (reader->height + 1) / 2 );
+
+    return ERR_SUCCESS;
+}
+
+EpFrameReader *ep_frame_reader_open (
+    char const  *const file_name,
+    char const  *const format,
+    EpErrorCode *const error_code
+) {
+    EpErrorCode error_code_stub;
+    EpErrorCode *const result = error_code ? error_code : &error_code_stub;
+
+    if(!file_name || !format) {
+        *result = ERR_ARGUMENT;
+        return NULL;
+    }
+
+    EpFrameReader *const reader = (EpFrameReader *)calloc( 1, sizeof(EpFrameReader) );
+    if(!reader) {
+        *result = ERR_MEMORY;
+        return NULL;
+    }
+
+    reader->y4m = !strcmp(format, "y4m");
+    if( !reader->y4m && (*result = parse_raw_format(reader, format)) != ERR_SUCCESS ) {
+        free(reader);
+        return NULL;
+    }
+
+    reader->own_fd = strcmp(file_name, "-") != 0;
+    reader->fd = reader->own_fd ? open(file_name, O_RDONLY) : STDIN_FILENO;
+    if(reader->fd < 0) {
+        free(reader);
+        *result = ERR_FILE;
+        return NULL;
+    }
+
+    if( reader->y4m && (*result = read_y4m_header(reader)) != ERR_SUCCESS ) {
+        ep_frame_reader_close(reader);
+        return NULL;
+    }
+
+    //Buffers are page-aligned and padded to whole pages
+    size_t const page_size = sysconf(_SC_PAGESIZE);
+    reader->luma_size = (size_t)reader->width * reader->height;
+    reader->buffer_size = (reader->luma_size + page_size - 1) / page_size * page_size;
+
+    void *buffers = NULL;
+    if( posix_memalign(&buffers, page_size, FRAME_RING_SIZE * reader->buffer_size) ) {
+        ep_frame_reader_close(reader);
+        *result = ERR_MEMORY;
+        return NULL;
+    }
+    reader->buffers = (unsigned char *)buffers;
+
+    *result = ERR_SUCCESS;
+    return reader;
+}
+
+void ep_frame_reader_info (
+    EpFrameReader const *const reader,
+    int                 *const width,
+    int                 *const height,
+    double              *const frame_rate
+) {
+    *width      = reader->width;
+    *height     = reader->height;
+    *frame_rate = reader->frame_rate;
+}
+
+int ep_frame_reader_read (
+    EpFrameReader *const reader,
+    EpImage       *const frame,
+    double        *const timestamp,
+    EpErrorCode   *const error_code
+) {
+    EpErrorCode error_code_stub;
+    EpErrorCode *const result = error_code ? error_code : &error_code_stub;
+
+    if(reader->y4m) {
+        char header[FRAME_MAX_HEADER];
+        ssize_t const count = read_full(reader->fd, header, 5);
+        if(count <= 0) {
+            *result = count ? ERR_FILE : ERR_SUCCESS; //End of stream at frame boundary
+            return 0;
+        }
+        if( count < 5 || memcmp(header, "FRAME", 5) ) {
+            *result = ERR_FILE_CONTENTS;
+            return 0;
+        }
+        if( (*result = read_line(reader->fd, header, FRAME_MAX_HEADER)) != ERR_SUCCESS )
+            return 0; //Frame parameters are ignored
+    }
+
+    unsigned char *const data = reader->buffers + reader->next_buffer * reader->buffer_size;
+
+    ssize_t const count = read_full(reader->fd, data, reader->luma_size);
+    if(count < 0 || (size_t)count != reader->luma_size) {
+        *result = count < 0 ? ERR_FILE : (count || reader->y4m) ? ERR_FILE_CONTENTS : ERR_SUCCESS;
+        return 0;
+    }
+
+    for(size_t remaining = reader->chroma_size; remaining; ) {
+        size_t const chunk = remaining < FRAME_SKIP_BUFFER ? remaining : FRAME_SKIP_BUFFER;
+        ssize_t const skipped = read_full(reader->fd, reader->skip, chunk);
+        if(skipped < 0 || (size_t)skipped != chunk) {
+            *result = skipped < 0 ? ERR_FILE : ERR_FILE_CONTENTS;
+            return 0;
+        }
+        remaining -= chunk;
+    }
+
+    frame->data   = data;
+    frame->width  = reader->width;
+    frame->height = reader->height;
+    frame->step   = reader->width;
+
+    if(timestamp)
+        *timestamp = reader->frame_rate > 0.0 ? reader->frame_index * 1000.0 / reader->frame_rate : 0.0;
+
+    reader->next_buffer = (reader->next_buffer + 1) % FRAME_RING_SIZE;
+    ++reader->frame_index;
+
+    *result = ERR_SUCCESS;
+    return 1;
+}
+
+void ep_frame_reader_close(EpFrameReader *const reader) {
+    if(!reader)
+        return;
+
+    if(reader->own_fd)
+        close(reader->fd);
+
+    free(reader->buffers);
+    free(reader);
+}
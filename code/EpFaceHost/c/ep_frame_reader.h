@@ -0,0 +1,107 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+
+/**
+ * Reader of decoded video frames from a pipe, FIFO or file.
+ *
+ * Input is either YUV4MPEG2 stream (.y4m) or raw planar NV12 / I420 frames, e.g.
+ * "ffmpeg -i input.mp4 -f yuv4mpegpipe -" or "ffmpeg -i input.mp4 -f rawvideo -pix_fmt nv12 -".
+ * Luma plane of each frame is read straight into one of FRAME_RING_SIZE page-aligned
+ * buffers allocated when reader is opened, and is returned as grayscale EpImage;
+ * chroma is skipped. No colour conversion and no allocation is done per frame.
+ */
+
+#ifndef EP_FRAME_READER_H
+#define EP_FRAME_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+typedef enum {
+    /// Number of frame buffers; frame returned by ep_frame_reader_read() stays valid during this many - 1 next reads
+    FRAME_RING_SIZE = 3,
+    /// Maximal length of YUV4MPEG2 stream or frame header line
+    FRAME_MAX_HEADER = 1024
+} EpFrameReaderConstants;
+
+typedef struct EpFrameReader EpFrameReader;
+
+/**
+ * Open frame reader.
+ * @param file_name: pipe, FIFO or file to read; "-" is standard input.
+ * @param format   : "y4m" -- YUV4MPEG2 stream (8-bit 420, 422, 444 or mono); frame size and rate are taken from stream header;
+ *                   "nv12:WxH" or "i420:WxH" -- raw frames of given size; optional "@fps" suffix (e.g. "nv12:1920x1080@25")
+ *                   sets frame rate used for timestamps.
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- success;
+ *                  ERR_ARGUMENT -- unknown format or bad frame size;
+ *                  ERR_FILE -- cannot open file;
+ *                  ERR_FILE_CONTENTS -- bad or unsupported YUV4MPEG2 header;
+ *                  ERR_MEMORY -- cannot allocate frame buffers.
+ * @return opened reader; NULL in case of any error.
+ */
+EpFrameReader *ep_frame_reader_open (
+    char const  *const file_name,
+    char const  *const format,
+    EpErrorCode *const error_code
+);
+
+/**
+ * Get frame size and rate of opened reader.
+ * @param frame_rate: receives frames per second; zero if unknown.
+ */
+void ep_frame_reader_info (
+    EpFrameReader const *const reader,
+    int                 *const width,
+    int                 *const height,
+    double              *const frame_rate
+);
+
+/**
+ * Read next frame; blocks until whole frame is available.
+ * @param reader   : opened reader;
+ * @param frame    : receives luma plane of the frame. Image data belongs to reader: it must not be released
+ *                   and stays valid until FRAME_RING_SIZE - 1 more frames are read (or reader is closed).
+ * @param timestamp: receives frame time in milliseconds (zero for raw input without frame rate); may be NULL.
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- frame is read, or stream ended at frame boundary;
+ *                  ERR_FILE -- read error;
+ *                  ERR_FILE_CONTENTS -- truncated frame or bad frame header.
+ * @return non-zero if frame is read; zero at the end of stream or in case of error.
+ */
+int ep_frame_reader_read (
+    EpFrameReader *const reader,
+    EpImage       *const frame,
+    double        *const timestamp,
+    EpErrorCode   *const error_code
+);
+
+/**
+ * Close reader and release its frame buffers.
+ */
+void ep_frame_reader_close(EpFrameReader *const reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//EP_FRAME_READER_H
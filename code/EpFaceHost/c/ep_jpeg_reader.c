@@ -0,0 +1,128 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * JPEG decoding at reduced resolution
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "ep_cascade_detector.h"
+#include "ep_jpeg_reader.h"
+
+/**
+ * libjpeg error manager which returns to ep_image_load_jpeg() instead of exiting
+ */
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf return_point;
+} EpJpegError;
+
+static void jpeg_error_exit(j_common_ptr const info) {
+    longjmp( ( (EpJpegError *)info->err )->return_point, 1 );
+}
+
+static void jpeg_output_message(j_common_ptr const info) {
+    (void)info; //Warnings about recoverable data errors are not printed
+}
+
+int ep_jpeg_reduction (
+    int const min_object_width,
+    int const min_object_height,
+    int const window_width,
+    int const window_height
+) {
+    int reduction = JPEG_MAX_REDUCTION;
+    while( reduction > 1 && (window_width * reduction > min_object_width || window_height * reduction > min_object_height) )
+        reduction /= 2;
+    return reduction;
+}
+
+/**
+ * Decode opened JPEG file.
+ * @param image: receives decoded image; it is left empty in case of error.
+ * @return ERR_SUCCESS, ERR_FILE_CONTENTS or ERR_MEMORY.
+ */
+static EpErrorCode decode_jpeg(FILE *const file, int const reduction, EpImage *const image) {
+    struct jpeg_decompress_struct info;
+    EpJpegError error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpeg_error_exit;
+    error.base.output_message = jpeg_output_message;
+
+    if( setjmp(error.return_point) ) { //Decoding error
+        jpeg_destroy_decompress(&info);
+        ep_image_release(image);
+        return ERR_FILE_CONTENTS;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+
+    //Reduction is done by inverse DCT of smaller size
+    info.out_color_space = JCS_GRAYSCALE;
+    info.scale_num = 1;
+    info.scale_denom = reduction;
+    jpeg_start_decompress(&info);
+
+    *image = ep_image_create(info.output_width, info.output_height);
+    if( ep_image_is_empty(image) ) {
+        jpeg_destroy_decompress(&info);
+        return ERR_MEMORY;
+    }
+
+    while(info.output_scanline < info.output_height) {
+        JSAMPROW row = image->data + info.output_scanline * image->step;
+        jpeg_read_scanlines(&info, &row, 1);
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+
+    return ERR_SUCCESS;
+}
+
+EpImage ep_image_load_jpeg (
+    char const  *const file_name,
+    int          const reduction,
+    EpErrorCode *const error_code
+) {
+    EpErrorCode error_code_stub;
+    EpErrorCode *const result = error_code ? error_code : &error_code_stub;
+
+    EpImage image = ep_image_create_empty();
+
+    if(reduction != 1 && reduction != 2 && reduction != 4 && reduction != 8) {
+        *result = ERR_ARGUMENT;
+        return image;
+    }
+
+    FILE *const file = fopen(file_name, "rb");
+    if(!file) {
+        *result = ERR_FILE;
+        return image;
+    }
+
+    *result = decode_jpeg(file, reduction, &image);
+    fclose(file);
+
+    return image;
+}
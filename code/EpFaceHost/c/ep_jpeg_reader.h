@@ -0,0 +1,82 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+
+/**
+ * JPEG decoding at reduced resolution.
+ *
+ * libjpeg can scale image down by 2, 4 or 8 while decoding (in DCT domain), which is
+ * much cheaper than full decoding followed by downscaling. When only objects several
+ * times larger than classifier window are needed, large photos are decoded at the
+ * coarsest resolution where such objects still cover the window; pyramid is built
+ * from the reduced image and detections are multiplied by the reduction factor.
+ */
+
+#ifndef EP_JPEG_READER_H
+#define EP_JPEG_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+typedef enum {
+    /// The largest reduction factor supported by libjpeg DCT scaling
+    JPEG_MAX_REDUCTION = 8
+} EpJpegReaderConstants;
+
+/**
+ * Get reduction factor which keeps objects of given size detectable.
+ * @param min_object_width : width of the smallest object to detect, in source image pixels;
+ * @param min_object_height: height of the smallest object to detect;
+ * @param window_width     : native object width of the classifier;
+ * @param window_height    : native object height of the classifier.
+ * @return the largest of 1, 2, 4 and 8 such that reduced object still covers the window.
+ */
+int ep_jpeg_reduction (
+    int const min_object_width,
+    int const min_object_height,
+    int const window_width,
+    int const window_height
+);
+
+/**
+ * Decode JPEG file into grayscale image scaled down by reduction factor. Luma of color
+ *   images is taken as is (no colour conversion). Image size is source size divided by
+ *   reduction and rounded up; pixel (x, y) covers source pixels from (x, y) * reduction.
+ * @param file_name: pointer to file name (null-terminated string);
+ * @param reduction: 1, 2, 4 or 8 (@see ep_jpeg_reduction).
+ * @param error_code: pointer to integer value which will receive the error code.
+ *                  If this pointer is NULL then no error code is stored.
+ *     Error codes: ERR_SUCCESS -- success;
+ *                  ERR_ARGUMENT -- unsupported reduction;
+ *                  ERR_FILE -- cannot open file;
+ *                  ERR_FILE_CONTENTS -- not a JPEG file, corrupted data or color space without luma (CMYK);
+ *                  ERR_MEMORY -- cannot allocate image.
+ * @return decoded image; empty image in case of any error.
+ */
+EpImage ep_image_load_jpeg (
+    char const  *const file_name,
+    int          const reduction,
+    EpErrorCode *const error_code
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//EP_JPEG_READER_H
@@ -0,0 +1,333 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Cost model of detection tasks and task planner
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ep_cascade_detector.h"
+#include "ep_task_planner.h"
+
+/**
+ * Area of tested window positions of a task in coordinates of its pyramid level
+ */
+typedef struct {
+    /// First tested position
+    int x, y;
+    /// Number of tested columns and rows
+    int width, height;
+    /// Number of tested positions (half of area for checkerboard scan)
+    int positions;
+    /// Range of cost model cells covered by window centers
+    int cell_x1, cell_y1, cell_x2, cell_y2;
+} EpTaskArea;
+
+static EpTaskArea get_task_area (
+    EpTaskItem const *const task,
+    EpImgList  const *const imgs,
+    int               const window_width,
+    int               const window_height
+) {
+    EpImageProp const *const img_prop = imgs->data + task->image_index;
+    EpTaskArea area;
+
+    area.x = task->offset % img_prop->step;
+    area.y = task->offset / img_prop->step;
+    area.width  = task->width  + 1 - window_width;
+    area.height = task->height + 1 - window_height;
+    area.positions = task->scan_mode == SCAN_FULL ?
+                     area.width * area.height :
+                     (area.width * area.height + 1) / 2;
+
+    int const center_x = area.x + window_width  / 2,
+              center_y = area.y + window_height / 2;
+
+    area.cell_x1 =  center_x                    * COST_GRID_SIZE / img_prop->width;
+    area.cell_y1 =  center_y                    * COST_GRID_SIZE / img_prop->height;
+    area.cell_x2 = (center_x + area.width  - 1) * COST_GRID_SIZE / img_prop->width;
+    area.cell_y2 = (center_y + area.height - 1) * COST_GRID_SIZE / img_prop->height;
+
+    return area;
+}
+
+/**
+ * Average cost of measured cells; used for cells without history
+ */
+static float get_default_cost(EpCostModel const *const model) {
+    float sum = 0.0f;
+    int count = 0;
+
+    for(int i = 0; i < COST_GRID_SIZE * COST_GRID_SIZE; ++i) {
+        if(model->cost[i] > 0.0f) {
+            sum += model->cost[i];
+            ++count;
+        }
+    }
+
+    return count ? sum / count : 1.0f;
+}
+
+static float predict_task_cost (
+    EpTaskArea  const *const area,
+    EpCostModel const *const model,
+    float              const default_cost
+) {
+    if(!model)
+        return area->positions;
+
+    float sum = 0.0f;
+    for(int y = area->cell_y1; y <= area->cell_y2; ++y)
+        for(int x = area->cell_x1; x <= area->cell_x2; ++x) {
+            float const cost = model->cost[y * COST_GRID_SIZE + x];
+            sum += cost > 0.0f ? cost : default_cost;
+        }
+
+    int const cells_count = (area->cell_x2 - area->cell_x1 + 1) * (area->cell_y2 - area->cell_y1 + 1);
+    return sum / cells_count * area->positions;
+}
+
+EpCostModel ep_cost_model_create_empty(void) {
+    EpCostModel result = {{0.0f}};
+    return result;
+}
+
+void ep_cost_model_update (
+    EpCostModel       *const model,
+    EpTaskList  const *const tasks,
+    EpImgList   const *const imgs,
+    int                const window_width,
+    int                const window_height
+) {
+    float sums[COST_GRID_SIZE * COST_GRID_SIZE] = {0.0f};
+    int counts[COST_GRID_SIZE * COST_GRID_SIZE] = {0};
+
+    for(int i = 0; i < tasks->count; ++i) {
+        EpTaskItem const *const task = tasks->data + i;
+        EpTaskArea const area = get_task_area(task, imgs, window_width, window_height);
+
+        if(area.positions <= 0)
+            continue;
+
+        float const cost = (float)task->cycles / area.positions;
+
+        for(int y = area.cell_y1; y <= area.cell_y2; ++y)
+            for(int x = area.cell_x1; x <= area.cell_x2; ++x) {
+                sums[y * COST_GRID_SIZE + x] += cost;
+                ++counts[y * COST_GRID_SIZE + x];
+            }
+    }
+
+    for(int i = 0; i < COST_GRID_SIZE * COST_GRID_SIZE; ++i) {
+        if(!counts[i]) continue;
+
+        float const cost = sums[i] / counts[i];
+        model->cost[i] = model->cost[i] > 0.0f ? (model->cost[i] + cost) * 0.5f : cost;
+    }
+}
+
+/**
+ * Longest task goes first; ties are broken by position to keep order reproducible
+ */
+static int compare_tasks(void const *const a, void const *const b) {
+    EpTaskItem const *const task_a = (EpTaskItem const *)a,
+                     *const task_b = (EpTaskItem const *)b;
+
+    if(task_a->cycles != task_b->cycles)
+        return task_a->cycles < task_b->cycles ? 1 : -1;
+    if(task_a->image_index != task_b->image_index)
+        return task_a->image_index - task_b->image_index;
+    return task_a->offset - task_b->offset;
+}
+
+EpErrorCode ep_task_list_plan (
+    EpTaskList        *const tasks,
+    EpImgList   const *const imgs,
+    EpCostModel const *const model,
+    int                const window_width,
+    int                const window_height,
+    int                const workers_count,
+    int                const max_tasks
+) {
+    if(!tasks->count)
+        return ERR_SUCCESS;
+
+    float const default_cost = model ? get_default_cost(model) : 1.0f;
+
+    float total_cost = 0.0f;
+    for(int i = 0; i < tasks->count; ++i) {
+        EpTaskArea const area = get_task_area(tasks->data + i, imgs, window_width, window_height);
+        float const cost = predict_task_cost(&area, model, default_cost);
+        tasks->data[i].cycles = (unsigned int)(cost + 0.5f);
+        total_cost += cost;
+    }
+
+    //Tile is hot if it takes much longer than average tile or noticeable part of worker share
+    float split_limit = total_cost / (workers_count * PLAN_TASKS_PER_WORKER);
+    if(split_limit > total_cost / tasks->count * PLAN_HOT_TASK_RATIO)
+        split_limit = total_cost / tasks->count * PLAN_HOT_TASK_RATIO;
+
+    //Split tasks appended at the end are checked too, so hot tile is halved until it is cool enough
+    for(int i = 0; i < tasks->count; ++i) {
+        while(tasks->data[i].cycles > split_limit && tasks->count < max_tasks) {
+            EpTaskItem const task = tasks->data[i];
+            EpTaskArea const area = get_task_area(&task, imgs, window_width, window_height);
+
+            if(area.height < PLAN_MIN_SPLIT_ROWS * 2)
+                break;
+
+            //Upper stripe keeps the task; lower one starts split_rows below and keeps checkerboard phase
+            int const split_rows = area.height / 2;
+            int const image_step = imgs->data[task.image_index].step;
+
+            EpErrorCode const result = ep_task_list_add (
+                tasks,
+                task.offset + split_rows * image_step,
+                task.width,
+                task.height - split_rows,
+                task.step,
+                task.scan_mode == SCAN_FULL ? SCAN_FULL : (task.scan_mode + split_rows) & 1,
+                0,
+                task.image_index
+            );
+            if(result != ERR_SUCCESS)
+                return result;
+
+            EpTaskItem *const upper = tasks->data + i;
+            EpTaskItem *const lower = tasks->data + tasks->count - 1;
+
+            upper->height = split_rows + window_height - 1;
+            upper->area   = upper->step * upper->height;
+
+            EpTaskArea const upper_area = get_task_area(upper, imgs, window_width, window_height);
+            EpTaskArea const lower_area = get_task_area(lower, imgs, window_width, window_height);
+            upper->cycles = (unsigned int)(predict_task_cost(&upper_area, model, default_cost) + 0.5f);
+            lower->cycles = (unsigned int)(predict_task_cost(&lower_area, model, default_cost) + 0.5f);
+        }
+    }
+
+    qsort(tasks->data, tasks->count, sizeof(EpTaskItem), compare_tasks);
+
+    return ERR_SUCCESS;
+}
+
+EpErrorCode ep_task_list_partition (
+    EpTaskList        *const tasks,
+    EpTaskRange       *const ranges,
+    int                const ranges_count
+) {
+    int    *const task_range = (int *)malloc(sizeof(int) * (tasks->count + 1));
+    EpTaskItem *const sorted = (EpTaskItem *)malloc(sizeof(EpTaskItem) * (tasks->count + 1));
+    double *const range_cost = (double *)malloc(sizeof(double) * ranges_count);
+
+    if(!task_range || !sorted || !range_cost) {
+        free(task_range);
+        free(sorted);
+        free(range_cost);
+        return ERR_MEMORY;
+    }
+
+    for(int r = 0; r < ranges_count; ++r) {
+        range_cost[r] = 0.0;
+        ranges[r].next = ranges[r].end = ranges[r].finished = ranges[r].reserved = 0;
+    }
+
+    //Greedy longest-first assignment; one is added so that tasks without cost are spread too
+    for(int i = 0; i < tasks->count; ++i) {
+        int cheapest = 0;
+        for(int r = 1; r < ranges_count; ++r)
+            if(range_cost[r] < range_cost[cheapest])
+                cheapest = r;
+
+        task_range[i] = cheapest;
+        range_cost[cheapest] += tasks->data[i].cycles + 1.0;
+        ++ranges[cheapest].end;
+    }
+
+    //Ranges are laid out one after another; end temporarily holds the number of tasks
+    int start = 0;
+    for(int r = 0; r < ranges_count; ++r) {
+        ranges[r].next = start;
+        start += ranges[r].end;
+        ranges[r].end = ranges[r].next;
+    }
+
+    for(int i = 0; i < tasks->count; ++i)
+        sorted[ ranges[task_range[i]].end++ ] = tasks->data[i];
+
+    //Copied back, so that tasks may be a view of the part of larger list
+    memcpy(tasks->data, sorted, sizeof(EpTaskItem) * tasks->count);
+
+    free(sorted);
+    free(task_range);
+    free(range_cost);
+    return ERR_SUCCESS;
+}
+
+EpErrorCode ep_task_list_route_hybrid (
+    EpTaskList        *const tasks,
+    EpImgList   const *const imgs,
+    float              const host_share,
+    int               *const device_count
+) {
+    *device_count = 0;
+
+    if(!tasks->count || !imgs->count)
+        return ERR_SUCCESS;
+
+    //The first level is the source image itself
+    if(imgs->data[0].width * imgs->data[0].height < HYBRID_HOST_IMAGE_AREA)
+        return ERR_SUCCESS; //Offload overhead would dominate; everything is done on host
+
+    EpTaskItem *const routed = (EpTaskItem *)malloc(sizeof(EpTaskItem) * tasks->count);
+    if(!routed)
+        return ERR_MEMORY;
+
+    //Tasks of small levels go to the end of the list; both parts stay sorted longest-first
+    double total_cost = 0.0, small_levels_cost = 0.0;
+    int device_tasks = 0, host_tasks = 0;
+
+    for(int i = 0; i < tasks->count; ++i) {
+        EpImageProp const *const img_prop = imgs->data + tasks->data[i].image_index;
+        if(img_prop->width * img_prop->height >= HYBRID_HOST_LEVEL_AREA)
+            routed[device_tasks++] = tasks->data[i];
+        total_cost += tasks->data[i].cycles;
+    }
+
+    for(int i = 0; i < tasks->count; ++i) {
+        EpImageProp const *const img_prop = imgs->data + tasks->data[i].image_index;
+        if(img_prop->width * img_prop->height < HYBRID_HOST_LEVEL_AREA) {
+            routed[device_tasks + host_tasks++] = tasks->data[i];
+            small_levels_cost += tasks->data[i].cycles;
+        }
+    }
+
+    memcpy(tasks->data, routed, sizeof(EpTaskItem) * tasks->count);
+    free(routed);
+
+    //The rest of host share is taken from the cheapest tasks, so host threads balance well
+    double host_budget = total_cost * host_share - small_levels_cost;
+    while(device_tasks > 0 && tasks->data[device_tasks - 1].cycles <= host_budget) {
+        host_budget -= tasks->data[device_tasks - 1].cycles;
+        --device_tasks;
+    }
+
+    *device_count = device_tasks;
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Cost model of detection tasks and task planner.
+ *
+ * Cost model keeps measured cycles per tested window position in a coarse grid of
+ * cells laid over the image (the same grid is used for all pyramid levels, so costs
+ * measured at one level predict costs at the next ones). Planner uses it to split
+ * predicted-hot tiles, to order tasks longest-first and to give every core a range
+ * of tasks with the same predicted cost, so that no core or thread is left with one
+ * expensive tile at the end of the frame.
+ */
+
+#ifndef EP_TASK_PLANNER_H
+#define EP_TASK_PLANNER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+typedef enum {
+    /// Number of cost model cells along each image dimension
+    COST_GRID_SIZE = 32,
+    /// Task is split if it is predicted to take longer than this many average tasks
+    PLAN_HOT_TASK_RATIO = 4,
+    /// Task is split if it is predicted to take longer than 1 / PLAN_TASKS_PER_WORKER of worker share
+    PLAN_TASKS_PER_WORKER = 4,
+    /// Tiles are not split to less than this many tested rows
+    PLAN_MIN_SPLIT_ROWS = 8,
+    /// In hybrid mode images smaller than this (in pixels) are processed by host only
+    HYBRID_HOST_IMAGE_AREA = 320 * 240,
+    /// In hybrid mode pyramid levels smaller than this (in pixels) are processed by host only
+    HYBRID_HOST_LEVEL_AREA = 4 * RECOMMENDED_TILE_SIZE * RECOMMENDED_TILE_SIZE
+} EpPlannerConstants;
+
+/**
+ * Predicted cost of tested window positions in every cell of the image
+ */
+typedef struct {
+    /// Cycles per tested position; zero if the cell was never measured
+    float cost[COST_GRID_SIZE * COST_GRID_SIZE];
+} EpCostModel;
+
+/**
+ * Create cost model without history. All positions are predicted to cost the same.
+ */
+EpCostModel ep_cost_model_create_empty(void);
+
+/**
+ * Update cost model with cycles measured for processed tasks.
+ * Each cell keeps exponential average of history and new measurements,
+ *   so model follows the scene of video.
+ * @param model        : pointer to valid cost model;
+ * @param tasks        : tasks with cycles field filled by cores (or host threads);
+ * @param imgs         : properties of pyramid levels the tasks refer to;
+ * @param window_width : detection window width;
+ * @param window_height: detection window height.
+ */
+void ep_cost_model_update (
+    EpCostModel       *const model,
+    EpTaskList  const *const tasks,
+    EpImgList   const *const imgs,
+    int                const window_width,
+    int                const window_height
+);
+
+/**
+ * Plan tasks according to cost model.
+ * Tiles predicted to be hot are split into horizontal stripes, then tasks are sorted
+ *   longest-first. Predicted cost is stored in cycles field of every task.
+ * @param tasks        : pointer to valid task list;
+ * @param imgs         : properties of pyramid levels the tasks refer to;
+ * @param model        : cost model; NULL means that all positions cost the same;
+ * @param window_width : detection window width;
+ * @param window_height: detection window height;
+ * @param workers_count: number of cores or threads which process the tasks;
+ * @param max_tasks    : tiles are not split if task list would grow above this count.
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY on memory allocation failure.
+ */
+EpErrorCode ep_task_list_plan (
+    EpTaskList        *const tasks,
+    EpImgList   const *const imgs,
+    EpCostModel const *const model,
+    int                const window_width,
+    int                const window_height,
+    int                const workers_count,
+    int                const max_tasks
+);
+
+/**
+ * Distribute tasks between ranges of cores.
+ * Tasks (sorted longest-first by ep_task_list_plan()) are given one by one to the range
+ *   with the least predicted cost, then task list is reordered so that every range is
+ *   contiguous and starts with its longest task. Cores steal from the back of ranges,
+ *   so the cheapest tasks are left for balancing at the end of the frame.
+ * @param tasks       : pointer to valid task list (may be a part of larger list); reordered;
+ * @param ranges      : receives ranges_count ranges;
+ * @param ranges_count: number of ranges (started cores).
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY on memory allocation failure.
+ */
+EpErrorCode ep_task_list_partition (
+    EpTaskList        *const tasks,
+    EpTaskRange       *const ranges,
+    int                const ranges_count
+);
+
+/**
+ * Route tasks between host threads and device cores (DET_HYBRID mode).
+ * Small images go to host entirely, since offload overhead would dominate. Otherwise
+ *   tasks of small pyramid levels go to host, and then the cheapest remaining tasks
+ *   are added until host gets host_share of total predicted cost.
+ *   The split is fixed for the frame, since host cannot take the mutexes cores use
+ *   to steal tasks from each other (@see EpTaskRange); host_share is tuned between frames instead.
+ * @param tasks       : task list planned by ep_task_list_plan(); reordered so that
+ *                      device tasks go first and host tasks follow them;
+ * @param imgs        : properties of pyramid levels the tasks refer to;
+ * @param host_share  : part of total predicted cost to process on host (0..1);
+ * @param device_count: receives number of tasks for device.
+ * @return ERR_SUCCESS on success;
+ *         ERR_MEMORY on memory allocation failure.
+ */
+EpErrorCode ep_task_list_route_hybrid (
+    EpTaskList        *const tasks,
+    EpImgList   const *const imgs,
+    float              const host_share,
+    int               *const device_count
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EP_TASK_PLANNER_H */
@@ -0,0 +1,212 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Timeline of host threads and device cores
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <opencv/cv.h>
+
+#include "ep_trace.h"
+
+/**
+ * Recorded span
+ */
+typedef struct {
+    char const *name;
+    char const *category;
+    int pid, tid;
+    /// Start and end in microseconds since ep_trace_start()
+    double start, end;
+    char const *arg_name;
+    int arg_value;
+} EpTraceSpan;
+
+/// Spans recorded since ep_trace_start(); guarded by critical section ep_trace
+static EpTraceSpan *trace_spans = NULL;
+static int trace_capacity = 0;
+static int trace_count = 0;
+static int trace_active = 0;
+/// Ticks at ep_trace_start()
+static int64 trace_origin = 0;
+
+EpErrorCode ep_trace_start(void) {
+    #pragma omp critical(ep_trace)
+    {
+        trace_count = 0;
+        trace_origin = cvGetTickCount();
+        trace_active = 1;
+    }
+    return ERR_SUCCESS;
+}
+
+int ep_trace_is_active(void) {
+    return trace_active;
+}
+
+double ep_trace_time(int64 const ticks) {
+    return (ticks - trace_origin) / cvGetTickFrequency();
+}
+
+double ep_trace_now(void) {
+    return ep_trace_time( cvGetTickCount() );
+}
+
+void ep_trace_span (
+    char const *const name,
+    char const *const category,
+    int         const pid,
+    int         const tid,
+    double      const start,
+    double      const end,
+    char const *const arg_name,
+    int         const arg_value
+) {
+    if(!trace_active)
+        return;
+
+    #pragma omp critical(ep_trace)
+    {
+        if(trace_count == trace_capacity) {
+            int const new_capacity = trace_capacity ? trace_capacity * 2 : 4096;
+            EpTraceSpan *const new_buf = (EpTraceSpan *)realloc(trace_spans, sizeof(EpTraceSpan) * new_capacity);
+            if(new_buf) {
+                trace_spans = new_buf;
+                trace_capacity = new_capacity;
+            }
+        }
+
+        if(trace_count < trace_capacity) { //Span is dropped if memory is over
+            EpTraceSpan *const span = trace_spans + trace_count++;
+            span->name      = name;
+            span->category  = category;
+            span->pid       = pid;
+            span->tid       = tid;
+            span->start     = start;
+            span->end       = end;
+            span->arg_name  = arg_name;
+            span->arg_value = arg_value;
+        }
+    }
+}
+
+double ep_trace_sum (
+    char const *const name,
+    double     *const durations,
+    int        *const counts,
+    int         const count
+) {
+    double result = 0;
+    for(int i = 0; i < count; ++i) {
+        if(durations) durations[i] = 0;
+        if(counts) counts[i] = 0;
+    }
+
+    #pragma omp critical(ep_trace)
+    {
+        for(int i = 0; i < trace_count; ++i) {
+            EpTraceSpan const *const span = trace_spans + i;
+            if( strcmp(span->name, name) )
+                continue;
+
+            double const duration = span->end - span->start;
+            result += duration;
+            if(span->arg_value >= 0 && span->arg_value < count) {
+                if(durations) durations[span->arg_value] += duration;
+                if(counts) ++counts[span->arg_value];
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Write process and thread names of every track used by spans.
+ * The host process name is always the first event; every other event is preceded by separator.
+ */
+static void write_track_names(FILE *const f) {
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"Host\"}}", TRACE_PID_HOST);
+    fprintf(f, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"Epiphany\"}}", TRACE_PID_DEVICE);
+
+    //Name is written for the first span of every track; core ids have 12 bits
+    char *const seen = (char *)calloc(3 * 4096, 1);
+    if(!seen)
+        return;
+
+    for(int i = 0; i < trace_count; ++i) {
+        EpTraceSpan const *const span = trace_spans + i;
+        int const track = span->pid == TRACE_PID_HOST ? span->tid & 4095 :
+                          span->tid >= TRACE_TID_DMA  ? 8192 + ( (span->tid - TRACE_TID_DMA) & 4095 ) :
+                                                        4096 + (span->tid & 4095);
+        if(seen[track]) continue;
+        seen[track] = 1;
+
+        if(span->pid == TRACE_PID_HOST)
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+                    span->pid, span->tid, span->tid);
+        else if(span->tid >= TRACE_TID_DMA)
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Core %d DMA\"}}",
+                    span->pid, span->tid, span->tid - TRACE_TID_DMA);
+        else
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Core %d\"}}",
+                    span->pid, span->tid, span->tid);
+    }
+
+    free(seen);
+}
+
+EpErrorCode ep_trace_stop(char const *const file_name) {
+    if(!trace_active)
+        return ERR_ARGUMENT;
+
+    trace_active = 0;
+    EpErrorCode result = ERR_SUCCESS;
+
+    if(file_name) {
+        FILE *const f = fopen(file_name, "wt");
+        if(!f)
+            result = ERR_FILE;
+        else {
+            fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+            write_track_names(f);
+
+            for(int i = 0; i < trace_count; ++i) {
+                EpTraceSpan const *const span = trace_spans + i;
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                        span->name, span->category, span->pid, span->tid, span->start, span->end - span->start);
+                if(span->arg_name)
+                    fprintf(f, ",\"args\":{\"%s\":%d}", span->arg_name, span->arg_value);
+                fprintf(f, "}");
+            }
+
+            fprintf(f, "\n]}\n");
+            if( fclose(f) )
+                result = ERR_FILE;
+        }
+    }
+
+    free(trace_spans);
+    trace_spans = NULL;
+    trace_capacity = 0;
+    trace_count = 0;
+
+    return result;
+}
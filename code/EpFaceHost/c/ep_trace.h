@@ -0,0 +1,119 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Timeline of host threads and device cores.
+ *
+ * Tracing is process-wide and off by default. While it is active, detection
+ * functions record timestamped spans (pyramid levels, tiles, device task phases,
+ * host stages); ep_trace_stop() writes them as Chrome trace-event JSON which
+ * can be opened in chrome://tracing or Perfetto.
+ */
+
+#ifndef EP_TRACE_H
+#define EP_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "ep_data_types.h"
+
+typedef enum {
+    /// Process id of host threads in trace
+    TRACE_PID_HOST = 0,
+    /// Process id of device cores in trace (thread id is core id)
+    TRACE_PID_DEVICE = 1,
+    /// Added to core id to get thread id of its tile DMA track, which overlaps detection
+    TRACE_TID_DMA = 0x10000
+} EpTraceConstants;
+
+/**
+ * Start recording spans. Spans recorded before are discarded.
+ * @return ERR_SUCCESS
+ */
+EpErrorCode ep_trace_start(void);
+
+/**
+ * Stop recording spans and write them to file.
+ * @param file_name: name of Chrome trace-event JSON file; NULL discards spans.
+ * @return ERR_SUCCESS on success;
+ *         ERR_ARGUMENT if trace was not started;
+ *         ERR_FILE if file cannot be written.
+ */
+EpErrorCode ep_trace_stop(char const *const file_name);
+
+/**
+ * @return non-zero if spans are being recorded
+ */
+int ep_trace_is_active(void);
+
+/**
+ * Convert value of cvGetTickCount() to trace time.
+ * @return microseconds since ep_trace_start()
+ */
+double ep_trace_time(int64 const ticks);
+
+/**
+ * @return current trace time in microseconds since ep_trace_start()
+ */
+double ep_trace_now(void);
+
+/**
+ * Record span. Ignored if trace is not active. May be called from several threads.
+ * @param name     : span name; must be string literal (pointer is stored);
+ * @param category : span category; must be string literal;
+ * @param pid      : TRACE_PID_HOST or TRACE_PID_DEVICE;
+ * @param tid      : host thread number or core id (plus TRACE_TID_DMA for DMA track);
+ * @param start    : trace time of span start in microseconds;
+ * @param end      : trace time of span end in microseconds;
+ * @param arg_name : name of integer argument shown with span (string literal), or NULL;
+ * @param arg_value: value of the argument.
+ */
+void ep_trace_span (
+    char const *const name,
+    char const *const category,
+    int         const pid,
+    int         const tid,
+    double      const start,
+    double      const end,
+    char const *const arg_name,
+    int         const arg_value
+);
+
+/**
+ * Sum durations of spans recorded since ep_trace_start() with given name, grouped by argument value.
+ *   Used for breakdowns (e.g. scan time per pyramid level) without writing the trace.
+ * @param name     : span name;
+ * @param durations: receives sum of durations in microseconds of spans with argument value i
+ *                   in durations[i]; spans with argument value outside [0, count) are only
+ *                   added to the result (may be NULL);
+ * @param counts   : receives number of spans with argument value i in counts[i] (may be NULL);
+ * @param count    : size of arrays.
+ * @return sum of durations in microseconds of all spans with this name.
+ */
+double ep_trace_sum (
+    char const *const name,
+    double     *const durations,
+    int        *const counts,
+    int         const count
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EP_TRACE_H */
@@ -0,0 +1,423 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+#include <omp.h>
+#include <algorithm>
+#include <cstring>
+
+#include "ep_async_detector.hpp"
+
+namespace ep
+{
+    /**
+     * State of request slot
+     */
+    enum AsyncRequestState {
+        /// Slot is free
+        REQUEST_FREE,
+        /// Frame is being copied by submit()
+        REQUEST_FILLING,
+        /// Frame waits for worker
+        REQUEST_QUEUED,
+        /// Frame is being detected
+        REQUEST_RUNNING,
+        /// Results are ready to be delivered
+        REQUEST_DONE
+    };
+
+    /**
+     * Submitted frame and its results
+     */
+    struct AsyncRequest {
+        long id;
+        AsyncRequestState state;
+        /// Copy of frame; buffer grows to the largest frame and is reused
+        std::vector<unsigned char> pixels;
+        int width, height;
+        int min_neighbors;
+        EpScanMode scan_mode;
+        EpErrorCode result;
+        std::vector<cv::Rect> objects;
+
+        inline AsyncRequest(void):
+            id(-1), state(REQUEST_FREE), pixels(), width(0), height(0),
+            min_neighbors(0), scan_mode(SCAN_EVEN), result(ERR_SUCCESS), objects()
+        { ; }
+
+        /// Frame copy as image (data is not copied)
+        inline cv::Mat image(void) {
+            return cv::Mat(height, width, CV_8UC1, &pixels[0], width);
+        }
+    };
+
+    /**
+     * Worker thread with its own detector
+     */
+    struct AsyncWorker {
+        AsyncDetector *owner;
+        pthread_t thread;
+        bool started;
+        /// Detector of DET_HOST worker
+        Detector detector;
+        /// Session of DET_DEVICE and DET_HYBRID worker
+        DeviceSession session;
+
+        inline AsyncWorker(AsyncDetector *const owner):
+            owner(owner), thread(), started(false), detector(), session()
+        { ; }
+    };
+
+    DetectionCallback::~DetectionCallback(void) { ; }
+
+    AsyncDetector::AsyncDetector(void):
+        workers(),
+        requests(),
+        backpressure(BACKPRESSURE_BLOCK),
+        callback(NULL),
+        next_submit(0), next_run(0), next_deliver(0),
+        delivering(false),
+        stopping(false)
+    {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&queued, NULL);
+        pthread_cond_init(&done, NULL);
+    }
+
+    AsyncDetector::~AsyncDetector(void) {
+        close();
+        pthread_cond_destroy(&done);
+        pthread_cond_destroy(&queued);
+        pthread_mutex_destroy(&lock);
+    }
+
+    EpErrorCode AsyncDetector::open (
+        CascadeClassifier const &classifier,
+        EpDetectionMode          detection_mode,
+        int                      workers_count,
+        int                      max_in_flight,
+        Backpressure             backpressure,
+        DetectionCallback       *callback
+    ) {
+        close();
+
+        if( ep_classifier_check( classifier.get_data() ) )
+            return ERR_ARGUMENT; //Wrong classifier
+
+        if(detection_mode != DET_HOST && detection_mode != DET_DEVICE && detection_mode != DET_HYBRID)
+            return ERR_ARGUMENT;
+
+        int const threads_count( omp_get_max_threads() );
+        int const host_workers( workers_count > 0 ? workers_count : threads_count );
+        int const slots_count( std::max(max_in_flight, detection_mode == DET_HOST ? host_workers : 1) );
+
+        for(int i(0); i < slots_count; ++i)
+            requests.push_back( new AsyncRequest() );
+        this->backpressure = backpressure;
+        this->callback = callback;
+
+        EpErrorCode result(ERR_SUCCESS);
+
+        if(detection_mode == DET_HOST) {
+            //Available threads are split between workers, so frames detected at once do not oversubscribe them
+            int const worker_threads( std::max(threads_count / host_workers, 1) );
+            for(int i(0); i < host_workers && result == ERR_SUCCESS; ++i) {
+                workers.push_back( new AsyncWorker(this) );
+                result = workers.back()->detector.open(classifier, DET_HOST, worker_threads);
+            }
+        } else {
+            workers.push_back( new AsyncWorker(this) );
+            result = workers.back()->session.open(classifier, workers_count > 0 ? workers_count : 16);
+            if(result == ERR_SUCCESS && detection_mode == DET_HYBRID)
+                result = workers.back()->session.set_mode(DET_HYBRID);
+        }
+
+        for(size_t i(0); i < workers.size() && result == ERR_SUCCESS; ++i) {
+            if( pthread_create(&workers[i]->thread, NULL, detection_mode == DET_HOST ? host_worker_main : device_worker_main, workers[i]) )
+                result = ERR_OTHER;
+            else
+                workers[i]->started = true;
+        }
+
+        if(result != ERR_SUCCESS)
+            close();
+
+        return result;
+    }
+
+    void AsyncDetector::close(void) {
+        //Workers detect queued frames before they stop, so callback gets all of them
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&queued);
+        pthread_mutex_unlock(&lock);
+
+        for(size_t i(0); i < workers.size(); ++i) {
+            if(workers[i]->started)
+                pthread_join(workers[i]->thread, NULL);
+            delete workers[i];
+        }
+        workers.clear();
+
+        for(size_t i(0); i < requests.size(); ++i)
+            delete requests[i];
+        requests.clear();
+
+        callback = NULL;
+        next_submit = next_run = next_deliver = 0;
+        delivering = stopping = false;
+    }
+
+    bool AsyncDetector::is_open(void) const {
+        return !workers.empty();
+    }
+
+    AsyncRequest &AsyncDetector::request_of(long const id) const {
+        return *requests[ id % static_cast<long>( requests.size() ) ];
+    }
+
+    EpErrorCode AsyncDetector::submit (
+        cv::Mat               const &image,
+        int                   const  min_neighbors,
+        EpScanMode            const  scan_mode,
+        long                        *id
+    ) {
+        if( !is_open() || !image.data || image.cols < 1 || image.rows < 1 )
+            return ERR_ARGUMENT;
+
+        pthread_mutex_lock(&lock);
+
+        while( next_submit - next_deliver >= static_cast<long>( requests.size() ) ) {
+            if(backpressure == BACKPRESSURE_REJECT) {
+                pthread_mutex_unlock(&lock);
+                return ERR_OTHER;
+            }
+            pthread_cond_wait(&done, &lock);
+        }
+
+        long const request_id( next_submit++ );
+        AsyncRequest &request( request_of(request_id) );
+        request.id = request_id;
+        request.state = REQUEST_FILLING;
+
+        pthread_mutex_unlock(&lock);
+
+        //Frame is copied without lock, so workers and other submitters are not held
+        request.width = image.cols;
+        request.height = image.rows;
+        request.min_neighbors = min_neighbors;
+        request.scan_mode = scan_mode;
+        request.pixels.resize(image.cols * image.rows);
+        for(int y(0); y < image.rows; ++y)
+            std::memcpy(&request.pixels[y * image.cols], image.data + y * image.step, image.cols);
+
+        pthread_mutex_lock(&lock);
+        request.state = REQUEST_QUEUED;
+        pthread_cond_broadcast(&queued);
+        pthread_mutex_unlock(&lock);
+
+        if(id)
+            *id = request_id;
+
+        return ERR_SUCCESS;
+    }
+
+    bool AsyncDetector::ready(void) const {
+        if( !is_open() )
+            return false;
+
+        pthread_mutex_lock(&lock);
+        bool const result( !callback && next_deliver < next_submit && request_of(next_deliver).state == REQUEST_DONE );
+        pthread_mutex_unlock(&lock);
+
+        return result;
+    }
+
+    EpErrorCode AsyncDetector::collect(std::vector<cv::Rect> &objects, long *id) {
+        objects.clear();
+        if( !is_open() || callback )
+            return ERR_ARGUMENT;
+
+        pthread_mutex_lock(&lock);
+
+        //Head is checked again after every wake up, since other thread may have collected it
+        while( next_deliver == next_submit || request_of(next_deliver).state != REQUEST_DONE ) {
+            if(next_deliver == next_submit) {
+                pthread_mutex_unlock(&lock);
+                return ERR_OTHER; //There are no submitted frames
+            }
+            pthread_cond_wait(&done, &lock);
+        }
+
+        AsyncRequest &request( request_of(next_deliver) );
+
+        //Vectors are exchanged, so caller's vector is reused by the slot
+        objects.swap(request.objects);
+        EpErrorCode const result(request.result);
+        if(id)
+            *id = request.id;
+
+        request.state = REQUEST_FREE;
+        ++next_deliver;
+        pthread_cond_broadcast(&done);
+
+        pthread_mutex_unlock(&lock);
+
+        return result;
+    }
+
+    void AsyncDetector::flush(void) {
+        pthread_mutex_lock(&lock);
+
+        for(;;) {
+            long pending(next_deliver);
+            if(!callback) {
+                while(pending < next_submit && request_of(pending).state == REQUEST_DONE)
+                    ++pending;
+            }
+            if(pending == next_submit)
+                break;
+            pthread_cond_wait(&done, &lock);
+        }
+
+        pthread_mutex_unlock(&lock);
+    }
+
+    int AsyncDetector::in_flight(void) const {
+        pthread_mutex_lock(&lock);
+        int const result( static_cast<int>(next_submit - next_deliver) );
+        pthread_mutex_unlock(&lock);
+
+        return result;
+    }
+
+    /**
+     * Mark request as done and pass results which are ready to callback in submission order. Called with lock held.
+     */
+    void AsyncDetector::finish(AsyncRequest &request) {
+        request.state = REQUEST_DONE;
+
+        //Callback is called by one thread at a time; results done meanwhile by other workers are delivered by it too
+        if(callback && !delivering) {
+            delivering = true;
+
+            while( next_deliver < next_submit && request_of(next_deliver).state == REQUEST_DONE ) {
+                AsyncRequest &ready( request_of(next_deliver) );
+
+                pthread_mutex_unlock(&lock);
+                callback->on_detection(ready.id, ready.result, ready.objects);
+                pthread_mutex_lock(&lock);
+
+                ready.state = REQUEST_FREE;
+                ++next_deliver;
+                pthread_cond_broadcast(&done);
+            }
+
+            delivering = false;
+        }
+
+        pthread_cond_broadcast(&done);
+    }
+
+    void AsyncDetector::run_host(AsyncWorker &worker) {
+        pthread_mutex_lock(&lock);
+
+        for(;;) {
+            //Frames are taken in submission order; queued frames are detected before workers stop
+            while( !( next_run < next_submit && request_of(next_run).state == REQUEST_QUEUED ) &&
+                   !( stopping && next_run == next_submit ) )
+                pthread_cond_wait(&queued, &lock);
+
+            if(next_run == next_submit)
+                break;
+
+            AsyncRequest &request( request_of(next_run++) );
+            request.state = REQUEST_RUNNING;
+
+            pthread_mutex_unlock(&lock);
+            request.result = worker.detector.detect(request.image(), request.objects, request.min_neighbors, request.scan_mode);
+            pthread_mutex_lock(&lock);
+
+            finish(request);
+        }
+
+        pthread_mutex_unlock(&lock);
+    }
+
+    void AsyncDetector::run_device(AsyncWorker &worker) {
+        //Frames submitted to device session and not collected yet, oldest first
+        AsyncRequest *device_frames[DRAM_BUF_SLOTS];
+        int device_count(0);
+        //Set when submission is refused until frames in flight are collected (large pyramid takes the whole images buffer)
+        bool wait_for_pipeline(false);
+
+        pthread_mutex_lock(&lock);
+
+        for(;;) {
+            //Submission is preferred to collection, so pipeline is kept full while frames are queued.
+            //If nothing is queued the oldest frame is collected right away: frames come slower than device detects them.
+            if( device_count < DRAM_BUF_SLOTS && !(wait_for_pipeline && device_count) &&
+                next_run < next_submit && request_of(next_run).state == REQUEST_QUEUED ) {
+                AsyncRequest &request( request_of(next_run++) );
+                request.state = REQUEST_RUNNING;
+
+                pthread_mutex_unlock(&lock);
+                request.result = worker.session.submit(request.image(), request.scan_mode);
+                pthread_mutex_lock(&lock);
+
+                wait_for_pipeline = request.result == ERR_OTHER && device_count > 0;
+                if(request.result == ERR_SUCCESS) {
+                    device_frames[device_count++] = &request;
+                } else if(wait_for_pipeline) {
+                    //Frame is submitted again after frames in flight are collected
+                    request.state = REQUEST_QUEUED;
+                    --next_run;
+                } else {
+                    request.objects.clear();
+                    finish(request);
+                }
+            } else if(device_count) {
+                AsyncRequest &request( *device_frames[0] );
+                std::copy(device_frames + 1, device_frames + device_count, device_frames);
+                --device_count;
+
+                pthread_mutex_unlock(&lock);
+                request.result = worker.session.collect(request.objects, request.min_neighbors);
+                pthread_mutex_lock(&lock);
+
+                finish(request);
+            } else if(stopping && next_run == next_submit) {
+                break;
+            } else {
+                pthread_cond_wait(&queued, &lock);
+            }
+        }
+
+        pthread_mutex_unlock(&lock);
+    }
+
+    void *AsyncDetector::host_worker_main(void *worker) {
+        AsyncWorker *const async_worker( static_cast<AsyncWorker *>(worker) );
+        async_worker->owner->run_host(*async_worker);
+        return NULL;
+    }
+
+    void *AsyncDetector::device_worker_main(void *worker) {
+        AsyncWorker *const async_worker( static_cast<AsyncWorker *>(worker) );
+        async_worker->owner->run_device(*async_worker);
+        return NULL;
+    }
+}
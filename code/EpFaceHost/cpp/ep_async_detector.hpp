@@ -0,0 +1,175 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Asynchronous detection: frames are submitted without waiting for their detection, several
+ * frames are processed at once, and results are delivered in submission order.
+ */
+#ifndef EP_ASYNC_DETECTOR_HPP
+#define EP_ASYNC_DETECTOR_HPP
+
+#include <pthread.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "ep_cascade_detector.hpp"
+
+namespace ep {
+
+struct AsyncRequest;
+struct AsyncWorker;
+
+/**
+ * What submit() does when max_in_flight frames are already submitted and not delivered
+ */
+enum Backpressure {
+    /// Wait until results of the oldest frame are delivered
+    BACKPRESSURE_BLOCK,
+    /// Return ERR_OTHER at once; frame is not submitted
+    BACKPRESSURE_REJECT
+};
+
+/**
+ * Receiver of asynchronous detection results
+ */
+class DetectionCallback {
+public:
+    virtual ~DetectionCallback(void);
+
+    /**
+     * Called once for every submitted frame in submission order, from one of worker threads.
+     *   Calls are never concurrent. Callback must not call close() or blocking submit().
+     * @param id     : id of the frame given by submit();
+     * @param result : error code of detection (@see Detector::detect);
+     * @param objects: grouped detections; valid during the call only.
+     */
+    virtual void on_detection(long id, EpErrorCode result, std::vector<cv::Rect> const &objects) = 0;
+};
+
+/**
+ * Detector running in its own threads. Frames are copied by submit(), so caller never waits for
+ *   detection (unless BACKPRESSURE_BLOCK is chosen and max_in_flight frames are not delivered yet).
+ * In DET_HOST mode several worker threads detect frames at once, each with its own ep::Detector.
+ *   In DET_DEVICE and DET_HYBRID modes one worker thread keeps DRAM_BUF_SLOTS frames in the device
+ *   session pipeline (@see DeviceSession::submit); frame with pyramid larger than MAX_SLOT_IMGS_BUF
+ *   bytes waits for frames in flight and is detected alone.
+ * Results are either passed to callback or taken by collect(), in both cases in submission order.
+ *   Frame buffers and result vectors are kept in max_in_flight slots and reused.
+ * submit(), ready() and collect() may be called from several threads.
+ */
+class AsyncDetector {
+public:
+    AsyncDetector(void);
+
+    /// Destructor closes detector
+    ~AsyncDetector(void);
+
+    /**
+     * Copy classifier and start worker threads; previously opened detector is closed.
+     * @param workers_count: DET_HOST: frames detected at once (zero means one per available thread);
+     *                       available threads are split between them;
+     *                       DET_DEVICE, DET_HYBRID: number of cores (zero means 16).
+     * @param max_in_flight: frames submitted and not delivered yet; at least workers_count is used in DET_HOST mode.
+     * @param backpressure : what submit() does when max_in_flight frames are in flight.
+     * @param callback     : receives results; if NULL results are taken by collect(). Callback is not owned.
+     * @return ERR_SUCCESS; ERR_ARGUMENT for invalid classifier or mode; errors of opening detectors or device session.
+     */
+    EpErrorCode open (
+        CascadeClassifier const &classifier,
+        EpDetectionMode          detection_mode = DET_HOST,
+        int                      workers_count  = 0,
+        int                      max_in_flight  = 4,
+        Backpressure             backpressure   = BACKPRESSURE_BLOCK,
+        DetectionCallback       *callback       = NULL
+    );
+
+    /// Wait for frames in flight (results of frames which are not collected are discarded) and stop workers
+    void close(void);
+
+    /// Determine whether detector is opened
+    bool is_open(void) const;
+
+    /**
+     * Copy frame and queue it for detection.
+     * @param min_neighbors: minimal number of detections in detection group.
+     *                       if this value is zero then grouping is disabled.
+     * @param id           : receives id of the frame (ids go up from zero); may be NULL.
+     * @return ERR_SUCCESS : frame is queued;
+     *         ERR_ARGUMENT: detector is not opened or image is empty;
+     *         ERR_OTHER   : max_in_flight frames are in flight and backpressure is BACKPRESSURE_REJECT.
+     */
+    EpErrorCode submit (
+        cv::Mat               const &image,
+        int                   const  min_neighbors  = 3,
+        EpScanMode            const  scan_mode      = SCAN_EVEN,
+        long                        *id             = NULL
+    );
+
+    /// Determine whether results of the oldest frame which is not collected are ready (@see collect)
+    bool ready(void) const;
+
+    /**
+     * Wait for results of the oldest frame which is not collected yet and take them.
+     * @param objects: receives grouped detections;
+     * @param id     : receives id of the frame; may be NULL.
+     * @return error code of detection;
+     *         ERR_ARGUMENT: detector is not opened or results are passed to callback;
+     *         ERR_OTHER   : there are no submitted frames.
+     */
+    EpErrorCode collect(std::vector<cv::Rect> &objects, long *id = NULL);
+
+    /// Wait until results of all submitted frames are delivered to callback or ready to be collected
+    void flush(void);
+
+    /// Number of frames submitted and not delivered yet
+    int in_flight(void) const;
+
+private:
+    AsyncDetector(AsyncDetector const &);
+    AsyncDetector &operator=(AsyncDetector const &);
+
+    static void *host_worker_main(void *worker);
+    static void *device_worker_main(void *worker);
+
+    void run_host(AsyncWorker &worker);
+    void run_device(AsyncWorker &worker);
+    void finish(AsyncRequest &request);
+    AsyncRequest &request_of(long id) const;
+
+    mutable pthread_mutex_t lock;
+    /// Signaled when frame is queued or workers are stopped
+    pthread_cond_t queued;
+    /// Signaled when frame is done, delivered or collected
+    pthread_cond_t done;
+
+    std::vector<AsyncWorker *> workers;
+    /// Ring of max_in_flight slots; frame with given id is held in slot id % max_in_flight
+    std::vector<AsyncRequest *> requests;
+    Backpressure backpressure;
+    DetectionCallback *callback;
+
+    /// Id of the next submitted frame, of the next frame taken by workers, of the oldest frame not delivered
+    long next_submit, next_run, next_deliver;
+    /// True while one of threads calls callback
+    bool delivering;
+    bool stopping;
+};
+
+}
+
+#endif
@@ -16,8 +16,10 @@
    <http://www.gnu.org/licenses/>. */
 
 #include <omp.h>
+#include <algorithm>
 
 #include "ep_cascade_detector.hpp"
+#include "../c/ep_trace.h"
 
 #ifdef __OPENCV_OBJDETECT_HPP__
     #include "cascadedetect.hpp"
@@ -105,11 +107,13 @@ namespace ep
      * @param ep_rectangles: source detections
      * @param rectangles: resulting grouped detections
      * @param min_neighbors: if zero then source rectangles will be just copied to result. Otherwise grouping is performed. Groups containing less than min_neighbors are discarded
+     * @param intersections: buffer for intersections lists; it is grown to number of source detections and reused by next calls
      */
     void group_rectangles (
         EpRectList const &ep_rectangles,
         std::vector<cv::Rect> &rectangles,
-        int const min_neighbors
+        int const min_neighbors,
+        std::vector<IntersectionsList> &intersections
     ) {
         rectangles.clear();
 
@@ -122,7 +126,18 @@ namespace ep
             return;
         }
 
-        std::vector<IntersectionsList> intersections(ep_rectangles.count);
+        //Lists are cleared rather than destroyed, so they keep memory of previous calls. All of them get
+        //the largest capacity, since order of detections (and so list of every rectangle) differs from call to call.
+        if(static_cast<int>( intersections.size() ) < ep_rectangles.count)
+            intersections.resize(ep_rectangles.count);
+        size_t capacity(0);
+        for(int i(0); i < static_cast<int>( intersections.size() ); ++i)
+            capacity = std::max( capacity, intersections[i].intersections.capacity() );
+        for(int i(0); i < ep_rectangles.count; ++i) {
+            intersections[i].total_amount = 1.0f;
+            intersections[i].intersections.clear();
+            intersections[i].intersections.reserve(capacity);
+        }
 
         for(int i1 = 0; i1 < ep_rectangles.count - 1; ++i1) {
             for(int i2(i1 + 1); i2 < ep_rectangles.count; ++i2) {
@@ -185,6 +200,15 @@ namespace ep
         }
     }
 
+    void group_rectangles (
+        EpRectList const &ep_rectangles,
+        std::vector<cv::Rect> &rectangles,
+        int const min_neighbors
+    ) {
+        std::vector<IntersectionsList> intersections;
+        group_rectangles(ep_rectangles, rectangles, min_neighbors, intersections);
+    }
+
     /**
      * Wrapper around corresponding C routine (@see ep_detect_multi_scale).
      * In addition this routine makes objects grouping.
@@ -199,18 +223,21 @@ namespace ep
         EpScanMode            const  scan_mode,
         EpDetectionMode       const  detection_mode,
         int                          num_cores,
-        std::string           const &log_file
+        EpDetectStats               *stats
     ) {
         EpImage ep_image_orig = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+        double const trace_clone( ep_trace_now() );
         //ToDo: ideally aligned copy should be created directly in shared memory
         EpImage ep_image_aligned = ep_image_clone(&ep_image_orig);
+        double const trace_detect( ep_trace_now() );
+        ep_trace_span("clone", "host", TRACE_PID_HOST, 0, trace_clone, trace_detect, NULL, 0);
 
         EpRectList ep_objects( ep_rect_list_create_empty() );
 
         EpErrorCode result(ERR_ARGUMENT);
 
         if(detection_mode == DET_HOST)
-            result = ep_detect_multi_scale_host(&ep_image_aligned, classifier.get_data(), &ep_objects, scan_mode);
+            result = ep_detect_multi_scale_host(&ep_image_aligned, classifier.get_data(), &ep_objects, scan_mode, stats);
 
         if(detection_mode == DET_DEVICE)
             result = ep_detect_multi_scale_device (
@@ -219,10 +246,27 @@ namespace ep
                 &ep_objects,
                  scan_mode,
                  num_cores,
-                log_file.length() ? log_file.c_str() : NULL
+                 stats
             );
 
+        if(detection_mode == DET_HYBRID)
+            result = ep_detect_multi_scale_hybrid (
+                &ep_image_aligned,
+                 classifier.get_data(),
+                &ep_objects,
+                 scan_mode,
+                 num_cores,
+                 stats
+            );
+
+        double const trace_group( ep_trace_now() );
+        ep_trace_span("detect", "host", TRACE_PID_HOST, 0, trace_detect, trace_group, NULL, 0);
+
         group_rectangles(ep_objects, objects, min_neighbors);
+        double const trace_end( ep_trace_now() );
+        ep_trace_span("group", "host", TRACE_PID_HOST, 0, trace_group, trace_end, "objects", ep_objects.count);
+        if(stats)
+            stats->time_group = trace_end - trace_group;
 
         ep_rect_list_release(&ep_objects);
 
@@ -231,6 +275,294 @@ namespace ep
         return result;
     }
 
+    /**
+     * Wrapper around corresponding C routine (@see ep_detect_multi_scale_host_multi).
+     * In addition this routine makes objects grouping for each classifier.
+     */
+    EpErrorCode detect_multi_scale (
+        cv::Mat                                  const &image,
+        std::vector<CascadeClassifier>           const &classifiers,
+        std::vector< std::vector<cv::Rect> >           &objects,
+        int                                      const  min_neighbors,
+        EpScanMode                               const  scan_mode,
+        EpDetectStats                                  *stats
+    ) {
+        int const classifiers_count( static_cast<int>( classifiers.size() ) );
+        objects.assign( classifiers.size(), std::vector<cv::Rect>() );
+        if(!classifiers_count)
+            return ERR_ARGUMENT;
+
+        EpImage ep_image_orig = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+        EpImage ep_image_aligned = ep_image_clone(&ep_image_orig);
+
+        std::vector<EpCascadeClassifier const *> ep_classifiers(classifiers_count);
+        std::vector<EpRectList> ep_objects( classifiers_count, ep_rect_list_create_empty() );
+        for(int i = 0; i < classifiers_count; ++i)
+            ep_classifiers[i] = classifiers[i].get_data();
+
+        EpErrorCode const result( ep_detect_multi_scale_host_multi (
+            &ep_image_aligned,
+            &ep_classifiers[0],
+             classifiers_count,
+            &ep_objects[0],
+             scan_mode,
+             stats
+        ) );
+
+        double const time_group( ep_trace_now() );
+        for(int i = 0; i < classifiers_count; ++i) {
+            group_rectangles(ep_objects[i], objects[i], min_neighbors);
+            ep_rect_list_release(&ep_objects[i]);
+        }
+        if(stats)
+            stats->time_group = ep_trace_now() - time_group;
+
+        ep_image_release(&ep_image_aligned);
+
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////
+
+    DeviceSession::DeviceSession(void):
+        ep_device_session(NULL)
+    { ; }
+
+    DeviceSession::DeviceSession(CascadeClassifier const &classifier, int num_cores):
+        ep_device_session( ep_device_session_create(classifier.get_data(), num_cores, NULL) )
+    { ; }
+
+    DeviceSession::~DeviceSession(void) {
+        close();
+    }
+
+    EpErrorCode DeviceSession::open(CascadeClassifier const &classifier, int num_cores) {
+        close();
+        EpErrorCode result;
+        ep_device_session = ep_device_session_create(classifier.get_data(), num_cores, &result);
+        return result;
+    }
+
+    void DeviceSession::close(void) {
+        ep_device_session_release(ep_device_session);
+        ep_device_session = NULL;
+    }
+
+    bool DeviceSession::is_open(void) const {
+        return ep_device_session != NULL;
+    }
+
+    EpErrorCode DeviceSession::set_mode(EpDetectionMode mode) {
+        return ep_device_session_set_mode(ep_device_session, mode);
+    }
+
+    EpErrorCode DeviceSession::detect_multi_scale (
+        cv::Mat               const &image,
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors,
+        EpScanMode            const  scan_mode,
+        EpDetectStats               *stats
+    ) {
+        //Image is copied by the pyramid builder right into shared memory
+        EpImage const ep_image = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+
+        EpRectList ep_objects( ep_rect_list_create_empty() );
+
+        EpErrorCode const result( ep_device_session_detect (
+            ep_device_session,
+            &ep_image,
+            &ep_objects,
+             scan_mode,
+             stats
+        ) );
+
+        double const trace_group( ep_trace_now() );
+        group_rectangles(ep_objects, objects, min_neighbors);
+        double const trace_end( ep_trace_now() );
+        ep_trace_span("group", "host", TRACE_PID_HOST, 0, trace_group, trace_end, "objects", ep_objects.count);
+        if(stats)
+            stats->time_group = trace_end - trace_group;
+
+        ep_rect_list_release(&ep_objects);
+
+        return result;
+    }
+
+    EpErrorCode DeviceSession::submit (
+        cv::Mat               const &image,
+        EpScanMode            const  scan_mode
+    ) {
+        EpImage const ep_image = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+
+        return ep_device_session_submit (
+            ep_device_session,
+            &ep_image,
+             scan_mode
+        );
+    }
+
+    EpErrorCode DeviceSession::collect (
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors,
+        EpDetectStats               *stats
+    ) {
+        EpRectList ep_objects( ep_rect_list_create_empty() );
+
+        EpErrorCode const result( ep_device_session_collect (
+            ep_device_session,
+            &ep_objects,
+             stats
+        ) );
+
+        double const trace_group( ep_trace_now() );
+        group_rectangles(ep_objects, objects, min_neighbors);
+        double const trace_end( ep_trace_now() );
+        ep_trace_span("group", "host", TRACE_PID_HOST, 0, trace_group, trace_end, "objects", ep_objects.count);
+        if(stats)
+            stats->time_group = trace_end - trace_group;
+
+        ep_rect_list_release(&ep_objects);
+
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////
+
+    Detector::Detector(void):
+        classifier(),
+        ep_host_session(NULL),
+        ep_device_session(NULL),
+        ep_objects( ep_rect_list_create_empty() ),
+        intersections(NULL)
+    { ; }
+
+    Detector::Detector(CascadeClassifier const &classifier, EpDetectionMode detection_mode, int workers_count):
+        classifier(),
+        ep_host_session(NULL),
+        ep_device_session(NULL),
+        ep_objects( ep_rect_list_create_empty() ),
+        intersections(NULL)
+    {
+        open(classifier, detection_mode, workers_count);
+    }
+
+    Detector::~Detector(void) {
+        close();
+    }
+
+#if __cplusplus >= 201103L
+    Detector::Detector(Detector &&detector):
+        classifier(),
+        ep_host_session(NULL),
+        ep_device_session(NULL),
+        ep_objects( ep_rect_list_create_empty() ),
+        intersections(NULL)
+    {
+        swap(detector);
+    }
+
+    Detector &Detector::operator=(Detector &&detector) {
+        if(&detector != this) {
+            close();
+            swap(detector);
+        }
+        return *this;
+    }
+#endif
+
+    void Detector::swap(Detector &detector) {
+        classifier.swap(detector.classifier);
+        std::swap(ep_host_session, detector.ep_host_session);
+        std::swap(ep_device_session, detector.ep_device_session);
+        std::swap(ep_objects, detector.ep_objects);
+        std::swap(intersections, detector.intersections);
+    }
+
+    EpErrorCode Detector::open(CascadeClassifier const &classifier, EpDetectionMode detection_mode, int workers_count) {
+        close();
+
+        if( ep_classifier_check( classifier.get_data() ) )
+            return ERR_ARGUMENT; //Wrong classifier
+
+        EpErrorCode result(ERR_ARGUMENT);
+
+        if(detection_mode == DET_HOST)
+            ep_host_session = ep_host_session_create(workers_count, &result);
+
+        if(detection_mode == DET_DEVICE || detection_mode == DET_HYBRID) {
+            ep_device_session = ep_device_session_create(classifier.get_data(), workers_count > 0 ? workers_count : 16, &result);
+            if(ep_device_session && detection_mode == DET_HYBRID)
+                result = ep_device_session_set_mode(ep_device_session, DET_HYBRID);
+        }
+
+        if(result != ERR_SUCCESS) {
+            close();
+            return result;
+        }
+
+        this->classifier = classifier;
+        intersections = new std::vector<IntersectionsList>();
+
+        return ERR_SUCCESS;
+    }
+
+    void Detector::close(void) {
+        ep_host_session_release(ep_host_session);
+        ep_host_session = NULL;
+        ep_device_session_release(ep_device_session);
+        ep_device_session = NULL;
+        ep_rect_list_release(&ep_objects);
+        delete intersections;
+        intersections = NULL;
+        classifier.release();
+    }
+
+    bool Detector::is_open(void) const {
+        return ep_host_session != NULL || ep_device_session != NULL;
+    }
+
+    CascadeClassifier const &Detector::get_classifier(void) const {
+        return classifier;
+    }
+
+    EpErrorCode Detector::detect (
+        cv::Mat               const &image,
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors,
+        EpScanMode            const  scan_mode,
+        EpDetectStats               *stats
+    ) {
+        objects.clear();
+        if( !is_open() )
+            return ERR_ARGUMENT;
+
+        EpImage const ep_image = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+
+        //Raw detections list keeps its memory between frames
+        ep_objects.count = 0;
+
+        double const trace_detect( ep_trace_now() );
+        EpErrorCode result;
+
+        if(ep_host_session) {
+            EpCascadeClassifier const *const ep_classifier( classifier.get_data() );
+            result = ep_host_session_detect(ep_host_session, &ep_image, &ep_classifier, 1, &ep_objects, scan_mode, stats);
+        } else {
+            result = ep_device_session_detect(ep_device_session, &ep_image, &ep_objects, scan_mode, stats);
+        }
+
+        double const trace_group( ep_trace_now() );
+        ep_trace_span("detect", "host", TRACE_PID_HOST, 0, trace_detect, trace_group, NULL, 0);
+
+        group_rectangles(ep_objects, objects, min_neighbors, *intersections);
+        double const trace_end( ep_trace_now() );
+        ep_trace_span("group", "host", TRACE_PID_HOST, 0, trace_group, trace_end, "objects", ep_objects.count);
+        if(stats)
+            stats->time_group = trace_end - trace_group;
+
+        return result;
+    }
+
 #ifdef __OPENCV_OBJDETECT_HPP__
     class ClassifierAccessor: public cv::CascadeClassifier {
         friend EpCascadeClassifier convert_cascade(cv::CascadeClassifier const &cv_classifier);
@@ -347,29 +679,50 @@ namespace ep
 
     ////////////////////////////////////////////////////////
 
+    /**
+     * Load classifier from binary .dat file or from OpenCV .xml cascade
+     */
+    EpCascadeClassifier load_classifier(std::string const &file_name, EpErrorCode *const error_code) {
+        if( file_name.size() > 4 && file_name.substr(file_name.size() - 4) == ".xml" )
+            return ep_classifier_load_xml(file_name.c_str(), error_code);
+        return ep_classifier_load(file_name.c_str(), error_code);
+    }
+
     CascadeClassifier::CascadeClassifier(void):
-    ep_cascade_classifier( ep_classifier_create_empty() )
+    ep_cascade_classifier( ep_classifier_create_empty() ),
+    mapped_classifier(NULL)
     { ; }
 
     CascadeClassifier::CascadeClassifier(std::string const &file_name):
-        ep_cascade_classifier( ep_classifier_load(file_name.c_str(), NULL) )
+        ep_cascade_classifier( load_classifier(file_name, NULL) ),
+        mapped_classifier(NULL)
+    { ; }
+
+    CascadeClassifier::CascadeClassifier(EpCascadeClassifier const *const mapped_classifier):
+        ep_cascade_classifier(*mapped_classifier),
+        mapped_classifier(mapped_classifier)
     { ; }
 
 #ifdef __OPENCV_OBJDETECT_HPP__
     CascadeClassifier::CascadeClassifier(cv::CascadeClassifier const &cv_classifier):
-        ep_cascade_classifier( convert_cascade(cv_classifier) )
+        ep_cascade_classifier( convert_cascade(cv_classifier) ),
+        mapped_classifier(NULL)
     { ; }
 
     CascadeClassifier &CascadeClassifier::operator=(cv::CascadeClassifier const &cv_classifier)
     {
-        ep_classifier_release(&ep_cascade_classifier);
+        release();
         ep_cascade_classifier = convert_cascade(cv_classifier);
         return *this;
     }
 #endif
 
+    //Classifiers taken from ClassifierStore are shared, others are cloned
     CascadeClassifier::CascadeClassifier(CascadeClassifier const &classifier):
-        ep_cascade_classifier( ep_classifier_clone(&classifier.ep_cascade_classifier) )
+        ep_cascade_classifier( classifier.mapped_classifier ? classifier.ep_cascade_classifier :
+            ep_classifier_clone(&classifier.ep_cascade_classifier) ),
+        mapped_classifier( classifier.mapped_classifier ?
+            ep_classifier_store_retain(classifier.mapped_classifier) : NULL )
     { ; }
 
     CascadeClassifier::~CascadeClassifier(void) {
@@ -380,24 +733,40 @@ namespace ep
         if(classifier.ep_cascade_classifier.data == ep_cascade_classifier.data)
             return *this;
 
-        ep_classifier_release(&ep_cascade_classifier);
-        ep_cascade_classifier = ep_classifier_clone(&classifier.ep_cascade_classifier);
+        release();
+        if(classifier.mapped_classifier) {
+            mapped_classifier = ep_classifier_store_retain(classifier.mapped_classifier);
+            ep_cascade_classifier = *mapped_classifier;
+        } else {
+            ep_cascade_classifier = ep_classifier_clone(&classifier.ep_cascade_classifier);
+        }
 
         return *this;
     }
 
+    void CascadeClassifier::swap(CascadeClassifier &classifier) {
+        std::swap(ep_cascade_classifier, classifier.ep_cascade_classifier);
+        std::swap(mapped_classifier, classifier.mapped_classifier);
+    }
+
     bool CascadeClassifier::empty(void) const {
         return ep_classifier_is_empty(&ep_cascade_classifier) != 0;
     }
 
     void CascadeClassifier::release(void) {
-        ep_classifier_release(&ep_cascade_classifier);
+        if(mapped_classifier) {
+            ep_classifier_store_release(mapped_classifier);
+            mapped_classifier = NULL;
+            ep_cascade_classifier = ep_classifier_create_empty();
+        } else {
+            ep_classifier_release(&ep_cascade_classifier);
+        }
     }
 
     EpErrorCode CascadeClassifier::load(std::string const &file_name) {
         release();
         EpErrorCode result;
-        ep_cascade_classifier = ep_classifier_load(file_name.c_str(), &result);
+        ep_cascade_classifier = load_classifier(file_name, &result);
         return result;
     }
 
@@ -405,6 +774,18 @@ namespace ep
         return ep_classifier_save( &ep_cascade_classifier, file_name.c_str() );
     }
 
+    CascadeClassifier CascadeClassifier::compact(void) const {
+        CascadeClassifier result;
+        result.ep_cascade_classifier = ep_classifier_compact(&ep_cascade_classifier);
+        return result;
+    }
+
+    CascadeClassifier CascadeClassifier::mirror(void) const {
+        CascadeClassifier result;
+        result.ep_cascade_classifier = ep_classifier_mirror(&ep_cascade_classifier);
+        return result;
+    }
+
     EpCascadeClassifier const *CascadeClassifier::get_data(void) const {
         return &ep_cascade_classifier;
     }
@@ -412,4 +793,53 @@ namespace ep
     int CascadeClassifier::get_size(void) const {
         return ep_cascade_classifier.size;
     }
+
+    cv::Size CascadeClassifier::get_window_size(void) const {
+        if( empty() )
+            return cv::Size();
+        //Compact META node starts with the same fields
+        EpNodeMeta const *const meta( reinterpret_cast<EpNodeMeta const *>(ep_cascade_classifier.data) );
+        return cv::Size(meta->window_width, meta->window_height);
+    }
+
+    ////////////////////////////////////////////////////////
+
+    ClassifierStore::ClassifierStore(void):
+        ep_classifier_store(NULL)
+    { ; }
+
+    ClassifierStore::ClassifierStore(std::string const &file_name):
+        ep_classifier_store( ep_classifier_store_open(file_name.c_str(), NULL) )
+    { ; }
+
+    ClassifierStore::~ClassifierStore(void) {
+        close();
+    }
+
+    EpErrorCode ClassifierStore::open(std::string const &file_name) {
+        close();
+        EpErrorCode result;
+        ep_classifier_store = ep_classifier_store_open(file_name.c_str(), &result);
+        return result;
+    }
+
+    void ClassifierStore::close(void) {
+        if(ep_classifier_store)
+            ep_classifier_store_close(ep_classifier_store);
+        ep_classifier_store = NULL;
+    }
+
+    bool ClassifierStore::is_open(void) const {
+        return ep_classifier_store != NULL;
+    }
+
+    bool ClassifierStore::reload(void) {
+        return ep_classifier_store && ep_classifier_store_reload(ep_classifier_store, NULL);
+    }
+
+    CascadeClassifier ClassifierStore::get(void) const {
+        if(!ep_classifier_store)
+            return CascadeClassifier();
+        return CascadeClassifier( ep_classifier_store_acquire(ep_classifier_store) );
+    }
 }
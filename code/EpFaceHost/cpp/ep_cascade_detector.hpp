@@ -34,6 +34,10 @@
 #include "../c/ep_cascade_detector.h"
 
 namespace ep {
+
+class ClassifierStore;
+struct IntersectionsList;
+
 /**
  * This is classifier usable by detect_multi_scale function.
  * Can be converted from cv::CascadeClassifier.
@@ -42,7 +46,7 @@ namespace ep {
 class CascadeClassifier {
 public:
     CascadeClassifier(void);
-    /// Load classifier from data file
+    /// Load classifier from data file (.dat) or OpenCV LBP cascade (.xml) without OpenCV ObjDetect
     CascadeClassifier(std::string const &file_name);
 #ifdef __OPENCV_OBJDETECT_HPP__
     /// Create cascade from OpenCV classifier
@@ -60,26 +64,80 @@ public:
     /// Assignment operator
     CascadeClassifier &operator=(CascadeClassifier const &classifier);
 
+    /// Exchange contents with other classifier without copying data
+    void swap(CascadeClassifier &classifier);
+
     /// Determine whether classifier is empty
     bool empty(void) const;
 
     /// Release classifier data
     void release(void);
 
-    /// Load classifier contents from file
+    /// Load classifier contents from .dat or .xml file
     EpErrorCode load(std::string const &file_name);
 
     /// Save classifier contents to binary file
     EpErrorCode save(std::string const &file_name) const;
 
+    /// Get copy of classifier in compact encoding (@see ep_classifier_compact); empty in case of error
+    CascadeClassifier compact(void) const;
+
+    /// Get horizontally mirrored copy of classifier (@see ep_classifier_mirror); empty in case of error
+    CascadeClassifier mirror(void) const;
+
     /// Get classifier data usable by C function ep_detect_multi_scale()
     EpCascadeClassifier const *get_data(void) const;
     
     /// Get classifier size in bytes (the data that will be uploaded to a core)
     int get_size(void) const;
 
+    /// Get native object size of classifier; zero size for empty classifier
+    cv::Size get_window_size(void) const;
+
 private:
+    friend class ClassifierStore;
+
+    /// Share classifier acquired from store (@see ClassifierStore::get)
+    explicit CascadeClassifier(EpCascadeClassifier const *mapped_classifier);
+
     EpCascadeClassifier ep_cascade_classifier;
+    /// Classifier acquired from ClassifierStore which data is shared; NULL if data is owned
+    EpCascadeClassifier const *mapped_classifier;
+};
+
+/**
+ * Classifier file mapped read-only and shared between processes; file may be replaced while used.
+ * Wrapper around EpClassifierStore
+ */
+class ClassifierStore {
+public:
+    ClassifierStore(void);
+    /// Open store of classifier file (@see open)
+    explicit ClassifierStore(std::string const &file_name);
+
+    /// Destructor closes store; classifiers taken from it stay valid
+    ~ClassifierStore(void);
+
+    /// Map classifier file written by CascadeClassifier::save(); previously opened store is closed
+    EpErrorCode open(std::string const &file_name);
+
+    /// Close store
+    void close(void);
+
+    /// Determine whether store is opened
+    bool is_open(void) const;
+
+    /// Swap in replaced file (@see ep_classifier_store_reload); returns true if classifier has changed
+    bool reload(void);
+
+    /// Get current classifier; it and its copies share mapped data, and stay valid after reload
+    CascadeClassifier get(void) const;
+
+private:
+    ClassifierStore(ClassifierStore const &);
+    ClassifierStore &operator=(ClassifierStore const &);
+
+    EpClassifierStore *ep_classifier_store;
 };
 
 /**
@@ -87,6 +145,7 @@ private:
  * In addition this routine does objects grouping.
  * @param min_neighbors: minimal number of detections in detection group.
  *                       if this value is zero then grouping is disabled.
+ * @param stats        : receives statistics of the call including grouping time (@see EpDetectStats); NULL if not needed.
  */
 EpErrorCode detect_multi_scale (
     cv::Mat               const &image,
@@ -96,9 +155,174 @@ EpErrorCode detect_multi_scale (
     EpScanMode            const  scan_mode      = SCAN_EVEN,
     EpDetectionMode       const  detection_mode = DET_HOST,
     int                          num_cores      = 16,
-    std::string           const &log_file       = std::string()
+    EpDetectStats               *stats          = NULL
+);
+
+/**
+ * Group raw detections the way detect_multi_scale does.
+ * @param ep_rectangles: detections of C routine;
+ * @param rectangles   : receives grouped detections;
+ * @param min_neighbors: groups with less detections are discarded; if zero then rectangles are just rounded.
+ */
+void group_rectangles (
+    EpRectList            const &ep_rectangles,
+    std::vector<cv::Rect>       &rectangles,
+    int                   const  min_neighbors
+);
+
+/**
+ * Detection of several classifiers over one scale pyramid by host threads (@see ep_detect_multi_scale_host_multi).
+ * In addition this routine does objects grouping for each classifier.
+ * @param objects      : receives one vector of objects per classifier.
+ * @param min_neighbors: minimal number of detections in detection group.
+ *                       if this value is zero then grouping is disabled.
+ * @param stats        : receives statistics of the call (counters of all classifiers are summed); NULL if not needed.
+ */
+EpErrorCode detect_multi_scale (
+    cv::Mat                                  const &image,
+    std::vector<CascadeClassifier>           const &classifiers,
+    std::vector< std::vector<cv::Rect> >           &objects,
+    int                                      const  min_neighbors = 3,
+    EpScanMode                               const  scan_mode     = SCAN_EVEN,
+    EpDetectStats                                  *stats         = NULL
 );
 
+/**
+ * Workgroup opened once and reused for many frames.
+ * Wrapper around EpDeviceSession
+ */
+class DeviceSession {
+public:
+    DeviceSession(void);
+    /// Open session with given classifier (@see open)
+    DeviceSession(CascadeClassifier const &classifier, int num_cores = 16);
+
+    /// Destructor closes session
+    ~DeviceSession(void);
+
+    /// Open workgroup and upload classifier; previously opened session is closed
+    EpErrorCode open(CascadeClassifier const &classifier, int num_cores = 16);
+
+    /// Close workgroup
+    void close(void);
+
+    /// Determine whether session is opened
+    bool is_open(void) const;
+
+    /// Share tasks with host threads (DET_HYBRID) or not (DET_DEVICE); @see ep_device_session_set_mode
+    EpErrorCode set_mode(EpDetectionMode mode);
+
+    /**
+     * Detection on opened workgroup (@see ep::detect_multi_scale).
+     * @param min_neighbors: minimal number of detections in detection group.
+     *                       if this value is zero then grouping is disabled.
+     * @param stats        : receives statistics of the frame (@see EpDetectStats); NULL if not needed.
+     */
+    EpErrorCode detect_multi_scale (
+        cv::Mat               const &image,
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors  = 3,
+        EpScanMode            const  scan_mode      = SCAN_EVEN,
+        EpDetectStats               *stats          = NULL
+    );
+
+    /**
+     * Start detection of frame without waiting for its end (@see ep_device_session_submit).
+     * Image may be modified or released right after the call.
+     */
+    EpErrorCode submit (
+        cv::Mat               const &image,
+        EpScanMode            const  scan_mode      = SCAN_EVEN
+    );
+
+    /**
+     * Get grouped detections of the oldest submitted frame (@see ep_device_session_collect).
+     * @param min_neighbors: minimal number of detections in detection group.
+     *                       if this value is zero then grouping is disabled.
+     * @param stats        : receives statistics of the frame (@see EpDetectStats); NULL if not needed.
+     */
+    EpErrorCode collect (
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors  = 3,
+        EpDetectStats               *stats          = NULL
+    );
+
+private:
+    DeviceSession(DeviceSession const &);
+    DeviceSession &operator=(DeviceSession const &);
+
+    EpDeviceSession *ep_device_session;
+};
+
+/**
+ * Detector reused for many frames. Owns copy of classifier, host session (DET_HOST) or device
+ *   session (DET_DEVICE, DET_HYBRID), raw detections and grouping buffers. Buffers are sized for
+ *   the last frame, so detection of frames of the same size does not allocate memory once they have grown.
+ * Detector is not thread safe: create one detector per calling thread (only one detector may use device at a time).
+ *   Detector may be moved (C++11) or swapped, but not copied.
+ * Wrapper around EpHostSession and EpDeviceSession
+ */
+class Detector {
+public:
+    Detector(void);
+    /// Create detector (@see open)
+    explicit Detector(CascadeClassifier const &classifier, EpDetectionMode detection_mode = DET_HOST, int workers_count = 0);
+
+    /// Destructor closes detector
+    ~Detector(void);
+
+#if __cplusplus >= 201103L
+    /// Take sessions and buffers of other detector; it becomes closed
+    Detector(Detector &&detector);
+    Detector &operator=(Detector &&detector);
+#endif
+
+    /// Exchange sessions and buffers with other detector
+    void swap(Detector &detector);
+
+    /**
+     * Copy classifier and create session of given mode; previously opened detector is closed.
+     * @param workers_count: host threads for DET_HOST (zero means omp_get_max_threads()),
+     *                       cores for DET_DEVICE and DET_HYBRID (zero means 16).
+     */
+    EpErrorCode open(CascadeClassifier const &classifier, EpDetectionMode detection_mode = DET_HOST, int workers_count = 0);
+
+    /// Release sessions and buffers
+    void close(void);
+
+    /// Determine whether detector is opened
+    bool is_open(void) const;
+
+    /// Get classifier used by detector
+    CascadeClassifier const &get_classifier(void) const;
+
+    /**
+     * Detect objects on image and group them (@see ep::detect_multi_scale). Image is not modified.
+     * @param min_neighbors: minimal number of detections in detection group.
+     *                       if this value is zero then grouping is disabled.
+     * @param stats        : receives statistics of the frame (@see EpDetectStats); NULL if not needed.
+     */
+    EpErrorCode detect (
+        cv::Mat               const &image,
+        std::vector<cv::Rect>       &objects,
+        int                   const  min_neighbors  = 3,
+        EpScanMode            const  scan_mode      = SCAN_EVEN,
+        EpDetectStats               *stats          = NULL
+    );
+
+private:
+    Detector(Detector const &);
+    Detector &operator=(Detector const &);
+
+    CascadeClassifier classifier;
+    EpHostSession *ep_host_session;
+    EpDeviceSession *ep_device_session;
+    /// Raw detections of the last frame
+    EpRectList ep_objects;
+    /// Intersections of raw detections used by grouping
+    std::vector<IntersectionsList> *intersections;
+};
+
 }
 
 #endif
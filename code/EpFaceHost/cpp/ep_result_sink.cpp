@@ -0,0 +1,133 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+#include "ep_result_sink.hpp"
+
+#include "../c/ep_data_types.h"
+
+namespace ep
+{
+    ResultSink::ResultSink(std::string const &file_name, bool binary):
+        file( std::fopen(file_name.c_str(), binary ? "wb" : "wt") )
+    { ; }
+
+    ResultSink::~ResultSink(void) {
+        if(file)
+            std::fclose(file);
+    }
+
+    bool ResultSink::is_open(void) const {
+        return file != NULL;
+    }
+
+    /**
+     * One JSON object per line:
+     * {"frame":0,"timestamp":0.000,"objects":[[x,y,width,height],...]}
+     */
+    class JsonLinesSink: public ResultSink {
+    public:
+        JsonLinesSink(std::string const &file_name):
+            ResultSink(file_name, false)
+        { ; }
+
+        virtual bool write(int frame_index, double timestamp, std::vector<cv::Rect> const &objects) {
+            std::fprintf(file, "{\"frame\":%d,\"timestamp\":%.3f,\"objects\":[", frame_index, timestamp);
+            for(int i(0); i < static_cast<int>( objects.size() ); ++i) {
+                cv::Rect const &r(objects[i]);
+                std::fprintf(file, i ? ",[%d,%d,%d,%d]" : "[%d,%d,%d,%d]", r.x, r.y, r.width, r.height);
+            }
+            return std::fputs("]}\n", file) >= 0;
+        }
+    };
+
+    /**
+     * One line per detection (frames without detections produce no lines):
+     * frame,timestamp,x,y,width,height
+     */
+    class CsvSink: public ResultSink {
+    public:
+        CsvSink(std::string const &file_name):
+            ResultSink(file_name, false)
+        {
+            if(file)
+                std::fputs("frame,timestamp,x,y,width,height\n", file);
+        }
+
+        virtual bool write(int frame_index, double timestamp, std::vector<cv::Rect> const &objects) {
+            for(int i(0); i < static_cast<int>( objects.size() ); ++i) {
+                cv::Rect const &r(objects[i]);
+                if(std::fprintf(file, "%d,%.3f,%d,%d,%d,%d\n", frame_index, timestamp, r.x, r.y, r.width, r.height) < 0)
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    /**
+     * Native-endian binary stream. File starts with FILE_ID_DETECTIONS,
+     * then for every frame:
+     *   int frame_index; int objects_count; double timestamp;
+     *   objects_count times { int x, y, width, height; }
+     */
+    class BinarySink: public ResultSink {
+    public:
+        BinarySink(std::string const &file_name):
+            ResultSink(file_name, true)
+        {
+            int const id(FILE_ID_DETECTIONS);
+            if(file)
+                std::fwrite(&id, sizeof(id), 1, file);
+        }
+
+        virtual bool write(int frame_index, double timestamp, std::vector<cv::Rect> const &objects) {
+            int const objects_count( static_cast<int>( objects.size() ) );
+
+            records.resize(objects_count * 4);
+            for(int i(0); i < objects_count; ++i) {
+                records[i * 4    ] = objects[i].x    ; records[i * 4 + 1] = objects[i].y     ;
+                records[i * 4 + 2] = objects[i].width; records[i * 4 + 3] = objects[i].height;
+            }
+
+            if(std::fwrite(&frame_index, sizeof(frame_index), 1, file) != 1) return false;
+            if(std::fwrite(&objects_count, sizeof(objects_count), 1, file) != 1) return false;
+            if(std::fwrite(&timestamp, sizeof(timestamp), 1, file) != 1) return false;
+            if(!objects_count) return true;
+            return std::fwrite(&records[0], sizeof(int), records.size(), file) == records.size();
+        }
+
+    private:
+        std::vector<int> records;
+    };
+
+    ResultSink *create_result_sink(std::string const &format, std::string const &file_name) {
+        ResultSink *sink(NULL);
+
+        if(format == "jsonl")
+            sink = new JsonLinesSink(file_name);
+        else if(format == "csv")
+            sink = new CsvSink(file_name);
+        else if(format == "bin")
+            sink = new BinarySink(file_name);
+
+        if(sink && !sink->is_open()) {
+            delete sink;
+            sink = NULL;
+        }
+
+        return sink;
+    }
+}
@@ -0,0 +1,74 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+
+/**
+ * Result sinks used in headless mode: detections are written as records
+ * instead of being drawn over the frame and encoded.
+ */
+#ifndef EP_RESULT_SINK_HPP
+#define EP_RESULT_SINK_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ep {
+
+/**
+ * Receiver of detection results, one record per processed frame.
+ */
+class ResultSink {
+public:
+    /// Closes output file
+    virtual ~ResultSink(void);
+
+    /// Check whether output was opened successfully
+    bool is_open(void) const;
+
+    /**
+     * Write detections of single frame.
+     * @param frame_index: index of the frame in the input stream (0 for single image);
+     * @param timestamp  : frame timestamp in milliseconds (0.0 for single image);
+     * @param objects    : detections of the frame.
+     * @return false on write error.
+     */
+    virtual bool write(int frame_index, double timestamp, std::vector<cv::Rect> const &objects) = 0;
+
+protected:
+    /// Open file_name for writing
+    ResultSink(std::string const &file_name, bool binary);
+
+    std::FILE *file;
+
+private:
+    ResultSink(ResultSink const &);
+    ResultSink &operator=(ResultSink const &);
+};
+
+/**
+ * Create result sink given its format name.
+ * @param format   : "jsonl" (JSON Lines), "csv" or "bin" (compact binary records, @see FILE_ID_DETECTIONS);
+ * @param file_name: output file name.
+ * @return new sink (to be deleted by caller), or NULL for unknown format or if file cannot be opened.
+ */
+ResultSink *create_result_sink(std::string const &format, std::string const &file_name);
+
+}
+
+#endif
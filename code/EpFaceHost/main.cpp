@@ -19,6 +19,8 @@
  */
 
 #include <cassert>
+#include <cctype>
+#include <cstdio>
 #include <iostream>
 
 #ifndef DEVICE_EMULATION
@@ -32,27 +34,122 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "cpp/ep_cascade_detector.hpp"
+#include "cpp/ep_result_sink.hpp"
+#include "c/ep_trace.h"
+#include "c/ep_frame_reader.h"
+#include "c/ep_jpeg_reader.h"
+#include "c/ep_cascade_heatmap.h"
+
+/**
+ * Read next video frame and convert it to grayscale
+ * @return false at the end of video
+ */
+static bool read_frame(cv::VideoCapture &capture, cv::Mat &image, double &timestamp) {
+    capture >> image;
+    if( image.empty() )
+        return false;
+    timestamp = capture.get(CV_CAP_PROP_POS_MSEC);
+    cv::cvtColor(image, image, CV_BGR2GRAY);
+    return true;
+}
+
+/**
+ * Read next frame of Y4M / raw YUV stream. Luma plane is used as grayscale image in place:
+ *   image shares reader's frame buffer, no copy and no colour conversion is done.
+ * @return false at the end of stream or in case of error
+ */
+static bool read_frame(EpFrameReader *reader, cv::Mat &image, double &timestamp) {
+    EpImage frame;
+    EpErrorCode error_code;
+    if( !ep_frame_reader_read(reader, &frame, &timestamp, &error_code) ) {
+        if(error_code != ERR_SUCCESS)
+            std::cout << "Error reading frame from stream (error code " << error_code << ")." << std::endl;
+        return false;
+    }
+    image = cv::Mat(frame.height, frame.width, CV_8UC1, frame.data, frame.step);
+    return true;
+}
+
+/**
+ * Check whether file name has .jpg or .jpeg extension (in any case)
+ */
+static bool is_jpeg(std::string const &file_name) {
+    std::string::size_type const dot( file_name.find_last_of('.') );
+    if(dot == std::string::npos)
+        return false;
+    std::string extension( file_name.substr(dot + 1) );
+    for(int i(0); i < static_cast<int>( extension.size() ); ++i)
+        extension[i] = static_cast<char>( std::tolower( static_cast<unsigned char>(extension[i]) ) );
+    return extension == "jpg" || extension == "jpeg";
+}
+
+/**
+ * Convert detections in image decoded at reduced resolution to source image coordinates
+ */
+static void scale_objects(std::vector<cv::Rect> &objects, int reduction) {
+    for(int i(0); i < static_cast<int>( objects.size() ); ++i) {
+        cv::Rect &r(objects[i]);
+        r = cv::Rect(r.x * reduction, r.y * reduction, r.width * reduction, r.height * reduction);
+    }
+}
+
+/**
+ * Write stage-exit histogram to <prefix>.txt and heatmaps of the last frame to <prefix>_NN.png
+ * @return false in case of error
+ */
+static bool save_heatmap(EpCascadeHeatmap const *heatmap, std::string const &prefix) {
+    if( ep_cascade_heatmap_save_report( heatmap, (prefix + ".txt").c_str() ) != ERR_SUCCESS )
+        return false;
+
+    for(int i(0); i < ep_cascade_heatmap_levels_count(heatmap); ++i) {
+        EpImage const *const level( ep_cascade_heatmap_level(heatmap, i, NULL) );
+        cv::Mat const image(level->height, level->width, CV_8UC1, level->data, level->step);
+        char suffix[16];
+        sprintf(suffix, "_%02d.png", i);
+        if( !cv::imwrite(prefix + suffix, image) )
+            return false;
+    }
+    return true;
+}
 
 int main(int argc, char **argv) {
 
     char const *const keys (
-        "{ i | input | | Input image or video file }"
+        "{ i | input | | Input image or video file; pipe, FIFO or stdin (-) with y option }"
         "{ c | classifier | lbpcascade_frontalface.dat | Epiphany LBP classifier }"
         "{ g | grouping | 3 | Number of detections in group }"
         "{ o | output | | Output filename }"
-        "{ h | host | 0 | Run detection on host }"
+        "{ h | host | 0 | Run detection on device (0), host (1) or both (2) }"
         "{ n | numcores | 16 | Number of working cores }"
-        "{ l | log | | Name of log-file }"
+        "{ l | log | | Name of file receiving detection statistics of the last frame }"
+        "{ f | format | | Headless mode: write detections as jsonl, csv or bin instead of rendering }"
+        "{ t | trace | | Chrome trace-event JSON file with timeline of host threads and cores }"
+        "{ k | compact | 0 | Convert classifier to compact encoding with 16-bit scores (1) }"
+        "{ s | save | | Save classifier (after conversion) to binary file }"
+        "{ r | reload | 0 | Map .dat classifier and swap in replaced file between frames in host mode (1) }"
+        "{ y | yuv | | Input is decoded video stream: y4m, nv12:WxH[@fps] or i420:WxH[@fps] }"
+        "{ m | minsize | 0 | Minimal object size; JPEG image is decoded at the lowest resolution where it is detectable }"
+        "{ p | profile | | Cascade-depth profile: stage-exit histogram <name>.txt and level heatmaps <name>_NN.png }"
     );
 
     cv::CommandLineParser cmd(argc, argv, keys);
     std::string const fn_image( cmd.get<std::string>("input") ),
                       fn_classifier( cmd.get<std::string>("classifier") ),
-                      fn_log( cmd.get<std::string>("log") );
+                      fn_log( cmd.get<std::string>("log") ),
+                      output_format( cmd.get<std::string>("format") ),
+                      fn_trace( cmd.get<std::string>("trace") ),
+                      fn_save_classifier( cmd.get<std::string>("save") ),
+                      yuv_format( cmd.get<std::string>("yuv") ),
+                      fn_profile( cmd.get<std::string>("profile") );
     std::string fn_output( cmd.get<std::string>("output") );
     int const detections_group( cmd.get<int>("grouping") );
     int const num_cores( cmd.get<int>("numcores") );
-    bool const host_only(cmd.get<int>("host") != 0);
+    int const min_object_size( cmd.get<int>("minsize") );
+    bool const hybrid(cmd.get<int>("host") == 2);
+    bool const compact_classifier(cmd.get<int>("compact") != 0);
+    bool const host_only(cmd.get<int>("host") != 0 && !hybrid);
+    bool const reload_classifier(cmd.get<int>("reload") != 0 && host_only);
+    bool const headless( !output_format.empty() );
 
     if( !host_only ) {
         /*      
@@ -68,31 +165,25 @@ int main(int argc, char **argv) {
 		*/
     }
 
-    std::cout << "Loading image " << fn_image << "..." << std::flush;
-    cv::Mat image(cv::imread(fn_image, CV_LOAD_IMAGE_GRAYSCALE));
-    cv::VideoCapture capture;
-    cv::VideoWriter writer;
-
-    bool f_video(false);
-
-    if( image.empty() ) {
-        std::cout << " Error loading image." << std::endl;
-        std::cout << "Loading video " << fn_image << "..." << std::flush;
-        if( !capture.open(fn_image) ) {
-            std::cout << " Error loading video." << std::endl;
+    //In headless mode detections are written by result sink; frames are neither rendered nor encoded
+    ep::ResultSink *sink(NULL);
+    if(headless) {
+        if( fn_output.empty() )
+            fn_output = "result." + output_format;
+        std::cout << "Opening " << output_format << " result sink " << fn_output << "..." << std::flush;
+        sink = ep::create_result_sink(output_format, fn_output);
+        if(!sink) {
+            std::cout << " Unknown format or cannot open output." << std::endl;
             return -1;
         }
-        f_video = true;
-        if( fn_output.empty() )
-            fn_output = "result.avi";
-    } else {
-        if( fn_output.empty() )
-            fn_output = "result.png";
+        std::cout << " Done." << std::endl;
     }
-    std::cout << " Done." << std::endl;
 
     std::cout << "Loading cascade " << fn_classifier << "..." << std::flush;
 
+    //Mapped classifier is shared with other processes using the same file
+    ep::ClassifierStore classifier_store;
+
 //See cpp/ep_cascade_detector.hpp for enabling/disabling integration with OpenCV object detector
 #ifdef __OPENCV_OBJDETECT_HPP__
     cv::CascadeClassifier classifier_cv;
@@ -100,66 +191,218 @@ int main(int argc, char **argv) {
 
     //When loading .xml cascade both OpenCV and Epiphany detectors are tested.
     //When loading .dat cascade only Epiphany detector is tested.
+    //Epiphany classifier is read from .xml by its own parser in both cases.
     if( fn_classifier.size() > 4 && fn_classifier.substr(fn_classifier.size() - 4) == ".xml" ) {
         classifier_cv.load(fn_classifier);
-        classifier_ep = classifier_cv;
+        classifier_ep.load(fn_classifier);
+    } else if(reload_classifier) {
+        classifier_store.open(fn_classifier);
+        classifier_ep = classifier_store.get();
     } else {
         classifier_ep.load(fn_classifier);
     }
 #else
-    ep::CascadeClassifier const classifier_ep(fn_classifier);
+    ep::CascadeClassifier classifier_ep;
+    if(reload_classifier) {
+        classifier_store.open(fn_classifier);
+        classifier_ep = classifier_store.get();
+    } else {
+        classifier_ep.load(fn_classifier);
+    }
 #endif
 
+    if( compact_classifier && !classifier_ep.empty() )
+        classifier_ep = classifier_ep.compact();
+
     if( classifier_ep.empty() ) {
         std::cout << " Error loading cascade." << std::endl;
         return -1;
     }
 
     std::cout << " Done. Classifier size is " << classifier_ep.get_size() << " bytes." << std::endl;
-    //classifier.save("lbpcascade_frontalface.dat");
+
+    if( !fn_save_classifier.empty() && classifier_ep.save(fn_save_classifier) != ERR_SUCCESS ) {
+        std::cout << "Error saving cascade " << fn_save_classifier << "." << std::endl;
+        return -1;
+    }
+
+    //Every frame is also classified window by window recording where cascade exited
+    EpCascadeHeatmap *heatmap(NULL);
+    if( !fn_profile.empty() ) {
+        heatmap = ep_cascade_heatmap_create(classifier_ep.get_data(), NULL);
+        if(!heatmap) {
+            std::cout << "Error creating cascade-depth profile." << std::endl;
+            return -1;
+        }
+    }
+
+    cv::Mat image;
+    cv::VideoCapture capture;
+    cv::VideoWriter writer;
+    //Frames of decoded stream are read into reader's ring of buffers and are not converted
+    EpFrameReader *reader(NULL);
+
+    bool f_video(false);
+    //JPEG decoded at reduced resolution (image shares its data); detections are multiplied by reduction factor
+    EpImage decoded_image( ep_image_create_empty() );
+    int image_reduction(1);
+
+    if( !yuv_format.empty() ) {
+        std::cout << "Opening " << yuv_format << " stream " << fn_image << "..." << std::flush;
+        reader = ep_frame_reader_open(fn_image.c_str(), yuv_format.c_str(), NULL);
+        if(!reader) {
+            std::cout << " Error opening stream." << std::endl;
+            return -1;
+        }
+        f_video = true;
+        if( fn_output.empty() && !headless )
+            fn_output = "result.avi";
+    } else {
+        std::cout << "Loading image " << fn_image << "..." << std::flush;
+        if( min_object_size > 0 && is_jpeg(fn_image) ) {
+            //Objects of min_object_size still cover classifier window in reduced image
+            cv::Size const window( classifier_ep.get_window_size() );
+            int const reduction( ep_jpeg_reduction(min_object_size, min_object_size, window.width, window.height) );
+            if(reduction > 1)
+                decoded_image = ep_image_load_jpeg(fn_image.c_str(), reduction, NULL);
+            if( !ep_image_is_empty(&decoded_image) ) {
+                image = cv::Mat(decoded_image.height, decoded_image.width, CV_8UC1, decoded_image.data, decoded_image.step);
+                image_reduction = reduction;
+                std::cout << " Decoded at 1/" << reduction << " resolution." << std::flush;
+            }
+        }
+        if( image.empty() )
+            image = cv::imread(fn_image, CV_LOAD_IMAGE_GRAYSCALE);
+
+        if( image.empty() ) {
+            std::cout << " Error loading image." << std::endl;
+            std::cout << "Loading video " << fn_image << "..." << std::flush;
+            if( !capture.open(fn_image) ) {
+                std::cout << " Error loading video." << std::endl;
+                return -1;
+            }
+            f_video = true;
+            if( fn_output.empty() && !headless )
+                fn_output = "result.avi";
+        } else {
+            if( fn_output.empty() && !headless )
+                fn_output = "result.png";
+        }
+    }
+    std::cout << " Done." << std::endl;
+
+    double timestamp(0.0);
 
     if(f_video) {
-        capture >> image;
-        cv::cvtColor(image, image, CV_BGR2GRAY);
-        if( !image.empty() ) {
+        double frame_rate(0.0);
+        if(reader) {
+            int width, height;
+            ep_frame_reader_info(reader, &width, &height, &frame_rate);
+            if( !read_frame(reader, image, timestamp) ) {
+                std::cout << " Error reading stream." << std::endl;
+                return -1;
+            }
+        } else {
+            if( !read_frame(capture, image, timestamp) ) {
+                std::cout << " Error reading video." << std::endl;
+                return -1;
+            }
+            frame_rate = capture.get(CV_CAP_PROP_FPS);
+        }
+        if(!headless) {
             writer.open (
                 fn_output,
                 CV_FOURCC('M', 'J', 'P', 'G'),
-                capture.get(CV_CAP_PROP_FPS),
+                frame_rate > 0.0 ? frame_rate : 25.0,
                 cv::Size(image.cols, image.rows)
             );
-        } else {
-            std::cout << " Error reading video." << std::endl;
+        }
+    }
+
+    if( !fn_trace.empty() )
+        ep_trace_start();
+
+    //Workgroup is opened once and reused for all frames
+    ep::DeviceSession session;
+    if( !host_only ) {
+        std::cout << "Opening device session..." << std::flush;
+        if( session.open(classifier_ep, num_cores) != ERR_SUCCESS ) {
+            std::cout << " Error opening device session." << std::endl;
             return -1;
         }
+        if(hybrid)
+            session.set_mode(DET_HYBRID);
+        std::cout << " Done." << std::endl;
+    }
+
+    //Host path keeps its pyramid and grouping buffers between frames
+    ep::Detector detector;
+    if( host_only && detector.open(classifier_ep) != ERR_SUCCESS ) {
+        std::cout << "Error opening host detector." << std::endl;
+        return -1;
     }
 
     cv::Mat canvas;
+    int frame_index(0);
+    EpDetectStats detect_stats;
+    EpDetectStats *const stats( fn_log.empty() ? NULL : &detect_stats );
+
+    //Device path is pipelined: frame N + 1 is read, scaled and uploaded before results
+    //of frame N are collected, so host and cores work at the same time
+    if( !host_only && session.submit(image, SCAN_EVEN) != ERR_SUCCESS ) {
+        std::cout << "Error submitting frame to device." << std::endl;
+        return -1;
+    }
 
     while(true) {
         std::vector<cv::Rect> objects_ep, objects_cv;
+        cv::Mat next_image;
+        double next_timestamp(0.0);
+        bool const has_next( f_video && ( reader ? read_frame(reader, next_image, next_timestamp) :
+                                                   read_frame(capture, next_image, next_timestamp) ) );
+
+        if(heatmap) {
+            std::cout << "Profiling cascade depth..." << std::flush;
+            EpImage const ep_image = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+            if( ep_cascade_heatmap_add_image(heatmap, &ep_image, SCAN_EVEN) != ERR_SUCCESS ) {
+                std::cout << " Error profiling frame." << std::endl;
+                return -1;
+            }
+            std::cout << " Done." << std::endl;
+        }
 
         {
             std::cout << "Detecting objects via ep::detect_multi_scale..." << std::endl;
             int64 const timeStart( cv::getTickCount() );
 
-            ep::detect_multi_scale (
-                image,
-                classifier_ep,
-                objects_ep,
-                detections_group,
-                SCAN_EVEN,
-                host_only ? DET_HOST : DET_DEVICE,
-                num_cores,
-                fn_log
-            );
+            if(host_only) {
+                if( classifier_store.reload() ) {
+                    classifier_ep = classifier_store.get();
+                    if(compact_classifier)
+                        classifier_ep = classifier_ep.compact();
+                    detector.open(classifier_ep);
+                    std::cout << "Classifier file was replaced; new cascade is used." << std::endl;
+                }
+                detector.detect(image, objects_ep, detections_group, SCAN_EVEN, stats);
+            } else {
+                if( has_next && session.submit(next_image, SCAN_EVEN) != ERR_SUCCESS ) {
+                    std::cout << "Error submitting frame to device." << std::endl;
+                    delete sink;
+                    return -1;
+                }
+                session.collect(objects_ep, detections_group, stats);
+            }
 
             int64 const timeStop( cv::getTickCount() );
             std::cout << "Done in " << (timeStop - timeStart) / cv::getTickFrequency() << " sec." << std::endl;
+
+            if( stats && ep_detect_stats_save(stats, fn_log.c_str()) != ERR_SUCCESS )
+                std::cout << "Error writing detection statistics to " << fn_log << std::endl;
         }
 
 #ifdef __OPENCV_OBJDETECT_HPP__
-        if( !classifier_cv.empty() ) {
+        //OpenCV detections are only used for visual comparison
+        if( !classifier_cv.empty() && !headless ) {
             std::cout << "Detecting objects via cv::detect_multi_scale..." << std::endl;
             int64 const timeStart( cv::getTickCount() );
 
@@ -170,6 +413,23 @@ int main(int argc, char **argv) {
         }
 #endif
 
+        if(headless) {
+            scale_objects(objects_ep, image_reduction);
+            if( !sink->write(frame_index, timestamp, objects_ep) ) {
+                std::cout << "Error writing results to " << fn_output << "." << std::endl;
+                delete sink;
+                return -1;
+            }
+            ++frame_index;
+
+            if(!has_next)
+                break; //Single image or end of video
+
+            image = next_image;
+            timestamp = next_timestamp;
+            continue;
+        }
+
         cv::cvtColor(image, canvas, CV_GRAY2BGR);
 
         //Visualizing OpenCV detections
@@ -186,10 +446,9 @@ int main(int argc, char **argv) {
 
         if(f_video) {
             writer << canvas;
-            capture >> image;
-            if( image.empty() )
+            if(!has_next)
                 break; //End of video
-            cv::cvtColor(image, image, CV_BGR2GRAY);
+            image = next_image;
         } else {
             std::cout << "Saving result to " << fn_output << "..." << std::flush;
             if( !cv::imwrite(fn_output, canvas) ) {
@@ -200,8 +459,21 @@ int main(int argc, char **argv) {
         }
     }
 
+    delete sink;
+    ep_frame_reader_close(reader);
+    ep_image_release(&decoded_image);
+
     std::cout << " Done." << std::endl;
 
+    if(heatmap) {
+        std::cout << "Saving cascade-depth profile " << fn_profile << "..." << std::flush;
+        std::cout << ( save_heatmap(heatmap, fn_profile) ? " Done." : " Error saving profile." ) << std::endl;
+        ep_cascade_heatmap_release(heatmap);
+    }
+
+    if( !fn_trace.empty() && ep_trace_stop( fn_trace.c_str() ) != ERR_SUCCESS )
+        std::cout << "Error writing trace " << fn_trace << "." << std::endl;
+
     if( !host_only ) {
 		/*
 		std::cout << "Disconnecting from e-server..." << std::flush;
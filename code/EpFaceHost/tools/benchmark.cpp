@@ -0,0 +1,564 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+/**
+ * Benchmark suite: microbenchmarks of detector kernels and end-to-end detection at several frame sizes.
+ * Every benchmark is run once for warm-up and then repeatedly; min, median and p99 of measurements
+ * are written as JSON, so kernel changes can be compared across commits.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../cpp/ep_cascade_detector.hpp"
+#include "../cpp/ep_async_detector.hpp"
+
+/// Results of kernels are accumulated here, so compiler cannot throw calls away
+static volatile int benchmark_sink(0);
+
+/**
+ * One measured operation
+ */
+class Benchmark {
+public:
+    virtual ~Benchmark(void) { ; }
+    /// Run operation once; @return time of measured part in seconds
+    virtual double run(void) = 0;
+    /// Error of the last run; such run is not measured
+    virtual EpErrorCode error(void) const { return ERR_SUCCESS; }
+};
+
+/**
+ * Statistics of benchmark measurements
+ */
+struct BenchmarkResult {
+    std::string name;
+    /// "ns" per item for kernels, "us" or "ms" per call otherwise
+    std::string unit;
+    /// Items processed per run (decisions, windows); 1 for whole calls
+    long items;
+    int repeat;
+    double min, median, p99, mean;
+    /// Raw detections found by end-to-end benchmark; -1 for kernels
+    int objects;
+    /// Error of unsupported operation (e.g. frame too large for the device); ERR_SUCCESS if measured
+    EpErrorCode error;
+};
+
+static double seconds_since(int64 const time_start) {
+    return (cv::getTickCount() - time_start) / cv::getTickFrequency();
+}
+
+/**
+ * Run benchmark once for warm-up and then repeat times.
+ *   Measurements are converted to unit per item (unit_scale is number of units in second).
+ *   If any run fails, the benchmark is reported as unsupported without measurements.
+ */
+static BenchmarkResult measure (
+    Benchmark         &benchmark,
+    std::string const &name,
+    std::string const &unit,
+    double      const  unit_scale,
+    long        const  items,
+    int         const  repeat
+) {
+    std::cout << name << "..." << std::flush;
+
+    BenchmarkResult result;
+    result.name = name;
+    result.unit = unit;
+    result.items = items;
+    result.repeat = repeat;
+    result.min = result.median = result.p99 = result.mean = 0;
+    result.objects = -1;
+
+    benchmark.run();
+    result.error = benchmark.error();
+
+    std::vector<double> samples(repeat);
+    for(int i(0); i < repeat && result.error == ERR_SUCCESS; ++i) {
+        samples[i] = benchmark.run() * unit_scale / items;
+        result.error = benchmark.error();
+    }
+
+    if(result.error != ERR_SUCCESS) {
+        result.repeat = 0;
+        std::cout << " unsupported (error " << result.error << ")" << std::endl;
+        return result;
+    }
+
+    std::sort( samples.begin(), samples.end() );
+    result.min = samples.front();
+    result.median = repeat % 2 ? samples[repeat / 2] : (samples[repeat / 2 - 1] + samples[repeat / 2]) / 2;
+    result.p99 = samples[ static_cast<int>( std::ceil(repeat * 0.99) ) - 1 ]; //Nearest rank
+    result.mean = 0;
+    for(int i(0); i < repeat; ++i)
+        result.mean += samples[i] / repeat;
+
+    std::cout << " median " << result.median << " " << unit << std::endl;
+    return result;
+}
+
+/**
+ * LBP feature calculation (calc_lbp_decision) of every decision node at a grid of window positions
+ */
+class NodeDecisionBenchmark: public Benchmark {
+public:
+    NodeDecisionBenchmark(EpCascadeClassifier const *classifier, EpImage const &image):
+        image(image)
+    {
+        EpNodeMeta const *const meta( reinterpret_cast<EpNodeMeta const *>(classifier->data) );
+        char const *node( classifier->data + sizeof(EpNodeMeta) );
+        char const *const nodes_end( classifier->data + classifier->size - sizeof(EpNodeFinal) );
+        while(node < nodes_end) {
+            if(*reinterpret_cast<int const *>(node) == NODE_DECISION) {
+                nodes.push_back(node);
+                node += sizeof(EpNodeDecision);
+            } else {
+                node += sizeof(EpNodeStage); //EpNodeBound has the same size
+            }
+        }
+
+        for(int y(0); y + meta->window_height <= image.height; y += image.height / 16)
+            for(int x(0); x + meta->window_width <= image.width; x += image.width / 32)
+                positions.push_back(y * image.step + x);
+    }
+
+    long items(void) const {
+        return static_cast<long>( nodes.size() * positions.size() );
+    }
+
+    virtual double run(void) {
+        int64 const time_start( cv::getTickCount() );
+        int sum(0);
+        for(size_t p(0); p < positions.size(); ++p)
+            for(size_t n(0); n < nodes.size(); ++n)
+                sum += ep_classifier_node_decision(nodes[n], image.data + positions[p], image.step);
+        double const result( seconds_since(time_start) );
+        benchmark_sink += sum;
+        return result;
+    }
+
+private:
+    EpImage image;
+    std::vector<char const *> nodes;
+    std::vector<int> positions;
+};
+
+/**
+ * Cascade evaluation (classify) with checkerboard scan of image region, as detection scans a tile
+ */
+class ClassifyBenchmark: public Benchmark {
+public:
+    ClassifyBenchmark(EpCascadeClassifier const *classifier, EpImage const &region):
+        classifier(classifier), region(region)
+    {
+        EpNodeMeta const *const meta( reinterpret_cast<EpNodeMeta const *>(classifier->data) );
+        process_width = region.width + 1 - meta->window_width;
+        process_height = region.height + 1 - meta->window_height;
+    }
+
+    long items(void) const {
+        return static_cast<long>(process_width) * process_height / 2;
+    }
+
+    virtual double run(void) {
+        int64 const time_start( cv::getTickCount() );
+        int sum(0);
+        for(int y(0); y < process_height; ++y)
+            for(int x(y & 1); x < process_width; x += 2)
+                sum += ep_classifier_classify(classifier, region.data + y * region.step + x, region.step);
+        double const result( seconds_since(time_start) );
+        benchmark_sink += sum;
+        return result;
+    }
+
+private:
+    EpCascadeClassifier const *classifier;
+    EpImage region;
+    int process_width, process_height;
+};
+
+/**
+ * The first pyramid octave: scale8765
+ */
+class Scale8765Benchmark: public Benchmark {
+public:
+    Scale8765Benchmark(EpImage const &image):
+        image(image),
+        img7( ep_image_create(image.width / 8 * 7, image.height / 8 * 7) ),
+        img6( ep_image_create(image.width / 8 * 6, image.height / 8 * 6) ),
+        img5( ep_image_create(image.width / 8 * 5, image.height / 8 * 5) )
+    { ; }
+
+    virtual ~Scale8765Benchmark(void) {
+        ep_image_release(&img5);
+        ep_image_release(&img6);
+        ep_image_release(&img7);
+    }
+
+    virtual double run(void) {
+        int offset_x, offset_y;
+        int64 const time_start( cv::getTickCount() );
+        ep_image_scale8765(&image, &img7, &img6, &img5, &offset_x, &offset_y);
+        double const result( seconds_since(time_start) );
+        benchmark_sink += img5.data[0];
+        return result;
+    }
+
+private:
+    Scale8765Benchmark(Scale8765Benchmark const &);
+    Scale8765Benchmark &operator=(Scale8765Benchmark const &);
+
+    EpImage image, img7, img6, img5;
+};
+
+/**
+ * The next pyramid octave: scale21
+ */
+class Scale21Benchmark: public Benchmark {
+public:
+    Scale21Benchmark(EpImage const &image):
+        image(image),
+        half( ep_image_create(image.width / 2, image.height / 2) )
+    { ; }
+
+    virtual ~Scale21Benchmark(void) {
+        ep_image_release(&half);
+    }
+
+    virtual double run(void) {
+        int64 const time_start( cv::getTickCount() );
+        ep_image_scale21(&image, &half);
+        double const result( seconds_since(time_start) );
+        benchmark_sink += half.data[0];
+        return result;
+    }
+
+private:
+    Scale21Benchmark(Scale21Benchmark const &);
+    Scale21Benchmark &operator=(Scale21Benchmark const &);
+
+    EpImage image, half;
+};
+
+/**
+ * Grouping of raw detections
+ */
+class GroupBenchmark: public Benchmark {
+public:
+    GroupBenchmark(EpRectList const &raw, int min_neighbors):
+        raw(raw), min_neighbors(min_neighbors)
+    { ; }
+
+    virtual double run(void) {
+        std::vector<cv::Rect> objects;
+        int64 const time_start( cv::getTickCount() );
+        ep::group_rectangles(raw, objects, min_neighbors);
+        double const result( seconds_since(time_start) );
+        benchmark_sink += static_cast<int>( objects.size() );
+        return result;
+    }
+
+private:
+    EpRectList raw;
+    int min_neighbors;
+};
+
+/**
+ * End-to-end detection without grouping: on host, or on (emulated) device through opened session
+ */
+class DetectBenchmark: public Benchmark {
+public:
+    DetectBenchmark(cv::Mat const &image, ep::CascadeClassifier const &classifier, ep::DeviceSession *session):
+        image(image), classifier(classifier), session(session), objects_count(0), result(ERR_SUCCESS)
+    { ; }
+
+    int objects(void) const {
+        return objects_count;
+    }
+
+    virtual double run(void) {
+        std::vector<cv::Rect> objects;
+        int64 const time_start( cv::getTickCount() );
+        if(session)
+            result = session->detect_multi_scale(image, objects, 0);
+        else
+            result = ep::detect_multi_scale(image, classifier, objects, 0, SCAN_EVEN, DET_HOST);
+        double const elapsed( seconds_since(time_start) );
+        objects_count = static_cast<int>( objects.size() );
+        return elapsed;
+    }
+
+    virtual EpErrorCode error(void) const {
+        return result;
+    }
+
+private:
+    cv::Mat image;
+    ep::CascadeClassifier const &classifier;
+    ep::DeviceSession *session;
+    int objects_count;
+    EpErrorCode result;
+};
+
+/**
+ * Host detection of several frames in flight: one worker thread per frame, results delivered to callback
+ */
+class AsyncBenchmark: public Benchmark, private ep::DetectionCallback {
+public:
+    AsyncBenchmark(cv::Mat const &image, ep::CascadeClassifier const &classifier, int const frames_count):
+        image(image), frames_count(frames_count), objects_count(0), result(ERR_SUCCESS)
+    {
+        open_result = detector.open(classifier, DET_HOST, 0, frames_count, ep::BACKPRESSURE_BLOCK, this);
+    }
+
+    int objects(void) const {
+        return objects_count;
+    }
+
+    /// @return time of all frames, from submission of the first one to delivery of the last one
+    virtual double run(void) {
+        result = open_result;
+        if(result != ERR_SUCCESS)
+            return 0;
+
+        int64 const time_start( cv::getTickCount() );
+        for(int i(0); i < frames_count; ++i) {
+            EpErrorCode const submit_result( detector.submit(image, 0) );
+            if(submit_result != ERR_SUCCESS)
+                result = submit_result;
+        }
+        detector.flush();
+        return seconds_since(time_start);
+    }
+
+    virtual EpErrorCode error(void) const {
+        return result;
+    }
+
+private:
+    /// Called by one thread at a time; flush() in run() waits for the last call
+    virtual void on_detection(long, EpErrorCode const detection_result, std::vector<cv::Rect> const &objects) {
+        objects_count = static_cast<int>( objects.size() );
+        if(detection_result != ERR_SUCCESS)
+            result = detection_result;
+    }
+
+    cv::Mat image;
+    int frames_count;
+    int objects_count;
+    EpErrorCode open_result;
+    EpErrorCode result;
+    ep::AsyncDetector detector;
+};
+
+/**
+ * Deterministic synthetic frame: smoothed noise with some large-scale structure
+ */
+static cv::Mat synthetic_frame(cv::Size const size) {
+    cv::RNG rng(0x45504643);
+    cv::Mat coarse(size.height / 8 + 1, size.width / 8 + 1, CV_8UC1), smooth;
+    rng.fill(coarse, cv::RNG::UNIFORM, 0, 256);
+    cv::resize(coarse, smooth, size, 0, 0, cv::INTER_LINEAR);
+
+    cv::Mat fine(size, CV_8UC1), result;
+    rng.fill(fine, cv::RNG::UNIFORM, 0, 256);
+    cv::addWeighted(smooth, 0.85, fine, 0.15, 0, result);
+    return result;
+}
+
+static EpImage ep_image_of(cv::Mat const &image) {
+    EpImage const result = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+    return result;
+}
+
+/**
+ * Write results as JSON
+ */
+static bool write_json(std::string const &file_name, std::string const &label, int num_cores, bool device,
+                       std::vector<BenchmarkResult> const &results) {
+    FILE *const file( std::fopen(file_name.c_str(), "wt") );
+    if(!file)
+        return false;
+
+    std::fprintf(file, "{\n  \"label\": \"%s\",\n  \"threads\": %d,\n", label.c_str(), omp_get_max_threads());
+    std::fprintf(file, "  \"num_cores\": %d,\n", device ? num_cores : 0);
+#ifdef DEVICE_EMULATION
+    std::fprintf(file, "  \"device\": \"emulated\",\n");
+#else
+    std::fprintf(file, "  \"device\": \"epiphany\",\n");
+#endif
+    std::fprintf(file, "  \"benchmarks\": [\n");
+
+    for(size_t i(0); i < results.size(); ++i) {
+        BenchmarkResult const &r(results[i]);
+        if(r.error != ERR_SUCCESS) {
+            std::fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %ld, \"unsupported\": true, \"error\": %d",
+                         r.name.c_str(), r.unit.c_str(), r.items, static_cast<int>(r.error));
+            std::fprintf(file, i + 1 < results.size() ? "},\n" : "}\n");
+            continue;
+        }
+        std::fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %ld, \"repeat\": %d, "
+                           "\"min\": %.6g, \"median\": %.6g, \"p99\": %.6g, \"mean\": %.6g",
+                     r.name.c_str(), r.unit.c_str(), r.items, r.repeat, r.min, r.median, r.p99, r.mean);
+        if(r.objects >= 0)
+            std::fprintf(file, ", \"objects\": %d", r.objects);
+        std::fprintf(file, i + 1 < results.size() ? "},\n" : "}\n");
+    }
+
+    std::fprintf(file, "  ]\n}\n");
+    return std::fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+
+    char const *const keys (
+        "{ c | classifier | lbpcascade_frontalface.dat | Epiphany LBP classifier (.dat or .xml) }"
+        "{ d | directory | . | Directory with g20.jpg and 1080.jpg }"
+        "{ o | output | benchmark.json | JSON file with results }"
+        "{ l | label | | Label stored with results, e.g. commit id }"
+        "{ r | repeat | 21 | Measurements per kernel benchmark }"
+        "{ e | endtoend | 7 | Measurements per end-to-end benchmark (0 to skip end-to-end benchmarks) }"
+        "{ h | host | 0 | End-to-end benchmarks on host and device (0) or on host only (1) }"
+        "{ n | numcores | 16 | Number of working cores }"
+    );
+
+    cv::CommandLineParser cmd(argc, argv, keys);
+    std::string const fn_classifier( cmd.get<std::string>("classifier") ),
+                      directory( cmd.get<std::string>("directory") ),
+                      fn_output( cmd.get<std::string>("output") ),
+                      label( cmd.get<std::string>("label") );
+    int const repeat( std::max(cmd.get<int>("repeat"), 1) );
+    int const repeat_end_to_end( cmd.get<int>("endtoend") );
+    bool const device(cmd.get<int>("host") == 0);
+    int const num_cores( cmd.get<int>("numcores") );
+
+    std::cout << "Loading cascade " << fn_classifier << "..." << std::flush;
+    ep::CascadeClassifier const classifier(fn_classifier);
+    if( classifier.empty() || ep_classifier_is_compact( classifier.get_data() ) ) {
+        std::cout << " Error loading cascade (compact classifiers are not supported)." << std::endl;
+        return -1;
+    }
+    std::cout << " Done." << std::endl;
+
+    //Frame sources: photos and synthetic frames, all resized to each benchmarked size
+    std::vector<std::string> source_names;
+    std::vector<cv::Mat> sources;
+    char const *const photos[2] = {"g20", "1080"};
+    for(int i(0); i < 2; ++i) {
+        cv::Mat const image( cv::imread(directory + "/" + photos[i] + ".jpg", CV_LOAD_IMAGE_GRAYSCALE) );
+        if( image.empty() ) {
+            std::cout << "Cannot load " << directory << "/" << photos[i] << ".jpg; it is skipped." << std::endl;
+            continue;
+        }
+        source_names.push_back(photos[i]);
+        sources.push_back(image);
+    }
+    source_names.push_back("synthetic");
+    sources.push_back( synthetic_frame( cv::Size(1920, 1080) ) );
+
+    cv::Mat frame_1080;
+    cv::resize(sources[0], frame_1080, cv::Size(1920, 1080), 0, 0, cv::INTER_AREA);
+    EpImage const image_1080( ep_image_of(frame_1080) );
+
+    std::vector<BenchmarkResult> results;
+
+    //Kernels
+    {
+        NodeDecisionBenchmark node_decision(classifier.get_data(), image_1080);
+        results.push_back( measure(node_decision, "calc_lbp_decision", "ns", 1e9, node_decision.items(), repeat) );
+
+        //Central region of the frame, the size of a core tile
+        EpImage const region( ep_subimage_get(&image_1080, 1920 / 2 - 160, 1080 / 2 - 120, 320, 240) );
+        ClassifyBenchmark classify(classifier.get_data(), region);
+        results.push_back( measure(classify, "classify", "ns", 1e9, classify.items(), repeat) );
+
+        Scale8765Benchmark scale8765(image_1080);
+        results.push_back( measure(scale8765, "scale8765/1080p", "us", 1e6, 1, repeat) );
+
+        Scale21Benchmark scale21(image_1080);
+        results.push_back( measure(scale21, "scale21/1080p", "us", 1e6, 1, repeat) );
+
+        EpImage raw_image( ep_image_clone(&image_1080) );
+        EpRectList raw( ep_rect_list_create_empty() );
+        ep_detect_multi_scale_host(&raw_image, classifier.get_data(), &raw, SCAN_EVEN, NULL);
+        ep_image_release(&raw_image);
+
+        GroupBenchmark group(raw, 3);
+        results.push_back( measure(group, "group_rectangles", "us", 1e6, 1, repeat) );
+        ep_rect_list_release(&raw);
+    }
+
+    //End-to-end detection
+    if(repeat_end_to_end > 0) {
+        ep::DeviceSession session;
+        if( device && session.open(classifier, num_cores) != ERR_SUCCESS ) {
+            std::cout << "Error opening device session." << std::endl;
+            return -1;
+        }
+
+        int const heights[4] = {480, 720, 1080, 2160};
+        //Asynchronous detection keeps a frame per host thread in flight
+        int const async_frames( omp_get_max_threads() );
+        for(size_t s(0); s < sources.size(); ++s) {
+            for(int h(0); h < 4; ++h) {
+                cv::Size const size(heights[h] * 16 / 9, heights[h]);
+                cv::Mat frame;
+                cv::resize(sources[s], frame, size, 0, 0, size.width < sources[s].cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+                char size_name[16];
+                std::sprintf(size_name, "/%dp", heights[h]);
+
+                for(int mode(0); mode < (device ? 2 : 1); ++mode) {
+                    DetectBenchmark detect(frame, classifier, mode ? &session : NULL);
+                    results.push_back( measure (
+                        detect,
+                        (mode ? "detect_device/" : "detect_host/") + source_names[s] + size_name,
+                        "ms", 1e3, 1, repeat_end_to_end
+                    ) );
+                    if(results.back().error == ERR_SUCCESS)
+                        results.back().objects = detect.objects();
+                }
+
+                AsyncBenchmark async(frame, classifier, async_frames);
+                results.push_back( measure (
+                    async, "detect_async/" + source_names[s] + size_name, "ms", 1e3, async_frames, repeat_end_to_end
+                ) );
+                if(results.back().error == ERR_SUCCESS)
+                    results.back().objects = async.objects();
+            }
+        }
+    }
+
+    if( !write_json(fn_output, label, num_cores, device && repeat_end_to_end > 0, results) ) {
+        std::cout << "Error writing " << fn_output << "." << std::endl;
+        return -1;
+    }
+    std::cout << "Results are saved to " << fn_output << "." << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+/**
+ * Offline tool: profile classifier on a directory of representative images, reorder decisions
+ * inside stages and insert early rejection bounds (@see ep_cascade_optimizer.h).
+ * Writes optimized .dat classifier and a report of expected speedup.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "../cpp/ep_cascade_detector.hpp"
+#include "../c/ep_cascade_optimizer.h"
+
+/**
+ * Get sorted names of files in directory
+ */
+static std::vector<std::string> list_directory(std::string const &directory) {
+    std::vector<std::string> result;
+
+    DIR *const dir( opendir( directory.c_str() ) );
+    if(!dir)
+        return result;
+
+    while(dirent const *const entry = readdir(dir))
+        if(entry->d_name[0] != '.')
+            result.push_back(directory + "/" + entry->d_name);
+
+    closedir(dir);
+    std::sort( result.begin(), result.end() );
+    return result;
+}
+
+static bool rect_less(cv::Rect const &a, cv::Rect const &b) {
+    if(a.y != b.y) return a.y < b.y;
+    if(a.x != b.x) return a.x < b.x;
+    if(a.width != b.width) return a.width < b.width;
+    return a.height < b.height;
+}
+
+/**
+ * Compare detections regardless of their order (host threads add them in any order)
+ */
+static bool same_objects(std::vector<cv::Rect> a, std::vector<cv::Rect> b) {
+    if( a.size() != b.size() )
+        return false;
+
+    std::sort(a.begin(), a.end(), rect_less);
+    std::sort(b.begin(), b.end(), rect_less);
+    for(size_t i(0); i < a.size(); ++i)
+        if( rect_less(a[i], b[i]) || rect_less(b[i], a[i]) )
+            return false;
+
+    return true;
+}
+
+/**
+ * Run host detection without grouping
+ * @return detection time in seconds
+ */
+static double detect_raw(cv::Mat const &image, ep::CascadeClassifier const &classifier, std::vector<cv::Rect> &objects) {
+    int64 const time_start( cv::getTickCount() );
+    ep::detect_multi_scale(image, classifier, objects, 0, SCAN_EVEN, DET_HOST);
+    return (cv::getTickCount() - time_start) / cv::getTickFrequency();
+}
+
+int main(int argc, char **argv) {
+
+    char const *const keys (
+        "{ c | classifier | lbpcascade_frontalface.xml | LBP classifier to optimize (.xml or .dat) }"
+        "{ d | directory | | Directory of representative images }"
+        "{ o | output | optimized.dat | Optimized classifier; report is written next to it (.txt) }"
+        "{ m | measure | 1 | Time host detection with both classifiers and compare raw detections (1) }"
+    );
+
+    cv::CommandLineParser cmd(argc, argv, keys);
+    std::string const fn_classifier( cmd.get<std::string>("classifier") ),
+                      directory( cmd.get<std::string>("directory") ),
+                      fn_output( cmd.get<std::string>("output") );
+    bool const measure(cmd.get<int>("measure") != 0);
+
+    std::string const fn_report( ( fn_output.size() > 4 && fn_output.substr(fn_output.size() - 4) == ".dat" ?
+        fn_output.substr(0, fn_output.size() - 4) : fn_output ) + ".txt" );
+
+    std::cout << "Loading cascade " << fn_classifier << "..." << std::flush;
+    ep::CascadeClassifier const classifier(fn_classifier);
+    if( classifier.empty() ) {
+        std::cout << " Error loading cascade." << std::endl;
+        return -1;
+    }
+    std::cout << " Done." << std::endl;
+
+    EpErrorCode error_code;
+    EpCascadeProfile *const profile( ep_cascade_profile_create(classifier.get_data(), &error_code) );
+    if(!profile) {
+        std::cout << "Cannot profile cascade (compact classifiers are not supported)." << std::endl;
+        return -1;
+    }
+
+    std::vector<cv::Mat> images;
+    std::vector<std::string> const files( list_directory(directory) );
+    for(size_t i(0); i < files.size(); ++i) {
+        cv::Mat const image( cv::imread(files[i], CV_LOAD_IMAGE_GRAYSCALE) );
+        if( image.empty() )
+            continue; //Not an image
+
+        std::cout << "Profiling " << files[i] << "..." << std::flush;
+        EpImage const ep_image = { image.data, image.cols, image.rows, static_cast<int>(image.step) };
+        if( ep_cascade_profile_add_image(profile, &ep_image) != ERR_SUCCESS ) {
+            std::cout << " Error." << std::endl;
+            ep_cascade_profile_release(profile);
+            return -1;
+        }
+        std::cout << " Done." << std::endl;
+
+        if(measure)
+            images.push_back(image);
+    }
+
+    EpCascadeOptimizeReport report;
+    EpCascadeClassifier optimized( ep_classifier_optimize(profile, &report) );
+    ep_cascade_profile_release(profile);
+
+    if( report.windows == 0 ) {
+        std::cout << "No images found in directory \"" << directory << "\"." << std::endl;
+        ep_classifier_release(&optimized);
+        return -1;
+    }
+
+    if( ep_classifier_is_empty(&optimized) || ep_classifier_save(&optimized, fn_output.c_str()) != ERR_SUCCESS ) {
+        std::cout << "Error saving optimized cascade " << fn_output << "." << std::endl;
+        ep_classifier_release(&optimized);
+        return -1;
+    }
+    ep_classifier_release(&optimized);
+    std::cout << "Optimized cascade is saved to " << fn_output << "." << std::endl;
+
+    std::ofstream report_file( fn_report.c_str() );
+    std::ostream *const outputs[2] = {&std::cout, &report_file};
+
+    for(int i(0); i < 2; ++i) {
+        std::ostream &out( *outputs[i] );
+        out << "Classifier:                     " << fn_classifier << " -> " << fn_output << std::endl
+            << "Windows profiled:               " << static_cast<long long>(report.windows) << std::endl
+            << "Stages / decisions / bounds:    " << report.stages_count << " / " << report.decisions_count
+                                                  << " / " << report.bounds_count << std::endl
+            << "Decisions per window:           " << report.decisions_before << " -> " << report.decisions_after << std::endl
+            << "Modeled cost per window:        " << report.cost_before << " -> " << report.cost_after << std::endl
+            << "Expected speedup:               " << report.cost_before / report.cost_after << std::endl;
+    }
+
+    if(measure) {
+        ep::CascadeClassifier const classifier_optimized(fn_output);
+        double time_before(0), time_after(0);
+        bool identical(true);
+
+        for(size_t i(0); i < images.size(); ++i) {
+            std::vector<cv::Rect> objects_before, objects_after;
+            time_before += detect_raw(images[i], classifier, objects_before);
+            time_after += detect_raw(images[i], classifier_optimized, objects_after);
+            identical = identical && same_objects(objects_before, objects_after);
+        }
+
+        for(int i(0); i < 2; ++i) {
+            std::ostream &out( *outputs[i] );
+            out << "Measured host detection, ms:    " << time_before * 1000 << " -> " << time_after * 1000 << std::endl
+                << "Measured speedup:               " << time_before / time_after << std::endl
+                << "Raw detections identical:       " << (identical ? "yes" : "NO") << std::endl;
+        }
+    }
+
+    std::cout << "Report is saved to " << fn_report << "." << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,419 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+/**
+ * Regression harness: runs a corpus of images through OpenCV detector (reference) and Epiphany
+ * detector on host and on (emulated) device. Detections are matched to reference ones by IoU;
+ * recall, precision and throughput are reported and compared with a stored baseline. Fails when
+ * host and device raw hits differ or when recall or precision moves beyond tolerance.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../cpp/ep_cascade_detector.hpp"
+
+/**
+ * Results of one image; the same fields are stored in baseline
+ */
+struct ImageResult {
+    /// Reference (OpenCV) detections, Epiphany detections and matched pairs; reference and matched are -1
+    ///   if reference detector is not available
+    int reference, detected, matched;
+    /// Raw (ungrouped) hits of Epiphany detector and their hash
+    int raw;
+    unsigned int raw_hash;
+};
+
+/**
+ * Corpus totals
+ */
+struct Totals {
+    int reference, detected, matched;
+    /// Images without reference detections; recall and precision are not measured if there are any
+    int unmeasured;
+
+    Totals(void): reference(0), detected(0), matched(0), unmeasured(0) { ; }
+
+    void add(ImageResult const &r) {
+        if(r.reference < 0) {
+            ++unmeasured;
+            return;
+        }
+        reference += r.reference;
+        detected += r.detected;
+        matched += r.matched;
+    }
+
+    double recall(void) const {
+        return reference ? static_cast<double>(matched) / reference : 1.0;
+    }
+
+    double precision(void) const {
+        return detected ? static_cast<double>(matched) / detected : 1.0;
+    }
+};
+
+/**
+ * Seconds and megapixels processed by one implementation
+ */
+struct Throughput {
+    double seconds, megapixels;
+    int frames;
+
+    Throughput(void): seconds(0), megapixels(0), frames(0) { ; }
+
+    void add(double time, cv::Mat const &image) {
+        seconds += time;
+        megapixels += image.cols * image.rows / 1e6;
+        ++frames;
+    }
+};
+
+static double seconds_since(int64 const time_start) {
+    return (cv::getTickCount() - time_start) / cv::getTickFrequency();
+}
+
+static double intersection_over_union(cv::Rect const &a, cv::Rect const &b) {
+    int const intersection( (a & b).area() );
+    int const union_area( a.area() + b.area() - intersection );
+    return union_area > 0 ? static_cast<double>(intersection) / union_area : 0.0;
+}
+
+struct RectPair {
+    double iou;
+    int detected, reference;
+
+    bool operator<(RectPair const &other) const {
+        return iou > other.iou;
+    }
+};
+
+/**
+ * Match detections to reference ones greedily, the best overlapping pairs first.
+ *   Each rectangle is matched at most once.
+ * @return number of matched pairs
+ */
+static int match_objects(std::vector<cv::Rect> const &detected, std::vector<cv::Rect> const &reference, double min_iou) {
+    std::vector<RectPair> pairs;
+    for(int i(0); i < static_cast<int>( detected.size() ); ++i) {
+        for(int j(0); j < static_cast<int>( reference.size() ); ++j) {
+            RectPair const pair = { intersection_over_union(detected[i], reference[j]), i, j };
+            if(pair.iou >= min_iou)
+                pairs.push_back(pair);
+        }
+    }
+    std::stable_sort( pairs.begin(), pairs.end() );
+
+    std::vector<bool> detected_used( detected.size() ), reference_used( reference.size() );
+    int result(0);
+    for(size_t i(0); i < pairs.size(); ++i) {
+        if(detected_used[pairs[i].detected] || reference_used[pairs[i].reference])
+            continue;
+        detected_used[pairs[i].detected] = reference_used[pairs[i].reference] = true;
+        ++result;
+    }
+    return result;
+}
+
+static bool rect_less(cv::Rect const &a, cv::Rect const &b) {
+    if(a.y != b.y) return a.y < b.y;
+    if(a.x != b.x) return a.x < b.x;
+    if(a.width != b.width) return a.width < b.width;
+    return a.height < b.height;
+}
+
+static bool rect_equal(cv::Rect const &a, cv::Rect const &b) {
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+/**
+ * Hash of hits independent of their order (hits are sorted in place)
+ */
+static unsigned int hits_hash(std::vector<cv::Rect> &hits) {
+    std::sort(hits.begin(), hits.end(), rect_less);
+    unsigned int result(2166136261u);
+    for(size_t i(0); i < hits.size(); ++i) {
+        int const values[4] = { hits[i].x, hits[i].y, hits[i].width, hits[i].height };
+        for(int k(0); k < 4; ++k)
+            result = (result ^ static_cast<unsigned int>(values[k])) * 16777619u;
+    }
+    return result;
+}
+
+/**
+ * Read corpus list: one image file name per line; empty lines and lines starting with # are skipped
+ */
+static bool read_corpus(std::string const &file_name, std::vector<std::string> &images) {
+    std::ifstream file( file_name.c_str() );
+    if(!file)
+        return false;
+    std::string line;
+    while( std::getline(file, line) ) {
+        if( !line.empty() && line[line.size() - 1] == '\r' )
+            line.erase(line.size() - 1);
+        if( !line.empty() && line[0] != '#' )
+            images.push_back(line);
+    }
+    return true;
+}
+
+/**
+ * Baseline file: "<image> <reference> <detected> <matched> <raw> <raw hash>" per line
+ *   (reference and matched are -1 if baseline was written without reference detector)
+ */
+static bool read_baseline(std::string const &file_name, std::map<std::string, ImageResult> &baseline) {
+    std::ifstream file( file_name.c_str() );
+    if(!file)
+        return false;
+    std::string name;
+    ImageResult r;
+    while(file >> name >> r.reference >> r.detected >> r.matched >> r.raw >> r.raw_hash)
+        baseline[name] = r;
+    return true;
+}
+
+static bool write_baseline(std::string const &file_name, std::vector<std::string> const &images,
+                           std::vector<ImageResult> const &results) {
+    FILE *const file( std::fopen(file_name.c_str(), "wt") );
+    if(!file)
+        return false;
+    for(size_t i(0); i < images.size(); ++i) {
+        ImageResult const &r(results[i]);
+        std::fprintf(file, "%s %d %d %d %d %u\n", images[i].c_str(), r.reference, r.detected, r.matched, r.raw, r.raw_hash);
+    }
+    return std::fclose(file) == 0;
+}
+
+static void print_throughput(char const *name, Throughput const &t) {
+    if(!t.frames)
+        return;
+    std::printf("%-16s %8.3f s  %8.2f frames/s  %8.2f Mpixels/s\n", name, t.seconds,
+                t.frames / t.seconds, t.megapixels / t.seconds);
+}
+
+int main(int argc, char **argv) {
+
+    char const *const keys (
+        "{ i | input | corpus.txt | Text file with image file names, one per line }"
+        "{ c | classifier | lbpcascade_frontalface.xml | Reference .xml cascade (OpenCV and Epiphany) }"
+        "{ e | epiphany | | Epiphany classifier used instead of the reference one (e.g. optimized .dat) }"
+        "{ g | grouping | 3 | Number of detections in group }"
+        "{ u | iou | 0.5 | Minimal intersection over union of matched detections }"
+        "{ b | baseline | baseline.txt | Baseline file compared with results }"
+        "{ w | write | 0 | Write results to baseline file instead of comparing (1) }"
+        "{ t | tolerance | 0.01 | Allowed change of recall and precision against baseline }"
+        "{ h | host | 0 | Check that host and device raw hits are equal (0) or run on host only (1) }"
+        "{ n | numcores | 16 | Number of working cores }"
+    );
+
+    cv::CommandLineParser cmd(argc, argv, keys);
+    std::string const fn_corpus( cmd.get<std::string>("input") ),
+                      fn_classifier( cmd.get<std::string>("classifier") ),
+                      fn_epiphany( cmd.get<std::string>("epiphany") ),
+                      fn_baseline( cmd.get<std::string>("baseline") );
+    int const detections_group( cmd.get<int>("grouping") );
+    double const min_iou( cmd.get<double>("iou") );
+    double const tolerance( cmd.get<double>("tolerance") );
+    bool const update_baseline(cmd.get<int>("write") != 0);
+    bool const device(cmd.get<int>("host") == 0);
+    int const num_cores( cmd.get<int>("numcores") );
+
+    std::vector<std::string> images;
+    if( !read_corpus(fn_corpus, images) || images.empty() ) {
+        std::cout << "Error reading corpus " << fn_corpus << "." << std::endl;
+        return -1;
+    }
+
+    std::cout << "Loading cascade " << fn_classifier << "..." << std::flush;
+    ep::CascadeClassifier const classifier( fn_epiphany.empty() ? fn_classifier : fn_epiphany );
+    if( classifier.empty() ) {
+        std::cout << " Error loading cascade." << std::endl;
+        return -1;
+    }
+#ifdef __OPENCV_OBJDETECT_HPP__
+    bool const has_reference(true);
+    cv::CascadeClassifier classifier_cv;
+    if( !classifier_cv.load(fn_classifier) ) {
+        std::cout << " Error loading reference cascade." << std::endl;
+        return -1;
+    }
+#else
+    bool const has_reference(false);
+#endif
+    std::cout << " Done." << std::endl;
+    if(!has_reference)
+        std::cout << "OpenCV detector is not available; recall and precision are not measured." << std::endl;
+
+    ep::DeviceSession session;
+    if( device && session.open(classifier, num_cores) != ERR_SUCCESS ) {
+        std::cout << "Error opening device session." << std::endl;
+        return -1;
+    }
+
+    std::map<std::string, ImageResult> baseline;
+    bool const has_baseline( !update_baseline && read_baseline(fn_baseline, baseline) );
+    if(!update_baseline && !has_baseline)
+        std::cout << "Baseline " << fn_baseline << " is not found; results are not compared." << std::endl;
+
+    std::vector<ImageResult> results;
+    std::vector<std::string> processed;
+    Throughput reference_time, host_time, device_time;
+    Totals totals, current, previous;
+    int mismatches(0), changed(0), errors(0);
+
+    for(size_t i(0); i < images.size(); ++i) {
+        cv::Mat const image( cv::imread(images[i], CV_LOAD_IMAGE_GRAYSCALE) );
+        if( image.empty() ) {
+            std::cout << "Cannot load " << images[i] << "; it is skipped." << std::endl;
+            continue;
+        }
+
+        std::vector<cv::Rect> objects_cv, objects_ep, raw_host, raw_device;
+
+#ifdef __OPENCV_OBJDETECT_HPP__
+        {
+            int64 const time_start( cv::getTickCount() );
+            classifier_cv.detectMultiScale(image, objects_cv, 1.19, detections_group);
+            reference_time.add(seconds_since(time_start), image);
+        }
+#endif
+        EpErrorCode result(ERR_SUCCESS);
+        {
+            int64 const time_start( cv::getTickCount() );
+            result = ep::detect_multi_scale(image, classifier, objects_ep, detections_group, SCAN_EVEN, DET_HOST);
+            host_time.add(seconds_since(time_start), image);
+        }
+        if(device && result == ERR_SUCCESS) {
+            std::vector<cv::Rect> objects;
+            int64 const time_start( cv::getTickCount() );
+            result = session.detect_multi_scale(image, objects, detections_group);
+            device_time.add(seconds_since(time_start), image);
+        }
+
+        //Raw hits are compared before grouping, so a single differing window is noticed
+        if(result == ERR_SUCCESS)
+            result = ep::detect_multi_scale(image, classifier, raw_host, 0, SCAN_EVEN, DET_HOST);
+        if(device && result == ERR_SUCCESS)
+            result = session.detect_multi_scale(image, raw_device, 0);
+
+        if(result != ERR_SUCCESS) {
+            std::printf("%s: DETECTION ERROR %d\n", images[i].c_str(), static_cast<int>(result));
+            ++errors;
+            continue;
+        }
+
+        ImageResult r;
+        r.raw = static_cast<int>( raw_host.size() );
+        r.raw_hash = hits_hash(raw_host);
+        r.reference = has_reference ? static_cast<int>( objects_cv.size() ) : -1;
+        r.detected = static_cast<int>( objects_ep.size() );
+        r.matched = has_reference ? match_objects(objects_ep, objects_cv, min_iou) : -1;
+
+        if(has_reference)
+            std::printf("%s: reference %d, detected %d, matched %d, raw hits %d", images[i].c_str(),
+                        r.reference, r.detected, r.matched, r.raw);
+        else
+            std::printf("%s: detected %d, raw hits %d", images[i].c_str(), r.detected, r.raw);
+
+        if(device) {
+            hits_hash(raw_device);
+            if( raw_device.size() != raw_host.size() ||
+                !std::equal(raw_host.begin(), raw_host.end(), raw_device.begin(), rect_equal) ) {
+                std::printf(", DEVICE RAW HITS DIFFER (%d)", static_cast<int>( raw_device.size() ));
+                ++mismatches;
+            }
+        }
+
+        if(has_baseline) {
+            std::map<std::string, ImageResult>::const_iterator const b( baseline.find(images[i]) );
+            if( b != baseline.end() ) {
+                current.add(r);
+                previous.add(b->second);
+                if(b->second.raw != r.raw || b->second.raw_hash != r.raw_hash) {
+                    std::printf(", raw hits changed (baseline %d)", b->second.raw);
+                    ++changed;
+                }
+            }
+        }
+        std::printf("\n");
+
+        totals.add(r);
+        results.push_back(r);
+        processed.push_back(images[i]);
+    }
+
+    if( processed.empty() ) {
+        std::cout << "No images are processed." << std::endl;
+        return -1;
+    }
+
+    if(has_reference) {
+        std::printf("\nImages: %d, reference %d, detected %d, matched %d\n",
+                    static_cast<int>( processed.size() ), totals.reference, totals.detected, totals.matched);
+        std::printf("Recall %.4f, precision %.4f against reference (IoU >= %.2f)\n", totals.recall(), totals.precision(), min_iou);
+    } else {
+        std::printf("\nImages: %d; recall and precision are not measured without reference detector\n",
+                    static_cast<int>( processed.size() ));
+    }
+
+    print_throughput("OpenCV", reference_time);
+    print_throughput("Epiphany host", host_time);
+    print_throughput("Epiphany device", device_time);
+
+    bool failed(errors != 0);
+    if(errors)
+        std::printf("Images with detection errors: %d\n", errors);
+    if(device) {
+        std::printf("Host and device raw hits: %s\n", mismatches ? "DIFFER" : "equal");
+        failed = failed || mismatches;
+    }
+
+    if(has_baseline && (current.unmeasured || previous.unmeasured)) {
+        std::printf("Against baseline: recall and precision are not compared (no reference detections), "
+                    "images with changed raw hits %d\n", changed);
+    } else if(has_baseline) {
+        double const recall_delta( current.recall() - previous.recall() ),
+                     precision_delta( current.precision() - previous.precision() );
+        std::printf("Against baseline: recall %+.4f, precision %+.4f, images with changed raw hits %d\n",
+                    recall_delta, precision_delta, changed);
+        if(std::abs(recall_delta) > tolerance || std::abs(precision_delta) > tolerance) {
+            std::printf("Change is beyond tolerance %.4f\n", tolerance);
+            failed = true;
+        }
+    }
+
+    if(update_baseline) {
+        if( !write_baseline(fn_baseline, processed, results) ) {
+            std::cout << "Error writing baseline " << fn_baseline << "." << std::endl;
+            return -1;
+        }
+        std::cout << "Baseline is saved to " << fn_baseline << "." << std::endl;
+    }
+
+    std::cout << (failed ? "FAILED" : "PASSED") << std::endl;
+    return failed ? 1 : 0;
+}
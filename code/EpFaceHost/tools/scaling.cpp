@@ -0,0 +1,367 @@
+/* <title of the code in this file>
+   Copyright (C) 2012 Adapteva, Inc.
+   
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program, see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>. */
+/**
+ * Thread-scaling study of detector. Host detection is measured over a sweep of OpenMP thread counts
+ * and affinity policies: strong scaling (the same frame for every thread count) and weak scaling
+ * (frame area proportional to thread count). Strong scaling points also get a breakdown collected
+ * from trace spans: serial pyramid scaling and scan time of every pyramid level summed over threads.
+ * Device detection (emulated cores are host threads) is swept over number of cores.
+ */
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../cpp/ep_cascade_detector.hpp"
+#include "../c/ep_trace.h"
+
+/// Pyramid levels in breakdown; levels beyond are summed into the total only
+static int const MAX_LEVELS = 64;
+
+/**
+ * Placement of OpenMP threads on CPUs allowed for the process
+ */
+enum AffinityPolicy {
+    /// Threads may run on any allowed CPU (operating system decides)
+    AFFINITY_NONE,
+    /// Thread i is bound to allowed CPU i: neighbour threads share cores and caches first
+    AFFINITY_COMPACT,
+    /// Threads are bound to CPUs spread evenly over allowed ones
+    AFFINITY_SCATTER
+};
+
+static char const *const affinity_names[3] = {"none", "compact", "scatter"};
+
+/**
+ * Bind threads of the current team size according to policy.
+ *   OpenMP runtime keeps its threads between parallel regions, so binding holds for following regions.
+ */
+static void apply_affinity(AffinityPolicy const policy, std::vector<int> const &cpus) {
+    int const cpus_count( static_cast<int>( cpus.size() ) );
+
+    #pragma omp parallel
+    {
+        int const thread( omp_get_thread_num() ), threads( omp_get_num_threads() );
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(policy == AFFINITY_NONE) {
+            for(int i(0); i < cpus_count; ++i)
+                CPU_SET(cpus[i], &set);
+        } else {
+            int const index( policy == AFFINITY_COMPACT ? thread % cpus_count :
+                             static_cast<int>( static_cast<long>(thread) * cpus_count / threads ) % cpus_count );
+            CPU_SET(cpus[index], &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+/**
+ * Detection without grouping on host, or on device through opened session
+ * @return median time in milliseconds
+ */
+static double measure_detection(cv::Mat const &image, ep::CascadeClassifier const &classifier,
+                                ep::DeviceSession *session, int repeat) {
+    std::vector<cv::Rect> objects;
+    std::vector<double> samples(repeat);
+
+    for(int i(-1); i < repeat; ++i) { //The first run is warm-up
+        int64 const time_start( cv::getTickCount() );
+        if(session)
+            session->detect_multi_scale(image, objects, 0);
+        else
+            ep::detect_multi_scale(image, classifier, objects, 0, SCAN_EVEN, DET_HOST);
+        if(i >= 0)
+            samples[i] = (cv::getTickCount() - time_start) * 1e3 / cv::getTickFrequency();
+    }
+
+    std::sort( samples.begin(), samples.end() );
+    return repeat % 2 ? samples[repeat / 2] : (samples[repeat / 2 - 1] + samples[repeat / 2]) / 2;
+}
+
+/**
+ * Breakdown of one host detection recorded from trace spans, in milliseconds
+ */
+struct Breakdown {
+    /// Serial pyramid scaling
+    double pyramid;
+    /// Scan time of levels summed over threads, and number of tiles
+    double busy[MAX_LEVELS];
+    int tiles[MAX_LEVELS];
+    int levels_count;
+};
+
+static Breakdown measure_breakdown(cv::Mat const &image, ep::CascadeClassifier const &classifier) {
+    std::vector<cv::Rect> objects;
+
+    ep_trace_start();
+    ep::detect_multi_scale(image, classifier, objects, 0, SCAN_EVEN, DET_HOST);
+
+    Breakdown result;
+    result.pyramid = ( ep_trace_sum("scale8765", NULL, NULL, 0) + ep_trace_sum("scale21", NULL, NULL, 0) ) / 1e3;
+    ep_trace_sum("tile", result.busy, result.tiles, MAX_LEVELS);
+    ep_trace_stop(NULL);
+
+    result.levels_count = 0;
+    for(int i(0); i < MAX_LEVELS; ++i) {
+        result.busy[i] /= 1e3;
+        if(result.tiles[i])
+            result.levels_count = i + 1;
+    }
+    return result;
+}
+
+/**
+ * One point of scaling curve
+ */
+struct ScalingPoint {
+    int policy;
+    /// Threads or cores
+    int workers;
+    cv::Size frame;
+    double ms, speedup, efficiency;
+    Breakdown breakdown;
+    bool has_breakdown;
+};
+
+/**
+ * Thread counts of sweep: powers of two up to max_workers, and max_workers itself
+ */
+static std::vector<int> sweep_counts(int const max_workers) {
+    std::vector<int> result;
+    for(int n(1); n < max_workers; n *= 2)
+        result.push_back(n);
+    result.push_back(max_workers);
+    return result;
+}
+
+static void write_points(FILE *const file, char const *const name, std::vector<ScalingPoint> const &points, bool last) {
+    std::fprintf(file, "  \"%s\": [\n", name);
+    for(size_t i(0); i < points.size(); ++i) {
+        ScalingPoint const &p(points[i]);
+        std::fprintf(file, "    {\"policy\": \"%s\", \"workers\": %d, \"width\": %d, \"height\": %d, "
+                           "\"ms\": %.4g, \"speedup\": %.4g, \"efficiency\": %.4g",
+                     affinity_names[p.policy], p.workers, p.frame.width, p.frame.height, p.ms, p.speedup, p.efficiency);
+        if(p.has_breakdown) {
+            Breakdown const &b(p.breakdown);
+            std::fprintf(file, ", \"pyramid_ms\": %.4g, \"levels\": [", b.pyramid);
+            for(int l(0); l < b.levels_count; ++l)
+                std::fprintf(file, "%s{\"busy_ms\": %.4g, \"tiles\": %d}", l ? ", " : "", b.busy[l], b.tiles[l]);
+            std::fprintf(file, "]");
+        }
+        std::fprintf(file, i + 1 < points.size() ? "},\n" : "}\n");
+    }
+    std::fprintf(file, last ? "  ]\n" : "  ],\n");
+}
+
+static bool write_json(std::string const &file_name, std::string const &label, int cpus_count,
+                       std::vector<ScalingPoint> const &strong, std::vector<ScalingPoint> const &weak,
+                       std::vector<ScalingPoint> const &device) {
+    FILE *const file( std::fopen(file_name.c_str(), "wt") );
+    if(!file)
+        return false;
+
+    std::fprintf(file, "{\n  \"label\": \"%s\",\n  \"cpus\": %d,\n", label.c_str(), cpus_count);
+#ifdef DEVICE_EMULATION
+    std::fprintf(file, "  \"device\": \"emulated\",\n");
+#else
+    std::fprintf(file, "  \"device\": \"epiphany\",\n");
+#endif
+    write_points(file, "strong", strong, false);
+    write_points(file, "weak", weak, false);
+    write_points(file, "device", device, true);
+    std::fprintf(file, "}\n");
+    return std::fclose(file) == 0;
+}
+
+static void print_point(char const *const study, ScalingPoint const &p) {
+    std::printf("%-6s %-7s %3d  %4dx%-4d  %9.2f ms  speedup %6.2f  efficiency %5.1f%%\n", study,
+                affinity_names[p.policy], p.workers, p.frame.width, p.frame.height, p.ms, p.speedup, 100 * p.efficiency);
+    if(p.has_breakdown) {
+        Breakdown const &b(p.breakdown);
+        double busy(0);
+        for(int l(0); l < b.levels_count; ++l)
+            busy += b.busy[l];
+        std::printf("         pyramid %.2f ms, scan %.2f ms over threads (%.2f ms per thread)\n",
+                    b.pyramid, busy, busy / p.workers);
+        for(int l(0); l < b.levels_count; ++l)
+            std::printf("           level %2d: %8.3f ms, %4d tiles\n", l, b.busy[l], b.tiles[l]);
+    }
+}
+
+int main(int argc, char **argv) {
+
+    char const *const keys (
+        "{ c | classifier | lbpcascade_frontalface.dat | Epiphany LBP classifier }"
+        "{ i | input | g20.jpg | Image of strong scaling workload and tile of weak scaling workload }"
+        "{ s | size | 1080 | Frame height of strong scaling workload (16:9) }"
+        "{ w | weak | 360 | Frame height per thread of weak scaling workload (0 to skip) }"
+        "{ t | threads | 0 | Maximal number of threads (0 for OpenMP default) }"
+        "{ a | affinity | none,compact,scatter | Affinity policies: none, compact, scatter }"
+        "{ n | numcores | 16 | Maximal number of device cores in device sweep (0 to skip) }"
+        "{ r | repeat | 5 | Measurements per point }"
+        "{ o | output | scaling.json | JSON file with results }"
+        "{ l | label | | Label stored with results, e.g. machine name }"
+    );
+
+    cv::CommandLineParser cmd(argc, argv, keys);
+    std::string const fn_classifier( cmd.get<std::string>("classifier") ),
+                      fn_image( cmd.get<std::string>("input") ),
+                      affinity( cmd.get<std::string>("affinity") ),
+                      fn_output( cmd.get<std::string>("output") ),
+                      label( cmd.get<std::string>("label") );
+    int const strong_height( cmd.get<int>("size") );
+    int const weak_height( cmd.get<int>("weak") );
+    int const max_threads( cmd.get<int>("threads") > 0 ? cmd.get<int>("threads") : omp_get_max_threads() );
+    int const max_cores( cmd.get<int>("numcores") );
+    int const repeat( std::max(cmd.get<int>("repeat"), 1) );
+
+    std::vector<int> policies;
+    for(int p(0); p < 3; ++p)
+        if( affinity.find(affinity_names[p]) != std::string::npos )
+            policies.push_back(p);
+
+    //CPUs allowed for the process; policies bind threads to them
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    if( sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ) {
+        for(int i(0); i < CPU_SETSIZE; ++i)
+            if( CPU_ISSET(i, &allowed) )
+                cpus.push_back(i);
+    }
+    if( cpus.empty() ) {
+        std::cout << "Cannot get CPUs of the process." << std::endl;
+        return -1;
+    }
+
+    std::cout << "Loading cascade " << fn_classifier << "..." << std::flush;
+    ep::CascadeClassifier const classifier(fn_classifier);
+    if( classifier.empty() ) {
+        std::cout << " Error loading cascade." << std::endl;
+        return -1;
+    }
+    std::cout << " Done." << std::endl;
+
+    cv::Mat const source( cv::imread(fn_image, CV_LOAD_IMAGE_GRAYSCALE) );
+    if( source.empty() ) {
+        std::cout << "Error loading image " << fn_image << "." << std::endl;
+        return -1;
+    }
+
+    cv::Mat strong_frame;
+    cv::Size const strong_size(strong_height * 16 / 9, strong_height);
+    cv::resize(source, strong_frame, strong_size, 0, 0, strong_size.width < source.cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+    std::vector<int> const thread_counts( sweep_counts(max_threads) );
+    std::vector<ScalingPoint> strong, weak, device;
+
+    std::printf("%d CPUs, up to %d threads\n", static_cast<int>( cpus.size() ), max_threads);
+
+    for(size_t p(0); p < policies.size(); ++p) {
+        double strong_base(0), weak_base(0);
+
+        for(size_t i(0); i < thread_counts.size(); ++i) {
+            int const threads( thread_counts[i] );
+            omp_set_num_threads(threads);
+            apply_affinity(static_cast<AffinityPolicy>(policies[p]), cpus);
+
+            ScalingPoint point;
+            point.policy = policies[p];
+            point.workers = threads;
+            point.frame = strong_size;
+            point.ms = measure_detection(strong_frame, classifier, NULL, repeat);
+            if(i == 0)
+                strong_base = point.ms * threads;
+            point.speedup = strong_base / point.ms;
+            point.efficiency = point.speedup / threads;
+            point.breakdown = measure_breakdown(strong_frame, classifier);
+            point.has_breakdown = true;
+            print_point("strong", point);
+            strong.push_back(point);
+
+            if(weak_height > 0) {
+                //Frame area grows with number of threads, so work per thread is constant
+                double const side( std::sqrt( static_cast<double>(threads) ) );
+                cv::Size const size( cvRound(weak_height * 16 / 9 * side), cvRound(weak_height * side) );
+                cv::Mat frame;
+                cv::resize(source, frame, size, 0, 0, size.width < source.cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+                point.frame = size;
+                point.ms = measure_detection(frame, classifier, NULL, repeat);
+                if(i == 0)
+                    weak_base = point.ms;
+                point.efficiency = weak_base / point.ms;
+                point.speedup = point.efficiency * threads; //Scaled speedup
+                point.has_breakdown = false;
+                print_point("weak", point);
+                weak.push_back(point);
+            }
+        }
+    }
+
+    omp_set_num_threads(max_threads);
+    apply_affinity(AFFINITY_NONE, cpus);
+
+    //Device sweep: tiles are distributed over workgroup of given size
+    if(max_cores > 0) {
+        std::vector<int> const core_counts( sweep_counts(max_cores) );
+        double base(0);
+        for(size_t i(0); i < core_counts.size(); ++i) {
+            ep::DeviceSession session;
+            if( session.open(classifier, core_counts[i]) != ERR_SUCCESS ) {
+                std::cout << "Error opening device session of " << core_counts[i] << " cores." << std::endl;
+                return -1;
+            }
+
+            ScalingPoint point;
+            point.policy = AFFINITY_NONE;
+            point.workers = core_counts[i];
+            point.frame = strong_size;
+            point.ms = measure_detection(strong_frame, classifier, &session, repeat);
+            if(i == 0)
+                base = point.ms * core_counts[i];
+            point.speedup = base / point.ms;
+            point.efficiency = point.speedup / core_counts[i];
+            point.has_breakdown = false;
+            print_point("device", point);
+            device.push_back(point);
+        }
+    }
+
+    if( !write_json(fn_output, label, static_cast<int>( cpus.size() ), strong, weak, device) ) {
+        std::cout << "Error writing " << fn_output << "." << std::endl;
+        return -1;
+    }
+    std::cout << "Results are saved to " << fn_output << "." << std::endl;
+
+    return 0;
+}
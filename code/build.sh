@@ -1,8 +1,34 @@
-g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP EpFaceHost/cpp/ep_cascade_detector.cpp -o release/cpp/ep_cascade_detector.o
-gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP -std=c99 EpFaceHost/c/ep_cascade_detector.c -o release/c/ep_cascade_detector.o
-gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP -std=c99 EpFaceHost/c/ep_emulator.c -o release/c/ep_emulator.o
-g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP EpFaceHost/main.cpp -o release/main.o
-g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/main.o -o release/EpFaceHost -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -lpthread -lm -le-hal -lrt -le-loader
+# DEVICE_EMULATION=1 ./build.sh builds host-only binary where Epiphany cores are emulated by host threads
+if [ -n "$DEVICE_EMULATION" ]; then
+    EMU_FLAGS="-DDEVICE_EMULATION"
+    EMU_LIBS=""
+else
+    EMU_FLAGS=""
+    EMU_LIBS="-le-hal -lrt -le-loader"
+fi
 
-e-gcc EpFaceCore_commonlib/src/device_cascade_detector.c -O3 -ffast-math -Wall -std=c99 -T/opt/adapteva/esdk/bsps/current/internal.ldf -le-lib -o release/epiphany.elf
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/cpp/ep_cascade_detector.cpp -o release/cpp/ep_cascade_detector.o
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/cpp/ep_result_sink.cpp -o release/cpp/ep_result_sink.o
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/cpp/ep_async_detector.cpp -o release/cpp/ep_async_detector.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_cascade_detector.c -o release/c/ep_cascade_detector.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_emulator.c -o release/c/ep_emulator.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_task_planner.c -o release/c/ep_task_planner.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_trace.c -o release/c/ep_trace.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_cascade_xml.c -o release/c/ep_cascade_xml.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_frame_reader.c -o release/c/ep_frame_reader.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_jpeg_reader.c -o release/c/ep_jpeg_reader.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_cascade_heatmap.c -o release/c/ep_cascade_heatmap.o
+gcc -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS -std=c99 EpFaceHost/c/ep_cascade_optimizer.c -o release/c/ep_cascade_optimizer.o
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/main.cpp -o release/main.o
+g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/cpp/ep_result_sink.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/c/ep_task_planner.o release/c/ep_trace.o release/c/ep_cascade_xml.o release/c/ep_frame_reader.o release/c/ep_jpeg_reader.o release/c/ep_cascade_heatmap.o release/main.o -o release/EpFaceHost -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -ljpeg -lpthread -lm $EMU_LIBS
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/tools/cascade_optimizer.cpp -o release/cascade_optimizer.o
+g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/c/ep_task_planner.o release/c/ep_trace.o release/c/ep_cascade_xml.o release/c/ep_cascade_optimizer.o release/cascade_optimizer.o -o release/EpCascadeOptimizer -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -lpthread -lm $EMU_LIBS
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/tools/benchmark.cpp -o release/benchmark.o
+g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/cpp/ep_async_detector.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/c/ep_task_planner.o release/c/ep_trace.o release/c/ep_cascade_xml.o release/benchmark.o -o release/EpBenchmark -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -lpthread -lm $EMU_LIBS
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/tools/regression.cpp -o release/regression.o
+g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/c/ep_task_planner.o release/c/ep_trace.o release/c/ep_cascade_xml.o release/regression.o -o release/EpRegression -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -lpthread -lm $EMU_LIBS
+g++ -I/opt/adapteva/esdk/tools/host/include -I/usr/local/include -O3 -g0 -Wall -c -fmessage-length=0 -fopenmp -MMD -MP $EMU_FLAGS EpFaceHost/tools/scaling.cpp -o release/scaling.o
+g++ -L/opt/adapteva/esdk/tools/host/lib -z origin -fopenmp release/cpp/ep_cascade_detector.o release/c/ep_cascade_detector.o release/c/ep_emulator.o release/c/ep_task_planner.o release/c/ep_trace.o release/c/ep_cascade_xml.o release/scaling.o -o release/EpScaling -lopencv_core -lopencv_highgui -lopencv_imgproc -lopencv_objdetect -lpthread -lm $EMU_LIBS
+
+[ -n "$DEVICE_EMULATION" ] || e-gcc EpFaceCore_commonlib/src/device_cascade_detector.c -O3 -ffast-math -Wall -std=c99 -T/opt/adapteva/esdk/bsps/current/internal.ldf -le-lib -o release/epiphany.elf
 